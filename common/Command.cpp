@@ -0,0 +1,130 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "Command.hpp"
+
+#include <array>
+#include <cstdint>
+
+namespace
+{
+    using LOOLProtocol::Command;
+
+    /// The names of the commands, in the order of Command.
+    const char* const CommandNames[] =
+    {
+        "unknown",
+        "canceltiles",
+        "clientvisiblearea",
+        "clientzoom",
+        "closedocument",
+        "commandvalues",
+        "downloadas",
+        "getchildid",
+        "gettextselection",
+        "insertfile",
+        "key",
+        "load",
+        "loolclient",
+        "mouse",
+        "partpagerectangles",
+        "paste",
+        "ping",
+        "renderfont",
+        "requestloksession",
+        "resetselection",
+        "saveas",
+        "selectgraphic",
+        "selecttext",
+        "setclientpart",
+        "setpage",
+        "status",
+        "thumbnail",
+        "tile",
+        "tilecombine",
+        "uno",
+        "useractive",
+        "userinactive",
+        "callback",
+        "dummymsg",
+        "eof"
+    };
+
+    static_assert(sizeof(CommandNames) / sizeof(CommandNames[0]) == LOOLProtocol::CommandCount,
+                  "A name is needed for each command.");
+
+    /// The commands by the hash of their name, open-addressed. Over three
+    /// times as many slots as names, so most lookups compare a single name.
+    class CommandTable
+    {
+    public:
+        CommandTable()
+        {
+            _slots.fill(Command::Unknown);
+            for (size_t index = 1; index < LOOLProtocol::CommandCount; ++index)
+            {
+                const std::string name = CommandNames[index];
+                size_t slot = hash(name.data(), name.size());
+                while (_slots[slot] != Command::Unknown)
+                {
+                    slot = (slot + 1) % SlotCount;
+                }
+
+                _slots[slot] = static_cast<Command>(index);
+            }
+        }
+
+        Command find(const LOOLProtocol::StringSpan& name) const
+        {
+            for (size_t slot = hash(name.data(), name.size()); ; slot = (slot + 1) % SlotCount)
+            {
+                const Command command = _slots[slot];
+                if (command == Command::Unknown || name == CommandNames[static_cast<size_t>(command)])
+                    return command;
+            }
+        }
+
+    private:
+        /// FNV-1a, reduced to a slot.
+        static size_t hash(const char* data, const size_t size)
+        {
+            uint32_t value = 2166136261u;
+            for (size_t i = 0; i < size; ++i)
+            {
+                value = (value ^ static_cast<unsigned char>(data[i])) * 16777619u;
+            }
+
+            return value % SlotCount;
+        }
+
+    private:
+        static constexpr size_t SlotCount = 128;
+
+        std::array<Command, SlotCount> _slots;
+    };
+}
+
+namespace LOOLProtocol
+{
+    Command getCommand(const StringSpan& name)
+    {
+        static const CommandTable table;
+        return table.find(name);
+    }
+
+    const char* getCommandName(const Command command)
+    {
+        const size_t index = static_cast<size_t>(command);
+        return (index < CommandCount ? CommandNames[index] : CommandNames[0]);
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
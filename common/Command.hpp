@@ -0,0 +1,90 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_COMMAND_HPP
+#define INCLUDED_COMMAND_HPP
+
+#include <cstddef>
+
+#include "Protocol.hpp"
+
+namespace LOOLProtocol
+{
+    /// The commands that the sessions and the Kit dispatch on, so that
+    /// they switch on the command rather than compare its name with each
+    /// of them, and so that what is kept by command is kept in an array.
+    enum class Command
+    {
+        Unknown,
+
+        // From the clients.
+        CancelTiles,
+        ClientVisibleArea,
+        ClientZoom,
+        CloseDocument,
+        CommandValues,
+        DownloadAs,
+        GetChildId,
+        GetTextSelection,
+        InsertFile,
+        Key,
+        Load,
+        LoolClient,
+        Mouse,
+        PartPageRectangles,
+        Paste,
+        Ping,
+        RenderFont,
+        RequestLokSession,
+        ResetSelection,
+        SaveAs,
+        SelectGraphic,
+        SelectText,
+        SetClientPart,
+        SetPage,
+        Status,
+        Thumbnail,
+        Tile,
+        TileCombine,
+        Uno,
+        UserActive,
+        UserInactive,
+
+        // From WSD to the Kit only.
+        Callback,
+        DummyMsg,
+        Eof,
+
+        Count
+    };
+
+    constexpr size_t CommandCount = static_cast<size_t>(Command::Count);
+
+    /// The command named by the given token, Unknown if none.
+    /// A lookup in a hash table of the names, without copying the token.
+    Command getCommand(const StringSpan& name);
+
+    inline Command getCommand(const std::string& name)
+    {
+        return getCommand(StringSpan(name));
+    }
+
+    /// The name of the command in the protocol, "unknown" for Unknown.
+    const char* getCommandName(Command command);
+
+    /// Whether the clients may send the command, rather than only WSD.
+    inline bool isClientCommand(const Command command)
+    {
+        return command > Command::Unknown && command < Command::Callback;
+    }
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -35,6 +35,9 @@ constexpr int LARGE_MESSAGE_SIZE = READ_BUFFER_SIZE - 512;
 /// or as intentionally flooding the server.
 constexpr int MAX_MESSAGE_SIZE = 2 * 1024 * READ_BUFFER_SIZE;
 
+/// The largest width or height, in pixels, of a rendered thumbnail.
+constexpr int MAX_THUMBNAIL_SIZE = 2048;
+
 constexpr auto JAILED_DOCUMENT_ROOT = "/user/docs/";
 constexpr auto CHILD_URI = "/loolws/child?";
 constexpr auto NEW_CHILD_URI = "/loolws/newchild?";
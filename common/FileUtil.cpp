@@ -11,9 +11,12 @@
 
 #include "FileUtil.hpp"
 
+#include <fcntl.h>
 #include <ftw.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/vfs.h>
+#include <unistd.h>
 
 #include <chrono>
 #include <cstdio>
@@ -22,6 +25,7 @@
 #include <fstream>
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include <Poco/TemporaryFile.h>
 
@@ -153,6 +157,99 @@ namespace FileUtil
         }
     }
 
+    bool copyFileTo(const std::string& fromPath, const std::string& toPath)
+    {
+        const int from = open(fromPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (from < 0)
+        {
+            LOG_SYS("Failed to open [" << fromPath << "] for copying.");
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(from, &st) != 0)
+        {
+            LOG_SYS("Failed to stat [" << fromPath << "] for copying.");
+            close(from);
+            return false;
+        }
+
+        const int to = open(toPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+        if (to < 0)
+        {
+            LOG_SYS("Failed to create [" << toPath << "] for copying.");
+            close(from);
+            return false;
+        }
+
+        off_t offset = 0;
+        bool success = true;
+        while (offset < st.st_size)
+        {
+            const ssize_t sent = sendfile(to, from, &offset, st.st_size - offset);
+            if (sent < 0 && errno == EINTR)
+                continue;
+
+            if (sent <= 0)
+            {
+                LOG_SYS("Failed to copy [" << fromPath << "] to [" << toPath << "] at offset " << offset << ".");
+                success = false;
+                break;
+            }
+        }
+
+        close(from);
+        close(to);
+        if (!success)
+        {
+            unlink(toPath.c_str());
+        }
+
+        return success;
+    }
+
+    bool isPrivateJailEntry(const std::string& name)
+    {
+        return name == "dev" || name == "tmp" || name == "user";
+    }
+
+    bool isMountedJailEntry(const std::string& skeleton, const std::string& name)
+    {
+        const Poco::File entry(Poco::Path(skeleton, name));
+        return !isPrivateJailEntry(name) && !entry.isLink() && entry.isDirectory();
+    }
+
+    void removeJail(const std::string& jailPath, const std::string& skeleton)
+    {
+        if (!skeleton.empty())
+        {
+            std::vector<std::string> entries;
+            Poco::File(skeleton).list(entries);
+            for (const auto& name : entries)
+            {
+                if (!isMountedJailEntry(skeleton, name))
+                    continue;
+
+                const std::string mountPath = Poco::Path(jailPath, name).toString();
+                const std::string unmountCommand = "loolmount -u " + mountPath;
+                if (system(unmountCommand.c_str()) != 0)
+                {
+                    // Fine if the kit died before mounting it, but never
+                    // recurse into a mount: that would remove the skeleton.
+                    std::vector<std::string> contents;
+                    if (Poco::File(mountPath).exists())
+                        Poco::File(mountPath).list(contents);
+                    if (!contents.empty())
+                    {
+                        LOG_ERR("Failed to unmount [" << mountPath << "]. Leaving jail [" << jailPath << "] behind.");
+                        return;
+                    }
+                }
+            }
+        }
+
+        removeFile(jailPath, true);
+    }
 
 } // namespace FileUtil
 
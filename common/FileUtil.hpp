@@ -70,6 +70,25 @@ namespace FileUtil
         removeFile(path.toString(), recursive);
     }
 
+    /// The directory under the child root where the jail skeleton is prepared.
+    constexpr const char* JailSkeletonName = "skeleton";
+
+    /// The top-level entries of the jail that each kit gets its own,
+    /// writable, copy of, rather than sharing the skeleton's.
+    bool isPrivateJailEntry(const std::string& name);
+
+    /// True if the skeleton entry is bind-mounted into the jails.
+    bool isMountedJailEntry(const std::string& skeleton, const std::string& name);
+
+    /// Unmounts the skeleton from a jail, if it was used, and removes the jail.
+    /// A jail still mounted is left behind, rather than removing the skeleton through it.
+    void removeJail(const std::string& jailPath, const std::string& skeleton);
+
+    /// Copy a regular file in the kernel with sendfile(2), without
+    /// bouncing the contents through user-space buffers.
+    /// Returns false on failure, in which case the destination is removed.
+    bool copyFileTo(const std::string& fromPath, const std::string& toPath);
+
     /// Make a temp copy of a file.
     /// Primarily used by tests to avoid tainting the originals.
     /// srcDir shouldn't end with '/' and srcFilename shouldn't contain '/'.
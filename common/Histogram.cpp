@@ -0,0 +1,79 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "Histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+Histogram::Histogram()
+{
+    clear();
+}
+
+void Histogram::add(const double ms)
+{
+    size_t index = 0;
+    double bound = 1;
+    while (index < BucketCount - 1 && ms >= bound)
+    {
+        ++index;
+        bound *= 2;
+    }
+
+    ++_buckets[index];
+    ++_count;
+    if (ms > _maxMs)
+        _maxMs = ms;
+}
+
+void Histogram::clear()
+{
+    _buckets.fill(0);
+    _count = 0;
+    _maxMs = 0;
+}
+
+double Histogram::getPercentile(const double fraction) const
+{
+    if (_count == 0)
+        return 0;
+
+    const double wanted = fraction * _count;
+    unsigned seen = 0;
+    double bound = 1;
+    for (size_t index = 0; index < BucketCount - 1; ++index, bound *= 2)
+    {
+        seen += _buckets[index];
+        if (seen >= wanted)
+            return std::min(bound, _maxMs);
+    }
+
+    return _maxMs;
+}
+
+std::string Histogram::toString(const std::string& name) const
+{
+    std::ostringstream oss;
+    oss << name << '=';
+    for (size_t index = 0; index < BucketCount; ++index)
+    {
+        oss << (index > 0 ? "," : "") << _buckets[index];
+    }
+
+    oss << ' ' << name << "_p50=" << std::lround(getPercentile(0.5))
+        << ' ' << name << "_p99=" << std::lround(getPercentile(0.99))
+        << ' ' << name << "_max=" << std::lround(_maxMs);
+    return oss.str();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,50 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_HISTOGRAM_HPP
+#define INCLUDED_HISTOGRAM_HPP
+
+#include <array>
+#include <string>
+
+/// A histogram of durations in milliseconds, in power-of-two buckets:
+/// [0, 1), [1, 2), [2, 4), ... [512, 1024) and 1024 or more.
+/// Cheap enough to add a sample per tile.
+/// Not thread-safe.
+class Histogram
+{
+public:
+    static constexpr size_t BucketCount = 12;
+
+    Histogram();
+
+    void add(double ms);
+
+    void clear();
+
+    unsigned getCount() const { return _count; }
+    unsigned getBucket(size_t index) const { return _buckets[index]; }
+    double getMaxMs() const { return _maxMs; }
+
+    /// The upper bound of the bucket the given fraction of the samples fall into,
+    /// or the largest sample for the last bucket, 0 when empty.
+    double getPercentile(double fraction) const;
+
+    /// Formats as "<name>=<bucket0>,<bucket1>,... <name>_p50=<ms> <name>_p99=<ms> <name>_max=<ms>".
+    std::string toString(const std::string& name) const;
+
+private:
+    std::array<unsigned, BucketCount> _buckets;
+    unsigned _count;
+    double _maxMs;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -13,12 +13,19 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <ctime>
 #include <iomanip>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <Poco/ConsoleChannel.h>
 #include <Poco/DateTimeFormatter.h>
@@ -31,9 +38,16 @@
 #include <Poco/Timestamp.h>
 
 #include "Log.hpp"
+#include "LogBuffer.hpp"
 
 static char LogPrefix[256] = { '\0' };
 
+/// The name of the thread, cached so the prefix doesn't cost a prctl() per line.
+static thread_local char ThreadName[32] = { '\0' };
+/// The second of the last line of the thread, and its time of day.
+static thread_local time_t LastSecond = -1;
+static thread_local char LastSecondText[16] = { '\0' };
+
 namespace Log
 {
     using namespace Poco;
@@ -55,6 +69,70 @@ namespace Log
     };
     static StaticNames Source;
 
+    /// The state of the asynchronous mode.
+    struct AsyncState
+    {
+        std::atomic<bool> enabled;
+        std::mutex mutex;
+        /// Wakes the writer up.
+        std::condition_variable cv;
+        /// Signalled when the writer has written what was requested.
+        std::condition_variable drainedCv;
+        std::thread writer;
+        bool stop;
+        size_t bufferLines;
+        /// Changes whenever started, so the threads make new buffers.
+        std::atomic<unsigned> generation;
+        std::vector<std::shared_ptr<LogBuffer>> buffers;
+        /// Orders the lines of all the threads.
+        std::atomic<uint64_t> seq;
+        /// Flushes requested and served.
+        uint64_t requested;
+        uint64_t drained;
+        std::atomic<uint64_t> written;
+        std::atomic<uint64_t> dropped;
+
+        AsyncState() :
+            enabled(false),
+            stop(false),
+            bufferLines(0),
+            generation(0),
+            seq(0),
+            requested(0),
+            drained(0),
+            written(0),
+            dropped(0)
+        {
+        }
+        ~AsyncState()
+        {
+            stopAsync();
+        }
+    };
+    static AsyncState Async;
+
+    /// The buffer of the calling thread, closed when it exits, for the
+    /// writer to forget once written out.
+    struct ThreadBuffer
+    {
+        std::shared_ptr<LogBuffer> buffer;
+        unsigned generation;
+
+        ThreadBuffer() :
+            generation(0)
+        {
+        }
+        ~ThreadBuffer()
+        {
+            if (buffer)
+                buffer->close();
+        }
+    };
+    static thread_local ThreadBuffer OwnBuffer;
+
+    /// How often the writer looks for lines when not asked to flush.
+    constexpr std::chrono::milliseconds WritePeriod(20);
+
     // We need a signal safe means of writing messages
     //   $ man 7 signal
     void signalLog(const char *message)
@@ -79,22 +157,239 @@ namespace Log
 
     char* prefix(char* buffer, const char* level, const long osTid)
     {
-        char procName[32];
-        if (prctl(PR_GET_NAME, reinterpret_cast<unsigned long>(procName), 0, 0, 0) != 0)
+        if (ThreadName[0] == '\0' &&
+            prctl(PR_GET_NAME, reinterpret_cast<unsigned long>(ThreadName), 0, 0, 0) != 0)
         {
-            strncpy(procName, "<noid>", sizeof(procName) - 1);
+            strncpy(ThreadName, "<noid>", sizeof(ThreadName) - 1);
         }
 
-        Poco::DateTime time;
-        snprintf(buffer, 1023, "%s-%.05lu %.2u:%.2u:%.2u.%.6u [ %s ] %s  ",
+        // Only break the time down once a second.
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec != LastSecond)
+        {
+            struct tm time;
+            gmtime_r(&now.tv_sec, &time);
+            snprintf(LastSecondText, sizeof(LastSecondText), "%.2d:%.2d:%.2d",
+                     time.tm_hour, time.tm_min, time.tm_sec);
+            LastSecond = now.tv_sec;
+        }
+
+        snprintf(buffer, 1023, "%s-%.05lu %s.%.6u [ %s ] %s  ",
                     (Source.inited ? Source.id.c_str() : "<shutdown>"),
-                    osTid,
-                    time.hour(), time.minute(), time.second(),
-                    time.millisecond() * 1000 + time.microsecond(),
-                    procName, level);
+                    osTid, LastSecondText,
+                    static_cast<unsigned>(now.tv_nsec / 1000),
+                    ThreadName, level);
         return buffer;
     }
 
+    void setThreadName(const char* name)
+    {
+        // As truncated by PR_SET_NAME.
+        strncpy(ThreadName, name, 15);
+        ThreadName[15] = '\0';
+    }
+
+    /// Hands the line to the writer.
+    /// Returns false if it is to be written synchronously instead.
+    static bool pushAsync(const Poco::Message::Priority priority, std::string& text)
+    {
+        ThreadBuffer& own = OwnBuffer;
+        if (!own.buffer || own.generation != Async.generation)
+        {
+            std::unique_lock<std::mutex> lock(Async.mutex);
+            if (!Async.enabled)
+                return false;
+
+            if (own.buffer)
+                own.buffer->close();
+            own.buffer = std::make_shared<LogBuffer>(Async.bufferLines);
+            own.generation = Async.generation;
+            Async.buffers.push_back(own.buffer);
+        }
+
+        // Tell the writer which lines may not be in our buffer yet, see writeBuffered().
+        own.buffer->beginPush(Async.seq.load());
+        LogBuffer::Entry entry(Async.seq++, priority, std::move(text));
+        const bool pushed = own.buffer->push(std::move(entry));
+        own.buffer->endPush();
+        if (pushed)
+            return true;
+
+        // Full. Rather than wait for the writer, drop the chatter,
+        // but write the warnings and errors ourselves.
+        if (priority <= Poco::Message::PRIO_WARNING)
+        {
+            text = std::move(entry._text);
+            return false;
+        }
+
+        ++Async.dropped;
+        return true;
+    }
+
+    void log(Poco::Logger& logger, const Poco::Message::Priority priority, std::string text)
+    {
+        if (Async.enabled)
+        {
+            // We may not live to write the fatal ones later.
+            if (priority <= Poco::Message::PRIO_CRITICAL)
+                flush();
+            else if (pushAsync(priority, text))
+                return;
+        }
+
+        logger.log(Poco::Message(logger.name(), text, priority));
+    }
+
+    /// Writes out the lines of all the threads, in order, moving them to pending first.
+    /// A line may be numbered before it's pushed, so unless writing all, those
+    /// above the low watermark wait in pending for the lines that may precede them.
+    static void writeBuffered(std::vector<LogBuffer::Entry>& pending, const bool all)
+    {
+        // Lines numbered from now on are above it, whatever buffer they go to.
+        uint64_t watermark = Async.seq.load();
+
+        // The buffers of the threads that started logging meanwhile included.
+        std::unique_lock<std::mutex> lock(Async.mutex);
+        const std::vector<std::shared_ptr<LogBuffer>> buffers = Async.buffers;
+        lock.unlock();
+
+        LogBuffer::Entry entry;
+        for (const auto& buffer : buffers)
+        {
+            // Checked before taking the lines, so that those below it are all in.
+            watermark = std::min(watermark, buffer->getPushing());
+            while (buffer->pop(entry))
+                pending.push_back(std::move(entry));
+        }
+
+        if (pending.empty())
+            return;
+
+        std::sort(pending.begin(), pending.end(),
+                  [](const LogBuffer::Entry& a, const LogBuffer::Entry& b) { return a._seq < b._seq; });
+        const auto end = (all ? pending.end()
+                          : std::lower_bound(pending.begin(), pending.end(), watermark,
+                                             [](const LogBuffer::Entry& a, const uint64_t seq)
+                                             {
+                                                 return a._seq < seq;
+                                             }));
+
+        Poco::Logger& output = logger();
+        for (auto it = pending.begin(); it != end; ++it)
+        {
+            output.log(Poco::Message(output.name(), it->_text,
+                                     static_cast<Poco::Message::Priority>(it->_priority)));
+        }
+
+        Async.written += end - pending.begin();
+        pending.erase(pending.begin(), end);
+    }
+
+    static void writeAsync()
+    {
+        const char* name = "log_writer";
+        prctl(PR_SET_NAME, reinterpret_cast<unsigned long>(name), 0, 0, 0);
+        setThreadName(name);
+
+        std::vector<LogBuffer::Entry> pending;
+        uint64_t reportedDropped = 0;
+
+        std::unique_lock<std::mutex> lock(Async.mutex);
+        while (true)
+        {
+            const bool stopping = Async.stop;
+            const uint64_t requested = Async.requested;
+            const bool flushing = (requested != Async.drained);
+            lock.unlock();
+
+            // When flushing, those who asked have pushed their lines, and the
+            // lines still being pushed by others can only be as recent.
+            writeBuffered(pending, stopping || flushing);
+
+            const uint64_t dropped = Async.dropped;
+            if (dropped != reportedDropped)
+            {
+                std::ostringstream oss;
+                char buffer[1024];
+                oss << prefix(buffer, "WRN", syscall(SYS_gettid))
+                    << "Dropped " << (dropped - reportedDropped)
+                    << " log lines, the buffers were full.| " << __FILE__ << ':' << __LINE__;
+                logger().warning(oss.str());
+                reportedDropped = dropped;
+            }
+
+            lock.lock();
+
+            // Forget the buffers of the threads that exited, once written out.
+            Async.buffers.erase(std::remove_if(Async.buffers.begin(), Async.buffers.end(),
+                                               [](const std::shared_ptr<LogBuffer>& buffer)
+                                               {
+                                                   return buffer->isClosed() && buffer->empty();
+                                               }),
+                                Async.buffers.end());
+
+            Async.drained = requested;
+            Async.drainedCv.notify_all();
+            if (stopping)
+                break;
+
+            Async.cv.wait_for(lock, WritePeriod,
+                              []() { return Async.stop || Async.requested != Async.drained; });
+        }
+    }
+
+    void startAsync(const size_t bufferLines)
+    {
+        std::unique_lock<std::mutex> lock(Async.mutex);
+        if (Async.writer.joinable() || bufferLines == 0)
+            return;
+
+        Async.bufferLines = bufferLines;
+        Async.stop = false;
+        Async.buffers.clear();
+        ++Async.generation;
+        Async.writer = std::thread(writeAsync);
+        Async.enabled = true;
+    }
+
+    void stopAsync()
+    {
+        std::unique_lock<std::mutex> lock(Async.mutex);
+        if (!Async.writer.joinable())
+            return;
+
+        // The writer writes what's left before exiting.
+        Async.enabled = false;
+        Async.stop = true;
+        Async.cv.notify_one();
+        std::thread writer = std::move(Async.writer);
+        lock.unlock();
+
+        writer.join();
+    }
+
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(Async.mutex);
+        if (!Async.writer.joinable() || Async.writer.get_id() == std::this_thread::get_id())
+            return;
+
+        const uint64_t request = ++Async.requested;
+        Async.cv.notify_one();
+        Async.drainedCv.wait(lock, [request]() { return Async.drained >= request || Async.stop; });
+    }
+
+    std::string getAsyncStats()
+    {
+        std::ostringstream oss;
+        oss << "async=" << (Async.enabled ? "true" : "false")
+            << " written=" << Async.written
+            << " dropped=" << Async.dropped;
+        return oss.str();
+    }
+
     void signalLogPrefix()
     {
         char buffer[1024];
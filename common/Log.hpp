@@ -30,6 +30,23 @@ namespace Log
 
     char* prefix(char* buffer, const char* level, const long osTid);
 
+    /// Caches the name of the calling thread for the prefix.
+    void setThreadName(const char* name);
+
+    /// Writes the line now, or hands it to the writer thread when asynchronous.
+    void log(Poco::Logger& logger, Poco::Message::Priority priority, std::string text);
+
+    /// From now on, hands the lines to a writer thread instead of writing them
+    /// on the calling thread, buffering up to bufferLines per thread.
+    /// Not to be enabled before forking: the writer thread doesn't survive it.
+    void startAsync(size_t bufferLines);
+    /// Writes out what is buffered and goes back to writing synchronously.
+    void stopAsync();
+    /// Waits until the lines buffered so far are written.
+    void flush();
+    /// Formats as "async=<bool> written=<n> dropped=<n>".
+    std::string getAsyncStats();
+
     void trace(const std::string& msg);
     void debug(const std::string& msg);
     void info(const std::string& msg);
@@ -107,42 +124,42 @@ namespace Log
     inline StreamLogger trace()
     {
         return traceEnabled()
-             ? StreamLogger([](const std::string& msg) { logger().trace(msg); }, "TRC")
+             ? StreamLogger([](const std::string& msg) { log(logger(), Poco::Message::PRIO_TRACE, msg); }, "TRC")
              : StreamLogger();
     }
 
     inline StreamLogger debug()
     {
         return debugEnabled()
-             ? StreamLogger([](const std::string& msg) { logger().debug(msg); }, "DBG")
+             ? StreamLogger([](const std::string& msg) { log(logger(), Poco::Message::PRIO_DEBUG, msg); }, "DBG")
              : StreamLogger();
     }
 
     inline StreamLogger info()
     {
         return infoEnabled()
-             ? StreamLogger([](const std::string& msg) { logger().information(msg); }, "INF")
+             ? StreamLogger([](const std::string& msg) { log(logger(), Poco::Message::PRIO_INFORMATION, msg); }, "INF")
              : StreamLogger();
     }
 
     inline StreamLogger warn()
     {
         return warnEnabled()
-             ? StreamLogger([](const std::string& msg) { logger().warning(msg); }, "WRN")
+             ? StreamLogger([](const std::string& msg) { log(logger(), Poco::Message::PRIO_WARNING, msg); }, "WRN")
              : StreamLogger();
     }
 
     inline StreamLogger error()
     {
         return errorEnabled()
-             ? StreamLogger([](const std::string& msg) { logger().error(msg); }, "ERR")
+             ? StreamLogger([](const std::string& msg) { log(logger(), Poco::Message::PRIO_ERROR, msg); }, "ERR")
              : StreamLogger();
     }
 
     inline StreamLogger fatal()
     {
         return fatalEnabled()
-             ? StreamLogger([](const std::string& msg) { logger().fatal(msg); }, "FTL")
+             ? StreamLogger([](const std::string& msg) { log(logger(), Poco::Message::PRIO_FATAL, msg); }, "FTL")
              : StreamLogger();
     }
 
@@ -175,7 +192,7 @@ namespace Log
     }
 }
 
-#define LOG_BODY_(PRIO, LVL, X) Poco::Message m_(l_.name(), "", Poco::Message::PRIO_##PRIO); char b_[1024]; std::ostringstream oss_(Log::prefix(b_, LVL, syscall(SYS_gettid)), std::ostringstream::ate); oss_ << std::boolalpha << X << "| " << __FILE__ << ':' << __LINE__; m_.setText(oss_.str()); l_.log(m_);
+#define LOG_BODY_(PRIO, LVL, X) char b_[1024]; std::ostringstream oss_(Log::prefix(b_, LVL, syscall(SYS_gettid)), std::ostringstream::ate); oss_ << std::boolalpha << X << "| " << __FILE__ << ':' << __LINE__; Log::log(l_, Poco::Message::PRIO_##PRIO, oss_.str());
 #define LOG_TRC(X) do { auto& l_ = Log::logger(); if (l_.trace()) { LOG_BODY_(TRACE, "TRC", X); } } while (false)
 #define LOG_DBG(X) do { auto& l_ = Log::logger(); if (l_.debug()) { LOG_BODY_(DEBUG, "DBG", X); } } while (false)
 #define LOG_INF(X) do { auto& l_ = Log::logger(); if (l_.information()) { LOG_BODY_(INFORMATION, "INF", X); } } while (false)
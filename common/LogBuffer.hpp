@@ -0,0 +1,120 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_LOGBUFFER_HPP
+#define INCLUDED_LOGBUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// A bounded ring of log lines, written by the one thread that owns
+/// it and read by the log writer thread, without locking.
+/// Never waits: when full, the caller decides what to do with the line.
+class LogBuffer
+{
+public:
+    struct Entry
+    {
+        Entry() :
+            _seq(0),
+            _priority(0)
+        {
+        }
+
+        Entry(const uint64_t seq, const int priority, std::string text) :
+            _seq(seq),
+            _priority(priority),
+            _text(std::move(text))
+        {
+        }
+
+        /// Orders the lines of all the threads.
+        uint64_t _seq;
+        int _priority;
+        std::string _text;
+    };
+
+    /// What getPushing() returns while the owner isn't pushing.
+    static constexpr uint64_t NotPushing = UINT64_MAX;
+
+    explicit LogBuffer(const size_t capacity) :
+        _entries(capacity + 1),
+        _head(0),
+        _tail(0),
+        _pushing(NotPushing),
+        _closed(false)
+    {
+    }
+
+    LogBuffer(const LogBuffer&) = delete;
+    LogBuffer& operator=(const LogBuffer&) = delete;
+
+    /// Called by the owner thread only.
+    /// Returns false, leaving the entry as is, if full.
+    bool push(Entry&& entry)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        const size_t next = (tail + 1) % _entries.size();
+        if (next == _head.load(std::memory_order_acquire))
+            return false;
+
+        _entries[tail] = std::move(entry);
+        _tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /// Called by the reader thread only.
+    /// Returns false if empty.
+    bool pop(Entry& entry)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+
+        entry = std::move(_entries[head]);
+        _head.store((head + 1) % _entries.size(), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return _entries.size() - 1; }
+
+    /// Called by the owner thread only, before numbering an entry to push:
+    /// lowestSeq is no more than its number, so the reader knows which
+    /// entries numbered by now may still be missing from the buffer.
+    void beginPush(const uint64_t lowestSeq) { _pushing.store(lowestSeq); }
+    void endPush() { _pushing.store(NotPushing); }
+    uint64_t getPushing() const { return _pushing.load(); }
+
+    /// The owner thread exited; nothing more will be pushed.
+    void close() { _closed.store(true, std::memory_order_release); }
+    bool isClosed() const { return _closed.load(std::memory_order_acquire); }
+
+private:
+    /// One more than the capacity, to tell full from empty.
+    std::vector<Entry> _entries;
+    /// The next entry to read.
+    std::atomic<size_t> _head;
+    /// The next entry to write.
+    std::atomic<size_t> _tail;
+    /// The lowest number of the entry being pushed, if any.
+    std::atomic<uint64_t> _pushing;
+    std::atomic<bool> _closed;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
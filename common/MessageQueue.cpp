@@ -13,9 +13,6 @@
 
 #include <algorithm>
 
-#include <Poco/JSON/JSON.h>
-#include <Poco/JSON/Object.h>
-#include <Poco/JSON/Parser.h>
 #include <Poco/StringTokenizer.h>
 
 #include <Protocol.hpp>
@@ -24,6 +21,33 @@
 
 using Poco::StringTokenizer;
 
+namespace {
+
+/// The tile message up to the version, which identifies the tile regardless of the request.
+std::string getTileKey(const std::string& tileMsg)
+{
+    return tileMsg.substr(0, tileMsg.find(" ver"));
+}
+
+/// Whether the message is a tile invalidation callback: "callback <view> 0 ...".
+bool isInvalidation(const std::vector<char>& message)
+{
+    const LOOLProtocol::TokenSpans tokens(message.data(), message.size());
+    return tokens.size() > 3 && tokens[2] == "0";
+}
+
+/// Stamps when a traced tile was queued, and that it is dequeued now.
+void stampDequeued(TileDesc& tile, const std::chrono::steady_clock::time_point arrival)
+{
+    if (tile.getTraceId() > 0)
+    {
+        tile.setStamp(TileTrace::Queued, TileTrace::toStamp(arrival));
+        tile.stamp(TileTrace::Dequeued);
+    }
+}
+
+}
+
 void TileQueue::put_impl(const Payload& value)
 {
     const auto msg = std::string(value.data(), value.size());
@@ -68,6 +92,8 @@ void TileQueue::put_impl(const Payload& value)
             const std::string newMsg = tile.serialize("tile");
 
             removeTileDuplicate(newMsg);
+            _tileArrivals.emplace(getTileKey(newMsg), std::chrono::steady_clock::now());
+            releaseInvalidationsOf(tile);
 
             MessageQueue::put_impl(Payload(newMsg.data(), newMsg.data() + newMsg.size()));
         }
@@ -76,6 +102,9 @@ void TileQueue::put_impl(const Payload& value)
     else if (firstToken == "tile")
     {
         removeTileDuplicate(msg);
+        _tileArrivals.emplace(getTileKey(msg), std::chrono::steady_clock::now());
+        if (!_invalidations.empty())
+            releaseInvalidationsOf(TileDesc::parse(msg));
 
         MessageQueue::put_impl(value);
         return;
@@ -83,14 +112,27 @@ void TileQueue::put_impl(const Payload& value)
     else if (firstToken == "callback")
     {
         const std::string newMsg = removeCallbackDuplicate(msg);
+        const Payload callback = (newMsg.empty() ? value : Payload(newMsg.data(), newMsg.data() + newMsg.size()));
 
-        if (newMsg.empty())
+        if (_invalidationWindowMs > 0 && isInvalidation(callback))
         {
-            MessageQueue::put_impl(value);
+            // Not held back behind the tiles of its area.
+            if (invalidatesQueuedTile(callback))
+            {
+                putAheadOfTiles(callback);
+                return;
+            }
+
+            if (_invalidations.empty())
+            {
+                _invalidationsDue = std::chrono::steady_clock::now() + std::chrono::milliseconds(_invalidationWindowMs);
+            }
+
+            _invalidations.push_back(callback);
         }
         else
         {
-            MessageQueue::put_impl(Payload(newMsg.data(), newMsg.data() + newMsg.size()));
+            MessageQueue::put_impl(callback);
         }
 
         return;
@@ -128,33 +170,27 @@ void TileQueue::removeTileDuplicate(const std::string& tileMsg)
 
 namespace {
 
-/// Read the viewId from the tokens.
-std::string extractViewId(const std::string& origMsg, const std::vector<std::string>& tokens)
+/// Read the viewId from the JSON payload of the callback after the tokens, -1 if none.
+int extractViewId(const char* data, const size_t size, const LOOLProtocol::TokenSpans& tokens)
 {
-    size_t nonJson = tokens[0].size() + tokens[1].size() + tokens[2].size() + 3; // including spaces
-    std::string jsonString(origMsg.data() + nonJson, origMsg.size() - nonJson);
+    const char* payload = std::min(tokens[2].data() + tokens[2].size() + 1, data + size); // including space
 
-    Poco::JSON::Parser parser;
-    const auto result = parser.parse(jsonString);
-    const auto& json = result.extract<Poco::JSON::Object::Ptr>();
-    return json->get("viewId").toString();
+    int viewId = -1;
+    LOOLProtocol::getJsonInteger(LOOLProtocol::StringSpan(payload, data + size - payload), "viewId", viewId);
+    return viewId;
 }
 
 /// Extract the .uno: command ID from the potential command.
-std::string extractUnoCommand(const std::string& command)
+LOOLProtocol::StringSpan extractUnoCommand(const LOOLProtocol::StringSpan& command)
 {
-    if (!LOOLProtocol::matchPrefix(".uno:", command))
-        return std::string();
+    if (!command.startsWith(".uno:"))
+        return LOOLProtocol::StringSpan();
 
-    size_t equalPos = command.find('=');
-    if (equalPos != std::string::npos)
-        return command.substr(0, equalPos);
-
-    return command;
+    return command.substr(0, command.find('='));
 }
 
 /// Extract rectangle from the invalidation callback
-bool extractRectangle(const std::vector<std::string>& tokens, int& x, int& y, int& w, int& h, int& part)
+bool extractRectangle(const LOOLProtocol::TokenSpans& tokens, int& x, int& y, int& w, int& h, int& part)
 {
     x = 0;
     y = 0;
@@ -167,20 +203,31 @@ bool extractRectangle(const std::vector<std::string>& tokens, int& x, int& y, in
 
     if (tokens[3] == "EMPTY,")
     {
-        part = std::atoi(tokens[4].c_str());
-        return true;
+        return LOOLProtocol::stringToInteger(tokens[4], part);
     }
 
     if (tokens.size() < 8)
         return false;
 
-    x = std::atoi(tokens[3].c_str());
-    y = std::atoi(tokens[4].c_str());
-    w = std::atoi(tokens[5].c_str());
-    h = std::atoi(tokens[6].c_str());
-    part = std::atoi(tokens[7].c_str());
+    // The numbers are followed by commas, where the parsing stops.
+    return LOOLProtocol::stringToInteger(tokens[3], x) &&
+           LOOLProtocol::stringToInteger(tokens[4], y) &&
+           LOOLProtocol::stringToInteger(tokens[5], w) &&
+           LOOLProtocol::stringToInteger(tokens[6], h) &&
+           LOOLProtocol::stringToInteger(tokens[7], part);
+}
 
-    return true;
+/// Whether the invalidation callback covers the tile.
+bool invalidatesTile(const std::vector<char>& invalidation, const TileDesc& tile)
+{
+    // EMPTY without a part, which the clients take for the part they show,
+    // is taken for all of them.
+    const LOOLProtocol::TokenSpans tokens(invalidation.data(), invalidation.size());
+    int x, y, w, h, part;
+    if (!extractRectangle(tokens, x, y, w, h, part))
+        return true;
+
+    return tile.getPart() == part && tile.intersectsWithRect(x, y, w, h);
 }
 
 }
@@ -189,13 +236,13 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
 {
     assert(LOOLProtocol::matchPrefix("callback", callbackMsg, /*ignoreWhitespace*/ true));
 
-    std::vector<std::string> tokens = LOOLProtocol::tokenize(callbackMsg);
+    const LOOLProtocol::TokenSpans tokens(callbackMsg);
 
     if (tokens.size() < 3)
         return std::string();
 
     // the message is "callback <view> <id> ..."
-    const std::string& callbackType = tokens[2];
+    const LOOLProtocol::StringSpan& callbackType = tokens[2];
 
     if (callbackType == "0")        // invalidation
     {
@@ -206,13 +253,16 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
 
         bool performedMerge = false;
 
+        // The invalidations held back are merged with each other only.
+        std::vector<Payload>& queue = (_invalidationWindowMs > 0 ? _invalidations : _queue);
+
         // we always travel the entire queue
         size_t i = 0;
-        while (i < _queue.size())
+        while (i < queue.size())
         {
-            auto& it = _queue[i];
+            auto& it = queue[i];
 
-            std::vector<std::string> queuedTokens = LOOLProtocol::tokenize(it.data(), it.size());
+            const LOOLProtocol::TokenSpans queuedTokens(it.data(), it.size());
             if (queuedTokens.size() < 3)
             {
                 ++i;
@@ -240,57 +290,40 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
                 continue;
             }
 
-            // the invalidation in the queue is fully covered by the message,
-            // just remove it
-            if (msgX <= queuedX && queuedX + queuedW <= msgX + msgW && msgY <= queuedY && queuedY + queuedH <= msgY + msgH)
+            // join those that cover, intersect or touch each other (if
+            // the result is small)
+            const int prevX = msgX, prevY = msgY, prevW = msgW, prevH = msgH;
+            if (!TileDesc::joinRectangles(msgX, msgY, msgW, msgH, queuedX, queuedY, queuedW, queuedH))
             {
-                LOG_TRC("Removing smaller invalidation: " << std::string(it.data(), it.size()) << " -> " <<
-                        tokens[0] << " " << tokens[1] << " " << tokens[2] << " " << msgX << " " << msgY << " " << msgW << " " << msgH << " " << msgPart);
-
-                // remove from the queue
-                _queue.erase(_queue.begin() + i);
+                ++i;
                 continue;
             }
 
-            // the invalidation just intersects, join those (if the result is
-            // small)
-            if (TileDesc::rectanglesIntersect(msgX, msgY, msgW, msgH, queuedX, queuedY, queuedW, queuedH))
+            if (msgX == prevX && msgY == prevY && msgW == prevW && msgH == prevH)
+            {
+                // the invalidation in the queue is fully covered by the message,
+                // just remove it
+                LOG_TRC("Removing smaller invalidation: " << std::string(it.data(), it.size()) << " -> " <<
+                        tokens[0] << " " << tokens[1] << " " << tokens[2] << " " << msgX << " " << msgY << " " << msgW << " " << msgH << " " << msgPart);
+            }
+            else
             {
-                int joinX = std::min(msgX, queuedX);
-                int joinY = std::min(msgY, queuedY);
-                int joinW = std::max(msgX + msgW, queuedX + queuedW) - joinX;
-                int joinH = std::max(msgY + msgH, queuedY + queuedH) - joinY;
-
-                const int reasonableSizeX = 4*3840; // 4x tile at 100% zoom
-                const int reasonableSizeY = 2*3840; // 2x tile at 100% zoom
-                if (joinW > reasonableSizeX || joinH > reasonableSizeY)
-                {
-                    ++i;
-                    continue;
-                }
-
                 LOG_TRC("Merging invalidations: " << std::string(it.data(), it.size()) << " and " <<
-                        tokens[0] << " " << tokens[1] << " " << tokens[2] << " " << msgX << " " << msgY << " " << msgW << " " << msgH << " " << msgPart << " -> " <<
-                        tokens[0] << " " << tokens[1] << " " << tokens[2] << " " << joinX << " " << joinY << " " << joinW << " " << joinH << " " << msgPart);
+                        tokens[0] << " " << tokens[1] << " " << tokens[2] << " " << prevX << " " << prevY << " " << prevW << " " << prevH << " " << msgPart << " -> " <<
+                        tokens[0] << " " << tokens[1] << " " << tokens[2] << " " << msgX << " " << msgY << " " << msgW << " " << msgH << " " << msgPart);
 
-                msgX = joinX;
-                msgY = joinY;
-                msgW = joinW;
-                msgH = joinH;
                 performedMerge = true;
-
-                // remove from the queue
-                _queue.erase(_queue.begin() + i);
-                continue;
             }
 
-            ++i;
+            // remove from the queue
+            queue.erase(queue.begin() + i);
         }
 
-        if (performedMerge)
+        // EMPTY covers all the part already.
+        if (performedMerge && tokens.size() >= 8)
         {
-            size_t pre = tokens[0].size() + tokens[1].size() + tokens[2].size() + 3;
-            size_t post = pre + tokens[3].size() + tokens[4].size() + tokens[5].size() + tokens[6].size() + 4;
+            const size_t pre = tokens[3].data() - callbackMsg.data();
+            const size_t post = tokens[7].data() - callbackMsg.data();
 
             std::string result = callbackMsg.substr(0, pre) +
                 std::to_string(msgX) + ", " +
@@ -308,7 +341,7 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
         if (tokens.size() < 4)
             return std::string();
 
-        std::string unoCommand = extractUnoCommand(tokens[3]);
+        const LOOLProtocol::StringSpan unoCommand = extractUnoCommand(tokens[3]);
         if (unoCommand.empty())
             return std::string();
 
@@ -317,7 +350,7 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
         {
             auto& it = _queue[i];
 
-            std::vector<std::string> queuedTokens = LOOLProtocol::tokenize(it.data(), it.size());
+            const LOOLProtocol::TokenSpans queuedTokens(it.data(), it.size());
             if (queuedTokens.size() < 4)
                 continue;
 
@@ -326,7 +359,7 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
 
             // callback, the same target, state changed; now check it's
             // the same .uno: command
-            std::string queuedUnoCommand = extractUnoCommand(queuedTokens[3]);
+            const LOOLProtocol::StringSpan queuedUnoCommand = extractUnoCommand(queuedTokens[3]);
             if (queuedUnoCommand.empty())
                 continue;
 
@@ -347,10 +380,10 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
     {
         const bool isViewCallback = (callbackType == "24" || callbackType == "26" || callbackType == "28");
 
-        std::string viewId;
+        int viewId = -1;
         if (isViewCallback)
         {
-            viewId = extractViewId(callbackMsg, tokens);
+            viewId = extractViewId(callbackMsg.data(), callbackMsg.size(), tokens);
         }
 
         for (size_t i = 0; i < _queue.size(); ++i)
@@ -361,7 +394,7 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
             if (!LOOLProtocol::matchPrefix("callback", it))
                 continue;
 
-            std::vector<std::string> queuedTokens = LOOLProtocol::tokenize(it.data(), it.size());
+            const LOOLProtocol::TokenSpans queuedTokens(it.data(), it.size());
             if (queuedTokens.size() < 3)
                 continue;
 
@@ -376,9 +409,9 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
                 // we additionally need to ensure that the payload is about
                 // the same viewid (otherwise we'd merge them all views into
                 // one)
-                const std::string queuedViewId = extractViewId(std::string(it.data(), it.size()), queuedTokens);
+                const int queuedViewId = extractViewId(it.data(), it.size(), queuedTokens);
 
-                if (viewId == queuedViewId)
+                if (viewId >= 0 && viewId == queuedViewId)
                 {
                     LOG_TRC("Remove obsolete view callback: " << std::string(it.data(), it.size()) << " -> " << callbackMsg);
                     _queue.erase(_queue.begin() + i);
@@ -425,10 +458,125 @@ void TileQueue::deprioritizePreviews()
     }
 }
 
+size_t TileQueue::yieldToNonTiles()
+{
+    auto lock = getLock();
+
+    _nonTilesFirst = std::count_if(_queue.begin(), _queue.end(),
+                                   [](const Payload& v) { return !LOOLProtocol::matchPrefix("tile", v); });
+    return _nonTilesFirst;
+}
+
+std::chrono::steady_clock::time_point TileQueue::tileDequeued(const std::string& tileMsg)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const auto it = _tileArrivals.find(getTileKey(tileMsg));
+    if (it == _tileArrivals.end())
+        return now;
+
+    const auto arrival = it->second;
+    _waitMs.add(std::chrono::duration<double, std::milli>(now - arrival).count());
+    _tileArrivals.erase(it);
+    return arrival;
+}
+
+void TileQueue::setInvalidationWindowMs(const unsigned windowMs)
+{
+    auto lock = getLock();
+
+    _invalidationWindowMs = windowMs;
+    if (_invalidationWindowMs == 0)
+    {
+        _queue.insert(_queue.end(), _invalidations.begin(), _invalidations.end());
+        _invalidations.clear();
+    }
+}
+
+bool TileQueue::wait_impl() const
+{
+    return !_queue.empty() ||
+           (!_invalidations.empty() && std::chrono::steady_clock::now() >= _invalidationsDue);
+}
+
+std::chrono::steady_clock::time_point TileQueue::getWakeUp_impl() const
+{
+    return (_invalidations.empty() ? std::chrono::steady_clock::time_point::max() : _invalidationsDue);
+}
+
+void TileQueue::clear_impl()
+{
+    MessageQueue::clear_impl();
+    _invalidations.clear();
+}
+
+bool TileQueue::invalidatesQueuedTile(const Payload& invalidation) const
+{
+    for (const auto& it : _queue)
+    {
+        if (LOOLProtocol::matchPrefix("tile", it) &&
+            invalidatesTile(invalidation, TileDesc::parse(LOOLProtocol::TokenSpans(it.data(), it.size()))))
+            return true;
+    }
+
+    return false;
+}
+
+void TileQueue::releaseInvalidationsOf(const TileDesc& tile)
+{
+    size_t i = 0;
+    while (i < _invalidations.size())
+    {
+        if (invalidatesTile(_invalidations[i], tile))
+        {
+            LOG_TRC("Releasing the invalidation of a queued tile: " <<
+                    std::string(_invalidations[i].data(), _invalidations[i].size()));
+            putAheadOfTiles(_invalidations[i]);
+            _invalidations.erase(_invalidations.begin() + i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+void TileQueue::putAheadOfTiles(const Payload& value)
+{
+    const auto it = std::find_if(_queue.begin(), _queue.end(),
+                                 [](const Payload& v) { return LOOLProtocol::matchPrefix("tile", v); });
+    _queue.insert(it, value);
+}
+
 TileQueue::Payload TileQueue::get_impl()
 {
     LOG_TRC("MessageQueue depth: " << _queue.size());
 
+    // The invalidations held back go first once due; they are the oldest.
+    if (!_invalidations.empty() && std::chrono::steady_clock::now() >= _invalidationsDue)
+    {
+        const Payload result = _invalidations.front();
+        _invalidations.erase(_invalidations.begin());
+        LOG_TRC("MessageQueue res (invalidation): " << std::string(result.data(), result.size()));
+        return result;
+    }
+
+    if (_nonTilesFirst > 0)
+    {
+        const auto it = std::find_if(_queue.begin(), _queue.end(),
+                                     [](const Payload& v) { return !LOOLProtocol::matchPrefix("tile", v); });
+        if (it != _queue.end())
+        {
+            --_nonTilesFirst;
+            const Payload result = *it;
+            _queue.erase(it);
+            LOG_TRC("MessageQueue res (ahead of tiles): " << std::string(result.data(), result.size()));
+            return result;
+        }
+
+        // Some were merged with newer ones meanwhile.
+        _nonTilesFirst = 0;
+    }
+
     const auto front = _queue.front();
 
     auto msg = std::string(front.data(), front.size());
@@ -441,6 +589,8 @@ TileQueue::Payload TileQueue::get_impl()
         // Don't combine non-tiles or tiles with id.
         LOG_TRC("MessageQueue res: " << msg);
         _queue.erase(_queue.begin());
+        if (isPreview)
+            tileDequeued(msg);
 
         // de-prioritize the other tiles with id - usually the previews in
         // Impress
@@ -484,40 +634,51 @@ TileQueue::Payload TileQueue::get_impl()
     }
 
     _queue.erase(_queue.begin() + prioritized);
-
-    std::vector<TileDesc> tiles;
-    tiles.emplace_back(TileDesc::parse(msg));
-
-    // Combine as many tiles as possible with the top one.
-    for (size_t i = 0; i < _queue.size(); )
+    const auto arrival = tileDequeued(msg);
+
+    // Combine the tiles that are worth painting with the top one.
+    std::vector<TileDesc> candidates;
+    std::vector<size_t> positions;
+    candidates.emplace_back(TileDesc::parse(msg));
+    stampDequeued(candidates.back(), arrival);
+    positions.push_back(0);
+    for (size_t i = 0; i < _queue.size(); ++i)
     {
         auto& it = _queue[i];
-        msg = std::string(it.data(), it.size());
-        if (!LOOLProtocol::matchPrefix("tile", msg) ||
-            LOOLProtocol::getTokenStringFromMessage(msg, "id", id))
+        const std::string candidate(it.data(), it.size());
+        if (!LOOLProtocol::matchPrefix("tile", candidate) ||
+            LOOLProtocol::getTokenStringFromMessage(candidate, "id", id))
         {
             // Don't combine non-tiles or tiles with id.
-            ++i;
             continue;
         }
 
-        auto tile2 = TileDesc::parse(msg);
-        LOG_TRC("Combining candidate: " << msg);
+        candidates.emplace_back(TileDesc::parse(candidate));
+        positions.push_back(i);
+    }
 
-        // Check if it's on the same row.
-        if (tiles[0].onSameRow(tile2))
-        {
-            tiles.emplace_back(tile2);
-            _queue.erase(_queue.begin() + i);
-        }
-        else
-        {
-            ++i;
-        }
+    std::vector<TileDesc> tiles;
+    tiles.push_back(candidates[0]);
+    const std::vector<size_t> picked = _coalescer.coalesce(candidates);
+    for (auto index = picked.rbegin(); index != picked.rend(); ++index)
+    {
+        // Erase from the back, to keep the positions before valid.
+        auto& it = _queue[positions[*index]];
+        stampDequeued(candidates[*index], tileDequeued(std::string(it.data(), it.size())));
+        _queue.erase(_queue.begin() + positions[*index]);
+    }
+
+    for (const size_t index : picked)
+    {
+        tiles.push_back(candidates[index]);
     }
 
     LOG_TRC("Combined " << tiles.size() << " tiles, leaving " << _queue.size() << " in queue.");
 
+    // Forget the tiles that were cancelled.
+    if (_queue.empty())
+        _tileArrivals.clear();
+
     if (tiles.size() == 1)
     {
         msg = tiles[0].serialize("tile");
@@ -11,12 +11,17 @@
 #define INCLUDED_MESSAGEQUEUE_HPP
 
 #include <algorithm>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <map>
 #include <mutex>
+#include <string>
 #include <vector>
 
+#include "Histogram.hpp"
+#include "TileCoalescer.hpp"
+
 /// Thread-safe message queue (FIFO).
 template <typename T>
 class MessageQueueBase
@@ -62,17 +67,25 @@ public:
     {
         std::unique_lock<std::mutex> lock(_mutex);
 
-        if (timeoutMs > 0)
+        const auto deadline = (timeoutMs > 0 ? std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs)
+                                             : std::chrono::steady_clock::time_point::max());
+        while (!wait_impl())
         {
-            if (!_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs),
-                              [this] { return wait_impl(); }))
+            if (timeoutMs > 0 && std::chrono::steady_clock::now() >= deadline)
             {
                 return Payload();
             }
-        }
-        else
-        {
-            _cv.wait(lock, [this] { return wait_impl(); });
+
+            // Wake up also when the messages held back are due.
+            const auto wakeUp = std::min(deadline, getWakeUp_impl());
+            if (wakeUp == std::chrono::steady_clock::time_point::max())
+            {
+                _cv.wait(lock);
+            }
+            else
+            {
+                _cv.wait_until(lock, wakeUp);
+            }
         }
 
         return get_impl();
@@ -99,11 +112,18 @@ protected:
         _queue.push_back(value);
     }
 
-    bool wait_impl() const
+    /// Whether there is a message to get now.
+    virtual bool wait_impl() const
     {
         return _queue.size() > 0;
     }
 
+    /// When a message held back becomes available, if none is now.
+    virtual std::chrono::steady_clock::time_point getWakeUp_impl() const
+    {
+        return std::chrono::steady_clock::time_point::max();
+    }
+
     virtual Payload get_impl()
     {
         Payload result = _queue.front();
@@ -111,7 +131,7 @@ protected:
         return result;
     }
 
-    void clear_impl()
+    virtual void clear_impl()
     {
         _queue.clear();
     }
@@ -187,11 +207,51 @@ public:
         _cursorPositions.erase(viewId);
     }
 
+    /// Returns the messages other than tiles that are queued now
+    /// ahead of any more tiles, so that callbacks and input don't
+    /// wait for a whole burst of tiles to render.
+    /// Returns the number of messages let through.
+    size_t yieldToNonTiles();
+
+    /// How long the tiles returned so far waited in the queue.
+    Histogram getWaitHistogram()
+    {
+        auto lock = getLock();
+        return _waitMs;
+    }
+
+    /// A paintPartTile call of the given number of pixels took elapsedMs,
+    /// to learn which tiles are worth combining.
+    void addPaintSample(double pixels, double elapsedMs)
+    {
+        auto lock = getLock();
+        _coalescer.addSample(pixels, elapsedMs);
+    }
+
+    /// The model of paint time used to combine tiles.
+    TileCoalescer getCoalescer()
+    {
+        auto lock = getLock();
+        return _coalescer;
+    }
+
+    /// Holds the tile invalidation callbacks back for up to windowMs, merging
+    /// those that overlap or touch meanwhile, so that a burst of them from a
+    /// single edit reaches WSD, and the clients, as few rectangles.
+    /// 0 disables, letting any held back through.
+    void setInvalidationWindowMs(unsigned windowMs);
+
 protected:
     virtual void put_impl(const Payload& value) override;
 
+    virtual bool wait_impl() const override;
+
+    virtual std::chrono::steady_clock::time_point getWakeUp_impl() const override;
+
     virtual Payload get_impl() override;
 
+    virtual void clear_impl() override;
+
 private:
     /// Search the queue for a duplicate tile and remove it (if present).
     void removeTileDuplicate(const std::string& tileMsg);
@@ -208,17 +268,48 @@ private:
     /// the queue.
     void deprioritizePreviews();
 
+    /// Whether the invalidation callback covers any of the tiles queued.
+    bool invalidatesQueuedTile(const Payload& invalidation) const;
+
+    /// Lets the invalidations held back that cover the tile through ahead of
+    /// the tiles, lest WSD caches the tile only to evict it on receiving them.
+    void releaseInvalidationsOf(const TileDesc& tile);
+
+    /// Queues the message before the first tile queued.
+    void putAheadOfTiles(const Payload& value);
+
     /// Priority of the given tile message.
     /// -1 means the lowest prio (the tile does not intersect any of the cursors),
     /// the higher the number, the bigger is priority [up to _viewOrder.size()-1].
     int priority(const std::string& tileMsg);
 
+    /// Accounts for how long the tile waited since it was first requested.
+    /// Returns when it was, or now if not known.
+    std::chrono::steady_clock::time_point tileDequeued(const std::string& tileMsg);
+
 private:
     std::map<int, CursorPosition> _cursorPositions;
 
     /// Check the views in the order of how the editing (cursor movement) has
     /// been happening (0 == oldest, size() - 1 == newest).
     std::vector<int> _viewOrder;
+
+    /// The number of messages other than tiles to return before any more tiles.
+    size_t _nonTilesFirst = 0;
+
+    /// When each queued tile was first requested, by its tile message up to the version.
+    std::map<std::string, std::chrono::steady_clock::time_point> _tileArrivals;
+
+    Histogram _waitMs;
+
+    TileCoalescer _coalescer;
+
+    /// How long to hold the invalidations back, in ms, 0 to not.
+    unsigned _invalidationWindowMs = 0;
+
+    /// The invalidation callbacks held back, and when the first of them is due.
+    std::vector<Payload> _invalidations;
+    std::chrono::steady_clock::time_point _invalidationsDue;
 };
 
 #endif
@@ -12,7 +12,9 @@
 #include "Protocol.hpp"
 
 #include <cassert>
+#include <cctype>
 #include <cstring>
+#include <limits>
 #include <map>
 #include <string>
 
@@ -73,6 +75,144 @@ namespace LOOLProtocol
         return true;
     }
 
+    bool stringToInteger(const StringSpan& input, int& value)
+    {
+        size_t i = 0;
+        while (i < input.size() && std::isspace(static_cast<unsigned char>(input[i])))
+            ++i;
+
+        const bool negative = (i < input.size() && input[i] == '-');
+        if (i < input.size() && (input[i] == '-' || input[i] == '+'))
+            ++i;
+
+        // The magnitude of the smallest int is one more than that of the largest.
+        const int64_t limit = static_cast<int64_t>(std::numeric_limits<int>::max()) + (negative ? 1 : 0);
+        const size_t first = i;
+        int64_t result = 0;
+        for (; i < input.size() && input[i] >= '0' && input[i] <= '9'; ++i)
+        {
+            result = result * 10 + (input[i] - '0');
+            if (result > limit)
+                return false;
+        }
+
+        if (i == first)
+            return false;
+
+        value = static_cast<int>(negative ? -result : result);
+        return true;
+    }
+
+    bool stringToUInt64(const StringSpan& input, uint64_t& value)
+    {
+        size_t i = 0;
+        while (i < input.size() && std::isspace(static_cast<unsigned char>(input[i])))
+            ++i;
+
+        if (i < input.size() && input[i] == '+')
+            ++i;
+
+        const size_t first = i;
+        uint64_t result = 0;
+        for (; i < input.size() && input[i] >= '0' && input[i] <= '9'; ++i)
+        {
+            const unsigned digit = input[i] - '0';
+            if (result > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+                return false;
+
+            result = result * 10 + digit;
+        }
+
+        if (i == first)
+            return false;
+
+        value = result;
+        return true;
+    }
+
+    TokenSpans::TokenSpans(const char* data, const size_t size) :
+        _size(0)
+    {
+        size_t i = 0;
+        while (data != nullptr && i < size && data[i] != '\n')
+        {
+            if (data[i] == ' ')
+            {
+                ++i;
+                continue;
+            }
+
+            const size_t start = i;
+            while (i < size && data[i] != ' ' && data[i] != '\n')
+                ++i;
+
+            add(StringSpan(data + start, i - start));
+        }
+    }
+
+    TokenSpans::TokenSpans(const std::vector<std::string>& tokens) :
+        _size(0)
+    {
+        for (const auto& token : tokens)
+        {
+            add(StringSpan(token));
+        }
+    }
+
+    void TokenSpans::add(const StringSpan& token)
+    {
+        if (_overflow.empty() && _size < InlineCount)
+        {
+            _inline[_size] = token;
+        }
+        else
+        {
+            if (_overflow.empty())
+                _overflow.assign(_inline.begin(), _inline.end());
+
+            _overflow.push_back(token);
+        }
+
+        ++_size;
+    }
+
+    bool ListTokenizer::next(StringSpan& item)
+    {
+        while (_pos < _list.size())
+        {
+            size_t end = _list.find(_delim, _pos);
+            if (end == std::string::npos)
+                end = _list.size();
+
+            size_t start = _pos;
+            _pos = end + 1;
+
+            while (start < end && std::isspace(static_cast<unsigned char>(_list[start])))
+                ++start;
+            while (end > start && std::isspace(static_cast<unsigned char>(_list[end - 1])))
+                --end;
+
+            if (end > start)
+            {
+                item = _list.substr(start, end - start);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    size_t ListTokenizer::count() const
+    {
+        ListTokenizer tokenizer(_list, _delim);
+        StringSpan item;
+        size_t count = 0;
+        while (tokenizer.next(item))
+            ++count;
+
+        return count;
+    }
+
     bool getTokenInteger(const std::string& token, const std::string& name, int& value)
     {
         if (token.size() > (name.size() + 1) &&
@@ -138,6 +278,133 @@ namespace LOOLProtocol
         return false;
     }
 
+    bool getTokenKeyword(const StringSpan& token, const char* name,
+                         const std::map<std::string, int>& map, int& value)
+    {
+        StringSpan t;
+        if (getTokenString(token, name, t))
+        {
+            if (t[0] == '\'' && t[t.size() - 1] == '\'')
+            {
+                t = t.substr(1, t.size() - 2);
+            }
+
+            // The maps are of a few keywords, don't copy to look it up.
+            for (const auto& pair : map)
+            {
+                if (t == pair.first)
+                {
+                    value = pair.second;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    namespace
+    {
+        /// The end of the JSON string whose opening quote is before pos:
+        /// the position of its closing quote, or the size if unterminated.
+        size_t findStringEnd(const StringSpan& json, size_t pos)
+        {
+            while (pos < json.size() && json[pos] != '"')
+            {
+                pos += (json[pos] == '\\' ? 2 : 1);
+            }
+
+            return std::min(pos, json.size());
+        }
+
+        size_t skipSpaces(const StringSpan& json, size_t pos)
+        {
+            while (pos < json.size() && std::isspace(static_cast<unsigned char>(json[pos])))
+            {
+                ++pos;
+            }
+
+            return pos;
+        }
+    }
+
+    bool getJsonValue(const StringSpan& json, const char* name, StringSpan& value)
+    {
+        const size_t nameSize = std::strlen(name);
+        const size_t size = json.size();
+        int depth = 0;
+        size_t pos = 0;
+        while (pos < size)
+        {
+            const char c = json[pos++];
+            if (c == '{' || c == '[')
+            {
+                ++depth;
+            }
+            else if (c == '}' || c == ']')
+            {
+                --depth;
+            }
+            else if (c == '"')
+            {
+                const size_t start = pos;
+                pos = findStringEnd(json, pos);
+                if (pos >= size)
+                    return false;
+
+                const StringSpan key = json.substr(start, pos - start);
+                pos = skipSpaces(json, pos + 1);
+
+                // Only the members of the top-level object, not the strings that are values.
+                if (depth != 1 || pos >= size || json[pos] != ':' || !key.equals(name, nameSize))
+                    continue;
+
+                pos = skipSpaces(json, pos + 1);
+                if (pos >= size)
+                    return false;
+
+                if (json[pos] == '"')
+                {
+                    const size_t valueStart = pos + 1;
+                    pos = findStringEnd(json, valueStart);
+                    if (pos >= size)
+                        return false;
+
+                    value = json.substr(valueStart, pos - valueStart);
+                    return true;
+                }
+
+                if (json[pos] == '{' || json[pos] == '[')
+                    return false;
+
+                const size_t valueStart = pos;
+                while (pos < size && json[pos] != ',' && json[pos] != '}' &&
+                       !std::isspace(static_cast<unsigned char>(json[pos])))
+                {
+                    ++pos;
+                }
+
+                value = json.substr(valueStart, pos - valueStart);
+                return !value.empty();
+            }
+        }
+
+        return false;
+    }
+
+    bool parseRectangle(const StringSpan& text, int& x, int& y, int& width, int& height)
+    {
+        ListTokenizer tokenizer(text, ',');
+        if (tokenizer.count() != 4)
+            return false;
+
+        StringSpan token;
+        return tokenizer.next(token) && stringToInteger(token, x) &&
+               tokenizer.next(token) && stringToInteger(token, y) &&
+               tokenizer.next(token) && stringToInteger(token, width) &&
+               tokenizer.next(token) && stringToInteger(token, height);
+    }
+
     bool getTokenInteger(const Poco::StringTokenizer& tokens, const std::string& name, int& value)
     {
         for (size_t i = 0; i < tokens.count(); i++)
@@ -10,11 +10,14 @@
 #ifndef INCLUDED_LOOLPROTOCOL_HPP
 #define INCLUDED_LOOLPROTOCOL_HPP
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <cstring>
 #include <map>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <Poco/Format.h>
 #include <Poco/StringTokenizer.h>
@@ -137,6 +140,246 @@ namespace LOOLProtocol
         return tokenize(s.data(), s.size());
     }
 
+    /// A span of the characters of a message, which it neither owns nor
+    /// copies, valid only as long as the message is. Like std::string_view.
+    class StringSpan
+    {
+    public:
+        StringSpan() :
+            _data(nullptr),
+            _size(0)
+        {
+        }
+
+        StringSpan(const char* data, const size_t size) :
+            _data(data),
+            _size(size)
+        {
+        }
+
+        explicit StringSpan(const std::string& s) :
+            _data(s.data()),
+            _size(s.size())
+        {
+        }
+
+        const char* data() const { return _data; }
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        char operator[](const size_t index) const { return _data[index]; }
+
+        /// A copy, where a string is needed.
+        std::string toString() const { return std::string(_data, _size); }
+
+        bool equals(const char* s, const size_t size) const
+        {
+            return _size == size && (size == 0 || std::memcmp(_data, s, size) == 0);
+        }
+
+        bool startsWith(const char* prefix) const
+        {
+            const size_t size = std::strlen(prefix);
+            return _size >= size && std::memcmp(_data, prefix, size) == 0;
+        }
+
+        /// The position of the first c from pos on, or std::string::npos.
+        size_t find(const char c, const size_t pos = 0) const
+        {
+            const void* found = (pos < _size ? std::memchr(_data + pos, c, _size - pos) : nullptr);
+            return (found ? static_cast<const char*>(found) - _data : std::string::npos);
+        }
+
+        /// The position of the first s, or std::string::npos.
+        size_t find(const char* s) const
+        {
+            const size_t size = std::strlen(s);
+            for (size_t i = 0; i + size <= _size; ++i)
+            {
+                if (std::memcmp(_data + i, s, size) == 0)
+                    return i;
+            }
+
+            return std::string::npos;
+        }
+
+        /// The span of up to len characters from pos on.
+        StringSpan substr(const size_t pos, const size_t len = std::string::npos) const
+        {
+            if (pos >= _size)
+                return StringSpan(_data + _size, 0);
+
+            return StringSpan(_data + pos, std::min(len, _size - pos));
+        }
+
+    private:
+        const char* _data;
+        size_t _size;
+    };
+
+    inline bool operator==(const StringSpan& lhs, const char* rhs) { return lhs.equals(rhs, std::strlen(rhs)); }
+    inline bool operator!=(const StringSpan& lhs, const char* rhs) { return !(lhs == rhs); }
+    inline bool operator==(const StringSpan& lhs, const std::string& rhs) { return lhs.equals(rhs.data(), rhs.size()); }
+    inline bool operator!=(const StringSpan& lhs, const std::string& rhs) { return !(lhs == rhs); }
+    inline bool operator==(const StringSpan& lhs, const StringSpan& rhs) { return lhs.equals(rhs.data(), rhs.size()); }
+    inline bool operator!=(const StringSpan& lhs, const StringSpan& rhs) { return !(lhs == rhs); }
+
+    inline std::ostream& operator<<(std::ostream& os, const StringSpan& span)
+    {
+        return os.write(span.data(), span.size());
+    }
+
+    /// The space-separated tokens of the first line of a message, as spans
+    /// over it: tokenize() without copying. Allocates only for messages
+    /// of more than InlineCount tokens.
+    class TokenSpans
+    {
+    public:
+        TokenSpans(const char* data, size_t size);
+
+        explicit TokenSpans(const std::string& message) :
+            TokenSpans(message.data(), message.size())
+        {
+        }
+
+        /// Spans over tokens already split, for the callers which have them.
+        explicit TokenSpans(const std::vector<std::string>& tokens);
+
+        /// The spans would outlive a temporary.
+        TokenSpans(std::string&&) = delete;
+        TokenSpans(std::vector<std::string>&&) = delete;
+
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        const StringSpan& operator[](const size_t index) const { return getSpans()[index]; }
+        const StringSpan* begin() const { return getSpans(); }
+        const StringSpan* end() const { return getSpans() + _size; }
+
+    private:
+        void add(const StringSpan& token);
+        const StringSpan* getSpans() const { return (_overflow.empty() ? _inline.data() : _overflow.data()); }
+
+    private:
+        static constexpr size_t InlineCount = 16;
+
+        std::array<StringSpan, InlineCount> _inline;
+        /// All the tokens, once there are more than fit inline.
+        std::vector<StringSpan> _overflow;
+        size_t _size;
+    };
+
+    /// Iterates over the items of a delimited list, like "1,2,3,", as spans
+    /// over it, trimmed, skipping the empty ones, like Poco::StringTokenizer
+    /// with TOK_IGNORE_EMPTY and TOK_TRIM, but without copying.
+    class ListTokenizer
+    {
+    public:
+        ListTokenizer(const StringSpan& list, const char delim) :
+            _list(list),
+            _pos(0),
+            _delim(delim)
+        {
+        }
+
+        /// Gets the next item, false if there are no more.
+        bool next(StringSpan& item);
+
+        /// The number of items in the list, regardless of those already gotten.
+        size_t count() const;
+
+    private:
+        const StringSpan _list;
+        size_t _pos;
+        const char _delim;
+    };
+
+    /// Parses an integer without copying, as std::stoi, but false on overflow.
+    bool stringToInteger(const StringSpan& input, int& value);
+    bool stringToUInt64(const StringSpan& input, uint64_t& value);
+
+    inline
+    bool parseNameValuePair(const StringSpan& token, StringSpan& name, StringSpan& value, const char delim = '=')
+    {
+        const auto mid = token.find(delim);
+        if (mid != std::string::npos)
+        {
+            name = token.substr(0, mid);
+            value = token.substr(mid + 1);
+            return true;
+        }
+
+        return false;
+    }
+
+    /// Gets the value of a name=value token, without copying.
+    inline bool getTokenString(const StringSpan& token, const char* name, StringSpan& value)
+    {
+        const size_t size = std::strlen(name);
+        if (token.size() > size + 1 &&
+            std::memcmp(token.data(), name, size) == 0 &&
+            token[size] == '=')
+        {
+            value = token.substr(size + 1);
+            return true;
+        }
+
+        return false;
+    }
+
+    inline bool getTokenInteger(const StringSpan& token, const char* name, int& value)
+    {
+        StringSpan str;
+        return getTokenString(token, name, str) && stringToInteger(str, value);
+    }
+
+    inline bool getTokenUInt64(const StringSpan& token, const char* name, uint64_t& value)
+    {
+        StringSpan str;
+        return getTokenString(token, name, str) && stringToUInt64(str, value);
+    }
+
+    bool getTokenKeyword(const StringSpan& token, const char* name, const std::map<std::string, int>& map, int& value);
+
+    /// Gets the value of a member of the top-level object of a JSON
+    /// document, without parsing the rest of it: of a string without the
+    /// quotes (and escapes left as they are), of a number or a literal as
+    /// it is. False if missing, or if an object or an array.
+    bool getJsonValue(const StringSpan& json, const char* name, StringSpan& value);
+
+    /// Gets an integer member, like "viewId": 1 or "viewId": "1", of
+    /// the top-level object of a JSON document. As frequent callbacks
+    /// are parsed for their viewId, and a JSON parser is not cheap.
+    inline bool getJsonInteger(const StringSpan& json, const char* name, int& value)
+    {
+        StringSpan str;
+        return getJsonValue(json, name, str) && stringToInteger(str, value);
+    }
+
+    /// Parses a rectangle of the callbacks, "x, y, width, height".
+    /// False if not 4 integers, like "EMPTY".
+    bool parseRectangle(const StringSpan& text, int& x, int& y, int& width, int& height);
+
+    inline bool getTokenString(const TokenSpans& tokens, const char* name, StringSpan& value)
+    {
+        for (const auto& token : tokens)
+        {
+            if (getTokenString(token, name, value))
+                return true;
+        }
+
+        return false;
+    }
+
+    inline bool getTokenInteger(const TokenSpans& tokens, const char* name, int& value)
+    {
+        for (const auto& token : tokens)
+        {
+            if (getTokenInteger(token, name, value))
+                return true;
+        }
+
+        return false;
+    }
+
     inline bool getTokenIntegerFromMessage(const std::string& message, const std::string& name, int& value)
     {
         return getTokenInteger(tokenize(message), name, value);
@@ -209,8 +452,8 @@ namespace LOOLProtocol
     /// Currently this excludes commands sent automatically.
     /// Notice that this doesn't guarantee editing activity,
     /// rather just user interaction with the UI.
-    inline
-    bool tokenIndicatesUserInteraction(const std::string& token)
+    template <typename T>
+    bool tokenIndicatesUserInteraction(const T& token)
     {
         // Exclude tokens that include these keywords, such as canceltiles statusindicator.
 
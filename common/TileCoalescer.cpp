@@ -0,0 +1,206 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "TileCoalescer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace
+{
+
+/// Where we start from until we measured some paints.
+constexpr double DefaultOverheadMs = 4;
+constexpr double DefaultMsPerMegaPixel = 25;
+
+/// A bounding rectangle, in twips.
+struct Bounds
+{
+    int _left;
+    int _top;
+    int _right;
+    int _bottom;
+
+    explicit Bounds(const TileDesc& tile) :
+        _left(tile.getTilePosX()),
+        _top(tile.getTilePosY()),
+        _right(tile.getTilePosX() + tile.getTileWidth()),
+        _bottom(tile.getTilePosY() + tile.getTileHeight())
+    {
+    }
+
+    Bounds extended(const TileDesc& tile) const
+    {
+        Bounds result(*this);
+        result._left = std::min(_left, tile.getTilePosX());
+        result._top = std::min(_top, tile.getTilePosY());
+        result._right = std::max(_right, tile.getTilePosX() + tile.getTileWidth());
+        result._bottom = std::max(_bottom, tile.getTilePosY() + tile.getTileHeight());
+        return result;
+    }
+
+    /// The number of pixels to paint it at the zoom of the tile.
+    double getPixels(const TileDesc& tile) const
+    {
+        return (static_cast<double>(_right - _left) * tile.getWidth() / tile.getTileWidth()) *
+               (static_cast<double>(_bottom - _top) * tile.getHeight() / tile.getTileHeight());
+    }
+};
+
+/// Whether the tile can be painted in the same pixmap as the reference one.
+bool isCompatible(const TileDesc& reference, const TileDesc& tile)
+{
+    return tile.getPart() == reference.getPart() &&
+           tile.getWidth() == reference.getWidth() &&
+           tile.getHeight() == reference.getHeight() &&
+           tile.getTileWidth() == reference.getTileWidth() &&
+           tile.getTileHeight() == reference.getTileHeight() &&
+           (tile.getTilePosX() - reference.getTilePosX()) % reference.getTileWidth() == 0 &&
+           (tile.getTilePosY() - reference.getTilePosY()) % reference.getTileHeight() == 0;
+}
+
+}
+
+TileCoalescer::TileCoalescer() :
+    _sumW(0),
+    _sumX(0),
+    _sumY(0),
+    _sumXX(0),
+    _sumXY(0),
+    _overheadMs(DefaultOverheadMs),
+    _msPerMegaPixel(DefaultMsPerMegaPixel)
+{
+    // Seed the fit with the defaults, at a single tile and at a screenful,
+    // so that it is well-defined until real samples take over.
+    for (const double megaPixels : { 256 * 256 / 1e6, 16 * 256 * 256 / 1e6 })
+    {
+        const double ms = DefaultOverheadMs + megaPixels * DefaultMsPerMegaPixel;
+        _sumW += 1;
+        _sumX += megaPixels;
+        _sumY += ms;
+        _sumXX += megaPixels * megaPixels;
+        _sumXY += megaPixels * ms;
+    }
+}
+
+void TileCoalescer::addSample(const double pixels, const double elapsedMs)
+{
+    if (pixels <= 0 || elapsedMs < 0)
+        return;
+
+    const double megaPixels = pixels / 1e6;
+    const double decay = 1 - SampleWeight;
+    _sumW = _sumW * decay + SampleWeight;
+    _sumX = _sumX * decay + SampleWeight * megaPixels;
+    _sumY = _sumY * decay + SampleWeight * elapsedMs;
+    _sumXX = _sumXX * decay + SampleWeight * megaPixels * megaPixels;
+    _sumXY = _sumXY * decay + SampleWeight * megaPixels * elapsedMs;
+
+    fit();
+}
+
+void TileCoalescer::fit()
+{
+    const double meanX = _sumX / _sumW;
+    const double meanY = _sumY / _sumW;
+    const double varX = _sumXX / _sumW - meanX * meanX;
+    const double covXY = _sumXY / _sumW - meanX * meanY;
+
+    if (varX > 0.01 * (meanX * meanX) && covXY > 0)
+    {
+        _msPerMegaPixel = covXY / varX;
+        _overheadMs = std::max(0.0, meanY - _msPerMegaPixel * meanX);
+    }
+    else
+    {
+        // With all recent paints of about the same size, we can't tell the
+        // overhead from the cost per pixel, so keep their proportion.
+        const double scale = meanY / estimateMs(meanX * 1e6);
+        _overheadMs *= scale;
+        _msPerMegaPixel *= scale;
+    }
+
+    // Painting is never free.
+    _msPerMegaPixel = std::max(_msPerMegaPixel, 1e-3);
+}
+
+double TileCoalescer::estimateMs(const double pixels) const
+{
+    return _overheadMs + pixels / 1e6 * _msPerMegaPixel;
+}
+
+double TileCoalescer::getMegaPixelsPerSec() const
+{
+    return 1000 / _msPerMegaPixel;
+}
+
+std::vector<size_t> TileCoalescer::coalesce(const std::vector<TileDesc>& tiles) const
+{
+    std::vector<size_t> picked;
+    if (tiles.empty())
+        return picked;
+
+    const TileDesc& reference = tiles[0];
+    std::vector<size_t> candidates;
+    for (size_t i = 1; i < tiles.size(); ++i)
+    {
+        if (isCompatible(reference, tiles[i]))
+            candidates.push_back(i);
+    }
+
+    Bounds bounds(reference);
+    double batchPixels = bounds.getPixels(reference);
+    const double tileMs = estimateMs(Bounds(reference).getPixels(reference));
+
+    while (!candidates.empty())
+    {
+        // The nearest tile is the one that grows the batch the least.
+        size_t best = 0;
+        double bestPixels = 0;
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+            const double pixels = bounds.extended(tiles[candidates[i]]).getPixels(reference);
+            if (i == 0 || pixels < bestPixels)
+            {
+                best = i;
+                bestPixels = pixels;
+            }
+        }
+
+        // Worth it only if painting the tile with the batch takes less
+        // than painting it on its own.
+        if (bestPixels > MaxBatchPixels ||
+            estimateMs(bestPixels) - estimateMs(batchPixels) > tileMs)
+        {
+            break;
+        }
+
+        const size_t index = candidates[best];
+        bounds = bounds.extended(tiles[index]);
+        batchPixels = bestPixels;
+        picked.push_back(index);
+        candidates.erase(candidates.begin() + best);
+    }
+
+    std::sort(picked.begin(), picked.end());
+    return picked;
+}
+
+std::string TileCoalescer::toString() const
+{
+    std::ostringstream oss;
+    oss << "paint_overhead_ms=" << std::lround(_overheadMs)
+        << " paint_mps=" << std::lround(getMegaPixelsPerSec());
+    return oss.str();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
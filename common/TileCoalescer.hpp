@@ -0,0 +1,74 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILECOALESCER_HPP
+#define INCLUDED_TILECOALESCER_HPP
+
+#include <string>
+#include <vector>
+
+#include "TileDesc.hpp"
+
+/// Decides which queued tiles to paint together in one paintPartTile call.
+/// Paint time is modelled as a fixed overhead per call plus a cost per
+/// pixel, both fitted to the measured paints (a least squares fit, with
+/// older samples fading out, starting from a rough guess). A tile is
+/// added to the batch when painting the grown bounding rectangle is
+/// estimated to be faster than painting the tile on its own, so nearby
+/// tiles get merged even across rows, while scattered ones don't make us
+/// paint the area in between.
+/// Not thread-safe.
+class TileCoalescer
+{
+public:
+    TileCoalescer();
+
+    /// A paintPartTile call of the given number of pixels took elapsedMs.
+    void addSample(double pixels, double elapsedMs);
+
+    /// The estimated time, in ms, to paint the given number of pixels in one call.
+    double estimateMs(double pixels) const;
+
+    double getOverheadMs() const { return _overheadMs; }
+
+    /// The throughput of painting, in megapixels per second, excluding the overhead.
+    double getMegaPixelsPerSec() const;
+
+    /// Picks the tiles to paint with tiles[0]: those of the same part and
+    /// zoom, on the same grid, nearest first, for as long as it pays off.
+    /// Returns the indexes of the picked tiles, in order, without 0.
+    std::vector<size_t> coalesce(const std::vector<TileDesc>& tiles) const;
+
+    /// Formats as "paint_overhead_ms=<ms> paint_mps=<MP/s>".
+    std::string toString() const;
+
+private:
+    /// Recomputes the model from the sums.
+    void fit();
+
+private:
+    /// Weight of a new sample in the fit.
+    static constexpr double SampleWeight = 0.05;
+    /// The largest batch, in pixels, to bound the memory of the pixmap.
+    static constexpr double MaxBatchPixels = 4096 * 4096;
+
+    /// Weighted sums of the samples, in megapixels and ms.
+    double _sumW;
+    double _sumX;
+    double _sumY;
+    double _sumXX;
+    double _sumXY;
+
+    double _overheadMs;
+    double _msPerMegaPixel;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
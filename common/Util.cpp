@@ -126,73 +126,160 @@ namespace Util
         return std::getenv("DISPLAY") != nullptr;
     }
 
-    static const char *startsWith(const char *line, const char *tag)
+    void SMapsParser::parse(const char* data, size_t len)
     {
-        int len = strlen(tag);
-        if (!strncmp(line, tag, len))
+        const char* const end = data + len;
+        const char* pos = data;
+        const char* eol;
+        while ((eol = static_cast<const char*>(std::memchr(pos, '\n', end - pos))) != nullptr)
         {
-            while (!isdigit(line[len]) && line[len] != '\0')
-                ++len;
+            if (!_partialLine.empty())
+            {
+                _partialLine.append(pos, eol);
+                parseLine(_partialLine.data(), _partialLine.data() + _partialLine.size());
+                _partialLine.clear();
+            }
+            else
+            {
+                parseLine(pos, eol);
+            }
 
-            const auto str = std::string(line + len, strlen(line + len) - 1);
-            return line + len;
+            pos = eol + 1;
         }
 
-        return nullptr;
+        _partialLine.append(pos, end);
+    }
+
+    void SMapsParser::parseLine(const char* line, const char* end)
+    {
+        // The field lines look like "Private_Dirty:       123 kB".
+        // The mapping headers start with the (hex) address, never a capital.
+        if (line == end || *line < 'A' || *line > 'Z')
+            return;
+
+        const char* colon = static_cast<const char*>(std::memchr(line, ':', end - line));
+        if (colon == nullptr)
+            return;
+
+        struct Field
+        {
+            const char* _key;
+            size_t _keyLen;
+            size_t MemoryStats::*_member;
+        };
+
+        static const Field fields[] =
+        {
+            { "Rss", 3, &MemoryStats::_rssKb },
+            { "Pss", 3, &MemoryStats::_pssKb },
+            { "Shared_Clean", 12, &MemoryStats::_sharedCleanKb },
+            { "Shared_Dirty", 12, &MemoryStats::_sharedDirtyKb },
+            { "Private_Clean", 13, &MemoryStats::_privateCleanKb },
+            { "Private_Dirty", 13, &MemoryStats::_privateDirtyKb },
+            { "Swap", 4, &MemoryStats::_swapKb }
+        };
+
+        const size_t keyLen = colon - line;
+        for (const auto& field : fields)
+        {
+            if (field._keyLen == keyLen && std::memcmp(line, field._key, keyLen) == 0)
+            {
+                const char* pos = colon + 1;
+                while (pos != end && *pos == ' ')
+                    ++pos;
+
+                size_t value = 0;
+                for (; pos != end && *pos >= '0' && *pos <= '9'; ++pos)
+                    value = value * 10 + (*pos - '0');
+
+                _stats.*field._member += value;
+                return;
+            }
+        }
     }
 
-    std::pair<size_t, size_t> getPssAndDirtyFromSMaps(FILE* file)
+    MemoryStats getMemoryStats(FILE* file)
     {
-        size_t numPSSKb = 0;
-        size_t numDirtyKb = 0;
+        SMapsParser parser;
         if (file)
         {
+            // Bypass stdio; we only need the raw content.
             rewind(file);
-            char line[4096] = { 0 };
-            while (fgets(line, sizeof (line), file))
+            const int fd = fileno(file);
+            lseek(fd, 0, SEEK_SET);
+
+            char buffer[16 * 1024];
+            ssize_t len;
+            while ((len = read(fd, buffer, sizeof(buffer))) > 0)
             {
-                const char *value;
-                // Shared_Dirty is accounted for by forkit's RSS
-                if ((value = startsWith(line, "Private_Dirty:")))
-                {
-                    numDirtyKb += atoi(value);
-                }
-                else if ((value = startsWith(line, "Pss:")))
-                {
-                    numPSSKb += atoi(value);
-                }
+                parser.parse(buffer, len);
             }
         }
 
-        return std::make_pair(numPSSKb, numDirtyKb);
+        return parser.getStats();
     }
 
-    std::string getMemoryStats(FILE* file)
+    MemoryStats getMemoryStats(const Poco::Process::PID pid)
     {
-        const auto pssAndDirtyKb = getPssAndDirtyFromSMaps(file);
+        if (pid > 0)
+        {
+            const std::string path = "/proc/" + std::to_string(pid) + "/smaps";
+            FILE* fp = fopen((path + "_rollup").c_str(), "r");
+            if (fp == nullptr)
+                fp = fopen(path.c_str(), "r");
+
+            if (fp != nullptr)
+            {
+                const MemoryStats stats = getMemoryStats(fp);
+                fclose(fp);
+                return stats;
+            }
+        }
+
+        return MemoryStats();
+    }
+
+    std::string getMemoryStats(FILE* file, const size_t sharedBaselineKb)
+    {
+        const MemoryStats stats = getMemoryStats(file);
+        const size_t sharedKb = stats.getSharedKb();
         std::ostringstream oss;
         oss << "procmemstats: pid=" << getpid()
-            << " pss=" << pssAndDirtyKb.first
-            << " dirty=" << pssAndDirtyKb.second;
+            << " pss=" << stats._pssKb
+            << " dirty=" << stats._privateDirtyKb
+            << " private=" << stats.getPrivateKb()
+            << " shared=" << sharedKb
+            << " swap=" << stats._swapKb
+            << " shared_lost=" << (sharedBaselineKb > sharedKb ? sharedBaselineKb - sharedKb : 0);
         LOG_TRC("Collected " << oss.str());
         return oss.str();
     }
 
     size_t getMemoryUsagePSS(const Poco::Process::PID pid)
     {
-        if (pid > 0)
+        return getMemoryStats(pid)._pssKb;
+    }
+
+    size_t getAvailableMemory()
+    {
+        size_t available = 0;
+        FILE* fp = fopen("/proc/meminfo", "r");
+        if (fp != nullptr)
         {
-            const auto cmd = "/proc/" + std::to_string(pid) + "/smaps";
-            FILE* fp = fopen(cmd.c_str(), "r");
-            if (fp != nullptr)
+            char line[4096] = { 0 };
+            while (fgets(line, sizeof (line), fp))
             {
-                const auto pss = getPssAndDirtyFromSMaps(fp).first;
-                fclose(fp);
-                return pss;
+                if (strncmp(line, "MemAvailable:", 13) == 0)
+                {
+                    available = strtoul(line + 13, nullptr, 10);
+                    break;
+                }
             }
+
+            fclose(fp);
         }
 
-        return 0;
+        return available;
     }
 
     size_t getMemoryUsageRSS(const Poco::Process::PID pid)
@@ -264,6 +351,10 @@ namespace Util
         {
             LOG_SYS("Cannot set thread name to " << s << ".");
         }
+        else
+        {
+            Log::setThreadName(s.c_str());
+        }
     }
 
     void getVersionInfo(std::string& version, std::string& hash)
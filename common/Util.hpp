@@ -85,15 +85,75 @@ namespace Util
         assert(!mtx.try_lock());
     }
 
+    /// The memory of a process, in KB, as summed up from /proc/<pid>/smaps.
+    struct MemoryStats
+    {
+        MemoryStats() :
+            _rssKb(0),
+            _pssKb(0),
+            _sharedCleanKb(0),
+            _sharedDirtyKb(0),
+            _privateCleanKb(0),
+            _privateDirtyKb(0),
+            _swapKb(0)
+        {
+        }
+
+        /// Pages only we map; what we would free by exiting.
+        size_t getPrivateKb() const { return _privateCleanKb + _privateDirtyKb; }
+        /// Pages also mapped by other processes, such as those inherited from forkit.
+        size_t getSharedKb() const { return _sharedCleanKb + _sharedDirtyKb; }
+
+        size_t _rssKb;
+        size_t _pssKb;
+        size_t _sharedCleanKb;
+        size_t _sharedDirtyKb;
+        size_t _privateCleanKb;
+        size_t _privateDirtyKb;
+        size_t _swapKb;
+    };
+
+    /// Sums up the fields of smaps, or of smaps_rollup, which has the same
+    /// fields for the whole process in one go.
+    /// Takes the content a chunk at a time, as read, and scans it in place,
+    /// only keeping the line that straddles two chunks.
+    class SMapsParser
+    {
+    public:
+        void parse(const char* data, size_t len);
+
+        /// The totals of the lines seen so far.
+        const MemoryStats& getStats() const { return _stats; }
+
+    private:
+        void parseLine(const char* line, const char* end);
+
+    private:
+        MemoryStats _stats;
+        std::string _partialLine;
+    };
+
+    /// Reads the memory stats from an open smaps or smaps_rollup file, from the start.
+    MemoryStats getMemoryStats(FILE* file);
+
+    /// Returns the memory stats of the process, preferring smaps_rollup, when available,
+    /// as it's much cheaper for the kernel to produce.
+    /// Works only when we have perms for /proc/pid/smaps.
+    MemoryStats getMemoryStats(const Poco::Process::PID pid);
+
     /// Returns the process PSS in KB (works only when we have perms for /proc/pid/smaps).
     size_t getMemoryUsagePSS(const Poco::Process::PID pid);
 
     /// Returns the process RSS in KB.
     size_t getMemoryUsageRSS(const Poco::Process::PID pid);
 
-    /// Returns the RSS and PSS of the current process in KB.
-    /// Example: "procmemstats: pid=123 rss=12400 pss=566"
-    std::string getMemoryStats(FILE* file);
+    /// Returns the memory available for new allocations system-wide in KB.
+    size_t getAvailableMemory();
+
+    /// Returns the memory stats of the current process in KB, with how much
+    /// of the memory shared at startup (sharedBaselineKb) has since been lost.
+    /// Example: "procmemstats: pid=123 pss=566 dirty=320 private=410 shared=9800 swap=0 shared_lost=120"
+    std::string getMemoryStats(FILE* file, size_t sharedBaselineKb);
 
     std::string replace(const std::string& s, const std::string& a, const std::string& b);
 
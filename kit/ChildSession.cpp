@@ -11,6 +11,8 @@
 
 #include "ChildSession.hpp"
 
+#include <algorithm>
+#include <fstream>
 #include <sstream>
 
 #include <Poco/JSON/Object.h>
@@ -19,6 +21,7 @@
 #include <Poco/StringTokenizer.h>
 #include <Poco/URI.h>
 
+#include "Command.hpp"
 #include "common/FileUtil.hpp"
 #include "KitHelper.hpp"
 #include "Log.hpp"
@@ -76,6 +79,16 @@ void ChildSession::disconnect()
 bool ChildSession::_handleInput(const char *buffer, int length)
 {
     LOG_TRC(getName() + ": handling [" << getAbbreviatedMessage(buffer, length) << "].");
+
+    // Input is most of the traffic, parse it without copying the tokens.
+    const LOOLProtocol::TokenSpans spans(buffer, length);
+    const Command command = getCommand(spans[0]);
+    if (_isDocLoaded && (command == Command::Key || command == Command::Mouse))
+    {
+        updateLastActivityTime();
+        return (command == Command::Key ? keyEvent(buffer, length, spans) : mouseEvent(buffer, length, spans));
+    }
+
     const std::string firstLine = getFirstLine(buffer, length);
     const auto tokens = LOOLProtocol::tokenize(firstLine.data(), firstLine.size());
 
@@ -85,7 +98,7 @@ bool ChildSession::_handleInput(const char *buffer, int length)
         updateLastActivityTime();
     }
 
-    if (tokens.size() > 0 && tokens[0] == "useractive" && getLOKitDocument() != nullptr)
+    if (command == Command::UserActive && getLOKitDocument() != nullptr)
     {
         LOG_DBG("Handling message after inactivity of " << getInactivityMS() << "ms.");
         setIsActive(true);
@@ -146,36 +159,39 @@ bool ChildSession::_handleInput(const char *buffer, int length)
         LOG_TRC("Finished replaying messages.");
     }
 
-    if (tokens[0] == "dummymsg")
-    {
-        // Just to update the activity of a view-only client.
-        return true;
-    }
-    else if (tokens[0] == "commandvalues")
-    {
-        return getCommandValues(buffer, length, tokens);
-    }
-    else if (tokens[0] == "load")
+    switch (command)
     {
-        if (_isDocLoaded)
-        {
-            sendTextFrame("error: cmd=load kind=docalreadyloaded");
-            return false;
-        }
+        case Command::DummyMsg:
+            // Just to update the activity of a view-only client.
+            return true;
 
-        _isDocLoaded = loadDocument(buffer, length, tokens);
-        if (!_isDocLoaded)
-        {
-            sendTextFrame("error: cmd=load kind=faileddocloading");
-        }
+        case Command::CommandValues:
+            return getCommandValues(buffer, length, tokens);
+
+        case Command::Load:
+            if (_isDocLoaded)
+            {
+                sendTextFrame("error: cmd=load kind=docalreadyloaded");
+                return false;
+            }
 
-        return _isDocLoaded;
+            _isDocLoaded = loadDocument(buffer, length, tokens);
+            if (!_isDocLoaded)
+            {
+                sendTextFrame("error: cmd=load kind=faileddocloading");
+            }
+
+            return _isDocLoaded;
+
+        default:
+            break;
     }
-    else if (!_isDocLoaded)
+
+    if (!_isDocLoaded)
     {
         // Be forgiving to these messages while we load.
-        if (tokens[0] == "useractive" ||
-            tokens[0] == "userinactive")
+        if (command == Command::UserActive ||
+            command == Command::UserInactive)
         {
             return true;
         }
@@ -183,116 +199,79 @@ bool ChildSession::_handleInput(const char *buffer, int length)
         sendTextFrame("error: cmd=" + tokens[0] + " kind=nodocloaded");
         return false;
     }
-    else if (tokens[0] == "renderfont")
-    {
-        sendFontRendering(buffer, length, tokens);
-    }
-    else if (tokens[0] == "setclientpart")
-    {
-        return setClientPart(buffer, length, tokens);
-    }
-    else if (tokens[0] == "setpage")
-    {
-        return setPage(buffer, length, tokens);
-    }
-    else if (tokens[0] == "status")
-    {
-        return getStatus(buffer, length);
-    }
-    else if (tokens[0] == "tile" || tokens[0] == "tilecombine")
-    {
-        assert(false && "Tile traffic should go through the DocumentBroker-LoKit WS.");
-    }
-    else
+
+    switch (command)
     {
+        case Command::RenderFont:
+            sendFontRendering(buffer, length, tokens);
+            break;
+
+        case Command::SetClientPart:
+            return setClientPart(buffer, length, tokens);
+
+        case Command::SetPage:
+            return setPage(buffer, length, tokens);
+
+        case Command::Status:
+            return getStatus(buffer, length);
+
+        case Command::Tile:
+        case Command::TileCombine:
+            assert(false && "Tile traffic should go through the DocumentBroker-LoKit WS.");
+            break;
+
         // All other commands are such that they always require a LibreOfficeKitDocument session,
         // i.e. need to be handled in a child process.
-
-        assert(tokens[0] == "clientzoom" ||
-               tokens[0] == "clientvisiblearea" ||
-               tokens[0] == "downloadas" ||
-               tokens[0] == "getchildid" ||
-               tokens[0] == "gettextselection" ||
-               tokens[0] == "paste" ||
-               tokens[0] == "insertfile" ||
-               tokens[0] == "key" ||
-               tokens[0] == "mouse" ||
-               tokens[0] == "uno" ||
-               tokens[0] == "selecttext" ||
-               tokens[0] == "selectgraphic" ||
-               tokens[0] == "resetselection" ||
-               tokens[0] == "saveas" ||
-               tokens[0] == "useractive" ||
-               tokens[0] == "userinactive");
-
-        if (tokens[0] == "clientzoom")
-        {
+        case Command::ClientZoom:
             return clientZoom(buffer, length, tokens);
-        }
-        else if (tokens[0] == "clientvisiblearea")
-        {
+
+        case Command::ClientVisibleArea:
             return clientVisibleArea(buffer, length, tokens);
-        }
-        else if (tokens[0] == "downloadas")
-        {
+
+        case Command::DownloadAs:
             return downloadAs(buffer, length, tokens);
-        }
-        else if (tokens[0] == "getchildid")
-        {
+
+        case Command::GetChildId:
             return getChildId();
-        }
-        else if (tokens[0] == "gettextselection")
-        {
+
+        case Command::GetTextSelection:
             return getTextSelection(buffer, length, tokens);
-        }
-        else if (tokens[0] == "paste")
-        {
+
+        case Command::Paste:
             return paste(buffer, length, tokens);
-        }
-        else if (tokens[0] == "insertfile")
-        {
+
+        case Command::InsertFile:
             return insertFile(buffer, length, tokens);
-        }
-        else if (tokens[0] == "key")
-        {
-            return keyEvent(buffer, length, tokens);
-        }
-        else if (tokens[0] == "mouse")
-        {
-            return mouseEvent(buffer, length, tokens);
-        }
-        else if (tokens[0] == "uno")
-        {
+
+        case Command::Uno:
             return unoCommand(buffer, length, tokens);
-        }
-        else if (tokens[0] == "selecttext")
-        {
+
+        case Command::SelectText:
             return selectText(buffer, length, tokens);
-        }
-        else if (tokens[0] == "selectgraphic")
-        {
+
+        case Command::SelectGraphic:
             return selectGraphic(buffer, length, tokens);
-        }
-        else if (tokens[0] == "resetselection")
-        {
+
+        case Command::ResetSelection:
             return resetSelection(buffer, length, tokens);
-        }
-        else if (tokens[0] == "saveas")
-        {
+
+        case Command::SaveAs:
             return saveAs(buffer, length, tokens);
-        }
-        else if (tokens[0] == "useractive")
-        {
+
+        case Command::Thumbnail:
+            return renderThumbnail(buffer, length, tokens);
+
+        case Command::UserActive:
             setIsActive(true);
-        }
-        else if (tokens[0] == "userinactive")
-        {
+            break;
+
+        case Command::UserInactive:
             setIsActive(false);
-        }
-        else
-        {
+            break;
+
+        default:
             assert(false && "Unknown command token.");
-        }
+            break;
     }
 
     return true;
@@ -545,6 +524,9 @@ bool ChildSession::clientZoom(const char* /*buffer*/, int /*length*/, const std:
     getLOKitDocument()->setView(_viewId);
 
     getLOKitDocument()->setClientZoom(tilePixelWidth, tilePixelHeight, tileTwipWidth, tileTwipHeight);
+    lock.unlock();
+
+    _docManager.onClientZoom(_viewId, tilePixelWidth, tilePixelHeight, tileTwipWidth, tileTwipHeight);
     return true;
 }
 
@@ -570,6 +552,9 @@ bool ChildSession::clientVisibleArea(const char* /*buffer*/, int /*length*/, con
     getLOKitDocument()->setView(_viewId);
 
     getLOKitDocument()->setClientVisibleArea(x, y, width, height);
+    lock.unlock();
+
+    _docManager.onClientVisibleArea(_viewId, x, y, width, height);
     return true;
 }
 
@@ -702,13 +687,14 @@ bool ChildSession::insertFile(const char* /*buffer*/, int /*length*/, const std:
     return true;
 }
 
-bool ChildSession::keyEvent(const char* /*buffer*/, int /*length*/, const std::vector<std::string>& tokens)
+bool ChildSession::keyEvent(const char* /*buffer*/, int /*length*/, const LOOLProtocol::TokenSpans& tokens)
 {
+    static const std::map<std::string, int> types =
+        {{"input", LOK_KEYEVENT_KEYINPUT}, {"up", LOK_KEYEVENT_KEYUP}};
+
     int type, charcode, keycode;
     if (tokens.size() != 4 ||
-        !getTokenKeyword(tokens[1], "type",
-                         {{"input", LOK_KEYEVENT_KEYINPUT}, {"up", LOK_KEYEVENT_KEYUP}},
-                         type) ||
+        !getTokenKeyword(tokens[1], "type", types, type) ||
         !getTokenInteger(tokens[2], "char", charcode) ||
         !getTokenInteger(tokens[3], "key", keycode))
     {
@@ -741,8 +727,13 @@ bool ChildSession::keyEvent(const char* /*buffer*/, int /*length*/, const std::v
     return true;
 }
 
-bool ChildSession::mouseEvent(const char* /*buffer*/, int /*length*/, const std::vector<std::string>& tokens)
+bool ChildSession::mouseEvent(const char* /*buffer*/, int /*length*/, const LOOLProtocol::TokenSpans& tokens)
 {
+    static const std::map<std::string, int> types =
+        {{"buttondown", LOK_MOUSEEVENT_MOUSEBUTTONDOWN},
+         {"buttonup", LOK_MOUSEEVENT_MOUSEBUTTONUP},
+         {"move", LOK_MOUSEEVENT_MOUSEMOVE}};
+
     int type, x, y, count;
     bool success = true;
 
@@ -751,11 +742,7 @@ bool ChildSession::mouseEvent(const char* /*buffer*/, int /*length*/, const std:
     int modifier = 0;
 
     if (tokens.size() < 5 ||
-        !getTokenKeyword(tokens[1], "type",
-                         {{"buttondown", LOK_MOUSEEVENT_MOUSEBUTTONDOWN},
-                          {"buttonup", LOK_MOUSEEVENT_MOUSEBUTTONUP},
-                          {"move", LOK_MOUSEEVENT_MOUSEMOVE}},
-                         type) ||
+        !getTokenKeyword(tokens[1], "type", types, type) ||
         !getTokenInteger(tokens[2], "x", x) ||
         !getTokenInteger(tokens[3], "y", y) ||
         !getTokenInteger(tokens[4], "count", count))
@@ -926,6 +913,114 @@ bool ChildSession::saveAs(const char* /*buffer*/, int /*length*/, const std::vec
     return true;
 }
 
+bool ChildSession::renderThumbnail(const char* /*buffer*/, int /*length*/, const std::vector<std::string>& tokens)
+{
+    std::string url;
+    int part = 0;
+    int width = 0;
+    int height = 0;
+    if (tokens.size() < 5 ||
+        !getTokenString(tokens[1], "url", url) ||
+        !getTokenInteger(tokens[2], "part", part) ||
+        !getTokenInteger(tokens[3], "width", width) ||
+        !getTokenInteger(tokens[4], "height", height) ||
+        part < 0 || width <= 0 || height <= 0 ||
+        width > MAX_THUMBNAIL_SIZE || height > MAX_THUMBNAIL_SIZE)
+    {
+        sendTextFrame("error: cmd=thumbnail kind=syntax");
+        return false;
+    }
+
+    std::string decodedUrl;
+    URI::decode(url, decodedUrl);
+    const std::string path = URI(decodedUrl).getPath();
+
+    std::vector<unsigned char> pixmap;
+    int pixelWidth = 0;
+    int pixelHeight = 0;
+    LibreOfficeKitTileMode mode = LOK_TILEMODE_RGBA;
+    {
+        std::unique_lock<std::mutex> lock(_docManager.getDocumentMutex());
+
+        getLOKitDocument()->setView(_viewId);
+
+        // Text documents are a single part, we render the requested page of it.
+        int renderPart = 0;
+        int x = 0;
+        int y = 0;
+        long docWidth = 0;
+        long docHeight = 0;
+        if (getLOKitDocument()->getDocumentType() == LOK_DOCTYPE_TEXT)
+        {
+            char* rectangles = getLOKitDocument()->getPartPageRectangles();
+            StringTokenizer pages(rectangles ? rectangles : "", ";",
+                                  StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+            std::free(rectangles);
+            if (part < static_cast<int>(pages.count()))
+            {
+                StringTokenizer rect(pages[part], ",", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+                if (rect.count() == 4)
+                {
+                    x = std::stoi(rect[0]);
+                    y = std::stoi(rect[1]);
+                    docWidth = std::stol(rect[2]);
+                    docHeight = std::stol(rect[3]);
+                }
+            }
+        }
+        else if (part < getLOKitDocument()->getParts())
+        {
+            renderPart = part;
+            getLOKitDocument()->setPart(part);
+            getLOKitDocument()->getDocumentSize(&docWidth, &docHeight);
+        }
+
+        if (docWidth <= 0 || docHeight <= 0)
+        {
+            LOG_WRN("No part " << part << " to render a thumbnail of.");
+            sendTextFrame("error: cmd=thumbnail kind=invalid");
+            // No file, so WSD reports the failure.
+            sendTextFrame("saveas: url=" + url);
+            return false;
+        }
+
+        // Fit in the requested size, keeping the aspect ratio.
+        const double scale = std::min(static_cast<double>(width) / docWidth,
+                                      static_cast<double>(height) / docHeight);
+        pixelWidth = std::max(1, static_cast<int>(docWidth * scale));
+        pixelHeight = std::max(1, static_cast<int>(docHeight * scale));
+
+        Timestamp timestamp;
+        pixmap.resize(4 * pixelWidth * pixelHeight);
+        getLOKitDocument()->paintPartTile(pixmap.data(), renderPart, pixelWidth, pixelHeight,
+                                          x, y, docWidth, docHeight);
+        mode = static_cast<LibreOfficeKitTileMode>(getLOKitDocument()->getTileMode());
+        LOG_TRC("Thumbnail of part " << part << " at " << pixelWidth << 'x' << pixelHeight <<
+                " rendered in " << (timestamp.elapsed()/1000.) << "ms");
+    }
+
+    std::vector<char> output;
+    if (!Png::encodeBufferToPNG(pixmap.data(), pixelWidth, pixelHeight, output, mode))
+    {
+        sendTextFrame("error: cmd=thumbnail kind=failure");
+        sendTextFrame("saveas: url=" + url);
+        return false;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(output.data(), output.size());
+    file.close();
+    if (!file)
+    {
+        LOG_ERR("Failed to write thumbnail to [" << path << "].");
+        FileUtil::removeFile(path);
+    }
+
+    // Delivered like a save-as, WSD checks that the file exists.
+    sendTextFrame("saveas: url=" + url);
+    return true;
+}
+
 bool ChildSession::setClientPart(const char* /*buffer*/, int /*length*/, const std::vector<std::string>& tokens)
 {
     int part;
@@ -991,12 +1086,16 @@ void ChildSession::rememberEventsForInactiveUser(const int type, const std::stri
              type == LOK_CALLBACK_VIEW_CURSOR_VISIBLE ||
              type == LOK_CALLBACK_VIEW_LOCK)
     {
-        auto lock(getLock());
-        Poco::JSON::Parser parser;
-
-        auto root = parser.parse(payload).extract<Poco::JSON::Object::Ptr>();
-        int viewId = root->getValue<int>("viewId");
-        _stateRecorder.recordViewEvent(viewId, type, payload);
+        int viewId = -1;
+        if (getJsonInteger(StringSpan(payload), "viewId", viewId))
+        {
+            auto lock(getLock());
+            _stateRecorder.recordViewEvent(viewId, type, payload);
+        }
+        else
+        {
+            LOG_ERR("No viewId in view callback [" << payload << "].");
+        }
     }
     else if (type == LOK_CALLBACK_STATE_CHANGED)
     {
@@ -56,6 +56,13 @@ public:
 
     virtual std::shared_ptr<TileQueue>& getTileQueue() = 0;
 
+    /// The view changed its zoom, as the size of a tile in pixels and twips.
+    virtual void onClientZoom(int viewId, int tilePixelWidth, int tilePixelHeight,
+                              int tileTwipWidth, int tileTwipHeight) = 0;
+
+    /// The view scrolled or resized to show the given area, in twips.
+    virtual void onClientVisibleArea(int viewId, int x, int y, int width, int height) = 0;
+
     virtual bool sendTextFrame(const std::string& message) = 0;
 };
 
@@ -118,6 +125,10 @@ public:
 
     void loKitCallback(const int type, const std::string& payload);
 
+    /// Disconnects without unloading our view, which is then
+    /// destroyed with the document.
+    void disconnectKeepingView() { Session::disconnect(); }
+
     bool sendTextFrame(const char* buffer, const int length) override
     {
         const auto msg = "client-" + getId() + ' ' + std::string(buffer, length);
@@ -142,13 +153,14 @@ private:
     bool getTextSelection(const char* buffer, int length, const std::vector<std::string>& tokens);
     bool paste(const char* buffer, int length, const std::vector<std::string>& tokens);
     bool insertFile(const char* buffer, int length, const std::vector<std::string>& tokens);
-    bool keyEvent(const char* buffer, int length, const std::vector<std::string>& tokens);
-    bool mouseEvent(const char* buffer, int length, const std::vector<std::string>& tokens);
+    bool keyEvent(const char* buffer, int length, const LOOLProtocol::TokenSpans& tokens);
+    bool mouseEvent(const char* buffer, int length, const LOOLProtocol::TokenSpans& tokens);
     bool unoCommand(const char* buffer, int length, const std::vector<std::string>& tokens);
     bool selectText(const char* buffer, int length, const std::vector<std::string>& tokens);
     bool selectGraphic(const char* buffer, int length, const std::vector<std::string>& tokens);
     bool resetSelection(const char* buffer, int length, const std::vector<std::string>& tokens);
     bool saveAs(const char* buffer, int length, const std::vector<std::string>& tokens);
+    bool renderThumbnail(const char* buffer, int length, const std::vector<std::string>& tokens);
     bool setClientPart(const char* buffer, int length, const std::vector<std::string>& tokens);
     bool setPage(const char* buffer, int length, const std::vector<std::string>& tokens);
 
@@ -13,12 +13,16 @@
 
 #include "config.h"
 
+#include <fcntl.h>
 #include <sys/capability.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -54,9 +58,18 @@ static bool NoCapsForKit = false;
 static bool DisplayVersion = false;
 static std::string UnitTestLibrary;
 static std::atomic<unsigned> ForkCounter(0);
+static std::string JailSkeleton;
 
 static std::map<Process::PID, std::string> childJails;
 
+/// Children forked but not yet ready, with when they were forked.
+static std::map<Process::PID, std::chrono::steady_clock::time_point> StartingChildren;
+/// Kits write their pid to this pipe once connected to WSD.
+static int ReadyPipe[2] = { -1, -1 };
+/// How many children may be starting at once. Starting
+/// is CPU-bound, so more than a core's worth just thrashes.
+static size_t MaxStartingChildren = 1;
+
 #ifndef KIT_IN_PROCESS
 int ClientPortNumber = DEFAULT_CLIENT_PORT_NUMBER;
 int MasterPortNumber = DEFAULT_MASTER_PORT_NUMBER;
@@ -103,8 +116,13 @@ public:
             const auto count = std::stoi(tokens[1]);
             if (count > 0)
             {
-                LOG_INF("Setting to spawn " << tokens[1] << " child" << (count == 1 ? "" : "ren") << " per request.");
-                ForkCounter = count;
+                // The count includes the children WSD is still waiting for,
+                // which it requests again when they are slow to come.
+                const size_t inFlight = ForkCounter + StartingChildren.size();
+                const size_t more = (static_cast<size_t>(count) > inFlight ? count - inFlight : 0);
+                LOG_INF("Requested to have " << tokens[1] << " child" << (count == 1 ? "" : "ren") <<
+                        " spawned, with " << inFlight << " in flight. Spawning " << more << " more.");
+                ForkCounter += more;
             }
             else
             {
@@ -195,6 +213,11 @@ static void cleanupChildren()
     int status;
     while ((exitedChildPid = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0)
     {
+        if (StartingChildren.erase(exitedChildPid) > 0)
+        {
+            LOG_WRN("Child " << exitedChildPid << " has exited before becoming ready.");
+        }
+
         const auto it = childJails.find(exitedChildPid);
         if (it != childJails.end())
         {
@@ -211,7 +234,48 @@ static void cleanupChildren()
     // Now delete the jails.
     for (const auto& path : jails)
     {
-        FileUtil::removeFile(path, true);
+        FileUtil::removeJail(path, JailSkeleton);
+    }
+}
+
+/// Forgets the children that became ready, or are taking too long to.
+static void updateStartingChildren()
+{
+    if (ReadyPipe[0] < 0)
+        return;
+
+    char buffer[1024];
+    std::string data;
+    ssize_t len;
+    while ((len = read(ReadyPipe[0], buffer, sizeof(buffer))) > 0)
+    {
+        data.append(buffer, len);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    StringTokenizer pids(data, "\n", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+    for (const auto& pid : pids)
+    {
+        const auto it = StartingChildren.find(std::atoi(pid.c_str()));
+        if (it != StartingChildren.end())
+        {
+            LOG_INF("Child " << it->first << " is ready, " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                        now - it->second).count() << " ms after forking.");
+            StartingChildren.erase(it);
+        }
+    }
+
+    for (auto it = StartingChildren.begin(); it != StartingChildren.end(); )
+    {
+        if (now - it->second > std::chrono::milliseconds(CHILD_TIMEOUT_MS))
+        {
+            LOG_WRN("Child " << it->first << " is taking too long to become ready. Not waiting for it.");
+            it = StartingChildren.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
     }
 }
 
@@ -223,6 +287,7 @@ static int createLibreOfficeKit(const std::string& childRoot,
 {
     LOG_DBG("Forking a loolkit process.");
 
+    const auto spawnTime = std::chrono::steady_clock::now();
     const Process::PID pid = fork();
     if (!pid)
     {
@@ -230,6 +295,8 @@ static int createLibreOfficeKit(const std::string& childRoot,
 
         // Close the pipe from loolwsd
         close(0);
+        if (ReadyPipe[0] >= 0)
+            close(ReadyPipe[0]);
 
 #ifndef KIT_IN_PROCESS
         UnitKit::get().postFork();
@@ -248,9 +315,11 @@ static int createLibreOfficeKit(const std::string& childRoot,
         }
 
 #ifndef KIT_IN_PROCESS
-        lokit_main(childRoot, sysTemplate, loTemplate, loSubPath, NoCapsForKit, queryVersion, DisplayVersion);
+        lokit_main(childRoot, sysTemplate, loTemplate, loSubPath, JailSkeleton, spawnTime, ReadyPipe[1],
+                   NoCapsForKit, queryVersion, DisplayVersion);
 #else
-        lokit_main(childRoot, sysTemplate, loTemplate, loSubPath, true, queryVersion, DisplayVersion);
+        lokit_main(childRoot, sysTemplate, loTemplate, loSubPath, JailSkeleton, spawnTime, ReadyPipe[1],
+                   true, queryVersion, DisplayVersion);
 #endif
     }
     else
@@ -264,6 +333,8 @@ static int createLibreOfficeKit(const std::string& childRoot,
         {
             LOG_INF("Forked kit [" << pid << "].");
             childJails[pid] = childRoot + std::to_string(pid);
+            if (ReadyPipe[1] >= 0)
+                StartingChildren[pid] = spawnTime;
         }
 
 #ifndef KIT_IN_PROCESS
@@ -281,6 +352,7 @@ void forkLibreOfficeKit(const std::string& childRoot,
                         int limit)
 {
     // Cleanup first, to reduce disk load.
+    updateStartingChildren();
     cleanupChildren();
 
 #ifndef KIT_IN_PROCESS
@@ -290,21 +362,52 @@ void forkLibreOfficeKit(const std::string& childRoot,
         ForkCounter = limit;
 #endif
 
+    // How many we deferred when we last logged it.
+    static size_t LastDeferred = 0;
+
     if (ForkCounter > 0)
     {
-        // Create as many as requested.
-        const size_t count = ForkCounter;
-        LOG_INF("Spawning " << count << " new child" << (count == 1 ? "." : "ren."));
+        // Create as many as requested, but only start so many at once.
+        // The rest are left for when those are ready.
+        size_t count = ForkCounter;
+        if (ReadyPipe[0] >= 0)
+        {
+            const size_t starting = StartingChildren.size();
+            count = std::min(count, MaxStartingChildren > starting ? MaxStartingChildren - starting : 0);
+        }
+
+        const size_t deferred = ForkCounter - count;
+        if (deferred != LastDeferred && deferred > 0)
+        {
+            LOG_DBG("Have " << StartingChildren.size() << " children starting, deferring " <<
+                    deferred << " more.");
+        }
+
+        LastDeferred = deferred;
+
+        if (count > 0)
+        {
+            LOG_INF("Spawning " << count << " new child" << (count == 1 ? "." : "ren."));
+        }
+
         const size_t retry = count * 2;
-        for (size_t i = 0; ForkCounter > 0 && i < retry; ++i)
+        for (size_t i = 0; count > 0 && i < retry; ++i)
         {
-            if (ForkCounter-- <= 0 || createLibreOfficeKit(childRoot, sysTemplate, loTemplate, loSubPath) < 0)
+            if (createLibreOfficeKit(childRoot, sysTemplate, loTemplate, loSubPath) < 0)
             {
                 LOG_ERR("Failed to create a kit process.");
-                ++ForkCounter;
+            }
+            else
+            {
+                --count;
+                --ForkCounter;
             }
         }
     }
+    else
+    {
+        LastDeferred = 0;
+    }
 }
 
 #ifndef KIT_IN_PROCESS
@@ -314,6 +417,7 @@ static void printArgumentHelp()
     std::cout << "  Single-threaded process that spawns lok instances" << std::endl;
     std::cout << "  Note: Running this standalone is not possible. It is spawned by loolwsd" << std::endl;
     std::cout << "        and is controlled via a pipe." << std::endl;
+    std::cout << "  --fastjail   Bind-mount jails from a skeleton prepared once (needs loolmount)." << std::endl;
     std::cout << "" << std::endl;
 }
 
@@ -358,6 +462,7 @@ int main(int argc, char** argv)
     std::string loSubPath;
     std::string sysTemplate;
     std::string loTemplate;
+    bool fastJail = false;
 
 #if ENABLE_DEBUG
     static const char* clientPort = std::getenv("LOOL_TEST_CLIENT_PORT");
@@ -409,6 +514,10 @@ int main(int argc, char** argv)
             std::cout << "loolforkit version details: " << version << " - " << hash << std::endl;
             DisplayVersion = true;
         }
+        else if (std::strstr(cmd, "--fastjail") == cmd)
+        {
+            fastJail = true;
+        }
 #if ENABLE_DEBUG
         // this process has various privileges - don't run arbitrary code.
         else if (std::strstr(cmd, "--unitlib=") == cmd)
@@ -466,6 +575,22 @@ int main(int argc, char** argv)
 
     LOG_INF("Preinit stage OK.");
 
+    if (pipe2(ReadyPipe, O_CLOEXEC | O_NONBLOCK) == -1)
+    {
+        LOG_SYS("Failed to create the ready pipe. Children will be spawned without waiting.");
+        ReadyPipe[0] = ReadyPipe[1] = -1;
+    }
+
+    MaxStartingChildren = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    LOG_INF("Starting up to " << MaxStartingChildren << " children at once.");
+
+    if (fastJail && !NoCapsForKit)
+    {
+        JailSkeleton = createJailSkeleton(childRoot, sysTemplate, loTemplate, loSubPath);
+        if (JailSkeleton.empty())
+            LOG_WRN("Failed to prepare the jail skeleton. Jails will be linked file by file.");
+    }
+
     // We must have at least one child, more are created dynamically.
     // Ask this first child to send version information to master process
     Process::PID forKitPid = createLibreOfficeKit(childRoot, sysTemplate, loTemplate, loSubPath, true);
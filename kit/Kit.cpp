@@ -20,15 +20,19 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <climits>
 #include <condition_variable>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <thread>
+#include <vector>
 
 #define LOK_USE_UNSTABLE_API
 #include <LibreOfficeKit/LibreOfficeKitInit.h>
@@ -50,7 +54,9 @@
 #include <Poco/Util/Application.h>
 
 #include "ChildSession.hpp"
+#include "Command.hpp"
 #include "Common.hpp"
+#include "Histogram.hpp"
 #include "IoUtil.hpp"
 #include "KitHelper.hpp"
 #include "Kit.hpp"
@@ -60,10 +66,12 @@
 #include "Png.hpp"
 #include "Rectangle.hpp"
 #include "TileDesc.hpp"
+#include "TilePrefetcher.hpp"
 #include "Unit.hpp"
 #include "UserMessages.hpp"
 #include "Util.hpp"
 
+#include "common/FileUtil.hpp"
 #include "common/SigUtil.hpp"
 
 #ifdef FUZZER
@@ -102,6 +110,14 @@ class Document;
 static std::shared_ptr<Document> document;
 static LokHookFunction2* initFunction = nullptr;
 
+/// Exits right away, skipping the destructors, once the lines logged
+/// so far are written out, which the log writer thread won't do then.
+[[noreturn]] static void exitNow(const int code)
+{
+    Log::stopAsync();
+    std::_Exit(code);
+}
+
 namespace
 {
 #ifndef BUILDING_TESTS
@@ -161,7 +177,7 @@ namespace
                 {
                     LOG_ERR("Copying of '" << fpath << "' to " << newPath.toString() <<
                             " failed: " << exc.what() << ". Exiting.");
-                    std::_Exit(Application::EXIT_SOFTWARE);
+                    exitNow(Application::EXIT_SOFTWARE);
                 }
             }
             break;
@@ -227,7 +243,7 @@ namespace
         if (caps == nullptr)
         {
             LOG_SYS("cap_get_proc() failed.");
-            std::_Exit(1);
+            exitNow(1);
         }
 
         char *capText = cap_to_text(caps, nullptr);
@@ -238,13 +254,13 @@ namespace
             cap_set_flag(caps, CAP_PERMITTED, sizeof(cap_list)/sizeof(cap_list[0]), cap_list, CAP_CLEAR) == -1)
         {
             LOG_SYS("cap_set_flag() failed.");
-            std::_Exit(1);
+            exitNow(1);
         }
 
         if (cap_set_proc(caps) == -1)
         {
             LOG_SYS("cap_set_proc() failed.");
-            std::_Exit(1);
+            exitNow(1);
         }
 
         capText = cap_to_text(caps, nullptr);
@@ -272,9 +288,159 @@ namespace
             throw Exception("symlink() failed");
         }
     }
+
+    /// Links or copies the systemplate, the LO installation and
+    /// the network configuration files into the jail.
+    void populateJail(const Path& jailPath,
+                      const std::string& sysTemplate,
+                      const std::string& loTemplate,
+                      const std::string& loSubPath,
+                      bool allowBindMount)
+    {
+        // Create a symlink inside the jailPath so that the absolute pathname loTemplate, when
+        // interpreted inside a chroot at jailPath, points to loSubPath (relative to the chroot).
+        symlinkPathToJail(jailPath, loTemplate, loSubPath);
+
+        // Font paths can end up as realpaths so match that too.
+        char *resolved = realpath(loTemplate.c_str(), nullptr);
+        if (resolved)
+        {
+            if (strcmp(loTemplate.c_str(), resolved) != 0)
+                symlinkPathToJail(jailPath, std::string(resolved), loSubPath);
+            free (resolved);
+        }
+
+        Path jailLOInstallation(jailPath, loSubPath);
+        jailLOInstallation.makeDirectory();
+        File(jailLOInstallation).createDirectory();
+
+        // Copy (link) LO installation and other necessary files into it from the template.
+        bool bLoopMounted = false;
+        if (allowBindMount && std::getenv("LOOL_BIND_MOUNT"))
+        {
+            Path usrSrcPath(sysTemplate, "usr");
+            Path usrDestPath(jailPath, "usr");
+            File(usrDestPath).createDirectory();
+            std::string mountCommand =
+                std::string("loolmount ") +
+                usrSrcPath.toString() +
+                std::string(" ") +
+                usrDestPath.toString();
+            LOG_DBG("Initializing jail bind mount.");
+            bLoopMounted = !system(mountCommand.c_str());
+            LOG_DBG("Initialized jail bind mount.");
+        }
+        linkOrCopy(sysTemplate, jailPath,
+                   bLoopMounted ? LinkOrCopyType::NoUsr : LinkOrCopyType::All);
+        linkOrCopy(loTemplate, jailLOInstallation, LinkOrCopyType::LO);
+
+        // We need this because sometimes the hostname is not resolved
+        const auto networkFiles = {"/etc/host.conf", "/etc/hosts", "/etc/nsswitch.conf", "/etc/resolv.conf"};
+        for (const auto& filename : networkFiles)
+        {
+            const auto etcPath = Path(jailPath, filename).toString();
+            const File networkFile(filename);
+            if (networkFile.exists() && !File(etcPath).exists())
+            {
+                networkFile.copyTo(etcPath);
+            }
+        }
+    }
+
+    /// Sets up a jail from the prepared skeleton: directories are bind-mounted
+    /// read-only, other files are linked, and the private directories are
+    /// created empty. Much cheaper than linking the templates file by file.
+    bool instantiateJail(const std::string& skeleton, const Path& jailPath)
+    {
+        std::vector<std::string> entries;
+        File(skeleton).list(entries);
+        for (const auto& name : entries)
+        {
+            const std::string source = Path(skeleton, name).toString();
+            const std::string destination = Path(jailPath, name).toString();
+            if (FileUtil::isPrivateJailEntry(name))
+            {
+                File(destination).createDirectory();
+            }
+            else if (FileUtil::isMountedJailEntry(skeleton, name))
+            {
+                File(destination).createDirectory();
+                const std::string mountCommand = "loolmount " + source + ' ' + destination;
+                if (system(mountCommand.c_str()) != 0)
+                {
+                    LOG_ERR("Failed to bind mount [" << source << "] on [" << destination << "].");
+                    return false;
+                }
+            }
+            else if (link(source.c_str(), destination.c_str()) == -1)
+            {
+                LOG_SYS("link(\"" << source << "\", \"" << destination << "\") failed.");
+                return false;
+            }
+        }
+
+        return true;
+    }
 #endif
+
+    /// Set by removeFilesFunction() when it fails to remove a file.
+    bool removeFilesFailed = false;
+
+    int removeFilesFunction(const char *fpath, const struct stat*, int typeflag, struct FTW*)
+    {
+        // Keep the directories, which LibreOffice may still use.
+        if (typeflag != FTW_D && typeflag != FTW_DP && unlink(fpath) == -1 && errno != ENOENT)
+        {
+            LOG_SYS("unlink(\"" << fpath << "\") failed.");
+            removeFilesFailed = true;
+        }
+
+        return 0;
+    }
+
+    /// Removes the files under path, but not the directories.
+    /// Returns false if any file is left.
+    bool removeFilesUnder(const std::string& path)
+    {
+        removeFilesFailed = false;
+        if (nftw(path.c_str(), removeFilesFunction, 10, FTW_DEPTH | FTW_PHYS) == -1 && errno != ENOENT)
+        {
+            LOG_SYS("removeFilesUnder: nftw() failed for '" << path << "'");
+            return false;
+        }
+
+        return !removeFilesFailed;
+    }
 }
 
+#ifndef BUILDING_TESTS
+std::string createJailSkeleton(const std::string& childRoot,
+                               const std::string& sysTemplate,
+                               const std::string& loTemplate,
+                               const std::string& loSubPath)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const Path skeletonPath = Path::forDirectory(childRoot + "/" + FileUtil::JailSkeletonName);
+    try
+    {
+        // Anything left over from an earlier run may well be stale.
+        FileUtil::removeFile(skeletonPath.toString(), true);
+        File(skeletonPath).createDirectories();
+        populateJail(skeletonPath, sysTemplate, loTemplate, loSubPath, false);
+    }
+    catch (const std::exception& exc)
+    {
+        LOG_ERR("Failed to prepare jail skeleton [" << skeletonPath.toString() << "]: " << exc.what());
+        FileUtil::removeFile(skeletonPath.toString(), true);
+        return std::string();
+    }
+
+    const auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    LOG_INF("Prepared jail skeleton [" << skeletonPath.toString() << "] in " << elapsedMs.count() << " ms.");
+    return skeletonPath.toString();
+}
+#endif
+
 /// A quick & dirty cache of the last few PNGs
 /// and their hashes to avoid re-compression
 /// wherever possible.
@@ -425,6 +591,29 @@ public:
 };
 
 static FILE* ProcSMapsFile = nullptr;
+/// The memory we shared (mostly with forkit) right after forking,
+/// to tell how much of the preinit sharing we lose over time.
+static size_t PreinitSharedKb = 0;
+
+/// How many more documents we may host after the first one, when WSD enabled recycling.
+static unsigned MaxKitReuses = 0;
+/// How much our private memory may grow, in KB, since we got ready and still be reused.
+static size_t MaxReuseGrowthKb = 0;
+/// Our private memory, in KB, before hosting any document.
+static size_t ReadyPrivateKb = 0;
+static unsigned KitReuses = 0;
+/// The root of our jail as we see it, where what the documents we host
+/// leave behind is wiped before hosting another.
+static std::string JailRoot;
+/// The number of tiles to render ahead of the client while idle, 0 to disable.
+static size_t MaxPrefetchTiles = 0;
+/// How long the queue must be idle before prefetching, in ms.
+constexpr unsigned PrefetchIdleMs = 100;
+/// How long, in ms, we may render tiles back to back before letting
+/// the queued callbacks and input through, 0 to disable.
+static unsigned RenderBudgetMs = 0;
+/// How long, in ms, to hold back the tile invalidations to merge them, 0 to disable.
+static unsigned InvalidationWindowMs = 0;
 
 /// A document container.
 /// Owns LOKitDocument instance and connections.
@@ -459,11 +648,16 @@ public:
         _isDocPasswordProtected(false),
         _docPasswordType(PasswordType::ToView),
         _stop(false),
-        _isLoading(0)
+        _isLoading(0),
+        _prefetchViewId(-1),
+        _renderBudgetUsedMs(0),
+        _renderYields(0)
     {
         LOG_INF("Document ctor for url [" << _url << "] on child [" << _jailId << "].");
         assert(_loKit);
 
+        _prefetcher.setMaxTiles(MaxPrefetchTiles);
+
         _callbackThread.start(*this);
     }
 
@@ -477,6 +671,30 @@ public:
 
         _tileQueue->put("eof");
         _callbackThread.join();
+
+        // Only reached when recycled, otherwise we exit bluntly. The views
+        // weren't unloaded (see purgeSessions), so nothing may call us back
+        // while the document and its views are destroyed at once.
+        std::unique_lock<std::mutex> lock(_documentMutex);
+        if (_loKitDocument)
+        {
+            const int viewCount = _loKitDocument->getViewsCount();
+            std::vector<int> viewIds(std::max(viewCount, 0));
+            if (!viewIds.empty() && _loKitDocument->getViewIds(viewIds.data(), viewIds.size()))
+            {
+                for (const int viewId : viewIds)
+                {
+                    _loKitDocument->setView(viewId);
+                    _loKitDocument->registerCallback(nullptr, nullptr);
+                }
+            }
+
+            LOG_INF("Destroying document [" << _url << "] with " << viewCount << " views.");
+            _loKitDocument.reset();
+        }
+
+        if (_loKit)
+            _loKit->registerCallback(nullptr, nullptr);
     }
 
     const std::string& getUrl() const { return _url; }
@@ -546,8 +764,16 @@ public:
             num_sessions = _sessions.size();
             if (num_sessions == 0)
             {
-                LOG_INF("Document [" << _url << "] has no more views, exiting bluntly.");
-                std::_Exit(Application::EXIT_OK);
+                if (MaxKitReuses == 0)
+                {
+                    LOG_INF("Document [" << _url << "] has no more views, exiting bluntly.");
+                    exitNow(Application::EXIT_OK);
+                }
+
+                // We may be recycled (see recycleKit), so can't exit, and mustn't
+                // unload the views one by one either. They go with the document.
+                for (const auto& session : deadSessions)
+                    session->disconnectKeepingView();
             }
         }
 
@@ -591,26 +817,21 @@ public:
         LOG_INF("setDocumentPassword returned");
     }
 
-    void renderTile(const std::vector<std::string>& tokens, const std::shared_ptr<LOOLWebSocket>& ws)
+    void renderTile(const LOOLProtocol::TokenSpans& tokens, const std::shared_ptr<LOOLWebSocket>& ws)
+    {
+        renderTile(TileDesc::parse(tokens), ws);
+    }
+
+    void renderTile(TileDesc tile, const std::shared_ptr<LOOLWebSocket>& ws)
     {
         assert(ws && "Expected a non-null websocket.");
-        auto tile = TileDesc::parse(tokens);
 
-        // Send back the request with all optional parameters given in the request.
-        const auto tileMsg = tile.serialize("tile:");
-#if ENABLE_DEBUG
-        const std::string response = tileMsg + " renderid=" + Util::UniqueId() + "\n";
-#else
-        const std::string response = tileMsg + "\n";
-#endif
+        std::vector<unsigned char> pixmap;
+        pixmap.resize(4 * tile.getWidth() * tile.getHeight());
 
         std::vector<char> output;
-        output.reserve(response.size() + (4 * tile.getWidth() * tile.getHeight()));
-        output.resize(response.size());
-        std::memcpy(output.data(), response.data(), response.size());
-
-        std::vector<unsigned char> pixmap;
-        pixmap.resize(output.capacity());
+        output.reserve(TileHeaderRoom + pixmap.size());
+        output.resize(TileHeaderRoom);
 
         std::unique_lock<std::mutex> lock(_documentMutex);
         if (!_loKitDocument)
@@ -631,7 +852,10 @@ public:
                                       tile.getWidth(), tile.getHeight(),
                                       tile.getTilePosX(), tile.getTilePosY(),
                                       tile.getTileWidth(), tile.getTileHeight());
+        _prefetcher.rendered(tile);
         const auto elapsed = timestamp.elapsed();
+        tile.stamp(TileTrace::Painted);
+        tileRendered(area, elapsed / 1000.);
         LOG_TRC("paintTile at (" << tile.getPart() << ',' << tile.getTilePosX() << ',' << tile.getTilePosY() <<
                 ") " << "ver: " << tile.getVersion() << " rendered in " << (elapsed/1000.) <<
                 " ms (" << area / elapsed << " MP/s).");
@@ -645,6 +869,7 @@ public:
             return;
         }
 
+        Timestamp encodeTimestamp;
         if (!_pngCache.encodeBufferToPNG(pixmap.data(), tile.getWidth(), tile.getHeight(), output, mode, hash))
         {
             //FIXME: Return error.
@@ -653,11 +878,126 @@ public:
             return;
         }
 
-        LOG_TRC("Sending render-tile response (" + std::to_string(output.size()) + " bytes) for: " + response);
-        ws->sendFrame(output.data(), output.size(), WebSocket::FRAME_BINARY);
+        tile.stamp(TileTrace::Encoded);
+
+        // Send back the request with all optional parameters given in the request,
+        // and how long the tile took to paint and encode, for the metrics of WSD.
+        const auto tileMsg = tile.serialize("tile:") + getRenderTimes(elapsed, encodeTimestamp.elapsed());
+#if ENABLE_DEBUG
+        const std::string response = tileMsg + " renderid=" + Util::UniqueId() + "\n";
+#else
+        const std::string response = tileMsg + "\n";
+#endif
+        LOG_TRC("Sending render-tile response (" + std::to_string(output.size() - TileHeaderRoom) +
+                " bytes of PNG) for: " + response);
+        sendTiles(response, output, ws);
+    }
+
+    /// Room left at the start of the tile buffers, for the header of the
+    /// response to be written in front of the PNGs without moving them.
+    static constexpr size_t TileHeaderRoom = 4096;
+
+    /// Sends the header and the PNGs, encoded after TileHeaderRoom bytes, as one frame.
+    static void sendTiles(const std::string& header, std::vector<char>& output,
+                          const std::shared_ptr<LOOLWebSocket>& ws)
+    {
+        if (header.size() > TileHeaderRoom)
+        {
+            // Only with a great many tiles; then the move costs little in comparison.
+            output.erase(output.begin(), output.begin() + TileHeaderRoom);
+            output.insert(output.begin(), header.begin(), header.end());
+            ws->sendFrame(output.data(), output.size(), WebSocket::FRAME_BINARY);
+            return;
+        }
+
+        const size_t start = TileHeaderRoom - header.size();
+        std::memcpy(output.data() + start, header.data(), header.size());
+        ws->sendFrame(output.data() + start, output.size() - start, WebSocket::FRAME_BINARY);
+    }
+
+    /// Renders the next tile the client is likely to request, if any,
+    /// planning them first if needed.
+    /// Called when the queue is idle, one tile at a time, so that
+    /// real requests don't wait for more than one tile.
+    void prefetchTile()
+    {
+        if (_prefetcher.needsPlan())
+        {
+            std::unique_lock<std::mutex> lock(_documentMutex);
+            if (!_loKitDocument || _loKitDocument->getViewsCount() <= 0)
+                return;
+
+            if (_prefetchViewId >= 0)
+                _loKitDocument->setView(_prefetchViewId);
+
+            long docWidth = 0;
+            long docHeight = 0;
+            _loKitDocument->getDocumentSize(&docWidth, &docHeight);
+            const int part = _loKitDocument->getPart();
+
+            // Slides and drawing pages are flipped through, so have the next one ready.
+            const int docType = _loKitDocument->getDocumentType();
+            const bool nextPart = ((docType == LOK_DOCTYPE_PRESENTATION || docType == LOK_DOCTYPE_DRAWING) &&
+                                   part + 1 < _loKitDocument->getParts());
+
+            _prefetcher.plan(part, docWidth, docHeight, nextPart ? part + 1 : -1);
+        }
+
+        TileDesc tile(0, 1, 1, 0, 0, 1, 1, -1, 0, -1, false);
+        if (_prefetcher.next(tile))
+        {
+            LOG_TRC("Prefetching tile at (" << tile.getPart() << ',' << tile.getTilePosX() << ',' <<
+                    tile.getTilePosY() << ").");
+            renderTile(tile, _ws);
+        }
+    }
+
+    /// Formats the time, in microseconds, to paint and to encode the tiles of a
+    /// render, as appended to the tile and tilecombine responses.
+    static std::string getRenderTimes(const Timestamp::TimeDiff paintUs, const Timestamp::TimeDiff encodeUs)
+    {
+        return " paintus=" + std::to_string(paintUs) + " encodeus=" + std::to_string(encodeUs);
+    }
+
+    /// Accounts for a paintPartTile call, of one tile or several.
+    void tileRendered(const double pixels, const double elapsedMs)
+    {
+        _renderMs.add(elapsedMs);
+        _renderBudgetUsedMs += elapsedMs;
+        _tileQueue->addPaintSample(pixels, elapsedMs);
+    }
+
+    /// Once we rendered for longer than the budget without anything
+    /// else getting through, lets the queued callbacks and input go
+    /// before the rest of the tiles.
+    void yieldIfOverBudget()
+    {
+        if (RenderBudgetMs == 0 || _renderBudgetUsedMs < RenderBudgetMs)
+            return;
+
+        const size_t count = _tileQueue->yieldToNonTiles();
+        if (count > 0)
+        {
+            ++_renderYields;
+            LOG_TRC("Rendered for " << _renderBudgetUsedMs << " ms, letting " << count <<
+                    " messages ahead of the tiles.");
+        }
+
+        _renderBudgetUsedMs = 0;
     }
 
-    void renderCombinedTiles(const std::vector<std::string>& tokens, const std::shared_ptr<LOOLWebSocket>& ws)
+    /// How long tiles waited and took to render, reported to WSD with the memory stats.
+    std::string getRenderStats()
+    {
+        std::ostringstream oss;
+        oss << "renderstats: " << _tileQueue->getWaitHistogram().toString("wait")
+            << ' ' << _renderMs.toString("render")
+            << " yields=" << _renderYields
+            << ' ' << _tileQueue->getCoalescer().toString();
+        return oss.str();
+    }
+
+    void renderCombinedTiles(const LOOLProtocol::TokenSpans& tokens, const std::shared_ptr<LOOLWebSocket>& ws)
     {
         assert(ws && "Expected a non-null websocket.");
         auto tileCombined = TileCombined::parse(tokens);
@@ -671,6 +1011,7 @@ public:
         {
             Util::Rectangle rectangle(tile.getTilePosX(), tile.getTilePosY(),
                                       tileCombined.getTileWidth(), tileCombined.getTileHeight());
+            _prefetcher.rendered(tile);
 
             if (tileRecs.empty())
             {
@@ -711,14 +1052,22 @@ public:
                                       renderArea.getLeft(), renderArea.getTop(),
                                       renderArea.getWidth(), renderArea.getHeight());
         const auto elapsed = timestamp.elapsed();
+        for (auto& tile : tiles)
+        {
+            tile.stamp(TileTrace::Painted);
+        }
+
+        tileRendered(area, elapsed / 1000.);
         LOG_DBG("paintTile (combined) at (" << renderArea.getLeft() << ", " << renderArea.getTop() << "), (" <<
                 renderArea.getWidth() << ", " << renderArea.getHeight() << ") " <<
                 " rendered in " << (elapsed/1000.) << " ms (" << area / elapsed << " MP/s).");
         const auto mode = static_cast<LibreOfficeKitTileMode>(_loKitDocument->getTileMode());
 
         std::vector<char> output;
-        output.reserve(pixmapWidth * pixmapHeight * 4);
+        output.reserve(TileHeaderRoom + pixmapSize);
+        output.resize(TileHeaderRoom);
 
+        Timestamp encodeTimestamp;
         size_t tileIndex = 0;
         for (Util::Rectangle& tileRect : tileRecs)
         {
@@ -756,19 +1105,20 @@ public:
             tileIndex++;
         }
 
+        for (auto& tile : tiles)
+        {
+            tile.stamp(TileTrace::Encoded);
+        }
+
+        const auto renderTimes = getRenderTimes(elapsed, encodeTimestamp.elapsed());
 #if ENABLE_DEBUG
-        const auto tileMsg = tileCombined.serialize("tilecombine:") + " renderid=" + Util::UniqueId() + "\n";
+        const auto tileMsg = tileCombined.serialize("tilecombine:") + renderTimes + " renderid=" + Util::UniqueId() + "\n";
 #else
-        const auto tileMsg = tileCombined.serialize("tilecombine:") + "\n";
+        const auto tileMsg = tileCombined.serialize("tilecombine:") + renderTimes + "\n";
 #endif
         LOG_TRC("Sending back painted tiles for " << tileMsg);
 
-        std::vector<char> response;
-        response.resize(tileMsg.size() + output.size());
-        std::copy(tileMsg.begin(), tileMsg.end(), response.begin());
-        std::copy(output.begin(), output.end(), response.begin() + tileMsg.size());
-
-        ws->sendFrame(response.data(), response.size(), WebSocket::FRAME_BINARY);
+        sendTiles(tileMsg, output, ws);
     }
 
     bool sendTextFrame(const std::string& message) override
@@ -836,42 +1186,38 @@ public:
                 "] [" << payload << "].");
 
         // when we examine the content of the JSON
-        std::string targetViewId;
+        int targetViewId = -1;
 
         if (type == LOK_CALLBACK_INVALIDATE_VISIBLE_CURSOR ||
             type == LOK_CALLBACK_CELL_CURSOR)
         {
-            Poco::StringTokenizer tokens(payload, ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
             // Payload may be 'EMPTY'.
-            if (tokens.count() == 4)
+            int cursorX, cursorY, cursorWidth, cursorHeight;
+            if (LOOLProtocol::parseRectangle(LOOLProtocol::StringSpan(payload), cursorX, cursorY, cursorWidth, cursorHeight))
             {
-                auto cursorX = std::stoi(tokens[0]);
-                auto cursorY = std::stoi(tokens[1]);
-                auto cursorWidth = std::stoi(tokens[2]);
-                auto cursorHeight = std::stoi(tokens[3]);
-
                 tileQueue->updateCursorPosition(0, 0, cursorX, cursorY, cursorWidth, cursorHeight);
             }
         }
         else if (type == LOK_CALLBACK_INVALIDATE_VIEW_CURSOR ||
                  type == LOK_CALLBACK_CELL_VIEW_CURSOR)
         {
-            Poco::JSON::Parser parser;
-            const auto result = parser.parse(payload);
-            const auto& command = result.extract<Poco::JSON::Object::Ptr>();
-            targetViewId = command->get("viewId").toString();
-            auto part = command->get("part").toString();
-            auto text = command->get("rectangle").toString();
-            Poco::StringTokenizer tokens(text, ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
-            // Payload may be 'EMPTY'.
-            if (tokens.count() == 4)
+            // The cursors of the other views move with each key stroke,
+            // don't parse the whole JSON for the few members needed.
+            const LOOLProtocol::StringSpan json(payload);
+            if (!LOOLProtocol::getJsonInteger(json, "viewId", targetViewId))
             {
-                auto cursorX = std::stoi(tokens[0]);
-                auto cursorY = std::stoi(tokens[1]);
-                auto cursorWidth = std::stoi(tokens[2]);
-                auto cursorHeight = std::stoi(tokens[3]);
+                LOG_ERR("No viewId in view cursor callback [" << payload << "].");
+                return;
+            }
 
-                tileQueue->updateCursorPosition(std::stoi(targetViewId), std::stoi(part), cursorX, cursorY, cursorWidth, cursorHeight);
+            // Payload may be 'EMPTY'.
+            int part, cursorX, cursorY, cursorWidth, cursorHeight;
+            LOOLProtocol::StringSpan rectangle;
+            if (LOOLProtocol::getJsonInteger(json, "part", part) &&
+                LOOLProtocol::getJsonValue(json, "rectangle", rectangle) &&
+                LOOLProtocol::parseRectangle(rectangle, cursorX, cursorY, cursorWidth, cursorHeight))
+            {
+                tileQueue->updateCursorPosition(targetViewId, part, cursorX, cursorY, cursorWidth, cursorHeight);
             }
         }
 
@@ -886,7 +1232,7 @@ public:
                  type == LOK_CALLBACK_CELL_VIEW_CURSOR)
         {
             // these should go to all views but the one that that triggered it
-            tileQueue->put("callback except-" + targetViewId + ' ' + std::to_string(type) + ' ' + payload);
+            tileQueue->put("callback except-" + std::to_string(targetViewId) + ' ' + std::to_string(type) + ' ' + payload);
         }
         else
             tileQueue->put("callback " + std::to_string(descriptor->ViewId) + ' ' + std::to_string(type) + ' ' + payload);
@@ -979,7 +1325,7 @@ private:
             if (_sessions.empty())
             {
                 LOG_INF("Document [" << _url << "] has no more views, exiting bluntly.");
-                std::_Exit(Application::EXIT_OK);
+                exitNow(Application::EXIT_OK);
             }
 
             LOG_INF("Document [" << _url << "] has no more views, but has " <<
@@ -1033,6 +1379,19 @@ private:
         return _tileQueue;
     }
 
+    void onClientZoom(const int viewId, const int tilePixelWidth, const int tilePixelHeight,
+                      const int tileTwipWidth, const int tileTwipHeight) override
+    {
+        _prefetchViewId = viewId;
+        _prefetcher.setZoom(tilePixelWidth, tilePixelHeight, tileTwipWidth, tileTwipHeight);
+    }
+
+    void onClientVisibleArea(const int viewId, const int x, const int y, const int width, const int height) override
+    {
+        _prefetchViewId = viewId;
+        _prefetcher.setVisibleArea(x, y, width, height);
+    }
+
     /// Notify all views of viewId and their associated usernames
     void notifyViewInfo(const std::vector<int>& viewIds) override
     {
@@ -1356,23 +1715,39 @@ private:
         // Update memory stats every 5 seconds.
         const auto memStatsPeriodMs = 5000;
         auto lastMemStatsTime = std::chrono::steady_clock::now();
-        sendTextFrame(Util::getMemoryStats(ProcSMapsFile));
+        sendTextFrame(Util::getMemoryStats(ProcSMapsFile, PreinitSharedKb));
+        std::string lastRenderStats;
 
         try
         {
             while (!_stop && !TerminationFlag)
             {
-                const TileQueue::Payload input = _tileQueue->get(POLL_TIMEOUT_MS * 2);
+                // Once idle for a while, prefetch, checking for requests between tiles.
+                const unsigned timeoutMs = (_prefetcher.hasPending() ? 1 :
+                                            _prefetcher.needsPlan() ? PrefetchIdleMs : POLL_TIMEOUT_MS * 2);
+                const TileQueue::Payload input = _tileQueue->get(timeoutMs);
                 if (input.empty())
                 {
+                    _renderBudgetUsedMs = 0;
+
                     const auto duration = (std::chrono::steady_clock::now() - lastMemStatsTime);
                     const auto durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
                     if (durationMs > memStatsPeriodMs)
                     {
-                        sendTextFrame(Util::getMemoryStats(ProcSMapsFile));
+                        sendTextFrame(Util::getMemoryStats(ProcSMapsFile, PreinitSharedKb));
                         lastMemStatsTime = std::chrono::steady_clock::now();
+
+                        const std::string renderStats = getRenderStats();
+                        if (renderStats != lastRenderStats)
+                        {
+                            sendTextFrame(renderStats);
+                            lastRenderStats = renderStats;
+                        }
                     }
 
+                    if (!_stop && !TerminationFlag)
+                        prefetchTile();
+
                     continue;
                 }
 
@@ -1384,27 +1759,43 @@ private:
                     break;
                 }
 
-                const auto tokens = LOOLProtocol::tokenize(input.data(), input.size());
+                // Spans over the input, tiles and callbacks are not worth copying.
+                const LOOLProtocol::TokenSpans tokens(input.data(), input.size());
+                const LOOLProtocol::Command command = LOOLProtocol::getCommand(tokens[0]);
 
-                if (tokens[0] == "eof")
+                if (command == LOOLProtocol::Command::Eof)
                 {
                     LOG_INF("Received EOF. Finishing.");
                     break;
                 }
 
-                if (tokens[0] == "tile")
+                if (command != LOOLProtocol::Command::Callback)
+                {
+                    // Real work comes first, prefetch again when idle.
+                    _prefetcher.cancel();
+                }
+
+                if (command != LOOLProtocol::Command::Tile && command != LOOLProtocol::Command::TileCombine)
+                {
+                    // Something other than tiles got through, start a new budget.
+                    _renderBudgetUsedMs = 0;
+                }
+
+                if (command == LOOLProtocol::Command::Tile)
                 {
                     renderTile(tokens, _ws);
+                    yieldIfOverBudget();
                 }
-                else if (tokens[0] == "tilecombine")
+                else if (command == LOOLProtocol::Command::TileCombine)
                 {
                     renderCombinedTiles(tokens, _ws);
+                    yieldIfOverBudget();
                 }
                 else if (LOOLProtocol::getFirstToken(tokens[0], '-') == "child")
                 {
-                    forwardToChild(tokens[0], input);
+                    forwardToChild(tokens[0].toString(), input);
                 }
-                else if (tokens[0] == "callback")
+                else if (command == LOOLProtocol::Command::Callback)
                 {
                     if (tokens.size() >= 3)
                     {
@@ -1412,26 +1803,36 @@ private:
                         int viewId = -1;
                         int exceptViewId = -1;
 
-                        const std::string& target = tokens[1];
+                        bool valid = true;
+                        const LOOLProtocol::StringSpan& target = tokens[1];
                         if (target == "all")
                         {
                             broadcast = true;
                         }
-                        else if (LOOLProtocol::matchPrefix("except-", target))
+                        else if (target.startsWith("except-"))
                         {
-                            exceptViewId = std::stoi(target.substr(7));
+                            valid = LOOLProtocol::stringToInteger(target.substr(7), exceptViewId);
                             broadcast = true;
                         }
                         else
                         {
-                            viewId = std::stoi(target);
+                            valid = LOOLProtocol::stringToInteger(target, viewId);
+                        }
+
+                        int type = -1;
+                        if (!valid || !LOOLProtocol::stringToInteger(tokens[2], type))
+                        {
+                            LOG_ERR("Invalid callback message: [" << LOOLProtocol::getAbbreviatedMessage(input) << "].");
+                            continue;
                         }
 
-                        const int type = std::stoi(tokens[2]);
+                        // payload is the rest of the message, after the delimiter
+                        const char* end = input.data() + input.size();
+                        const char* offset = std::min(tokens[2].data() + tokens[2].size() + 1, end);
+                        const std::string payload(offset, end);
 
-                        // payload is the rest of the message
-                        const auto offset = tokens[0].length() + tokens[1].length() + tokens[2].length() + 3; // + delims
-                        const std::string payload(input.data() + offset, input.size() - offset);
+                        if (type == LOK_CALLBACK_INVALIDATE_TILES)
+                            invalidatePrefetched(payload);
 
                         // Forward the callback to the same view, demultiplexing is done by the LibreOffice core.
                         // TODO: replace with a map to be faster.
@@ -1486,6 +1887,29 @@ private:
         LOG_DBG("Thread finished.");
     }
 
+    /// Forgets the prefetched tiles in the area of the
+    /// invalidatetiles payload: "EMPTY[, <part>]" or "<x>, <y>, <width>, <height>[, <part>]".
+    void invalidatePrefetched(const std::string& payload)
+    {
+        StringTokenizer tokens(payload, ",", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+        try
+        {
+            if (tokens.count() == 4 || tokens.count() == 5)
+            {
+                const int part = (tokens.count() == 5 ? std::stoi(tokens[4]) : -1);
+                _prefetcher.invalidate(part, std::stoi(tokens[0]), std::stoi(tokens[1]),
+                                       std::stoi(tokens[2]), std::stoi(tokens[3]));
+                return;
+            }
+        }
+        catch (const std::exception&)
+        {
+            LOG_WRN("Invalid invalidatetiles payload [" << payload << "].");
+        }
+
+        _prefetcher.invalidateAll();
+    }
+
     /// Return access to the lok::Document instance.
     std::shared_ptr<lok::Document> getLOKitDocument() override
     {
@@ -1540,6 +1964,19 @@ private:
 
     /// For showing disconnected user info in the doc repair dialog.
     std::map<int, UserInfo> _sessionUserInfo;
+
+    /// Renders the tiles around the viewport of _prefetchViewId while idle.
+    /// Only used by the callback thread.
+    TilePrefetcher _prefetcher;
+    int _prefetchViewId;
+
+    /// How long paintPartTile took, in ms. Only used by the callback thread.
+    Histogram _renderMs;
+    /// How long we rendered since something other than tiles got through.
+    double _renderBudgetUsedMs;
+    /// How many times we let callbacks and input ahead of tiles.
+    unsigned _renderYields;
+
     Poco::Thread _callbackThread;
 };
 
@@ -1549,10 +1986,69 @@ void documentViewCallback(const int type, const char* payload, void* data)
 }
 
 #ifndef BUILDING_TESTS
+/// Unloads our document once it has no more sessions, so that WSD can
+/// hand us another one rather than spawn a new Kit for it.
+/// Only if we haven't been reused too often, didn't grow too much,
+/// and nothing of the old document is left behind for the next one.
+/// Returns false if we should exit instead.
+static bool recycleKit(const std::shared_ptr<TileQueue>& queue, const std::shared_ptr<LOOLWebSocket>& ws)
+{
+    if (KitReuses >= MaxKitReuses)
+    {
+        LOG_INF("Hosted " << KitReuses + 1 << " documents already, not recycling.");
+        return false;
+    }
+
+    // Nothing should hold on to the document once its sessions are gone.
+    std::weak_ptr<Document> oldDocument = document;
+    document.reset();
+    if (!oldDocument.expired())
+    {
+        LOG_WRN("Document still referenced after unloading, not recycling.");
+        return false;
+    }
+
+    // The callback thread is gone; anything left queued was for the old document.
+    queue->clear();
+
+    // Nor anything it left in the jail: the document, the temporary files,
+    // and the backups in the profile.
+    const std::string docsRoot = JailRoot + JAILED_DOCUMENT_ROOT;
+    FileUtil::removeFile(docsRoot, true);
+    if (File(docsRoot).exists() ||
+        !removeFilesUnder(JailRoot + "/tmp") ||
+        !removeFilesUnder(JailRoot + "/user/backup"))
+    {
+        LOG_ERR("Failed to wipe what the document left in [" << JailRoot << "], not recycling.");
+        return false;
+    }
+
+    if (ProcSMapsFile != nullptr)
+    {
+        const size_t privateKb = Util::getMemoryStats(ProcSMapsFile).getPrivateKb();
+        if (privateKb > ReadyPrivateKb + MaxReuseGrowthKb)
+        {
+            LOG_INF("Private memory grew from " << ReadyPrivateKb << " KB to " << privateKb <<
+                    " KB, not recycling.");
+            return false;
+        }
+    }
+
+    ++KitReuses;
+    LOG_INF("Recycled for another document (reuse " << KitReuses << " of " << MaxKitReuses << ").");
+
+    const std::string message = "recyclable: reuses=" + std::to_string(KitReuses);
+    ws->sendFrame(message.data(), message.size());
+    return true;
+}
+
 void lokit_main(const std::string& childRoot,
                 const std::string& sysTemplate,
                 const std::string& loTemplate,
                 const std::string& loSubPath,
+                const std::string& jailSkeleton,
+                std::chrono::steady_clock::time_point spawnTime,
+                int readyFd,
                 bool noCapabilities,
                 bool queryVersion,
                 bool displayVersion)
@@ -1576,6 +2072,13 @@ void lokit_main(const std::string& childRoot,
     }
 
     Log::initialize("kit", logLevel ? logLevel : "", logColor != nullptr, logToFile, logProperties);
+    // Only now, as the writer thread wouldn't survive the fork.
+    const char* logAsync = std::getenv("LOOL_LOGASYNC");
+    if (logAsync)
+    {
+        Log::startAsync(std::max(1, std::atoi(logAsync)));
+    }
+
     Util::rng::reseed();
 
     assert(!childRoot.empty());
@@ -1590,6 +2093,7 @@ void lokit_main(const std::string& childRoot,
     static const std::string jailId = pid;
 
     LOG_DBG("Process started.");
+    const auto startTime = std::chrono::steady_clock::now();
 
     std::string userdir_url;
     std::string instdir_path;
@@ -1611,56 +2115,19 @@ void lokit_main(const std::string& childRoot,
             userdir_url = "file:///user";
             instdir_path = "/" + loSubPath + "/program";
 
-            // Create a symlink inside the jailPath so that the absolute pathname loTemplate, when
-            // interpreted inside a chroot at jailPath, points to loSubPath (relative to the chroot).
-            symlinkPathToJail(jailPath, loTemplate, loSubPath);
-
-            // Font paths can end up as realpaths so match that too.
-            char *resolved = realpath(loTemplate.c_str(), nullptr);
-            if (resolved)
+            if (jailSkeleton.empty())
             {
-                if (strcmp(loTemplate.c_str(), resolved) != 0)
-                    symlinkPathToJail(jailPath, std::string(resolved), loSubPath);
-                free (resolved);
+                populateJail(jailPath, sysTemplate, loTemplate, loSubPath, true);
             }
-
-            Path jailLOInstallation(jailPath, loSubPath);
-            jailLOInstallation.makeDirectory();
-            File(jailLOInstallation).createDirectory();
-
-            // Copy (link) LO installation and other necessary files into it from the template.
-            bool bLoopMounted = false;
-            if (std::getenv("LOOL_BIND_MOUNT"))
-            {
-                Path usrSrcPath(sysTemplate, "usr");
-                Path usrDestPath(jailPath, "usr");
-                File(usrDestPath).createDirectory();
-                std::string mountCommand =
-                    std::string("loolmount ") +
-                    usrSrcPath.toString() +
-                    std::string(" ") +
-                    usrDestPath.toString();
-                LOG_DBG("Initializing jail bind mount.");
-                bLoopMounted = !system(mountCommand.c_str());
-                LOG_DBG("Initialized jail bind mount.");
-            }
-            linkOrCopy(sysTemplate, jailPath,
-                       bLoopMounted ? LinkOrCopyType::NoUsr : LinkOrCopyType::All);
-            linkOrCopy(loTemplate, jailLOInstallation, LinkOrCopyType::LO);
-
-            // We need this because sometimes the hostname is not resolved
-            const auto networkFiles = {"/etc/host.conf", "/etc/hosts", "/etc/nsswitch.conf", "/etc/resolv.conf"};
-            for (const auto& filename : networkFiles)
+            else if (!instantiateJail(jailSkeleton, jailPath))
             {
-                const auto etcPath = Path(jailPath, filename).toString();
-                const File networkFile(filename);
-                if (networkFile.exists() && !File(etcPath).exists())
-                {
-                    networkFile.copyTo(etcPath);
-                }
+                LOG_FTL("Failed to set up jail from skeleton [" << jailSkeleton << "]. Exiting.");
+                exitNow(Application::EXIT_SOFTWARE);
             }
 
-            LOG_DBG("Initialized jail files.");
+            LOG_DBG("Initialized jail files in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - startTime).count() << " ms" <<
+                    (jailSkeleton.empty() ? "." : " from skeleton."));
 
             // Create the urandom and random devices
             File(Path(jailPath, "/dev")).createDirectory();
@@ -1678,23 +2145,32 @@ void lokit_main(const std::string& childRoot,
                 LOG_SYS("mknod(" << jailPath.toString() << "/dev/urandom) failed.");
             }
 
-            ProcSMapsFile = fopen("/proc/self/smaps", "r");
+            // The rollup is much cheaper to read, when the kernel has it.
+            ProcSMapsFile = fopen("/proc/self/smaps_rollup", "r");
+            if (ProcSMapsFile == nullptr)
+                ProcSMapsFile = fopen("/proc/self/smaps", "r");
+
             if (ProcSMapsFile == nullptr)
             {
                 LOG_SYS("Failed to symlink /proc/self/smaps. Memory stats will be missing.");
             }
+            else
+            {
+                PreinitSharedKb = Util::getMemoryStats(ProcSMapsFile).getSharedKb();
+                LOG_DBG("Sharing " << PreinitSharedKb << " KB after forking.");
+            }
 
             LOG_INF("chroot(\"" << jailPath.toString() << "\")");
             if (chroot(jailPath.toString().c_str()) == -1)
             {
                 LOG_SYS("chroot(\"" << jailPath.toString() << "\") failed.");
-                std::_Exit(Application::EXIT_SOFTWARE);
+                exitNow(Application::EXIT_SOFTWARE);
             }
 
             if (chdir("/") == -1)
             {
                 LOG_SYS("chdir(\"/\") in jail failed.");
-                std::_Exit(Application::EXIT_SOFTWARE);
+                exitNow(Application::EXIT_SOFTWARE);
             }
 
             dropCapability(CAP_SYS_CHROOT);
@@ -1710,6 +2186,8 @@ void lokit_main(const std::string& childRoot,
             instdir_path = "/" + loTemplate + "/program";
         }
 
+        const auto jailTime = std::chrono::steady_clock::now();
+
         {
             const char *instdir = instdir_path.c_str();
             const char *userdir = userdir_url.c_str();
@@ -1731,14 +2209,27 @@ void lokit_main(const std::string& childRoot,
             if (!loKit)
             {
                 LOG_FTL("LibreOfficeKit initialization failed. Exiting.");
-                std::_Exit(Application::EXIT_SOFTWARE);
+                exitNow(Application::EXIT_SOFTWARE);
             }
         }
 
         assert(loKit);
-        LOG_INF("Process is ready.");
-
+        const auto initTime = std::chrono::steady_clock::now();
+        const auto forkMs = std::chrono::duration_cast<std::chrono::milliseconds>(startTime - spawnTime).count();
+        const auto jailMs = std::chrono::duration_cast<std::chrono::milliseconds>(jailTime - startTime).count();
+        const auto initMs = std::chrono::duration_cast<std::chrono::milliseconds>(initTime - jailTime).count();
+        LOG_INF("Process is ready in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    initTime - startTime).count() << " ms (fork: " << forkMs << " ms, jail: " <<
+                jailMs << " ms, lok init: " << initMs << " ms).");
+
+        // Report how long we took, so WSD can tell how long spawning takes.
+        // WSD works out the time to connect from when we were spawned.
         std::string requestUrl = std::string(NEW_CHILD_URI) + "pid=" + pid;
+        requestUrl += "&fork_ms=" + std::to_string(forkMs);
+        requestUrl += "&jail_ms=" + std::to_string(jailMs);
+        requestUrl += "&init_ms=" + std::to_string(initMs);
+        requestUrl += "&spawn_us=" + std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(
+                                                        spawnTime.time_since_epoch()).count());
         if (queryVersion)
         {
             char* versionInfo = loKit->getVersionInfo();
@@ -1760,7 +2251,43 @@ void lokit_main(const std::string& childRoot,
         auto ws = std::make_shared<LOOLWebSocket>(cs, request, response);
         ws->setReceiveTimeout(0);
 
+        // Let ForKit know we are usable, so it can spawn more.
+        if (readyFd >= 0)
+        {
+            const std::string ready = pid + '\n';
+            if (write(readyFd, ready.c_str(), ready.size()) != static_cast<ssize_t>(ready.size()))
+                LOG_SYS("Failed to notify ForKit that we are ready.");
+            close(readyFd);
+        }
+
+        // WSD enables recycling by telling us how often we may be reused.
+        const char* maxReuses = std::getenv("LOOL_KIT_MAX_REUSES");
+        if (maxReuses != nullptr)
+        {
+            MaxKitReuses = std::max(0, std::atoi(maxReuses));
+            const char* maxGrowthMb = std::getenv("LOOL_KIT_MAX_MEMORY_GROWTH_MB");
+            MaxReuseGrowthKb = (maxGrowthMb ? std::max(0, std::atoi(maxGrowthMb)) : 0) * 1024;
+            JailRoot = (bRunInsideJail ? std::string() : jailPath.toString());
+            if (!JailRoot.empty() && JailRoot.back() == '/')
+                JailRoot.pop_back();
+            if (ProcSMapsFile != nullptr)
+                ReadyPrivateKb = Util::getMemoryStats(ProcSMapsFile).getPrivateKb();
+        }
+
+        const char* prefetchTiles = std::getenv("LOOL_PREFETCH_TILES");
+        if (prefetchTiles != nullptr)
+            MaxPrefetchTiles = std::max(0, std::atoi(prefetchTiles));
+
+        const char* renderBudgetMs = std::getenv("LOOL_RENDER_BUDGET_MS");
+        if (renderBudgetMs != nullptr)
+            RenderBudgetMs = std::max(0, std::atoi(renderBudgetMs));
+
+        const char* invalidationWindowMs = std::getenv("LOOL_INVALIDATION_WINDOW_MS");
+        if (invalidationWindowMs != nullptr)
+            InvalidationWindowMs = std::max(0, std::atoi(invalidationWindowMs));
+
         auto queue = std::make_shared<TileQueue>();
+        queue->setInvalidationWindowMs(InvalidationWindowMs);
 
         const std::string socketName = "child_ws_" + std::to_string(getpid());
         IoUtil::SocketProcessor(ws, socketName,
@@ -1829,12 +2356,19 @@ void lokit_main(const std::string& childRoot,
                     return true;
                 },
                 []() {},
-                []()
+                [&queue, &ws]()
                 {
                     if (document && document->purgeSessions() == 0)
                     {
-                        LOG_INF("Last session discarded. Terminating.");
-                        TerminationFlag = true;
+                        if (MaxKitReuses > 0 && recycleKit(queue, ws))
+                        {
+                            LOG_INF("Last session discarded. Waiting for another document.");
+                        }
+                        else
+                        {
+                            LOG_INF("Last session discarded. Terminating.");
+                            TerminationFlag = true;
+                        }
                     }
 
                     return TerminationFlag.load();
@@ -1853,7 +2387,7 @@ void lokit_main(const std::string& childRoot,
         if (!loKitDoc || !loKitDoc->get())
         {
             LOG_ERR("Failed to load: " << uri << ", error: " << loKit->getError());
-            std::_Exit(Application::EXIT_OK);
+            exitNow(Application::EXIT_OK);
         }
 
         // specific case to debug
@@ -1875,6 +2409,7 @@ void lokit_main(const std::string& childRoot,
     // Trap the signal handler, if invoked,
     // to prevent exiting.
     LOG_INF("Process finished.");
+    Log::stopAsync();
     std::unique_lock<std::mutex> lock(SigHandlerTrap);
     std::_Exit(Application::EXIT_OK);
 }
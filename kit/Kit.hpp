@@ -9,15 +9,34 @@
 #ifndef INCLUDED_LOOLKIT_HPP
 #define INCLUDED_LOOLKIT_HPP
 
+#include <chrono>
+#include <string>
+
+/// Sets up the jail, initializes LOK and serves WSD until done.
+/// @param jailSkeleton If not empty, the jail is bind-mounted from this skeleton.
+/// @param spawnTime When ForKit forked us, to report the time of each phase of starting.
+/// @param readyFd If not negative, we write our pid to it once connected to WSD.
 void lokit_main(const std::string& childRoot,
                 const std::string& sysTemplate,
                 const std::string& loTemplate,
                 const std::string& loSubPath,
+                const std::string& jailSkeleton,
+                std::chrono::steady_clock::time_point spawnTime,
+                int readyFd,
                 bool noCapabilities,
                 bool queryVersionInfo,
                 bool displayVersion);
 
 bool globalPreinit(const std::string& loTemplate);
+
+/// Prepares, once, the jail contents shared by all kits under the child root,
+/// so that kits can bind-mount it instead of linking the templates file by file.
+/// Returns the path of the skeleton, or empty on failure.
+std::string createJailSkeleton(const std::string& childRoot,
+                               const std::string& sysTemplate,
+                               const std::string& loTemplate,
+                               const std::string& loSubPath);
+
 /// Wrapper around private Document::ViewCallback().
 void documentViewCallback(const int type, const char* p, void* data);
 
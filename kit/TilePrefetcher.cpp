@@ -0,0 +1,223 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "TilePrefetcher.hpp"
+
+#include <algorithm>
+
+TilePrefetcher::TilePrefetcher() :
+    _maxTiles(0),
+    _tilePixelWidth(0),
+    _tilePixelHeight(0),
+    _tileTwipWidth(0),
+    _tileTwipHeight(0),
+    _visibleX(0),
+    _visibleY(0),
+    _visibleWidth(0),
+    _visibleHeight(0),
+    _scrollX(0),
+    _scrollY(1),
+    _needsPlan(false),
+    _prefetched(0)
+{
+}
+
+void TilePrefetcher::setMaxTiles(const size_t maxTiles)
+{
+    _maxTiles = maxTiles;
+    _pending.clear();
+    _needsPlan = true;
+}
+
+void TilePrefetcher::setZoom(const int tilePixelWidth, const int tilePixelHeight,
+                             const int tileTwipWidth, const int tileTwipHeight)
+{
+    if (tilePixelWidth == _tilePixelWidth && tilePixelHeight == _tilePixelHeight &&
+        tileTwipWidth == _tileTwipWidth && tileTwipHeight == _tileTwipHeight)
+    {
+        return;
+    }
+
+    _tilePixelWidth = tilePixelWidth;
+    _tilePixelHeight = tilePixelHeight;
+    _tileTwipWidth = tileTwipWidth;
+    _tileTwipHeight = tileTwipHeight;
+
+    // Nothing rendered at the old zoom is of use.
+    _rendered.clear();
+    _pending.clear();
+    _needsPlan = true;
+}
+
+void TilePrefetcher::setVisibleArea(const int x, const int y, const int width, const int height)
+{
+    if (x == _visibleX && y == _visibleY && width == _visibleWidth && height == _visibleHeight)
+        return;
+
+    // Remember the last direction on each axis, so a horizontal
+    // scroll doesn't make us forget about the vertical one.
+    if (_visibleWidth > 0 && _visibleHeight > 0)
+    {
+        if (x != _visibleX)
+            _scrollX = (x > _visibleX ? 1 : -1);
+        if (y != _visibleY)
+            _scrollY = (y > _visibleY ? 1 : -1);
+    }
+
+    _visibleX = x;
+    _visibleY = y;
+    _visibleWidth = width;
+    _visibleHeight = height;
+
+    _pending.clear();
+    _needsPlan = true;
+}
+
+void TilePrefetcher::cancel()
+{
+    if (!_pending.empty())
+    {
+        _pending.clear();
+        _needsPlan = true;
+    }
+}
+
+void TilePrefetcher::rendered(const TileDesc& tile)
+{
+    if (tile.getTileWidth() == _tileTwipWidth && tile.getTileHeight() == _tileTwipHeight &&
+        tile.getWidth() == _tilePixelWidth && tile.getHeight() == _tilePixelHeight)
+    {
+        _rendered.emplace(tile.getPart(), tile.getTilePosX(), tile.getTilePosY());
+    }
+}
+
+void TilePrefetcher::invalidate(const int part, const int x, const int y, const int width, const int height)
+{
+    for (auto it = _rendered.begin(); it != _rendered.end(); )
+    {
+        if ((part < 0 || std::get<0>(*it) == part) &&
+            TileDesc::rectanglesIntersect(std::get<1>(*it), std::get<2>(*it),
+                                          _tileTwipWidth, _tileTwipHeight, x, y, width, height))
+        {
+            it = _rendered.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    _needsPlan = true;
+}
+
+void TilePrefetcher::invalidateAll()
+{
+    _rendered.clear();
+    _needsPlan = true;
+}
+
+bool TilePrefetcher::needsPlan() const
+{
+    return _needsPlan && isEnabled() &&
+           _tilePixelWidth > 0 && _tilePixelHeight > 0 &&
+           _tileTwipWidth > 0 && _tileTwipHeight > 0 &&
+           _visibleWidth > 0 && _visibleHeight > 0;
+}
+
+bool TilePrefetcher::isRendered(const int part, const int x, const int y) const
+{
+    return _rendered.find(std::make_tuple(part, x, y)) != _rendered.end();
+}
+
+void TilePrefetcher::addTile(const int part, const int column, const int row)
+{
+    const int x = column * _tileTwipWidth;
+    const int y = row * _tileTwipHeight;
+    if (_pending.size() >= _maxTiles || isRendered(part, x, y))
+        return;
+
+    _pending.emplace_back(part, _tilePixelWidth, _tilePixelHeight, x, y,
+                          _tileTwipWidth, _tileTwipHeight, -1, 0, -1, false);
+}
+
+void TilePrefetcher::plan(const int part, const int docWidth, const int docHeight, const int nextPart)
+{
+    _pending.clear();
+    _needsPlan = false;
+    if (!isEnabled() || docWidth <= 0 || docHeight <= 0 ||
+        _tileTwipWidth <= 0 || _tileTwipHeight <= 0 ||
+        _visibleWidth <= 0 || _visibleHeight <= 0)
+    {
+        return;
+    }
+
+    const int lastColumn = (docWidth - 1) / _tileTwipWidth;
+    const int lastRow = (docHeight - 1) / _tileTwipHeight;
+
+    // The tiles covering the visible area, within the document.
+    const int firstVisibleColumn = std::max(0, _visibleX / _tileTwipWidth);
+    const int firstVisibleRow = std::max(0, _visibleY / _tileTwipHeight);
+    const int lastVisibleColumn = std::min(lastColumn, (_visibleX + _visibleWidth - 1) / _tileTwipWidth);
+    const int lastVisibleRow = std::min(lastRow, (_visibleY + _visibleHeight - 1) / _tileTwipHeight);
+    if (firstVisibleColumn > lastVisibleColumn || firstVisibleRow > lastVisibleRow)
+        return;
+
+    // Up to a screenful ahead, nearest first.
+    const int rows = lastVisibleRow - firstVisibleRow + 1;
+    const int columns = lastVisibleColumn - firstVisibleColumn + 1;
+    for (int i = 1; i <= std::max(rows, columns); ++i)
+    {
+        if (_scrollY != 0 && i <= rows)
+        {
+            const int row = (_scrollY > 0 ? lastVisibleRow + i : firstVisibleRow - i);
+            if (row >= 0 && row <= lastRow)
+            {
+                for (int column = firstVisibleColumn; column <= lastVisibleColumn; ++column)
+                    addTile(part, column, row);
+            }
+        }
+
+        if (_scrollX != 0 && i <= columns)
+        {
+            const int column = (_scrollX > 0 ? lastVisibleColumn + i : firstVisibleColumn - i);
+            if (column >= 0 && column <= lastColumn)
+            {
+                for (int row = firstVisibleRow; row <= lastVisibleRow; ++row)
+                    addTile(part, column, row);
+            }
+        }
+    }
+
+    // The same view of the next slide or page.
+    if (nextPart >= 0)
+    {
+        for (int row = firstVisibleRow; row <= lastVisibleRow; ++row)
+        {
+            for (int column = firstVisibleColumn; column <= lastVisibleColumn; ++column)
+                addTile(nextPart, column, row);
+        }
+    }
+}
+
+bool TilePrefetcher::next(TileDesc& tile)
+{
+    if (_pending.empty())
+        return false;
+
+    tile = _pending.front();
+    _pending.pop_front();
+
+    rendered(tile);
+    ++_prefetched;
+    return true;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,108 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILEPREFETCHER_HPP
+#define INCLUDED_TILEPREFETCHER_HPP
+
+#include <deque>
+#include <set>
+#include <tuple>
+
+#include "TileDesc.hpp"
+
+/// Picks the tiles to render ahead of the client, while idle.
+/// Follows the visible area and the zoom of the last active view, and
+/// plans the tiles just outside the visible area, in the direction it
+/// last scrolled, then those of the next part (for slides and pages of
+/// drawings), so that the WSD TileCache has them when the view gets there.
+/// Tiles already rendered since they were last invalidated are skipped.
+/// The plan is dropped as soon as real requests come in, and made
+/// again when idle.
+/// Not thread-safe; used from the thread of the Kit Document only.
+class TilePrefetcher
+{
+public:
+    TilePrefetcher();
+
+    /// The maximum number of tiles planned at a time, 0 to disable.
+    void setMaxTiles(size_t maxTiles);
+
+    bool isEnabled() const { return _maxTiles > 0; }
+
+    /// The size of a tile in pixels and in twips, as set by clientzoom.
+    void setZoom(int tilePixelWidth, int tilePixelHeight, int tileTwipWidth, int tileTwipHeight);
+
+    /// The visible area in twips, as set by clientvisiblearea.
+    void setVisibleArea(int x, int y, int width, int height);
+
+    /// Drops the planned tiles, to make room for real requests.
+    /// The tiles are planned again once idle.
+    void cancel();
+
+    /// The tile was rendered, so there is no need to prefetch it.
+    void rendered(const TileDesc& tile);
+
+    /// The tiles of the part intersecting the area, in twips, are stale.
+    /// A part of -1 stands for all parts.
+    void invalidate(int part, int x, int y, int width, int height);
+
+    /// All the tiles are stale.
+    void invalidateAll();
+
+    /// True if we know the viewport, and the tiles need planning.
+    bool needsPlan() const;
+
+    bool hasPending() const { return !_pending.empty(); }
+
+    /// Plans the tiles to prefetch around the visible area of part, within the
+    /// document size in twips, followed by those of nextPart, unless -1.
+    void plan(int part, int docWidth, int docHeight, int nextPart);
+
+    /// Takes the next tile to render.
+    /// Returns false if there is none.
+    bool next(TileDesc& tile);
+
+    /// The number of tiles handed out for prefetching.
+    unsigned getPrefetched() const { return _prefetched; }
+
+private:
+    /// Plans the tile at the given column and row, unless rendered already.
+    void addTile(int part, int column, int row);
+
+    bool isRendered(int part, int x, int y) const;
+
+private:
+    size_t _maxTiles;
+
+    int _tilePixelWidth;
+    int _tilePixelHeight;
+    int _tileTwipWidth;
+    int _tileTwipHeight;
+
+    int _visibleX;
+    int _visibleY;
+    int _visibleWidth;
+    int _visibleHeight;
+
+    /// The direction of the last scroll on each axis: -1, 0 or 1.
+    int _scrollX;
+    int _scrollY;
+
+    bool _needsPlan;
+    std::deque<TileDesc> _pending;
+
+    /// The part and position of the tiles rendered at the current zoom.
+    std::set<std::tuple<int, int, int>> _rendered;
+
+    unsigned _prefetched;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -430,6 +430,24 @@ public:
                 " leaving " << _pollSockets.size());
     }
 
+    /// Removes a socket from this poller, unless it was
+    /// dropped already, having been closed meanwhile.
+    /// Returns false if the socket wasn't polled here.
+    /// NB. this must be called from the polling thread.
+    bool releaseSocketIfPolled(const std::shared_ptr<Socket>& socket)
+    {
+        assert(socket);
+        assert(isCorrectThread());
+        auto it = std::find(_pollSockets.begin(), _pollSockets.end(), socket);
+        if (it == _pollSockets.end())
+            return false;
+
+        _pollSockets.erase(it);
+        LOG_TRC("Release socket #" << socket->getFD() << " from " << _name <<
+                " leaving " << _pollSockets.size());
+        return true;
+    }
+
     const std::string& name() const { return _name; }
 
     /// Start the polling thread (if desired)
@@ -808,6 +826,20 @@ protected:
     /// Get the Write Lock.
     std::unique_lock<std::mutex> getWriteLock() { return std::unique_lock<std::mutex>(_writeMutex); }
 
+    /// The bytes received and not yet handled.
+    size_t getInBufferSize()
+    {
+        assert(isCorrectThread());
+        return _inBuffer.size();
+    }
+
+    /// The bytes queued and not yet written. Takes the Write Lock.
+    size_t getOutBufferSize()
+    {
+        std::unique_lock<std::mutex> lock(_writeMutex);
+        return _outBuffer.size();
+    }
+
 protected:
     /// Client handling the actual data.
     std::shared_ptr<SocketHandlerInterface> _socketHandler;
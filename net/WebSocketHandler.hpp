@@ -100,6 +100,17 @@ public:
         RESERVED_TLS_FAILURE    = 1015
     };
 
+    /// Adds the bytes waiting in the buffers of our socket, if still connected.
+    void addBufferSizes(size_t& inBytes, size_t& outBytes)
+    {
+        auto socket = _socket.lock();
+        if (socket)
+        {
+            inBytes += socket->getInBufferSize();
+            outBytes += socket->getOutBufferSize();
+        }
+    }
+
     /// Sends WS shutdown message to the peer.
     void shutdown(const StatusCodes statusCode = StatusCodes::NORMAL_CLOSE, const std::string& statusMessage = "")
     {
@@ -53,6 +53,7 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
 
     CPPUNIT_TEST(testSimple);
     CPPUNIT_TEST(testSimpleCombine);
+    CPPUNIT_TEST(testTileBeforeLoad);
     CPPUNIT_TEST(testPerformance);
     CPPUNIT_TEST(testCancelTiles);
     CPPUNIT_TEST(testCancelTilesMultiView);
@@ -78,6 +79,7 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
 
     void testSimple();
     void testSimpleCombine();
+    void testTileBeforeLoad();
     void testPerformance();
     void testCancelTiles();
     void testCancelTilesMultiView();
@@ -224,6 +226,38 @@ void TileCacheTests::testSimpleCombine()
     CPPUNIT_ASSERT_MESSAGE("did not receive a tile: message as expected", !tile2b.empty());
 }
 
+void TileCacheTests::testTileBeforeLoad()
+{
+    const auto testname = "tileBeforeLoad ";
+    std::string documentPath, documentURL;
+    getDocumentPathAndURL("hello.odt", documentPath, documentURL, testname);
+
+    // Request tiles right after the load, while WSD may still wait for a Kit.
+    Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_GET, documentURL);
+    auto socket = connectLOKit(_uri, request, _response, testname);
+    sendTextFrame(socket, "load url=" + documentURL, testname);
+    sendTextFrame(socket, "tile part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840", testname);
+    sendTextFrame(socket, "tilecombine part=0 width=256 height=256 tileposx=0,3840 tileposy=0,0 tilewidth=3840 tileheight=3840", testname);
+
+    // They are served once the document is loaded, the first tile maybe twice.
+    bool gotFirst = false;
+    bool gotSecond = false;
+    for (int i = 0; i < 3 && !(gotFirst && gotSecond); ++i)
+    {
+        const auto tile = getResponseMessage(socket, "tile:", testname);
+        if (tile.empty())
+            break;
+
+        int tilePosX = -1;
+        LOOLProtocol::getTokenIntegerFromMessage(LOOLProtocol::getFirstLine(tile), "tileposx", tilePosX);
+        gotFirst = gotFirst || tilePosX == 0;
+        gotSecond = gotSecond || tilePosX == 3840;
+    }
+
+    CPPUNIT_ASSERT_MESSAGE("did not receive the tile requested before the load", gotFirst);
+    CPPUNIT_ASSERT_MESSAGE("did not receive the combined tile requested before the load", gotSecond);
+}
+
 void TileCacheTests::testPerformance()
 {
     auto socket = loadDocAndGetSocket("hello.odt", _uri, "performance ");
@@ -50,6 +50,10 @@ class TileQueueTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testSenderQueueTileDeduplication);
     CPPUNIT_TEST(testInvalidateViewCursorDeduplication);
     CPPUNIT_TEST(testCallbackInvalidation);
+    CPPUNIT_TEST(testYieldToNonTiles);
+    CPPUNIT_TEST(testViewCallbackDeduplication);
+    CPPUNIT_TEST(testInvalidationWindow);
+    CPPUNIT_TEST(testCombinedTileWaits);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -62,6 +66,10 @@ class TileQueueTests : public CPPUNIT_NS::TestFixture
     void testSenderQueueTileDeduplication();
     void testInvalidateViewCursorDeduplication();
     void testCallbackInvalidation();
+    void testYieldToNonTiles();
+    void testViewCallbackDeduplication();
+    void testInvalidationWindow();
+    void testCombinedTileWaits();
 };
 
 void TileQueueTests::testTileQueuePriority()
@@ -176,19 +184,20 @@ void TileQueueTests::testViewOrder()
     TileQueue queue;
 
     // should result in the 3, 2, 1, 0 order of the views
+    // (far apart, so that their tiles aren't worth painting together)
     queue.updateCursorPosition(0, 0, 0, 0, 10, 100);
     queue.updateCursorPosition(2, 0, 0, 0, 10, 100);
-    queue.updateCursorPosition(1, 0, 0, 7680, 10, 100);
+    queue.updateCursorPosition(1, 0, 0, 76800, 10, 100);
     queue.updateCursorPosition(3, 0, 0, 0, 10, 100);
-    queue.updateCursorPosition(2, 0, 0, 15360, 10, 100);
-    queue.updateCursorPosition(3, 0, 0, 23040, 10, 100);
+    queue.updateCursorPosition(2, 0, 0, 153600, 10, 100);
+    queue.updateCursorPosition(3, 0, 0, 230400, 10, 100);
 
     const std::vector<std::string> tiles =
     {
         "tile part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1",
-        "tile part=0 width=256 height=256 tileposx=0 tileposy=7680 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1",
-        "tile part=0 width=256 height=256 tileposx=0 tileposy=15360 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1",
-        "tile part=0 width=256 height=256 tileposx=0 tileposy=23040 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1"
+        "tile part=0 width=256 height=256 tileposx=0 tileposy=76800 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1",
+        "tile part=0 width=256 height=256 tileposx=0 tileposy=153600 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1",
+        "tile part=0 width=256 height=256 tileposx=0 tileposy=230400 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1"
     };
 
     for (auto &tile : tiles)
@@ -444,6 +453,120 @@ void TileQueueTests::testCallbackInvalidation()
     CPPUNIT_ASSERT_EQUAL(std::string("callback all 0 EMPTY, 0"), payloadAsString(queue.get()));
 }
 
+void TileQueueTests::testYieldToNonTiles()
+{
+    TileQueue queue;
+
+    const std::string tile1 = "tile part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1";
+    const std::string tile2 = "tile part=0 width=256 height=256 tileposx=0 tileposy=38400 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1";
+    const std::string tile3 = "tile part=0 width=256 height=256 tileposx=0 tileposy=76800 tilewidth=3840 tileheight=3840 oldhash=0 hash=0 ver=-1";
+
+    queue.put(tile1);
+    queue.put(tile2);
+    queue.put("callback all 1 284, 1418, 11105, 275");
+    queue.put(tile3);
+    queue.put("child-0 key type=input char=97 key=0");
+
+    // Normally the tiles ahead of the callback come first.
+    CPPUNIT_ASSERT_EQUAL(tile1, payloadAsString(queue.get()));
+
+    // Once yielding, the callbacks and input queued so far skip the tiles.
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), queue.yieldToNonTiles());
+    queue.put("callback all 2 0, 0, 10, 10");
+    CPPUNIT_ASSERT_EQUAL(std::string("callback all 1 284, 1418, 11105, 275"), payloadAsString(queue.get()));
+    CPPUNIT_ASSERT_EQUAL(std::string("child-0 key type=input char=97 key=0"), payloadAsString(queue.get()));
+
+    // Then the tiles again, before what came in meanwhile.
+    CPPUNIT_ASSERT_EQUAL(tile2, payloadAsString(queue.get()));
+    CPPUNIT_ASSERT_EQUAL(tile3, payloadAsString(queue.get()));
+    CPPUNIT_ASSERT_EQUAL(std::string("callback all 2 0, 0, 10, 10"), payloadAsString(queue.get()));
+
+    // All the tiles were accounted for.
+    CPPUNIT_ASSERT_EQUAL(3U, queue.getWaitHistogram().getCount());
+}
+
+void TileQueueTests::testViewCallbackDeduplication()
+{
+    TileQueue queue;
+
+    // The view cursors of two views, as the Kit queues them.
+    queue.put("callback except-1 24 {    \"viewId\": \"1\",     \"rectangle\": \"3999, 1418, 0, 298\",     \"part\": \"0\" }");
+    queue.put("callback except-2 24 { \"viewId\": 2, \"rectangle\": \"3999, 1418, 0, 298\", \"part\": 0 }");
+    CPPUNIT_ASSERT_EQUAL(2, static_cast<int>(queue._queue.size()));
+
+    // Only the latest of the same view is kept.
+    queue.put("callback except-1 24 {    \"viewId\": \"1\",     \"rectangle\": \"4999, 1418, 0, 298\",     \"part\": \"0\" }");
+    CPPUNIT_ASSERT_EQUAL(2, static_cast<int>(queue._queue.size()));
+    CPPUNIT_ASSERT_EQUAL(std::string("callback except-2 24 { \"viewId\": 2, \"rectangle\": \"3999, 1418, 0, 298\", \"part\": 0 }"),
+                         payloadAsString(queue.get()));
+    CPPUNIT_ASSERT_EQUAL(std::string("callback except-1 24 {    \"viewId\": \"1\",     \"rectangle\": \"4999, 1418, 0, 298\",     \"part\": \"0\" }"),
+                         payloadAsString(queue.get()));
+
+    // Without a viewId, nothing is taken as the same view.
+    queue.put("callback 0 28 { \"visible\": \"true\" }");
+    queue.put("callback 0 28 { \"visible\": \"false\" }");
+    CPPUNIT_ASSERT_EQUAL(2, static_cast<int>(queue._queue.size()));
+}
+
+void TileQueueTests::testInvalidationWindow()
+{
+    TileQueue queue;
+    queue.setInvalidationWindowMs(200);
+
+    // The invalidations are held back, and those touching are merged.
+    queue.put("callback all 0 0, 0, 3840, 3840, 0");
+    queue.put("callback all 1 284, 1418, 0, 275");
+    queue.put("callback all 0 3840, 0, 3840, 3840, 0");
+    queue.put("callback all 0 0, 0, 3840, 3840, 1");
+    CPPUNIT_ASSERT_EQUAL(1, static_cast<int>(queue._queue.size()));
+    CPPUNIT_ASSERT_EQUAL(2, static_cast<int>(queue._invalidations.size()));
+
+    // The rest isn't held back with them.
+    CPPUNIT_ASSERT_EQUAL(std::string("callback all 1 284, 1418, 0, 275"), payloadAsString(queue.get(1)));
+    CPPUNIT_ASSERT(queue.get(1).empty());
+
+    // Once due, they come without anything else queued.
+    CPPUNIT_ASSERT_EQUAL(std::string("callback all 0 0, 0, 7680, 3840, 0"), payloadAsString(queue.get()));
+    CPPUNIT_ASSERT_EQUAL(std::string("callback all 0 0, 0, 3840, 3840, 1"), payloadAsString(queue.get(1)));
+
+    // But not behind the tiles of their area.
+    queue.put("callback all 0 0, 0, 3840, 3840, 1");
+    queue.put("callback all 0 0, 0, 3840, 3840, 0");
+    queue.put("tile part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840 ver=1");
+    CPPUNIT_ASSERT_EQUAL(1, static_cast<int>(queue._invalidations.size()));
+    CPPUNIT_ASSERT_EQUAL(std::string("callback all 0 0, 0, 3840, 3840, 0"), payloadAsString(queue.get(1)));
+    CPPUNIT_ASSERT(LOOLProtocol::matchPrefix("tile", queue.get(1)));
+    CPPUNIT_ASSERT_EQUAL(std::string("callback all 0 0, 0, 3840, 3840, 1"), payloadAsString(queue.get()));
+
+    // Nor held back at all when their tiles are queued already.
+    queue.put("tile part=1 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840 ver=2");
+    queue.put("callback all 0 0, 0, 3840, 3840, 1");
+    CPPUNIT_ASSERT(queue._invalidations.empty());
+    CPPUNIT_ASSERT_EQUAL(std::string("callback all 0 0, 0, 3840, 3840, 1"), payloadAsString(queue.get(1)));
+    CPPUNIT_ASSERT(LOOLProtocol::matchPrefix("tile", queue.get(1)));
+
+    // Not held back when disabled.
+    queue.setInvalidationWindowMs(0);
+    queue.put("callback all 0 0, 0, 3840, 3840, 0");
+    CPPUNIT_ASSERT_EQUAL(1, static_cast<int>(queue._queue.size()));
+}
+
+void TileQueueTests::testCombinedTileWaits()
+{
+    TileQueue queue;
+
+    queue.put("tile part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840");
+    queue.put("tile part=0 width=256 height=256 tileposx=3840 tileposy=0 tilewidth=3840 tileheight=3840");
+    queue.put("callback all 0 0, 0, 10, 10");
+    CPPUNIT_ASSERT_EQUAL(2, static_cast<int>(queue._tileArrivals.size()));
+
+    // Each combined tile accounts for its own arrival, not the top one's.
+    CPPUNIT_ASSERT(LOOLProtocol::matchPrefix("tilecombine", queue.get()));
+    CPPUNIT_ASSERT_EQUAL(2U, queue.getWaitHistogram().getCount());
+    CPPUNIT_ASSERT(queue._tileArrivals.empty());
+    CPPUNIT_ASSERT_EQUAL(std::string("callback all 0 0, 0, 10, 10"), payloadAsString(queue.get()));
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(TileQueueTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
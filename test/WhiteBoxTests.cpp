@@ -9,15 +9,36 @@
 
 #include "config.h"
 
+#include <fstream>
+#include <sstream>
+
+#include <Poco/TemporaryFile.h>
+
 #include <cppunit/extensions/HelperMacros.h>
 
 #include <ChildSession.hpp>
+#include <Command.hpp>
 #include <Common.hpp>
+#include <ConvertQueue.hpp>
+#include <FileUtil.hpp>
+#include <Histogram.hpp>
 #include <Kit.hpp>
+#include <LogBuffer.hpp>
 #include <MessageQueue.hpp>
+#include <Metrics.hpp>
+#include <PrespawnController.hpp>
+#include <PreviewCache.hpp>
 #include <Protocol.hpp>
+#include <ShardedMap.hpp>
+#include <TileCachePolicy.hpp>
+#include <TileCoalescer.hpp>
 #include <TileDesc.hpp>
+#include <TileInvalidations.hpp>
+#include <TilePrefetcher.hpp>
+#include <TileTracer.hpp>
+#include <TraceFile.hpp>
 #include <Util.hpp>
+#include <tools/Benchmark.hpp>
 
 /// WhiteBox unit-tests.
 class WhiteBoxTests : public CPPUNIT_NS::TestFixture
@@ -31,6 +52,24 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testRegexListMatcher_Init);
     CPPUNIT_TEST(testEmptyCellCursor);
     CPPUNIT_TEST(testRectanglesIntersect);
+    CPPUNIT_TEST(testShardedMap);
+    CPPUNIT_TEST(testPrespawnController);
+    CPPUNIT_TEST(testSMapsParser);
+    CPPUNIT_TEST(testConvertQueue);
+    CPPUNIT_TEST(testTilePrefetcher);
+    CPPUNIT_TEST(testHistogram);
+    CPPUNIT_TEST(testTileCoalescer);
+    CPPUNIT_TEST(testTileCachePolicy);
+    CPPUNIT_TEST(testLogBuffer);
+    CPPUNIT_TEST(testBinaryTraceRecord);
+    CPPUNIT_TEST(testMetrics);
+    CPPUNIT_TEST(testTileTrace);
+    CPPUNIT_TEST(testBenchmarkCompare);
+    CPPUNIT_TEST(testTokenSpans);
+    CPPUNIT_TEST(testCommands);
+    CPPUNIT_TEST(testJsonValue);
+    CPPUNIT_TEST(testTileInvalidations);
+    CPPUNIT_TEST(testPreviewCache);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -41,6 +80,24 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testRegexListMatcher_Init();
     void testEmptyCellCursor();
     void testRectanglesIntersect();
+    void testShardedMap();
+    void testPrespawnController();
+    void testSMapsParser();
+    void testConvertQueue();
+    void testTilePrefetcher();
+    void testHistogram();
+    void testTileCoalescer();
+    void testTileCachePolicy();
+    void testLogBuffer();
+    void testBinaryTraceRecord();
+    void testMetrics();
+    void testTileTrace();
+    void testBenchmarkCompare();
+    void testTokenSpans();
+    void testCommands();
+    void testJsonValue();
+    void testTileInvalidations();
+    void testPreviewCache();
 };
 
 void WhiteBoxTests::testLOOLProtocolFunctions()
@@ -348,6 +405,15 @@ public:
         return _tileQueue;
     }
 
+    void onClientZoom(int /*viewId*/, int /*tilePixelWidth*/, int /*tilePixelHeight*/,
+                      int /*tileTwipWidth*/, int /*tileTwipHeight*/) override
+    {
+    }
+
+    void onClientVisibleArea(int /*viewId*/, int /*x*/, int /*y*/, int /*width*/, int /*height*/) override
+    {
+    }
+
     bool sendTextFrame(const std::string& /*message*/) override
     {
         return true;
@@ -387,6 +453,937 @@ void WhiteBoxTests::testRectanglesIntersect()
                                                   1000, 1000, 2000, 1000));
 }
 
+void WhiteBoxTests::testShardedMap()
+{
+    ShardedMap<int> map(4);
+    CPPUNIT_ASSERT(map.empty());
+    CPPUNIT_ASSERT(!map.find("a"));
+
+    // Created once, then found.
+    int created = 0;
+    const auto a = map.findOrCreate("a", 3, [&]() { ++created; return std::make_shared<int>(1); });
+    CPPUNIT_ASSERT(a);
+    CPPUNIT_ASSERT_EQUAL(a, map.findOrCreate("a", 3, [&]() { ++created; return std::make_shared<int>(2); }));
+    CPPUNIT_ASSERT_EQUAL(1, created);
+    CPPUNIT_ASSERT_EQUAL(a, map.find("a"));
+
+    // Null isn't inserted.
+    CPPUNIT_ASSERT(!map.findOrCreate("b", 3, []() { return std::shared_ptr<int>(); }));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), map.size());
+
+    // The size limit is honored, but existing keys are still found.
+    CPPUNIT_ASSERT(map.insert("b", std::make_shared<int>(2), 3));
+    CPPUNIT_ASSERT(!map.insert("b", std::make_shared<int>(3), 3));
+    CPPUNIT_ASSERT(map.insert("c", std::make_shared<int>(3), 3));
+    CPPUNIT_ASSERT(!map.insert("d", std::make_shared<int>(4), 3));
+    CPPUNIT_ASSERT(!map.findOrCreate("d", 3, []() { return std::make_shared<int>(4); }));
+    CPPUNIT_ASSERT_EQUAL(a, map.findOrCreate("a", 3, []() { return std::make_shared<int>(4); }));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), map.size());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), map.snapshot().size());
+
+    // Only the same instance is erased.
+    CPPUNIT_ASSERT(!map.erase("a", std::make_shared<int>(1)));
+    CPPUNIT_ASSERT(map.erase("a", a));
+    CPPUNIT_ASSERT(!map.find("a"));
+    CPPUNIT_ASSERT(map.erase("b"));
+    CPPUNIT_ASSERT(!map.erase("b"));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), map.size());
+
+    map.clear();
+    CPPUNIT_ASSERT(map.empty());
+    CPPUNIT_ASSERT(map.snapshot().empty());
+}
+
+void WhiteBoxTests::testPrespawnController()
+{
+    PrespawnController controller;
+    const auto now = std::chrono::steady_clock::now();
+
+    // Nothing to adapt to yet, or not adaptive.
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), controller.getTarget(now, 1, 10));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), controller.getTarget(now, 2, 2));
+
+    // A spike of one open a second, with children taking 3 seconds to spawn.
+    controller.childSpawned(std::chrono::seconds(3));
+    for (int i = 0; i < 60; ++i)
+    {
+        controller.documentOpened(now + std::chrono::seconds(i), i % 4 != 0);
+    }
+
+    const auto spike = now + std::chrono::seconds(60);
+    const size_t target = controller.getTarget(spike, 1, 10);
+    CPPUNIT_ASSERT(target > 1);
+    CPPUNIT_ASSERT(target <= 10);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), controller.getTarget(spike, 1, 2));
+    CPPUNIT_ASSERT_EQUAL(45U, controller.getHits());
+    CPPUNIT_ASSERT_EQUAL(15U, controller.getMisses());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.25, controller.getMissRate(), 0.001);
+
+    // Falls back to the minimum when idle.
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), controller.getTarget(spike + std::chrono::hours(1), 1, 10));
+
+    // Bounded by memory, but never below the minimum.
+    controller.setMemory(400 * 1024, 100 * 1024);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), controller.getTarget(spike, 1, 10));
+    controller.setMemory(100 * 1024, 100 * 1024);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), controller.getTarget(spike, 1, 10));
+
+    // Phases reported by the children feed the spawn time.
+    SpawnPhases phases;
+    phases._forkMs = 10;
+    phases._jailMs = 200;
+    phases._initMs = 1500;
+    phases._connectMs = 290;
+    controller.childSpawned(phases);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.75, controller.getSpawnSecs(), 0.001);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(200, controller.getSpawnPhases()._jailMs, 0.001);
+    phases._jailMs = 600;
+    controller.childSpawned(phases);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(300, controller.getSpawnPhases()._jailMs, 0.001);
+}
+
+void WhiteBoxTests::testSMapsParser()
+{
+    const std::string smaps =
+        "00400000-0040b000 r-xp 00000000 08:01 1234    /usr/bin/foo\n"
+        "Size:                 44 kB\n"
+        "Rss:                  40 kB\n"
+        "Pss:                  20 kB\n"
+        "Shared_Clean:         36 kB\n"
+        "Shared_Dirty:          0 kB\n"
+        "Private_Clean:         4 kB\n"
+        "Private_Dirty:         0 kB\n"
+        "Swap:                  0 kB\n"
+        "SwapPss:               0 kB\n"
+        "VmFlags: rd ex mr mw me dw\n"
+        "7f0000000000-7f0000100000 rw-p 00000000 00:00 0\n"
+        "Size:               1024 kB\n"
+        "Rss:                 900 kB\n"
+        "Pss:                 700 kB\n"
+        "Shared_Clean:          0 kB\n"
+        "Shared_Dirty:        300 kB\n"
+        "Private_Clean:         0 kB\n"
+        "Private_Dirty:       600 kB\n"
+        "Swap:                 12 kB\n"
+        "SwapPss:              12 kB\n";
+
+    // However the content is split into reads, we get the same totals.
+    for (size_t split = 0; split <= smaps.size(); ++split)
+    {
+        Util::SMapsParser parser;
+        parser.parse(smaps.data(), split);
+        parser.parse(smaps.data() + split, smaps.size() - split);
+
+        const Util::MemoryStats& stats = parser.getStats();
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(940), stats._rssKb);
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(720), stats._pssKb);
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(336), stats.getSharedKb());
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(604), stats.getPrivateKb());
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(600), stats._privateDirtyKb);
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(12), stats._swapKb);
+    }
+}
+
+void WhiteBoxTests::testConvertQueue()
+{
+    ConvertQueue queue;
+    queue.configure(2, 1, std::chrono::seconds(10));
+    const auto now = std::chrono::steady_clock::now();
+
+    std::vector<unsigned> started;
+    std::vector<unsigned> cancelled;
+    const auto start = [&started](const unsigned id) { started.push_back(id); };
+    const auto cancel = [&cancelled](const unsigned id) { cancelled.push_back(id); };
+
+    // Two run right away, one waits, and the rest are refused.
+    const unsigned first = queue.submit(now, start, cancel);
+    const unsigned second = queue.submit(now, start, cancel);
+    const unsigned third = queue.submit(now, start, cancel);
+    CPPUNIT_ASSERT(first != 0 && second != 0 && third != 0);
+    CPPUNIT_ASSERT_EQUAL(0U, queue.submit(now, start, cancel));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), started.size());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), queue.getRunning());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), queue.getQueued());
+    CPPUNIT_ASSERT_EQUAL(1U, queue.getRejected());
+
+    // Finishing one starts the queued one.
+    queue.finished(first, now + std::chrono::seconds(2));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), started.size());
+    CPPUNIT_ASSERT_EQUAL(third, started.back());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), queue.getQueued());
+    CPPUNIT_ASSERT_EQUAL(1U, queue.getCompleted());
+
+    // Finishing twice is harmless.
+    queue.finished(first, now + std::chrono::seconds(3));
+    CPPUNIT_ASSERT_EQUAL(1U, queue.getCompleted());
+
+    // Those running too long are cancelled, counting the time queued.
+    queue.expire(now + std::chrono::seconds(5));
+    CPPUNIT_ASSERT(cancelled.empty());
+    queue.expire(now + std::chrono::seconds(10));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), cancelled.size());
+    CPPUNIT_ASSERT_EQUAL(2U, queue.getTimedOut());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), queue.getRunning());
+
+    // Finishing after timing out doesn't count.
+    queue.finished(second, now + std::chrono::seconds(11));
+    CPPUNIT_ASSERT_EQUAL(1U, queue.getCompleted());
+
+    CPPUNIT_ASSERT_EQUAL(std::string("running=0 queued=0 max_running=2 max_queued=1 completed=1 "
+                                     "rejected=1 timedout=2 wait_ms=500 run_ms=2000"),
+                         queue.toString());
+}
+
+void WhiteBoxTests::testTilePrefetcher()
+{
+    constexpr int TileTwips = 3840;
+    const int docWidth = 4 * TileTwips;
+    const int docHeight = 10 * TileTwips;
+    TileDesc tile(0, 1, 1, 0, 0, 1, 1, -1, 0, -1, false);
+
+    TilePrefetcher prefetcher;
+    prefetcher.setMaxTiles(100);
+    prefetcher.setZoom(256, 256, TileTwips, TileTwips);
+    CPPUNIT_ASSERT(!prefetcher.needsPlan());
+
+    // Before any scrolling, the screenful below is prefetched.
+    prefetcher.setVisibleArea(0, 0, 2 * TileTwips, 2 * TileTwips);
+    CPPUNIT_ASSERT(prefetcher.needsPlan());
+    prefetcher.plan(0, docWidth, docHeight, -1);
+    std::vector<std::pair<int, int>> tiles;
+    while (prefetcher.next(tile))
+        tiles.emplace_back(tile.getTilePosX() / TileTwips, tile.getTilePosY() / TileTwips);
+    CPPUNIT_ASSERT(!prefetcher.needsPlan());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(4), tiles.size());
+    CPPUNIT_ASSERT(tiles[0] == std::make_pair(0, 2));
+    CPPUNIT_ASSERT(tiles[3] == std::make_pair(1, 3));
+    CPPUNIT_ASSERT_EQUAL(256, tile.getWidth());
+
+    // Scrolling up prefetches above, nearest first, then the next part.
+    prefetcher.setVisibleArea(0, 4 * TileTwips, 2 * TileTwips, 2 * TileTwips);
+    prefetcher.setVisibleArea(0, 3 * TileTwips, 2 * TileTwips, 2 * TileTwips);
+    prefetcher.plan(0, docWidth, docHeight, 1);
+    CPPUNIT_ASSERT(prefetcher.next(tile));
+    CPPUNIT_ASSERT_EQUAL(0, tile.getPart());
+    CPPUNIT_ASSERT_EQUAL(TileTwips, tile.getTilePosY());
+    CPPUNIT_ASSERT(prefetcher.next(tile));
+    CPPUNIT_ASSERT(prefetcher.next(tile));
+    CPPUNIT_ASSERT_EQUAL(1, tile.getPart());
+    CPPUNIT_ASSERT_EQUAL(3 * TileTwips, tile.getTilePosY());
+
+    // Real requests drop the plan, and it's made again when idle.
+    CPPUNIT_ASSERT(prefetcher.hasPending());
+    prefetcher.cancel();
+    CPPUNIT_ASSERT(!prefetcher.hasPending());
+    CPPUNIT_ASSERT(prefetcher.needsPlan());
+
+    // Tiles already rendered are skipped, until invalidated.
+    prefetcher.setVisibleArea(0, 0, 2 * TileTwips, 2 * TileTwips);
+    prefetcher.setVisibleArea(0, TileTwips, 2 * TileTwips, 2 * TileTwips);
+    prefetcher.rendered(TileDesc(0, 256, 256, 0, 4 * TileTwips, TileTwips, TileTwips, -1, 0, -1, false));
+    prefetcher.plan(0, docWidth, docHeight, -1);
+    CPPUNIT_ASSERT(prefetcher.next(tile));
+    CPPUNIT_ASSERT_EQUAL(TileTwips, tile.getTilePosX());
+    CPPUNIT_ASSERT_EQUAL(4 * TileTwips, tile.getTilePosY());
+    CPPUNIT_ASSERT(!prefetcher.next(tile));
+
+    prefetcher.invalidate(0, 10, 3 * TileTwips + 10, 100, 100);
+    CPPUNIT_ASSERT(prefetcher.needsPlan());
+    prefetcher.plan(0, docWidth, docHeight, -1);
+    CPPUNIT_ASSERT(prefetcher.next(tile));
+    CPPUNIT_ASSERT_EQUAL(0, tile.getTilePosX());
+    CPPUNIT_ASSERT_EQUAL(3 * TileTwips, tile.getTilePosY());
+    CPPUNIT_ASSERT(!prefetcher.next(tile));
+
+    // Nothing past the end of the document, nor beyond the limit.
+    prefetcher.invalidateAll();
+    prefetcher.setVisibleArea(0, 8 * TileTwips, 2 * TileTwips, 2 * TileTwips);
+    prefetcher.plan(0, docWidth, docHeight, -1);
+    CPPUNIT_ASSERT(!prefetcher.hasPending());
+    prefetcher.setMaxTiles(3);
+    prefetcher.setVisibleArea(0, 4 * TileTwips, 2 * TileTwips, 2 * TileTwips);
+    prefetcher.plan(0, docWidth, docHeight, -1);
+    unsigned count = 0;
+    while (prefetcher.next(tile))
+        ++count;
+    CPPUNIT_ASSERT_EQUAL(3U, count);
+
+    // A new zoom makes all of them stale.
+    prefetcher.setZoom(256, 256, 2 * TileTwips, 2 * TileTwips);
+    CPPUNIT_ASSERT(prefetcher.needsPlan());
+}
+
+void WhiteBoxTests::testHistogram()
+{
+    Histogram histogram;
+    CPPUNIT_ASSERT_EQUAL(0U, histogram.getCount());
+    CPPUNIT_ASSERT_EQUAL(0.0, histogram.getPercentile(0.5));
+
+    // Power-of-two buckets, the last one open-ended.
+    histogram.add(0.5);
+    histogram.add(1);
+    histogram.add(3);
+    histogram.add(3.5);
+    histogram.add(5000);
+    CPPUNIT_ASSERT_EQUAL(5U, histogram.getCount());
+    CPPUNIT_ASSERT_EQUAL(1U, histogram.getBucket(0));
+    CPPUNIT_ASSERT_EQUAL(1U, histogram.getBucket(1));
+    CPPUNIT_ASSERT_EQUAL(2U, histogram.getBucket(2));
+    CPPUNIT_ASSERT_EQUAL(1U, histogram.getBucket(Histogram::BucketCount - 1));
+
+    CPPUNIT_ASSERT_EQUAL(4.0, histogram.getPercentile(0.5));
+    CPPUNIT_ASSERT_EQUAL(5000.0, histogram.getPercentile(0.99));
+    CPPUNIT_ASSERT_EQUAL(std::string("wait=1,1,2,0,0,0,0,0,0,0,0,1 wait_p50=4 wait_p99=5000 wait_max=5000"),
+                         histogram.toString("wait"));
+
+    // Percentiles don't exceed the largest sample.
+    histogram.clear();
+    histogram.add(20);
+    CPPUNIT_ASSERT_EQUAL(20.0, histogram.getPercentile(0.5));
+}
+
+void WhiteBoxTests::testTileCoalescer()
+{
+    constexpr int TileTwips = 3840;
+    const auto tile = [](const int part, const int x, const int y, const int twips)
+    {
+        return TileDesc(part, 256, 256, x, y, twips, twips, -1, 0, -1, false);
+    };
+
+    TileCoalescer coalescer;
+
+    // Neighbours are combined, even on the next row, but not those far
+    // away, of another part or zoom, or off the grid.
+    const std::vector<TileDesc> tiles =
+    {
+        tile(0, 0, 0, TileTwips),
+        tile(0, TileTwips, 0, TileTwips),
+        tile(0, 0, TileTwips, TileTwips),
+        tile(0, 20 * TileTwips, 0, TileTwips),
+        tile(1, TileTwips, TileTwips, TileTwips),
+        tile(0, TileTwips, TileTwips, 2 * TileTwips),
+        tile(0, TileTwips / 2, 0, TileTwips)
+    };
+    CPPUNIT_ASSERT(std::vector<size_t>({ 1, 2 }) == coalescer.coalesce(tiles));
+
+    // Combining across a gap pays off only while each paint has an overhead.
+    const std::vector<TileDesc> gap = { tile(0, 0, 0, TileTwips), tile(0, 2 * TileTwips, 0, TileTwips) };
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), coalescer.coalesce(gap).size());
+
+    for (int i = 0; i < 200; ++i)
+    {
+        const double pixels = 256 * 256 * (1 + i % 8);
+        coalescer.addSample(pixels, pixels / 1e6 * 10);
+    }
+
+    CPPUNIT_ASSERT_EQUAL(0L, std::lround(coalescer.getOverheadMs()));
+    CPPUNIT_ASSERT_EQUAL(100L, std::lround(coalescer.getMegaPixelsPerSec()));
+    CPPUNIT_ASSERT(coalescer.coalesce(gap).empty());
+
+    for (int i = 0; i < 200; ++i)
+    {
+        const double pixels = 256 * 256 * (1 + i % 8);
+        coalescer.addSample(pixels, 30 + pixels / 1e6 * 10);
+    }
+
+    CPPUNIT_ASSERT_EQUAL(30L, std::lround(coalescer.getOverheadMs()));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), coalescer.coalesce(gap).size());
+}
+
+void WhiteBoxTests::testTileCachePolicy()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const auto ago = [now](const int secs) { return now - std::chrono::seconds(secs); };
+
+    TileCachePolicy policy;
+    policy.add("a", "1", "z1", 100, ago(30));
+    policy.add("a", "2", "z1", 100, ago(30));
+    policy.add("a", "3", "z1", 100, ago(30));
+    policy.add("a", "4", "z2", 100, ago(25));
+    policy.add("b", "1", "z1", 100, ago(10));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(500), policy.getBytes());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(400), policy.getBytes("a"));
+
+    // Saving a tile again replaces it.
+    policy.add("b", "1", "z1", 50, ago(10));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(450), policy.getBytes());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(5), policy.getTileCount());
+
+    // Nothing to evict without a budget.
+    CPPUNIT_ASSERT(policy.pickVictims(now).empty());
+
+    // The tile of the rarely used zoom goes first, though more recent.
+    policy.setMaxBytes(400);
+    std::vector<TileCachePolicy::Victim> victims = policy.pickVictims(now);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), victims.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("a"), victims[0]._dir);
+    CPPUNIT_ASSERT_EQUAL(std::string("4"), victims[0]._name);
+    CPPUNIT_ASSERT(!policy.has("a", "4"));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(350), policy.getBytes());
+
+    // Then the least recently used, down to below the budget.
+    policy.touch("a", "1", now);
+    policy.setMaxBytes(200);
+    victims = policy.pickVictims(now);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), victims.size());
+    CPPUNIT_ASSERT(policy.has("a", "1"));
+    CPPUNIT_ASSERT(policy.has("b", "1"));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(150), policy.getBytes());
+
+    policy.remove("b", "1");
+    policy.removeAll("a");
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), policy.getBytes());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), policy.getTileCount());
+
+    // Only the directories without tiles, nor a tile cache open in them, are removed.
+    policy.open("c");
+    policy.addDir("c");
+    policy.addDir("d");
+    std::vector<std::string> removed;
+    policy.removeEmptyDirs([&removed](const std::string& dir) { removed.push_back(dir); });
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), removed.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("b"), removed[0]);
+    CPPUNIT_ASSERT_EQUAL(std::string("d"), removed[1]);
+
+    policy.close("c");
+    removed.clear();
+    policy.removeEmptyDirs([&removed](const std::string& dir) { removed.push_back(dir); });
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), removed.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("c"), removed[0]);
+}
+
+void WhiteBoxTests::testLogBuffer()
+{
+    LogBuffer buffer(2);
+    CPPUNIT_ASSERT(buffer.empty());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), buffer.capacity());
+
+    LogBuffer::Entry entry;
+    CPPUNIT_ASSERT(!buffer.pop(entry));
+
+    CPPUNIT_ASSERT(buffer.push(LogBuffer::Entry(1, 6, "first")));
+    CPPUNIT_ASSERT(buffer.push(LogBuffer::Entry(2, 6, "second")));
+
+    // Full: the entry is left to the caller.
+    LogBuffer::Entry third(3, 4, "third");
+    CPPUNIT_ASSERT(!buffer.push(std::move(third)));
+    CPPUNIT_ASSERT_EQUAL(std::string("third"), third._text);
+
+    CPPUNIT_ASSERT(buffer.pop(entry));
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(1), entry._seq);
+    CPPUNIT_ASSERT_EQUAL(std::string("first"), entry._text);
+
+    // Wraps around.
+    CPPUNIT_ASSERT(buffer.push(std::move(third)));
+    CPPUNIT_ASSERT(buffer.pop(entry));
+    CPPUNIT_ASSERT_EQUAL(std::string("second"), entry._text);
+    CPPUNIT_ASSERT(buffer.pop(entry));
+    CPPUNIT_ASSERT_EQUAL(4, entry._priority);
+    CPPUNIT_ASSERT_EQUAL(std::string("third"), entry._text);
+    CPPUNIT_ASSERT(buffer.empty());
+
+    // Tells the reader the lowest number it may be pushing.
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(LogBuffer::NotPushing), buffer.getPushing());
+    buffer.beginPush(5);
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(5), buffer.getPushing());
+    buffer.endPush();
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(LogBuffer::NotPushing), buffer.getPushing());
+
+    CPPUNIT_ASSERT(!buffer.isClosed());
+    buffer.close();
+    CPPUNIT_ASSERT(buffer.isClosed());
+}
+
+void WhiteBoxTests::testBinaryTraceRecord()
+{
+    std::string data;
+    TraceFileRecord::appendBinaryHeader(data, 1234567);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(TraceFileRecord::BinaryHeaderSize), data.size());
+    CPPUNIT_ASSERT(TraceFileRecord::isBinary(data));
+    CPPUNIT_ASSERT(!TraceFileRecord::isBinary("-0-42-0001-NewSession: file:///doc.odt"));
+
+    TraceFileRecord::appendBinary(data, TraceFileRecord::Direction::Incoming, 5000000000LL,
+                                  "42", "0001", "key type=input char=97 key=0");
+    TraceFileRecord::appendBinary(data, TraceFileRecord::Direction::Outgoing, 5000000001LL,
+                                  "42", "", "");
+
+    size_t pos = TraceFileRecord::BinaryHeaderSize;
+    TraceFileRecord rec;
+    CPPUNIT_ASSERT(rec.readBinary(data, pos));
+    CPPUNIT_ASSERT(rec.Dir == TraceFileRecord::Direction::Incoming);
+    CPPUNIT_ASSERT_EQUAL(static_cast<Poco::Int64>(5000000000LL), rec.TimestampNs);
+    CPPUNIT_ASSERT_EQUAL(42U, rec.Pid);
+    CPPUNIT_ASSERT_EQUAL(std::string("0001"), rec.SessionId);
+    CPPUNIT_ASSERT_EQUAL(std::string("key type=input char=97 key=0"), rec.Payload);
+
+    CPPUNIT_ASSERT(rec.readBinary(data, pos));
+    CPPUNIT_ASSERT(rec.Dir == TraceFileRecord::Direction::Outgoing);
+    CPPUNIT_ASSERT(rec.SessionId.empty());
+    CPPUNIT_ASSERT(rec.Payload.empty());
+    CPPUNIT_ASSERT_EQUAL(data.size(), pos);
+
+    // A record cut short is rejected, and the position kept.
+    const std::string truncated = data.substr(0, data.size() - 1);
+    pos = TraceFileRecord::BinaryHeaderSize;
+    CPPUNIT_ASSERT(rec.readBinary(truncated, pos));
+    const size_t last = pos;
+    CPPUNIT_ASSERT(!rec.readBinary(truncated, pos));
+    CPPUNIT_ASSERT_EQUAL(last, pos);
+}
+
+void WhiteBoxTests::testMetrics()
+{
+    // Exact below 4 us, then 4 buckets per power of two.
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), MetricHistogram::getIndex(3));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(4), MetricHistogram::getIndex(4));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(8), MetricHistogram::getIndex(8));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(8), MetricHistogram::getIndex(9));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(9), MetricHistogram::getIndex(10));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(MetricHistogram::BucketCount - 1),
+                         MetricHistogram::getIndex(static_cast<uint64_t>(1) << 40));
+    for (uint64_t us = 1; us < 100000; us = us * 3 / 2 + 1)
+    {
+        const size_t index = MetricHistogram::getIndex(us);
+        CPPUNIT_ASSERT(us < MetricHistogram::getUpperBound(index));
+        CPPUNIT_ASSERT(index == 0 || us >= MetricHistogram::getUpperBound(index - 1));
+        // Within 25%.
+        CPPUNIT_ASSERT(MetricHistogram::getUpperBound(index) <= us + us / 4 + 1);
+    }
+
+    MetricHistogram histogram;
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(0), histogram.getPercentile(0.5));
+    for (int i = 0; i < 98; ++i)
+    {
+        histogram.addMs(1);
+    }
+
+    histogram.add(100000);
+    histogram.add(200000);
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(100), histogram.getCount());
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(398000), histogram.getSum());
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(1024), histogram.getPercentile(0.5));
+    CPPUNIT_ASSERT(histogram.getPercentile(1) > 200000);
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(98), histogram.getCountBelow(1024));
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(99), histogram.getCountBelow(131072));
+
+    std::ostringstream oss;
+    Metrics::writeHistogram(oss, "test_seconds", "Test.", histogram);
+    const std::string text = oss.str();
+    CPPUNIT_ASSERT(text.find("# TYPE test_seconds histogram\n") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("test_seconds_bucket{le=\"0.000512\"} 0\n") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("test_seconds_bucket{le=\"0.001024\"} 98\n") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("test_seconds_bucket{le=\"0.131072\"} 99\n") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("test_seconds_bucket{le=\"+Inf\"} 100\n") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("test_seconds_sum 0.398\n") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("test_seconds_count 100\n") != std::string::npos);
+
+    oss.str("");
+    Metrics::writeGauge(oss, "test_gauge", "Test.", 2.5);
+    CPPUNIT_ASSERT_EQUAL(std::string("# HELP test_gauge Test.\n# TYPE test_gauge gauge\ntest_gauge 2.5\n"), oss.str());
+
+    MetricGauge gauge;
+    gauge.add(5);
+    gauge.add(-7);
+    CPPUNIT_ASSERT_EQUAL(static_cast<int64_t>(-2), gauge.get());
+}
+
+void WhiteBoxTests::testTileTrace()
+{
+    // Untraced tiles serialize as before.
+    TileDesc tile = TileDesc::parse("tile part=0 width=256 height=256 tileposx=0 tileposy=3840 tilewidth=3840 tileheight=3840 ver=5");
+    CPPUNIT_ASSERT_EQUAL(0, tile.getTraceId());
+    CPPUNIT_ASSERT(tile.serialize().find("trace") == std::string::npos);
+
+    TileTracer tracer;
+    tracer.requested(tile, 1000);
+    CPPUNIT_ASSERT_EQUAL(1, tile.getTraceId());
+    tracer.forwarded(tile);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), tracer.getPendingCount());
+
+    // The Kit stamps its stages and sends them back.
+    TileDesc kitTile = TileDesc::parse(tile.serialize());
+    CPPUNIT_ASSERT_EQUAL(1, kitTile.getTraceId());
+    CPPUNIT_ASSERT(!kitTile.hasKitStamps());
+    kitTile.setStamp(TileTrace::Queued, 2000);
+    kitTile.setStamp(TileTrace::Dequeued, 3000);
+    kitTile.setStamp(TileTrace::Painted, 5000);
+    kitTile.setStamp(TileTrace::Encoded, 6000);
+    const std::string response = kitTile.serialize("tile:");
+    CPPUNIT_ASSERT(response.find(" traceid=1 tracets=2000:3000:5000:6000") != std::string::npos);
+
+    TileDesc received = TileDesc::parse(response);
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(5000), received.getStamp(TileTrace::Painted));
+    tracer.received(received);
+    received.clearKitStamps();
+    CPPUNIT_ASSERT(received.serialize("tile:").find("tracets") == std::string::npos);
+    tracer.enqueued(received.getTraceId());
+    tracer.sent(received.getTraceId());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), tracer.getPendingCount());
+    CPPUNIT_ASSERT_EQUAL(1u, tracer.getCompleted());
+
+    // The stamps of the Kit are accounted as they were.
+    CPPUNIT_ASSERT_EQUAL(1u, tracer.getHistogram(TileTracer::Queue).getBucket(1));
+    CPPUNIT_ASSERT_EQUAL(1u, tracer.getHistogram(TileTracer::Paint).getBucket(2));
+    CPPUNIT_ASSERT_EQUAL(1u, tracer.getHistogram(TileTracer::Encode).getBucket(1));
+    CPPUNIT_ASSERT_EQUAL(1u, tracer.getHistogram(TileTracer::Total).getCount());
+    CPPUNIT_ASSERT(tracer.toString().find("traced=1") != std::string::npos);
+
+    // Missing stamps skip their intervals.
+    TileTrace::Stamps stamps;
+    stamps.fill(0);
+    stamps[TileTrace::Requested] = 10;
+    CPPUNIT_ASSERT_EQUAL(-1.0, TileTracer::getIntervalUs(stamps, TileTrace::Requested, TileTrace::Sent));
+    stamps[TileTrace::Sent] = 25;
+    CPPUNIT_ASSERT_EQUAL(15.0, TileTracer::getIntervalUs(stamps, TileTrace::Requested, TileTrace::Sent));
+
+    // Tilecombine carries a trace id and stamps per tile.
+    std::vector<TileDesc> tiles;
+    tiles.push_back(TileDesc(0, 256, 256, 0, 0, 3840, 3840, 1, 0, -1, false));
+    tiles.push_back(TileDesc(0, 256, 256, 3840, 0, 3840, 3840, 2, 0, -1, false));
+    tiles[1].setTraceId(7);
+    tiles[1].setStamp(TileTrace::Encoded, 42);
+    const TileCombined tileCombined = TileCombined::parse(TileCombined::create(tiles).serialize("tilecombine"));
+    CPPUNIT_ASSERT(tileCombined.isTraced());
+    CPPUNIT_ASSERT_EQUAL(0, tileCombined.getTiles()[0].getTraceId());
+    CPPUNIT_ASSERT_EQUAL(7, tileCombined.getTiles()[1].getTraceId());
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(42), tileCombined.getTiles()[1].getStamp(TileTrace::Encoded));
+
+    // Not traced while disabled.
+    tracer.setEnabled(false);
+    tracer.requested(tile, 1000);
+    CPPUNIT_ASSERT_EQUAL(0, tile.getTraceId());
+
+    // Those of the clients are dropped.
+    TileDesc clientTile = TileDesc::parse("tile part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840 traceid=3 tracets=1:2:3:4");
+    CPPUNIT_ASSERT(clientTile.hasKitStamps());
+    clientTile.clearTrace();
+    CPPUNIT_ASSERT_EQUAL(0, clientTile.getTraceId());
+    CPPUNIT_ASSERT(!clientTile.hasKitStamps());
+
+    // The oldest pending traces are forgotten first, even once the ids wrapped around.
+    TileTracer pendingTracer;
+    TileDesc pendingTile(0, 256, 256, 0, 0, 3840, 3840, 1, 0, -1, false);
+    pendingTile.setTraceId(std::numeric_limits<int>::max());
+    pendingTracer.forwarded(pendingTile);
+    for (int id = 1; id <= 1024; ++id)
+    {
+        pendingTile.setTraceId(id);
+        pendingTracer.forwarded(pendingTile);
+    }
+
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1024), pendingTracer.getPendingCount());
+    pendingTracer.sent(std::numeric_limits<int>::max());
+    CPPUNIT_ASSERT_EQUAL(0u, pendingTracer.getCompleted());
+    pendingTracer.sent(1);
+    CPPUNIT_ASSERT_EQUAL(1u, pendingTracer.getCompleted());
+}
+
+void WhiteBoxTests::testBenchmarkCompare()
+{
+    std::vector<long> samples = { 5, 1, 4, 2, 3 };
+    CPPUNIT_ASSERT_EQUAL(3L, percentile(samples, 50));
+    CPPUNIT_ASSERT_EQUAL(5L, percentile(samples, 100));
+
+    BenchmarkReport before("scroll");
+    BenchmarkReport after("scroll");
+    for (long us = 1000; us <= 100000; us += 1000)
+    {
+        before.addSample("screen", us);
+        // Slower by half at the tail only.
+        after.addSample("screen", (us > 95000 ? us * 3 / 2 : us));
+    }
+
+    std::vector<BenchmarkReport> baselineReports;
+    baselineReports.push_back(before);
+    baselineReports.push_back(BenchmarkReport("typing"));
+    std::vector<BenchmarkReport> currentReports;
+    currentReports.push_back(after);
+
+    std::stringstream baseline;
+    BenchmarkReport::write(baseline, baselineReports, { { "server", "http://\"localhost\"" } });
+    CPPUNIT_ASSERT(baseline.str().find("\"server\": \"http://\\\"localhost\\\"\"") != std::string::npos);
+    CPPUNIT_ASSERT(baseline.str().find("\"screen\": { \"count\": 100, \"min\": 1000,") != std::string::npos);
+
+    std::stringstream current;
+    BenchmarkReport::write(current, currentReports, {});
+
+    // Only the p99 got worse.
+    std::ostringstream oss;
+    CPPUNIT_ASSERT_EQUAL(1u, BenchmarkReport::compare(baseline, current, 10, oss));
+    CPPUNIT_ASSERT(oss.str().find("scroll screen p50 us: 50500.0 -> 50500.0 (+0.0%)\n") != std::string::npos);
+    CPPUNIT_ASSERT(oss.str().find("scroll screen p99 us:") < oss.str().find("REGRESSION"));
+    CPPUNIT_ASSERT(oss.str().find("typing: not run") != std::string::npos);
+
+    // Not beyond a larger threshold.
+    baseline.clear();
+    baseline.seekg(0);
+    current.clear();
+    current.seekg(0);
+    oss.str("");
+    CPPUNIT_ASSERT_EQUAL(0u, BenchmarkReport::compare(baseline, current, 60, oss));
+}
+
+void WhiteBoxTests::testTokenSpans()
+{
+    const std::string message = "  tile part=0  width=256 height=-3\nbinary data";
+    const LOOLProtocol::TokenSpans spans(message);
+    const auto tokens = LOOLProtocol::tokenize(message);
+    CPPUNIT_ASSERT_EQUAL(tokens.size(), spans.size());
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        CPPUNIT_ASSERT_EQUAL(tokens[i], spans[i].toString());
+    }
+
+    // Over the message, not copies of it.
+    CPPUNIT_ASSERT(spans[0].data() == message.data() + 2);
+    CPPUNIT_ASSERT(spans[0] == "tile");
+    CPPUNIT_ASSERT(spans[0] != "til");
+
+    int value = 0;
+    CPPUNIT_ASSERT(LOOLProtocol::getTokenInteger(spans, "width", value));
+    CPPUNIT_ASSERT_EQUAL(256, value);
+    CPPUNIT_ASSERT(LOOLProtocol::getTokenInteger(spans[3], "height", value));
+    CPPUNIT_ASSERT_EQUAL(-3, value);
+    CPPUNIT_ASSERT(!LOOLProtocol::getTokenInteger(spans, "data", value));
+
+    // More tokens than fit inline.
+    std::string longMessage = "tilecombine";
+    for (int i = 0; i < 40; ++i)
+    {
+        longMessage += " t" + std::to_string(i) + '=' + std::to_string(i);
+    }
+
+    const LOOLProtocol::TokenSpans longSpans(longMessage);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(41), longSpans.size());
+    CPPUNIT_ASSERT(LOOLProtocol::getTokenInteger(longSpans, "t39", value));
+    CPPUNIT_ASSERT_EQUAL(39, value);
+
+    CPPUNIT_ASSERT(LOOLProtocol::stringToInteger(LOOLProtocol::StringSpan(std::string("2147483647")), value));
+    CPPUNIT_ASSERT_EQUAL(2147483647, value);
+    CPPUNIT_ASSERT(!LOOLProtocol::stringToInteger(LOOLProtocol::StringSpan(std::string("2147483648")), value));
+    CPPUNIT_ASSERT(!LOOLProtocol::stringToInteger(LOOLProtocol::StringSpan(std::string("-")), value));
+    CPPUNIT_ASSERT(LOOLProtocol::stringToInteger(LOOLProtocol::StringSpan(std::string("-2147483648")), value));
+    CPPUNIT_ASSERT_EQUAL(std::numeric_limits<int>::min(), value);
+
+    const std::string list = " 1,2,,3, ";
+    LOOLProtocol::ListTokenizer listTokenizer(LOOLProtocol::StringSpan(list), ',');
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), listTokenizer.count());
+    LOOLProtocol::StringSpan item;
+    std::string items;
+    while (listTokenizer.next(item))
+    {
+        items += item.toString() + ';';
+    }
+
+    CPPUNIT_ASSERT_EQUAL(std::string("1;2;3;"), items);
+
+    // The parsers agree with the serializers.
+    const std::string tileMessage =
+        "tile part=2 width=256 height=256 tileposx=3840 tileposy=7680 tilewidth=3840 tileheight=3840 ver=12 id=4";
+    const TileDesc tile = TileDesc::parse(LOOLProtocol::TokenSpans(tileMessage));
+    CPPUNIT_ASSERT_EQUAL(2, tile.getPart());
+    CPPUNIT_ASSERT_EQUAL(7680, tile.getTilePosY());
+    CPPUNIT_ASSERT_EQUAL(12, tile.getVersion());
+    CPPUNIT_ASSERT_EQUAL(tile.serialize(), TileDesc::parse(tile.serialize()).serialize());
+
+    const TileCombined tileCombined = TileCombined::parse(
+        "tilecombine part=0 width=256 height=256 tileposx=0,3840,7680 tileposy=0,0,0 tilewidth=3840 tileheight=3840 ver=1,2,3");
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), tileCombined.getTiles().size());
+    CPPUNIT_ASSERT_EQUAL(7680, tileCombined.getTiles()[2].getTilePosX());
+    CPPUNIT_ASSERT_EQUAL(3, tileCombined.getTiles()[2].getVersion());
+    CPPUNIT_ASSERT_EQUAL(tileCombined.serialize("tilecombine"),
+                         TileCombined::parse(tileCombined.serialize("tilecombine")).serialize("tilecombine"));
+
+    // Mismatched lists are rejected, as before.
+    CPPUNIT_ASSERT_THROW(TileCombined::parse(
+        "tilecombine part=0 width=256 height=256 tileposx=0,3840 tileposy=0 tilewidth=3840 tileheight=3840"),
+        std::exception);
+}
+
+void WhiteBoxTests::testCommands()
+{
+    using LOOLProtocol::Command;
+
+    // Each name maps back to its command.
+    for (size_t index = 1; index < LOOLProtocol::CommandCount; ++index)
+    {
+        const Command command = static_cast<Command>(index);
+        CPPUNIT_ASSERT(command == LOOLProtocol::getCommand(std::string(LOOLProtocol::getCommandName(command))));
+    }
+
+    const std::string message = "tilecombine part=0 width=256";
+    const LOOLProtocol::TokenSpans tokens(message);
+    CPPUNIT_ASSERT(Command::TileCombine == LOOLProtocol::getCommand(tokens[0]));
+    CPPUNIT_ASSERT(Command::Tile == LOOLProtocol::getCommand(LOOLProtocol::StringSpan(message.data(), 4)));
+
+    CPPUNIT_ASSERT(Command::Unknown == LOOLProtocol::getCommand(std::string("tiles")));
+    CPPUNIT_ASSERT(Command::Unknown == LOOLProtocol::getCommand(std::string("Tile")));
+    CPPUNIT_ASSERT(Command::Unknown == LOOLProtocol::getCommand(std::string("unknown")));
+    CPPUNIT_ASSERT(Command::Unknown == LOOLProtocol::getCommand(std::string()));
+    CPPUNIT_ASSERT_EQUAL(std::string("unknown"), std::string(LOOLProtocol::getCommandName(Command::Count)));
+
+    CPPUNIT_ASSERT(LOOLProtocol::isClientCommand(Command::Key));
+    CPPUNIT_ASSERT(LOOLProtocol::isClientCommand(Command::UserInactive));
+    CPPUNIT_ASSERT(!LOOLProtocol::isClientCommand(Command::Unknown));
+    CPPUNIT_ASSERT(!LOOLProtocol::isClientCommand(Command::Callback));
+    CPPUNIT_ASSERT(!LOOLProtocol::isClientCommand(Command::Eof));
+
+    // Counted by command in the metrics.
+    Metrics::instance()._clientCommands[static_cast<size_t>(Command::Uno)].inc(3);
+    std::ostringstream oss;
+    Metrics::instance().write(oss, {});
+    const std::string text = oss.str();
+    CPPUNIT_ASSERT(text.find("# TYPE loolwsd_client_commands_total counter\n") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("loolwsd_client_commands_total{command=\"uno\"} 3\n") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("loolwsd_client_commands_total{command=\"unknown\"} ") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("{command=\"callback\"}") == std::string::npos);
+}
+
+void WhiteBoxTests::testJsonValue()
+{
+    const std::string json = "{ \"viewId\": \"3\", \"part\":0,\n"
+                             "  \"nested\": { \"depth\": 2 }, \"name\": \"a \\\"depth\\\": 1\",\n"
+                             "  \"list\": [ 1, 2 ], \"rectangle\": \"3999, 1418, 0, 298\", \"negative\": -7 }";
+    const LOOLProtocol::StringSpan span(json);
+
+    int value = 0;
+    CPPUNIT_ASSERT(LOOLProtocol::getJsonInteger(span, "viewId", value));
+    CPPUNIT_ASSERT_EQUAL(3, value);
+    CPPUNIT_ASSERT(LOOLProtocol::getJsonInteger(span, "part", value));
+    CPPUNIT_ASSERT_EQUAL(0, value);
+    CPPUNIT_ASSERT(LOOLProtocol::getJsonInteger(span, "negative", value));
+    CPPUNIT_ASSERT_EQUAL(-7, value);
+
+    // Only the members of the top-level object, not of those nested, nor in strings.
+    CPPUNIT_ASSERT(!LOOLProtocol::getJsonInteger(span, "depth", value));
+    CPPUNIT_ASSERT(!LOOLProtocol::getJsonInteger(span, "missing", value));
+
+    LOOLProtocol::StringSpan str;
+    CPPUNIT_ASSERT(LOOLProtocol::getJsonValue(span, "name", str));
+    CPPUNIT_ASSERT_EQUAL(std::string("a \\\"depth\\\": 1"), str.toString());
+    CPPUNIT_ASSERT(!LOOLProtocol::getJsonValue(span, "nested", str));
+    CPPUNIT_ASSERT(!LOOLProtocol::getJsonValue(span, "list", str));
+
+    // Malformed.
+    CPPUNIT_ASSERT(!LOOLProtocol::getJsonValue(LOOLProtocol::StringSpan(std::string("{ \"viewId\": \"3")), "viewId", str));
+    CPPUNIT_ASSERT(!LOOLProtocol::getJsonValue(LOOLProtocol::StringSpan(std::string("{ \"viewId\": }")), "viewId", str));
+    CPPUNIT_ASSERT(!LOOLProtocol::getJsonValue(LOOLProtocol::StringSpan(), "viewId", str));
+
+    int x, y, width, height;
+    CPPUNIT_ASSERT(LOOLProtocol::getJsonValue(span, "rectangle", str));
+    CPPUNIT_ASSERT(LOOLProtocol::parseRectangle(str, x, y, width, height));
+    CPPUNIT_ASSERT_EQUAL(3999, x);
+    CPPUNIT_ASSERT_EQUAL(1418, y);
+    CPPUNIT_ASSERT_EQUAL(0, width);
+    CPPUNIT_ASSERT_EQUAL(298, height);
+    CPPUNIT_ASSERT(!LOOLProtocol::parseRectangle(LOOLProtocol::StringSpan(std::string("EMPTY")), x, y, width, height));
+    CPPUNIT_ASSERT(!LOOLProtocol::parseRectangle(LOOLProtocol::StringSpan(std::string("1, 2, 3")), x, y, width, height));
+}
+
+void WhiteBoxTests::testTileInvalidations()
+{
+    TileInvalidations invalidations;
+
+    // The same area from each view is searched for once.
+    CPPUNIT_ASSERT(invalidations.add("invalidatetiles: part=0 x=284 y=1418 width=11105 height=275"));
+    CPPUNIT_ASSERT(invalidations.add("invalidatetiles: part=0 x=284 y=1418 width=11105 height=275"));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), invalidations.getAreas().size());
+
+    // Those touching are merged, but not across parts.
+    CPPUNIT_ASSERT(invalidations.add("invalidatetiles: part=0 x=284 y=1693 width=11105 height=275"));
+    CPPUNIT_ASSERT(invalidations.add("invalidatetiles: part=1 x=284 y=1693 width=11105 height=275"));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), invalidations.getAreas().size());
+    CPPUNIT_ASSERT_EQUAL(std::string("invalidatetiles: part=0 x=284 y=1418 width=11105 height=550"),
+                         TileInvalidations::toMessage(invalidations.getAreas()[0]));
+
+    // Those far apart are not, lest much more be invalidated.
+    CPPUNIT_ASSERT(invalidations.add("invalidatetiles: part=0 x=284 y=141800 width=11105 height=275"));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), invalidations.getAreas().size());
+
+    // Grown by a merge, an area absorbs those it reaches now.
+    CPPUNIT_ASSERT(invalidations.add("invalidatetiles: part=1 x=0 y=0 width=3840 height=3840"));
+    CPPUNIT_ASSERT(invalidations.add("invalidatetiles: part=1 x=3840 y=0 width=3840 height=3840"));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), invalidations.getAreas().size());
+    CPPUNIT_ASSERT_EQUAL(std::string("invalidatetiles: part=1 x=0 y=0 width=11389 height=3840"),
+                         TileInvalidations::toMessage(invalidations.getAreas()[2]));
+
+    // All the part.
+    CPPUNIT_ASSERT(invalidations.add("invalidatetiles: EMPTY, 0"));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), invalidations.getAreas().size());
+    CPPUNIT_ASSERT_EQUAL(std::string("invalidatetiles: part=0 x=0 y=0 width=2147483647 height=2147483647"),
+                         TileInvalidations::toMessage(invalidations.getAreas()[1]));
+
+    // All the parts, as the clients take it.
+    CPPUNIT_ASSERT(invalidations.add("invalidatetiles: EMPTY"));
+    CPPUNIT_ASSERT_EQUAL(std::string("invalidatetiles: EMPTY"),
+                         TileInvalidations::toMessage(invalidations.getAreas().back()));
+
+    CPPUNIT_ASSERT(!invalidations.add("invalidatetiles: part=0 x=0"));
+    CPPUNIT_ASSERT(!invalidations.add("invalidatecursor: 0, 0, 10, 10"));
+
+    invalidations.clear();
+    CPPUNIT_ASSERT(invalidations.empty());
+}
+
+void WhiteBoxTests::testPreviewCache()
+{
+    // Identical documents share their previews, at the same part and size only.
+    std::istringstream document("Hello, World!");
+    std::ostringstream upload;
+    const std::string digest = PreviewCache::copyDigested(document, upload);
+    CPPUNIT_ASSERT_EQUAL(document.str(), upload.str());
+
+    std::istringstream same("Hello, World!");
+    std::istringstream other("Hello, Sailor!");
+    std::ostringstream discard;
+    CPPUNIT_ASSERT_EQUAL(digest, PreviewCache::copyDigested(same, discard));
+    CPPUNIT_ASSERT(digest != PreviewCache::copyDigested(other, discard));
+
+    const std::string key = PreviewCache::getKey(digest, 0, 256, 256);
+    CPPUNIT_ASSERT_EQUAL(key, PreviewCache::getKey(digest, 0, 256, 256));
+    CPPUNIT_ASSERT(key != PreviewCache::getKey(digest, 1, 256, 256));
+    CPPUNIT_ASSERT(key != PreviewCache::getKey(digest, 0, 128, 256));
+
+    const std::string tempDir = Poco::TemporaryFile::tempName();
+    Poco::File(tempDir).createDirectories();
+    const auto writePreview = [&tempDir](const std::string& name, const size_t size) -> std::string
+    {
+        const std::string path = Poco::Path(tempDir, name + ".png").toString();
+        std::ofstream file(path, std::ios::binary);
+        file << std::string(size, name[0]);
+        return path;
+    };
+
+    // Room for two previews of 100 bytes.
+    PreviewCache& cache = PreviewCache::instance();
+    cache.initialize(Poco::Path(tempDir, "cache").toString(), 250);
+    CPPUNIT_ASSERT(cache.isEnabled());
+
+    std::string png;
+    CPPUNIT_ASSERT(!cache.fetch("a", png));
+    cache.insert("a", writePreview("a", 100));
+    cache.insert("b", writePreview("b", 100));
+    CPPUNIT_ASSERT(cache.fetch("a", png));
+    CPPUNIT_ASSERT_EQUAL(std::string(100, 'a'), png);
+
+    // The least recently used is evicted, not the first inserted.
+    cache.insert("c", writePreview("c", 100));
+    CPPUNIT_ASSERT(!cache.fetch("b", png));
+    CPPUNIT_ASSERT(cache.fetch("a", png));
+    CPPUNIT_ASSERT(cache.fetch("c", png));
+    CPPUNIT_ASSERT_EQUAL(std::string(100, 'c'), png);
+
+    // Too large to cache, without evicting the others.
+    cache.insert("d", writePreview("d", 300));
+    CPPUNIT_ASSERT(!cache.fetch("d", png));
+    CPPUNIT_ASSERT(cache.fetch("a", png));
+    CPPUNIT_ASSERT(cache.fetch("c", png));
+
+    cache.initialize(Poco::Path(tempDir, "cache").toString(), 0);
+    CPPUNIT_ASSERT(!cache.isEnabled());
+    FileUtil::removeFile(tempDir, true);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(WhiteBoxTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,559 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Microbenchmarks of the hot paths of the protocol and of the queues,
+ * reporting the time and the heap allocations per operation, to catch
+ * regressions without a document or a running server.
+ *
+ * Usage: loolbench [--iterations=N] [filter...]
+ * Runs the benchmarks whose names contain any of the filters, or all.
+ */
+
+#include "config.h"
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <Command.hpp>
+#include <Log.hpp>
+#include <Message.hpp>
+#include <MessageQueue.hpp>
+#include <Png.hpp>
+#include <Protocol.hpp>
+#include <SenderQueue.hpp>
+#include <TileDesc.hpp>
+#include <Util.hpp>
+#include <WebSocketHandler.hpp>
+
+namespace
+{
+    /// The heap allocations made so far, by any thread.
+    std::atomic<uint64_t> Allocations(0);
+
+    /// Counts the allocation and makes it, of a byte at least. Returns nullptr on failure.
+    void* allocate(const std::size_t size)
+    {
+        Allocations.fetch_add(1, std::memory_order_relaxed);
+        return std::malloc(size ? size : 1);
+    }
+
+    void* allocateOrThrow(const std::size_t size)
+    {
+        void* p = allocate(size);
+        if (!p)
+            throw std::bad_alloc();
+
+        return p;
+    }
+
+#if __cpp_aligned_new
+    void* allocateAligned(const std::size_t size, const std::align_val_t align)
+    {
+        Allocations.fetch_add(1, std::memory_order_relaxed);
+        void* p = nullptr;
+        const std::size_t alignment = std::max(static_cast<std::size_t>(align), sizeof(void*));
+        return (posix_memalign(&p, alignment, size ? size : 1) == 0 ? p : nullptr);
+    }
+
+    void* allocateAlignedOrThrow(const std::size_t size, const std::align_val_t align)
+    {
+        void* p = allocateAligned(size, align);
+        if (!p)
+            throw std::bad_alloc();
+
+        return p;
+    }
+#endif
+}
+
+// All the replaceable forms, so that none allocates uncounted, or frees
+// what another allocated differently.
+// Not inlined, lest the compiler warns of freeing what operator new returned.
+__attribute__((noinline)) void* operator new(std::size_t size) { return allocateOrThrow(size); }
+__attribute__((noinline)) void* operator new[](std::size_t size) { return allocateOrThrow(size); }
+__attribute__((noinline)) void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+__attribute__((noinline)) void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+#if __cpp_aligned_new
+__attribute__((noinline)) void* operator new(std::size_t size, std::align_val_t align) { return allocateAlignedOrThrow(size, align); }
+__attribute__((noinline)) void* operator new[](std::size_t size, std::align_val_t align) { return allocateAlignedOrThrow(size, align); }
+__attribute__((noinline)) void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return allocateAligned(size, align); }
+__attribute__((noinline)) void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return allocateAligned(size, align); }
+
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+#endif
+
+namespace
+{
+    /// Keeps the compiler from optimizing away what was computed.
+    volatile uint64_t Sink;
+
+    unsigned Iterations = 100000;
+    std::vector<std::string> Filters;
+
+    /// Runs func, which does some operations and returns how many,
+    /// repeatedly, first to warm up, then timed, and prints the time
+    /// and the allocations per operation.
+    template <typename F>
+    void bench(const std::string& name, const unsigned iterations, F func)
+    {
+        bool selected = Filters.empty();
+        for (const auto& filter : Filters)
+        {
+            selected = selected || name.find(filter) != std::string::npos;
+        }
+
+        if (!selected)
+            return;
+
+        for (unsigned i = 0; i < std::max(iterations / 10, 1U); ++i)
+        {
+            func();
+        }
+
+        uint64_t operations = 0;
+        const uint64_t allocations = Allocations.load();
+        const auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < iterations; ++i)
+        {
+            operations += func();
+        }
+
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        const double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        const double allocs = Allocations.load() - allocations;
+
+        operations = std::max<uint64_t>(operations, 1);
+        std::cout << std::left << std::setw(32) << name << std::right
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(14) << ns / operations << " ns/op"
+                  << std::setprecision(2)
+                  << std::setw(10) << allocs / operations << " allocs/op\n";
+    }
+
+    /// A tile request, as the client sends them while scrolling.
+    std::string tileRequest(const int x, const int y, const int ver)
+    {
+        return "tile part=0 width=256 height=256 tileposx=" + std::to_string(x) +
+               " tileposy=" + std::to_string(y) + " tilewidth=3840 tileheight=3840 ver=" +
+               std::to_string(ver);
+    }
+
+    /// The requests of the tiles of a screen, 4 by 3 tiles from (x, y).
+    std::vector<std::string> screenRequests(const int x, const int y)
+    {
+        std::vector<std::string> requests;
+        for (int row = 0; row < 3; ++row)
+        {
+            for (int column = 0; column < 4; ++column)
+            {
+                requests.push_back(tileRequest(x + column * 3840, y + row * 3840, -1));
+            }
+        }
+
+        return requests;
+    }
+
+    void benchProtocol()
+    {
+        const std::string tile = tileRequest(7680, 11520, 42);
+        bench("tokenize", Iterations, [&tile]()
+        {
+            Sink = LOOLProtocol::tokenize(tile.data(), tile.size()).size();
+            return 1;
+        });
+
+        const std::vector<std::string> commands = { "tile", "tilecombine", "key", "mouse", "uno", "callback", "useractive", "bogus" };
+        bench("getCommand", Iterations, [&commands]()
+        {
+            for (const auto& command : commands)
+            {
+                Sink = static_cast<size_t>(LOOLProtocol::getCommand(command));
+            }
+
+            return commands.size();
+        });
+
+        bench("TileDesc::parse", Iterations, [&tile]()
+        {
+            Sink = TileDesc::parse(tile).getTilePosX();
+            return 1;
+        });
+
+        const TileDesc desc = TileDesc::parse(tile);
+        bench("TileDesc::serialize", Iterations, [&desc]()
+        {
+            Sink = desc.serialize("tile:").size();
+            return 1;
+        });
+
+        std::vector<TileDesc> tiles;
+        for (const auto& request : screenRequests(0, 0))
+        {
+            tiles.push_back(TileDesc::parse(request));
+        }
+
+        const std::string combined = TileCombined::create(tiles).serialize("tilecombine");
+        bench("TileCombined::parse", Iterations / 10, [&combined]()
+        {
+            Sink = TileCombined::parse(combined).getTiles().size();
+            return 1;
+        });
+
+        bench("TileCombined::serialize", Iterations / 10, [&tiles]()
+        {
+            Sink = TileCombined::create(tiles).serialize("tilecombine").size();
+            return 1;
+        });
+
+        bench("Message", Iterations, [&tile]()
+        {
+            const Message message(tile, Message::Dir::Out);
+            Sink = message.size();
+            return 1;
+        });
+    }
+
+    /// A TileQueue that tells when it's drained, as get() waits.
+    class BenchTileQueue : public TileQueue
+    {
+    public:
+        bool isEmpty()
+        {
+            auto lock = getLock();
+            return _queue.empty();
+        }
+    };
+
+    void benchTileQueue()
+    {
+        // Three views editing in different places of the document,
+        // the current one in the middle of the screen.
+        BenchTileQueue queue;
+        queue.updateCursorPosition(0, 0, 100000, 100000, 10, 100);
+        queue.updateCursorPosition(1, 0, 50000, 7000, 10, 100);
+        queue.updateCursorPosition(2, 0, 8000, 8000, 10, 100);
+
+        // A screen of tiles, the invalidations that caused them, and a
+        // second request for the same tiles, as a second view asks.
+        std::vector<std::string> messages;
+        for (const auto& request : screenRequests(0, 3840))
+        {
+            messages.push_back(request);
+            messages.push_back("callback all 0 284, 1418, 11105, 275, 0");
+        }
+
+        for (const auto& request : screenRequests(0, 3840))
+        {
+            messages.push_back(request);
+        }
+
+        bench("TileQueue::put+get", Iterations / 100, [&queue, &messages]()
+        {
+            for (const auto& message : messages)
+            {
+                queue.put(message);
+            }
+
+            // Fewer come out, deduplicated and combined.
+            while (!queue.isEmpty())
+            {
+                Sink = queue.get().size();
+            }
+
+            return messages.size();
+        });
+
+        // The cursors of the other views, moving with each key stroke.
+        std::vector<std::string> callbacks;
+        for (int i = 0; i < 30; ++i)
+        {
+            const std::string view = std::to_string(i % 3);
+            callbacks.push_back("callback except-" + view + " 24 { \"viewId\": \"" + view + "\", \"rectangle\": \"" +
+                                std::to_string(1000 + i * 100) + ", 1418, 0, 298\", \"part\": \"0\" }");
+        }
+
+        bench("TileQueue::put view callbacks", Iterations / 10, [&queue, &callbacks]()
+        {
+            for (const auto& callback : callbacks)
+            {
+                queue.put(callback);
+            }
+
+            while (!queue.isEmpty())
+            {
+                Sink = queue.get().size();
+            }
+
+            return callbacks.size();
+        });
+    }
+
+    void benchSenderQueue()
+    {
+        // The tiles of a screen waiting for the client; each new one
+        // replaces the same tile queued before it.
+        SenderQueue<std::shared_ptr<Message>> queue;
+        std::vector<std::shared_ptr<Message>> tiles;
+        for (const auto& request : screenRequests(0, 0))
+        {
+            const TileDesc tile = TileDesc::parse(request);
+            tiles.push_back(std::make_shared<Message>(tile.serialize("tile:") + "\n", Message::Dir::Out));
+            queue.enqueue(tiles.back());
+        }
+
+        size_t index = 0;
+        bench("SenderQueue::enqueue", Iterations, [&queue, &tiles, &index]()
+        {
+            Sink = queue.enqueue(tiles[index++ % tiles.size()]);
+            return 1;
+        });
+
+        // The view cursors of the other views, each replacing the last of its view.
+        SenderQueue<std::shared_ptr<Message>> cursorQueue;
+        std::vector<std::shared_ptr<Message>> cursors;
+        for (int i = 0; i < 30; ++i)
+        {
+            const std::string view = std::to_string(i % 3);
+            cursors.push_back(std::make_shared<Message>("invalidateviewcursor: { \"viewId\": \"" + view +
+                                                        "\", \"rectangle\": \"" + std::to_string(1000 + i * 100) +
+                                                        ", 1418, 0, 298\", \"part\": \"0\" }", Message::Dir::Out));
+        }
+
+        index = 0;
+        bench("SenderQueue::enqueue view cursors", Iterations, [&cursorQueue, &cursors, &index]()
+        {
+            Sink = cursorQueue.enqueue(cursors[index++ % cursors.size()]);
+            return 1;
+        });
+    }
+
+    void benchPng()
+    {
+        // A tile of text: lines of dark glyphs on a white background.
+        const int size = 256;
+        std::vector<unsigned char> pixmap(size * size * 4, 0xff);
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                if (y % 20 < 12 && (x * 7 + y * 3) % 11 < 4)
+                {
+                    unsigned char* pixel = &pixmap[(y * size + x) * 4];
+                    pixel[0] = pixel[1] = pixel[2] = static_cast<unsigned char>((x + y) % 64);
+                }
+            }
+        }
+
+        std::vector<char> output;
+        bench("Png::encodeBufferToPNG", Iterations / 100, [&pixmap, &output]()
+        {
+            output.clear();
+            Sink = Png::encodeBufferToPNG(pixmap.data(), size, size, output, LOK_TILEMODE_RGBA);
+            return 1;
+        });
+
+        bench("Png::hashBuffer", Iterations / 10, [&pixmap]()
+        {
+            Sink = Png::hashBuffer(pixmap.data(), size, size);
+            return 1;
+        });
+    }
+
+    /// Counts the messages decoded.
+    class BenchWebSocketHandler : public WebSocketHandler
+    {
+    public:
+        BenchWebSocketHandler() :
+            _received(0)
+        {
+        }
+
+        size_t getReceived() const { return _received; }
+
+        void handleMessage(bool /*fin*/, WSOpCode /*code*/, std::vector<char>& data) override
+        {
+            Sink = data.size();
+            ++_received;
+        }
+
+    private:
+        size_t _received;
+    };
+
+    /// Writes to nowhere and reads what is set, to measure the frames
+    /// and the buffers without the system calls.
+    class BenchSocket : public StreamSocket
+    {
+    public:
+        BenchSocket(const int fd, std::shared_ptr<SocketHandlerInterface> handler) :
+            StreamSocket(fd, std::move(handler)),
+            _offset(0)
+        {
+        }
+
+        void setInput(const std::string& input)
+        {
+            _input = input;
+            _offset = 0;
+        }
+
+        /// Reads the input and decodes the frames in it.
+        void receive()
+        {
+            readIncomingData();
+            _socketHandler->handleIncomingMessage();
+        }
+
+    protected:
+        int readData(char* buf, int len) override
+        {
+            len = std::min(len, static_cast<int>(_input.size() - _offset));
+            if (len <= 0)
+            {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            std::memcpy(buf, _input.data() + _offset, len);
+            _offset += len;
+            return len;
+        }
+
+        int writeData(const char* /*buf*/, const int len) override
+        {
+            return len;
+        }
+
+    private:
+        std::string _input;
+        size_t _offset;
+    };
+
+    /// Encodes a frame of the given payload, as a client sends them, masked.
+    std::string encodeFrame(const std::string& payload)
+    {
+        const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+        std::string frame;
+        frame += static_cast<char>(0x80 | WebSocketHandler::WSOpCode::Text);
+        if (payload.size() < 126)
+        {
+            frame += static_cast<char>(0x80 | payload.size());
+        }
+        else
+        {
+            frame += static_cast<char>(0x80 | 126);
+            frame += static_cast<char>((payload.size() >> 8) & 0xff);
+            frame += static_cast<char>(payload.size() & 0xff);
+        }
+
+        frame.append(mask, sizeof(mask));
+        for (size_t i = 0; i < payload.size(); ++i)
+        {
+            frame += static_cast<char>(payload[i] ^ mask[i % 4]);
+        }
+
+        return frame;
+    }
+
+    void benchWebSocket()
+    {
+        auto handler = std::make_shared<BenchWebSocketHandler>();
+        const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        auto socket = StreamSocket::create<BenchSocket>(fd, handler);
+
+        const std::string tile = tileRequest(7680, 11520, 42);
+        const std::string textResult = "statechanged: .uno:Bold=false " + std::string(256, 'x');
+        bench("WebSocket::encode", Iterations, [&handler, &tile]()
+        {
+            Sink = handler->sendMessage(tile.data(), tile.size(), WebSocketHandler::WSOpCode::Text);
+            return 1;
+        });
+
+        bench("WebSocket::encode (medium)", Iterations, [&handler, &textResult]()
+        {
+            Sink = handler->sendMessage(textResult.data(), textResult.size(), WebSocketHandler::WSOpCode::Text);
+            return 1;
+        });
+
+        // What a client sends while scrolling, in one read.
+        std::string frames;
+        for (const auto& request : screenRequests(0, 0))
+        {
+            frames += encodeFrame(request);
+        }
+
+        bench("WebSocket::decode", Iterations / 10, [&socket, &handler, &frames]()
+        {
+            const size_t received = handler->getReceived();
+            socket->setInput(frames);
+            socket->receive();
+            return handler->getReceived() - received;
+        });
+    }
+}
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg.compare(0, 13, "--iterations=") == 0)
+        {
+            Iterations = std::max(std::atoi(arg.c_str() + 13), 100);
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            std::cout << "Usage: loolbench [--iterations=N] [filter...]\n"
+                      << "Runs the benchmarks whose names contain any of the filters, or all.\n";
+            return EXIT_SUCCESS;
+        }
+        else
+        {
+            Filters.push_back(arg);
+        }
+    }
+
+    Log::initialize("bench", "warning", false, false, {});
+
+    benchProtocol();
+    benchTileQueue();
+    benchSenderQueue();
+    benchPng();
+    benchWebSocket();
+
+    return EXIT_SUCCESS;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
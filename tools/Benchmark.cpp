@@ -0,0 +1,335 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "Benchmark.hpp"
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+
+#include <Poco/JSON/Object.h>
+#include <Poco/JSON/Parser.h>
+
+long percentile(std::vector<long>& v, const double percentile)
+{
+    std::sort(v.begin(), v.end());
+
+    const auto N = v.size();
+    const double n = (N - 1) * percentile / 100.0 + 1;
+    if (n <= 1)
+    {
+        return v[0];
+    }
+    else if (n >= N)
+    {
+        return v[N - 1];
+    }
+
+    const auto k = static_cast<int>(n);
+    const double d = n - k;
+    return v[k - 1] + d * (v[k] - v[k - 1]);
+}
+
+namespace
+{
+    /// The percentiles of the latencies written, and compared.
+    const std::vector<std::pair<std::string, double>> Percentiles =
+    {
+        { "p50", 50 }, { "p90", 90 }, { "p95", 95 }, { "p99", 99 }
+    };
+
+    const std::vector<std::string> ComparedPercentiles = { "p50", "p95", "p99" };
+
+    std::string quote(const std::string& value)
+    {
+        std::ostringstream oss;
+        oss << '"';
+        for (const char c : value)
+        {
+            if (c == '"' || c == '\\')
+                oss << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                oss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+            else
+                oss << c;
+        }
+
+        oss << '"';
+        return oss.str();
+    }
+
+    Poco::JSON::Object::Ptr parse(std::istream& is)
+    {
+        const std::string text((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+        Poco::JSON::Parser parser;
+        const auto result = parser.parse(text);
+        return result.extract<Poco::JSON::Object::Ptr>();
+    }
+
+    /// The scenarios of a run, by name.
+    std::map<std::string, Poco::JSON::Object::Ptr> getScenarios(const Poco::JSON::Object::Ptr& run)
+    {
+        std::map<std::string, Poco::JSON::Object::Ptr> scenarios;
+        const auto array = run->getArray("scenarios");
+        for (size_t i = 0; array && i < array->size(); ++i)
+        {
+            const auto scenario = array->getObject(i);
+            if (scenario)
+                scenarios[scenario->getValue<std::string>("scenario")] = scenario;
+        }
+
+        return scenarios;
+    }
+
+    /// Writes a line comparing a measure, and whether it regressed.
+    bool compareValue(std::ostream& os, const std::string& name, const double baseline,
+                      const double current, const bool regressed)
+    {
+        os << name << ": " << baseline << " -> " << current;
+        if (baseline > 0)
+            os << " (" << std::showpos << (current - baseline) * 100 / baseline << std::noshowpos << "%)";
+
+        os << (regressed ? " REGRESSION" : "") << '\n';
+        return regressed;
+    }
+}
+
+BenchmarkReport::BenchmarkReport(const std::string& scenario) :
+    _scenario(scenario),
+    _operations(0),
+    _errors(0),
+    _elapsed(0),
+    _clientCpuMs(0),
+    _serverCpuMs(0),
+    _serverRssKb(0)
+{
+}
+
+void BenchmarkReport::start()
+{
+    _start = std::chrono::steady_clock::now();
+    _clientCpuMs = getClientCpuMs();
+    getServerUsage(_serverCpuMs, _serverRssKb);
+}
+
+void BenchmarkReport::stop()
+{
+    _elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start);
+    _clientCpuMs = getClientCpuMs() - _clientCpuMs;
+
+    // Children that exited in between take their CPU time with them.
+    double serverCpuMs = 0;
+    getServerUsage(serverCpuMs, _serverRssKb);
+    _serverCpuMs = std::max(0.0, serverCpuMs - _serverCpuMs);
+}
+
+void BenchmarkReport::addSample(const std::string& metric, const long us)
+{
+    _samples[metric].push_back(us);
+}
+
+void BenchmarkReport::addSamples(const std::string& metric, const std::vector<long>& us)
+{
+    auto& samples = _samples[metric];
+    samples.insert(samples.end(), us.begin(), us.end());
+}
+
+double BenchmarkReport::getThroughput() const
+{
+    return (_elapsed.count() > 0 ? _operations * 1e6 / _elapsed.count() : 0);
+}
+
+void BenchmarkReport::write(std::ostream& os) const
+{
+    os << "{ \"scenario\": " << quote(_scenario)
+       << ", \"elapsed_ms\": " << _elapsed.count() / 1000
+       << ", \"operations\": " << _operations
+       << ", \"throughput\": " << getThroughput()
+       << ", \"errors\": " << _errors
+       << ",\n      \"latency_us\": {";
+
+    const char* separator = "";
+    for (const auto& it : _samples)
+    {
+        if (it.second.empty())
+            continue;
+
+        std::vector<long> samples = it.second;
+        const double sum = std::accumulate(samples.begin(), samples.end(), 0.0);
+        os << separator << "\n        " << quote(it.first) << ": { \"count\": " << samples.size()
+           << ", \"min\": " << *std::min_element(samples.begin(), samples.end())
+           << ", \"mean\": " << static_cast<long>(sum / samples.size());
+        for (const auto& p : Percentiles)
+        {
+            os << ", " << quote(p.first) << ": " << percentile(samples, p.second);
+        }
+
+        os << ", \"max\": " << samples.back() << " }";
+        separator = ",";
+    }
+
+    os << " },\n      \"resources\": { \"client_cpu_ms\": " << static_cast<long>(_clientCpuMs)
+       << ", \"server_cpu_ms\": " << static_cast<long>(_serverCpuMs)
+       << ", \"server_rss_kb\": " << _serverRssKb << " } }";
+}
+
+void BenchmarkReport::write(std::ostream& os, const std::vector<BenchmarkReport>& reports,
+                            const std::map<std::string, std::string>& settings)
+{
+    os << "{\n  \"settings\": {";
+    const char* separator = "";
+    for (const auto& it : settings)
+    {
+        os << separator << ' ' << quote(it.first) << ": " << quote(it.second);
+        separator = ",";
+    }
+
+    os << " },\n  \"scenarios\": [";
+    separator = "";
+    for (const auto& report : reports)
+    {
+        os << separator << "\n    ";
+        report.write(os);
+        separator = ",";
+    }
+
+    os << "\n  ]\n}\n";
+}
+
+unsigned BenchmarkReport::compare(std::istream& baseline, std::istream& current,
+                                  const double threshold, std::ostream& os)
+{
+    const auto baselineScenarios = getScenarios(parse(baseline));
+    const auto currentScenarios = getScenarios(parse(current));
+
+    os << std::fixed << std::setprecision(1);
+
+    unsigned regressions = 0;
+    for (const auto& it : currentScenarios)
+    {
+        const auto baselineIt = baselineScenarios.find(it.first);
+        if (baselineIt == baselineScenarios.end())
+        {
+            os << it.first << ": not in the baseline\n";
+            continue;
+        }
+
+        const auto& before = baselineIt->second;
+        const auto& after = it.second;
+
+        const auto beforeLatencies = before->getObject("latency_us");
+        const auto afterLatencies = after->getObject("latency_us");
+        std::vector<std::string> metrics;
+        if (afterLatencies)
+            afterLatencies->getNames(metrics);
+
+        for (const auto& metric : metrics)
+        {
+            if (!beforeLatencies || !beforeLatencies->has(metric))
+                continue;
+
+            const auto beforeMetric = beforeLatencies->getObject(metric);
+            const auto afterMetric = afterLatencies->getObject(metric);
+            for (const auto& p : ComparedPercentiles)
+            {
+                const double b = beforeMetric->getValue<double>(p);
+                const double c = afterMetric->getValue<double>(p);
+                const bool regressed = (c - b > MinRegressionUs && c > b * (1 + threshold / 100));
+                if (compareValue(os, it.first + ' ' + metric + ' ' + p + " us", b, c, regressed))
+                    ++regressions;
+            }
+        }
+
+        const double b = before->getValue<double>("throughput");
+        const double c = after->getValue<double>("throughput");
+        if (compareValue(os, it.first + " throughput", b, c, c < b * (1 - threshold / 100)))
+            ++regressions;
+
+        const double beforeErrors = before->getValue<double>("errors");
+        const double afterErrors = after->getValue<double>("errors");
+        if (compareValue(os, it.first + " errors", beforeErrors, afterErrors, afterErrors > beforeErrors))
+            ++regressions;
+    }
+
+    for (const auto& it : baselineScenarios)
+    {
+        if (currentScenarios.find(it.first) == currentScenarios.end())
+            os << it.first << ": not run\n";
+    }
+
+    return regressions;
+}
+
+double BenchmarkReport::getClientCpuMs()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+void BenchmarkReport::getServerUsage(double& cpuMs, uint64_t& rssKb)
+{
+    cpuMs = 0;
+    rssKb = 0;
+
+    DIR* proc = opendir("/proc");
+    if (!proc)
+        return;
+
+    const long ticksPerSec = sysconf(_SC_CLK_TCK);
+    const long pageKb = sysconf(_SC_PAGESIZE) / 1024;
+    while (struct dirent* entry = readdir(proc))
+    {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+            continue;
+
+        std::ifstream file(std::string("/proc/") + entry->d_name + "/stat");
+        std::string stat;
+        if (!std::getline(file, stat))
+            continue;
+
+        // The name is in parentheses, and may contain spaces.
+        const auto open = stat.find('(');
+        const auto close = stat.rfind(')');
+        if (open == std::string::npos || close == std::string::npos || close < open)
+            continue;
+
+        const std::string name = stat.substr(open + 1, close - open - 1);
+        if (name != "loolwsd" && name != "loolforkit" && name != "loolkit")
+            continue;
+
+        // The fields after the name, from the state, the 3rd.
+        std::istringstream iss(stat.substr(close + 2));
+        std::vector<std::string> fields((std::istream_iterator<std::string>(iss)),
+                                        std::istream_iterator<std::string>());
+        if (fields.size() < 22 || ticksPerSec <= 0)
+            continue;
+
+        // utime and stime are the 14th and 15th, rss the 24th.
+        cpuMs += (std::stoull(fields[11]) + std::stoull(fields[12])) * 1000.0 / ticksPerSec;
+        rssKb += std::stoull(fields[21]) * pageKb;
+    }
+
+    closedir(proc);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,92 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_BENCHMARK_HPP
+#define INCLUDED_BENCHMARK_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// The value below which the given percentage of the samples fall,
+/// interpolated between the nearest two. Sorts the samples.
+long percentile(std::vector<long>& v, double percentile);
+
+/// The results of running one benchmark scenario of loolstress:
+/// the latencies of each kind of operation, the throughput and the
+/// CPU and memory used by the client and by the server, if local.
+class BenchmarkReport
+{
+public:
+    explicit BenchmarkReport(const std::string& scenario);
+
+    const std::string& getScenario() const { return _scenario; }
+
+    /// Records the time and the resources used so far.
+    void start();
+    /// Accounts for the time and the resources used since start().
+    void stop();
+
+    /// Adds a latency, in microseconds, of the given kind of operation.
+    void addSample(const std::string& metric, long us);
+    void addSamples(const std::string& metric, const std::vector<long>& us);
+    const std::map<std::string, std::vector<long>>& getSamples() const { return _samples; }
+
+    /// The operations completed, by which the throughput is computed.
+    void addOperations(uint64_t count) { _operations += count; }
+    void addError() { ++_errors; }
+    unsigned getErrors() const { return _errors; }
+
+    /// Operations per second, 0 if not run.
+    double getThroughput() const;
+
+    /// Writes the results as a JSON object.
+    void write(std::ostream& os) const;
+
+    /// Writes the reports of a run as a JSON document.
+    static void write(std::ostream& os, const std::vector<BenchmarkReport>& reports,
+                      const std::map<std::string, std::string>& settings);
+
+    /// Compares the results of two runs, as written by write(), and writes
+    /// a line per measure to os. A latency percentile more than threshold
+    /// percent higher, a throughput more than threshold percent lower, or
+    /// more errors, in the same scenario, is a regression.
+    /// Returns the number of regressions. Throws if either is malformed.
+    static unsigned compare(std::istream& baseline, std::istream& current,
+                            double threshold, std::ostream& os);
+
+    /// The CPU time used by this process, in milliseconds.
+    static double getClientCpuMs();
+    /// The CPU time used, in milliseconds, and the resident memory, in
+    /// kilobytes, of the processes of the server running on this host.
+    static void getServerUsage(double& cpuMs, uint64_t& rssKb);
+
+private:
+    /// Differences smaller than this many microseconds are noise.
+    static constexpr long MinRegressionUs = 100;
+
+    const std::string _scenario;
+    std::map<std::string, std::vector<long>> _samples;
+    uint64_t _operations;
+    unsigned _errors;
+
+    std::chrono::steady_clock::time_point _start;
+    std::chrono::microseconds _elapsed;
+    double _clientCpuMs;
+    double _serverCpuMs;
+    uint64_t _serverRssKb;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
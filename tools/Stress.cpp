@@ -17,11 +17,16 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <numeric>
+#include <sstream>
 #include <thread>
 
+#include <Poco/File.h>
 #include <Poco/Net/HTTPRequest.h>
 #include <Poco/Net/HTTPResponse.h>
+#include <Poco/Path.h>
+#include <Poco/StringTokenizer.h>
 #include <Poco/Thread.h>
 #include <Poco/URI.h>
 #include <Poco/Util/Application.h>
@@ -29,6 +34,7 @@
 #include <Poco/Util/Option.h>
 #include <Poco/Util/OptionSet.h>
 
+#include "Benchmark.hpp"
 #include "Replay.hpp"
 #include "TraceFile.hpp"
 #include "test/helpers.hpp"
@@ -43,12 +49,48 @@ public:
     static size_t Iterations;
     static bool NoDelay;
     unsigned _numClients;
+    unsigned _numOpenDocs;
     std::string _serverURI;
+    /// The canned scenarios to run, in the order of Scenarios.
+    std::vector<std::string> _scenarios;
+    unsigned _numCollaborators;
+    std::string _jsonFile;
+    bool _compare;
+    /// Percentage by which a measure may get worse before it is a regression.
+    double _threshold;
+
+    /// The canned scenarios, and the documents in TDOC they run on by default.
+    static const std::vector<std::pair<std::string, std::string>> Scenarios;
 
 protected:
     void defineOptions(Poco::Util::OptionSet& options) override;
     void handleOption(const std::string& name, const std::string& value) override;
     int  main(const std::vector<std::string>& args) override;
+
+private:
+    /// Opens _numOpenDocs distinct copies of the document
+    /// concurrently and reports the load latencies.
+    int openDocs(const std::string& document);
+
+    /// Runs the scenarios selected, on their own documents or on the given one,
+    /// and writes the results to stderr and, as JSON, to _jsonFile.
+    int runScenarios(const std::vector<std::string>& args);
+
+    /// Copies the document to a path of its own in dir, so that it gets its own
+    /// DocumentBroker and Kit and the original isn't modified, and returns its URL.
+    static std::string copyDocument(const std::string& document, const std::string& dir, const std::string& name);
+
+    /// Opens count distinct copies of the document concurrently.
+    void openStorm(const std::string& document, const std::string& dir, unsigned count, BenchmarkReport& report);
+    /// Loads the document and requests the tiles of one screen after the other, downwards.
+    void scroll(const std::string& documentURL, BenchmarkReport& report);
+    /// Loads the document in _numCollaborators views, which all type into it.
+    void typing(const std::string& documentURL, BenchmarkReport& report);
+    /// Loads the presentation and shows one slide after the other.
+    void slideshow(const std::string& documentURL, BenchmarkReport& report);
+
+    /// Compares two runs written with --json and prints the regressions.
+    int compare(const std::string& baseline, const std::string& current);
 };
 
 using Poco::Thread;
@@ -57,31 +99,55 @@ using Poco::Util::HelpFormatter;
 using Poco::Util::Option;
 using Poco::Util::OptionSet;
 
-long percentile(std::vector<long>& v, const double percentile)
-{
-    std::sort(v.begin(), v.end());
+std::mutex Connection::Mutex;
+
+//static constexpr auto FIRST_ROW_TILES = "tilecombine part=0 width=256 height=256 tileposx=0,3840,7680 tileposy=0,0,0 tilewidth=3840 tileheight=3840";
+static constexpr auto FIRST_PAGE_TILES = "tilecombine part=0 width=256 height=256 tileposx=0,3840,7680,11520,0,3840,7680,11520,0,3840,7680,11520,0,3840,7680,11520 tileposy=0,0,0,0,3840,3840,3840,3840,7680,7680,7680,7680,11520,11520,11520,11520 tilewidth=3840 tileheight=3840";
+static constexpr auto FIRST_PAGE_TILE_COUNT = 16;
+static constexpr auto FIRST_TILE = "tile part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840";
+static constexpr auto SCREEN_TILES = 4;
+static constexpr auto TILE_TWIPS = 3840;
 
-    const auto N = v.size();
-    const double n = (N - 1) * percentile / 100.0 + 1;
-    if (n <= 1)
+/// The tilecombine request of a screen of SCREEN_TILES x SCREEN_TILES tiles, from the given row.
+static std::string getScreenTiles(const int part, const int row)
+{
+    std::ostringstream xs;
+    std::ostringstream ys;
+    for (int y = 0; y < SCREEN_TILES; ++y)
     {
-        return v[0];
+        for (int x = 0; x < SCREEN_TILES; ++x)
+        {
+            xs << (x + y > 0 ? "," : "") << x * TILE_TWIPS;
+            ys << (x + y > 0 ? "," : "") << (row + y) * TILE_TWIPS;
+        }
     }
-    else if (n >= N)
+
+    return "tilecombine part=" + std::to_string(part) + " width=256 height=256 tileposx=" + xs.str() +
+           " tileposy=" + ys.str() + " tilewidth=" + std::to_string(TILE_TWIPS) +
+           " tileheight=" + std::to_string(TILE_TWIPS);
+}
+
+/// Requests the tiles and waits for all of them. Returns the microseconds it took, or -1 on failure.
+static long requestTiles(const std::shared_ptr<Connection>& con, const std::string& request, const int count)
+{
+    const auto start = std::chrono::steady_clock::now();
+    if (!con->send(request))
+        return -1;
+
+    for (int i = 0; i < count; ++i)
     {
-        return v[N - 1];
+        if (helpers::getTileMessage(*con->getWS(), con->getName()).empty())
+            return -1;
     }
 
-    const auto k = static_cast<int>(n);
-    const double d = n - k;
-    return v[k - 1] + d * (v[k] - v[k - 1]);
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
 }
 
-std::mutex Connection::Mutex;
-
-//static constexpr auto FIRST_ROW_TILES = "tilecombine part=0 width=256 height=256 tileposx=0,3840,7680 tileposy=0,0,0 tilewidth=3840 tileheight=3840";
-static constexpr auto FIRST_PAGE_TILES = "tilecombine part=0 width=256 height=256 tileposx=0,3840,7680,11520,0,3840,7680,11520,0,3840,7680,11520,0,3840,7680,11520 tileposy=0,0,0,0,3840,3840,3840,3840,7680,7680,7680,7680,11520,11520,11520,11520 tilewidth=3840 tileheight=3840";
-static constexpr auto FIRST_PAGE_TILE_COUNT = 16;
+static std::string nextSessionId()
+{
+    static std::atomic<unsigned> SessionId;
+    return std::to_string(++SessionId);
+}
 
 /// Main thread class to replay a trace file.
 class Worker: public Replay
@@ -209,17 +275,160 @@ private:
     std::vector<long> _cacheStats;
 };
 
+/// Opens a single document and measures the time it takes.
+class Opener: public Poco::Runnable
+{
+public:
+    Opener(const std::string& serverUri, const std::string& uri, const unsigned id) :
+        _serverUri(serverUri),
+        _uri(uri),
+        _id(id),
+        _connectLatency(-1),
+        _loadLatency(-1),
+        _firstTileLatency(-1)
+    {
+    }
+
+    /// Microseconds to connect to the document, or -1 on failure.
+    long getConnectLatency() const { return _connectLatency; }
+    /// Microseconds from requesting to load until loaded, or -1 on failure.
+    long getLoadLatency() const { return _loadLatency; }
+    /// Microseconds from connecting until the first tile arrived, or -1 on failure.
+    long getFirstTileLatency() const { return _firstTileLatency; }
+
+    void run() override
+    {
+        try
+        {
+            const auto start = std::chrono::steady_clock::now();
+            auto connection = Connection::create(_serverUri, _uri, std::to_string(_id));
+            if (!connection)
+                return;
+
+            const auto connected = std::chrono::steady_clock::now();
+            _connectLatency = std::chrono::duration_cast<std::chrono::microseconds>(connected - start).count();
+
+            if (connection->load())
+            {
+                const auto loaded = std::chrono::steady_clock::now();
+                _loadLatency = std::chrono::duration_cast<std::chrono::microseconds>(loaded - connected).count();
+
+                connection->send(FIRST_TILE);
+                if (!helpers::getTileMessage(*connection->getWS(), connection->getName()).empty())
+                {
+                    const auto now = std::chrono::steady_clock::now();
+                    _firstTileLatency = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+                }
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "Error: " << e.what() << std::endl;
+        }
+    }
+
+private:
+    const std::string _serverUri;
+    const std::string _uri;
+    const unsigned _id;
+    long _connectLatency;
+    long _loadLatency;
+    long _firstTileLatency;
+};
+
+/// One of the collaborators typing into a document.
+class Typist: public Poco::Runnable
+{
+public:
+    Typist(const std::string& serverUri, const std::string& uri, const size_t keystrokes) :
+        _serverUri(serverUri),
+        _uri(uri),
+        _keystrokes(keystrokes),
+        _errors(0)
+    {
+    }
+
+    /// Microseconds from each key to the Kit having handled it.
+    const std::vector<long>& getKeystrokeStats() const { return _keystrokeStats; }
+    /// Microseconds to get the first screen of tiles after each key.
+    const std::vector<long>& getScreenStats() const { return _screenStats; }
+    unsigned getErrors() const { return _errors; }
+
+    void run() override
+    {
+        try
+        {
+            auto connection = Connection::create(_serverUri, _uri, nextSessionId());
+            if (!connection || !connection->load())
+            {
+                ++_errors;
+                return;
+            }
+
+            for (size_t i = 0; i < _keystrokes; ++i)
+            {
+                // The status is answered once the Kit handled the key before it,
+                // unlike the invalidations, which the dummy Kit doesn't send.
+                const auto start = std::chrono::steady_clock::now();
+                connection->send("key type=input char=97 key=0");
+                connection->send("key type=up char=0 key=512");
+                connection->send("status");
+                if (connection->recv("status:").empty())
+                {
+                    ++_errors;
+                    continue;
+                }
+
+                const auto now = std::chrono::steady_clock::now();
+                _keystrokeStats.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - start).count());
+
+                const long screen = requestTiles(connection, getScreenTiles(0, 0), SCREEN_TILES * SCREEN_TILES);
+                if (screen >= 0)
+                    _screenStats.push_back(screen);
+                else
+                    ++_errors;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            ++_errors;
+            std::cout << "Error: " << e.what() << std::endl;
+        }
+    }
+
+private:
+    const std::string _serverUri;
+    const std::string _uri;
+    const size_t _keystrokes;
+    std::vector<long> _keystrokeStats;
+    std::vector<long> _screenStats;
+    unsigned _errors;
+};
+
 bool Stress::NoDelay = false;
 bool Stress::Benchmark = false;
 size_t Stress::Iterations = 100;
 
+const std::vector<std::pair<std::string, std::string>> Stress::Scenarios =
+{
+    { "open_storm", "hello.odt" },
+    { "scroll", "Example.odt" },
+    { "typing", "hello.odt" },
+    { "spreadsheet", "calc_render.xls" },
+    { "slideshow", "setclientpart.odp" }
+};
+
 Stress::Stress() :
     _numClients(1),
+    _numOpenDocs(0),
 #if ENABLE_SSL
-    _serverURI("https://127.0.0.1:" + std::to_string(DEFAULT_CLIENT_PORT_NUMBER))
+    _serverURI("https://127.0.0.1:" + std::to_string(DEFAULT_CLIENT_PORT_NUMBER)),
 #else
-    _serverURI("http://127.0.0.1:" + std::to_string(DEFAULT_CLIENT_PORT_NUMBER))
+    _serverURI("http://127.0.0.1:" + std::to_string(DEFAULT_CLIENT_PORT_NUMBER)),
 #endif
+    _numCollaborators(4),
+    _compare(false),
+    _threshold(10)
 {
 }
 
@@ -239,9 +448,28 @@ void Stress::defineOptions(OptionSet& optionSet)
     optionSet.addOption(Option("clientsperdoc", "", "Number of simultaneous clients on each doc.")
                         .required(false).repeatable(false)
                         .argument("concurrency"));
+    optionSet.addOption(Option("opendocs", "", "Open this many distinct copies of the given document concurrently and report latencies.")
+                        .required(false).repeatable(false)
+                        .argument("count"));
     optionSet.addOption(Option("server", "", "URI of LOOL server")
                         .required(false).repeatable(false)
                         .argument("uri"));
+    optionSet.addOption(Option("scenario", "", "Comma-separated benchmark scenarios to run, or 'all': "
+                               "open_storm, scroll, typing, spreadsheet, slideshow. "
+                               "They run on documents of their own unless one is given.")
+                        .required(false).repeatable(false)
+                        .argument("names"));
+    optionSet.addOption(Option("collaborators", "", "Number of views typing at once in the typing scenario.")
+                        .required(false).repeatable(false)
+                        .argument("count"));
+    optionSet.addOption(Option("json", "", "Write the results of the scenarios to this file, as JSON.")
+                        .required(false).repeatable(false)
+                        .argument("file"));
+    optionSet.addOption(Option("compare", "", "Compare two result files written with --json, the baseline first, and fail on regressions.")
+                        .required(false).repeatable(false));
+    optionSet.addOption(Option("threshold", "", "Percentage by which a latency or throughput may get worse before --compare flags it. 10 by default.")
+                        .required(false).repeatable(false)
+                        .argument("percent"));
 }
 
 void Stress::handleOption(const std::string& optionName,
@@ -267,8 +495,34 @@ void Stress::handleOption(const std::string& optionName,
         Stress::NoDelay = true;
     else if (optionName == "clientsperdoc")
         _numClients = std::max(std::stoi(value), 1);
+    else if (optionName == "opendocs")
+        _numOpenDocs = std::max(std::stoi(value), 1);
     else if (optionName == "server")
         _serverURI = value;
+    else if (optionName == "scenario")
+    {
+        Poco::StringTokenizer tokens(value, ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
+        const std::vector<std::string> names(tokens.begin(), tokens.end());
+        for (const auto& scenario : Scenarios)
+        {
+            if (value == "all" || std::find(names.begin(), names.end(), scenario.first) != names.end())
+                _scenarios.push_back(scenario.first);
+        }
+
+        if (_scenarios.size() != names.size() && value != "all")
+        {
+            std::cout << "Unknown scenario in: " << value << std::endl;
+            exit(1);
+        }
+    }
+    else if (optionName == "collaborators")
+        _numCollaborators = std::max(std::stoi(value), 1);
+    else if (optionName == "json")
+        _jsonFile = value;
+    else if (optionName == "compare")
+        _compare = true;
+    else if (optionName == "threshold")
+        _threshold = std::max(std::stod(value), 0.0);
     else
     {
         std::cout << "Unknown option: " << optionName << std::endl;
@@ -280,14 +534,34 @@ int Stress::main(const std::vector<std::string>& args)
 {
     std::vector<std::unique_ptr<Thread>> clients(_numClients * args.size());
 
+    if (_compare)
+    {
+        if (args.size() != 2)
+        {
+            std::cerr << "Usage: loolstress --compare [--threshold <percent>] <baseline.json> <current.json>" << std::endl;
+            return Application::EXIT_USAGE;
+        }
+
+        return compare(args[0], args[1]);
+    }
+
+    if (!_scenarios.empty())
+        return runScenarios(args);
+
     if (args.size() == 0)
     {
         std::cerr << "Usage: loolstress [--bench] <tracefile | url> " << std::endl;
         std::cerr << "       Trace files may be plain text or gzipped (with .gz extension)." << std::endl;
+        std::cerr << "       loolstress --opendocs <count> <document path>" << std::endl;
+        std::cerr << "       loolstress --scenario <names | all> [--json <file>] [document path]" << std::endl;
+        std::cerr << "       loolstress --compare <baseline.json> <current.json>" << std::endl;
         std::cerr << "       --help for full arguments list." << std::endl;
         return Application::EXIT_NOINPUT;
     }
 
+    if (_numOpenDocs > 0)
+        return openDocs(args[0]);
+
     std::vector<std::shared_ptr<Worker>> workers;
 
     unsigned index = 0;
@@ -349,6 +623,298 @@ int Stress::main(const std::vector<std::string>& args)
     return Application::EXIT_OK;
 }
 
+std::string Stress::copyDocument(const std::string& document, const std::string& dir, const std::string& name)
+{
+    const Poco::Path source(document);
+    const Poco::Path path(dir, name + '.' + source.getExtension());
+    Poco::File(source).copyTo(path.toString());
+    return "file://" + path.toString();
+}
+
+void Stress::openStorm(const std::string& document, const std::string& dir, const unsigned count,
+                       BenchmarkReport& report)
+{
+    std::vector<std::shared_ptr<Opener>> openers;
+    std::vector<std::unique_ptr<Thread>> threads;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        openers.emplace_back(new Opener(_serverURI, copyDocument(document, dir, std::to_string(i)), i + 1));
+    }
+
+    std::cout << "Opening " << count << " copies of [" << document << "] concurrently." << std::endl;
+
+    report.start();
+    for (const auto& opener : openers)
+    {
+        threads.emplace_back(new Thread());
+        threads.back()->start(*opener);
+    }
+
+    for (const auto& thread : threads)
+    {
+        thread->join();
+    }
+
+    report.stop();
+
+    for (const auto& opener : openers)
+    {
+        if (opener->getConnectLatency() >= 0)
+            report.addSample("connect", opener->getConnectLatency());
+        if (opener->getLoadLatency() >= 0)
+            report.addSample("load", opener->getLoadLatency());
+        if (opener->getFirstTileLatency() >= 0)
+        {
+            report.addSample("first_tile", opener->getFirstTileLatency());
+            report.addOperations(1);
+        }
+        else
+            report.addError();
+    }
+}
+
+int Stress::openDocs(const std::string& document)
+{
+    // Each copy has its own path, hence its own DocumentBroker and Kit.
+    const std::string dir = Poco::Path::temp() + "loolstress-" + std::to_string(getpid());
+    Poco::File(dir).createDirectories();
+
+    BenchmarkReport report("open_storm");
+    openStorm(document, dir, _numOpenDocs, report);
+
+    Poco::File(dir).remove(true);
+
+    std::map<std::string, std::vector<long>> stats = report.getSamples();
+    std::vector<long>& connectStats = stats["connect"];
+    std::vector<long>& loadStats = stats["load"];
+    std::vector<long>& firstTileStats = stats["first_tile"];
+
+    std::cerr << "\nResults:\n";
+    std::cerr << "Documents: " << _numOpenDocs << ", loaded: " << loadStats.size() << ", at " <<
+              report.getThroughput() << " documents/sec." << std::endl;
+    if (!connectStats.empty())
+    {
+        std::cerr << "Connect p50: " << percentile(connectStats, 50) << " microsecs, p95: " <<
+                  percentile(connectStats, 95) << " microsecs, p99: " << percentile(connectStats, 99) <<
+                  " microsecs, max: " << connectStats.back() << " microsecs." << std::endl;
+    }
+
+    if (!loadStats.empty())
+    {
+        std::cerr << "Load p50: " << percentile(loadStats, 50) << " microsecs, p95: " <<
+                  percentile(loadStats, 95) << " microsecs, p99: " << percentile(loadStats, 99) <<
+                  " microsecs, max: " << loadStats.back() << " microsecs." << std::endl;
+    }
+
+    if (!firstTileStats.empty())
+    {
+        std::cerr << "Time to first tile p50: " << percentile(firstTileStats, 50) << " microsecs, p95: " <<
+                  percentile(firstTileStats, 95) << " microsecs, p99: " << percentile(firstTileStats, 99) <<
+                  " microsecs, max: " << firstTileStats.back() << " microsecs." << std::endl;
+    }
+
+    return (loadStats.size() == _numOpenDocs ? Application::EXIT_OK : Application::EXIT_SOFTWARE);
+}
+
+void Stress::scroll(const std::string& documentURL, BenchmarkReport& report)
+{
+    const auto start = std::chrono::steady_clock::now();
+    auto connection = Connection::create(_serverURI, documentURL, nextSessionId());
+    if (!connection || !connection->load())
+    {
+        report.addError();
+        return;
+    }
+
+    report.addSample("load", std::chrono::duration_cast<std::chrono::microseconds>(
+                                 std::chrono::steady_clock::now() - start).count());
+
+    for (size_t i = 0; i < Stress::Iterations; ++i)
+    {
+        // Each screen is new, hence rendered, as when scrolling down a long document.
+        const long screen = requestTiles(connection, getScreenTiles(0, static_cast<int>(i) * SCREEN_TILES),
+                                         SCREEN_TILES * SCREEN_TILES);
+        if (screen >= 0)
+        {
+            report.addSample("screen", screen);
+            report.addOperations(SCREEN_TILES * SCREEN_TILES);
+        }
+        else
+            report.addError();
+    }
+}
+
+void Stress::typing(const std::string& documentURL, BenchmarkReport& report)
+{
+    std::vector<std::shared_ptr<Typist>> typists;
+    std::vector<std::unique_ptr<Thread>> threads;
+    for (unsigned i = 0; i < _numCollaborators; ++i)
+    {
+        typists.emplace_back(new Typist(_serverURI, documentURL, Stress::Iterations));
+        threads.emplace_back(new Thread());
+        threads.back()->start(*typists.back());
+    }
+
+    for (const auto& thread : threads)
+    {
+        thread->join();
+    }
+
+    for (const auto& typist : typists)
+    {
+        report.addSamples("keystroke", typist->getKeystrokeStats());
+        report.addSamples("screen", typist->getScreenStats());
+        report.addOperations(typist->getKeystrokeStats().size());
+        for (unsigned i = 0; i < typist->getErrors(); ++i)
+        {
+            report.addError();
+        }
+    }
+}
+
+void Stress::slideshow(const std::string& documentURL, BenchmarkReport& report)
+{
+    const auto start = std::chrono::steady_clock::now();
+    auto connection = Connection::create(_serverURI, documentURL, nextSessionId());
+    if (!connection || !connection->load())
+    {
+        report.addError();
+        return;
+    }
+
+    report.addSample("load", std::chrono::duration_cast<std::chrono::microseconds>(
+                                 std::chrono::steady_clock::now() - start).count());
+
+    connection->send("status");
+    const auto status = connection->recv("status:");
+    int parts = 0;
+    if (status.empty() ||
+        !LOOLProtocol::getTokenIntegerFromMessage(std::string(status.begin(), status.end()), "parts", parts) ||
+        parts <= 0)
+    {
+        parts = 1;
+    }
+
+    for (size_t i = 0; i < Stress::Iterations; ++i)
+    {
+        const int part = static_cast<int>(i % parts);
+        const auto slideStart = std::chrono::steady_clock::now();
+        connection->send("setclientpart part=" + std::to_string(part));
+        if (requestTiles(connection, getScreenTiles(part, 0), SCREEN_TILES * SCREEN_TILES) >= 0)
+        {
+            report.addSample("slide", std::chrono::duration_cast<std::chrono::microseconds>(
+                                          std::chrono::steady_clock::now() - slideStart).count());
+            report.addOperations(1);
+        }
+        else
+            report.addError();
+    }
+}
+
+int Stress::runScenarios(const std::vector<std::string>& args)
+{
+    const std::string dir = Poco::Path::temp() + "loolstress-" + std::to_string(getpid());
+    Poco::File(dir).createDirectories();
+
+    std::vector<BenchmarkReport> reports;
+    for (const auto& scenario : Scenarios)
+    {
+        if (std::find(_scenarios.begin(), _scenarios.end(), scenario.first) == _scenarios.end())
+            continue;
+
+        const std::string document = (args.empty() ? std::string(TDOC) + '/' + scenario.second : args[0]);
+        std::cout << "Running scenario " << scenario.first << " on [" << document << "]." << std::endl;
+
+        reports.emplace_back(scenario.first);
+        BenchmarkReport& report = reports.back();
+        try
+        {
+            if (scenario.first == "open_storm")
+            {
+                openStorm(document, dir, (_numOpenDocs > 0 ? _numOpenDocs : 20), report);
+                continue;
+            }
+
+            const std::string documentURL = copyDocument(document, dir, scenario.first);
+            report.start();
+            if (scenario.first == "typing")
+                typing(documentURL, report);
+            else if (scenario.first == "slideshow")
+                slideshow(documentURL, report);
+            else
+                scroll(documentURL, report);
+            report.stop();
+        }
+        catch (const std::exception& exc)
+        {
+            std::cout << "Error in scenario " << scenario.first << ": " << exc.what() << std::endl;
+            report.addError();
+        }
+    }
+
+    Poco::File(dir).remove(true);
+
+    std::cerr << "\nResults:\n";
+    unsigned errors = 0;
+    for (const auto& report : reports)
+    {
+        std::cerr << report.getScenario() << ": " << report.getThroughput() << " operations/sec, " <<
+                  report.getErrors() << " errors." << std::endl;
+        for (const auto& it : report.getSamples())
+        {
+            std::vector<long> samples = it.second;
+            if (samples.empty())
+                continue;
+
+            std::cerr << "    " << it.first << " p50: " << percentile(samples, 50) << " microsecs, p95: " <<
+                      percentile(samples, 95) << " microsecs, p99: " << percentile(samples, 99) <<
+                      " microsecs, max: " << samples.back() << " microsecs." << std::endl;
+        }
+
+        errors += report.getErrors();
+    }
+
+    if (!_jsonFile.empty())
+    {
+        std::ofstream ofs(_jsonFile);
+        BenchmarkReport::write(ofs, reports,
+                               { { "server", _serverURI },
+                                 { "iterations", std::to_string(Stress::Iterations) },
+                                 { "collaborators", std::to_string(_numCollaborators) },
+                                 { "document", (args.empty() ? std::string() : args[0]) } });
+        if (!ofs)
+        {
+            std::cerr << "Failed to write the results to [" << _jsonFile << "]." << std::endl;
+            return Application::EXIT_CANTCREAT;
+        }
+    }
+
+    return (errors == 0 ? Application::EXIT_OK : Application::EXIT_SOFTWARE);
+}
+
+int Stress::compare(const std::string& baseline, const std::string& current)
+{
+    std::ifstream baselineFile(baseline);
+    std::ifstream currentFile(current);
+    if (!baselineFile || !currentFile)
+    {
+        std::cerr << "Failed to read [" << (baselineFile ? current : baseline) << "]." << std::endl;
+        return Application::EXIT_NOINPUT;
+    }
+
+    try
+    {
+        const unsigned regressions = BenchmarkReport::compare(baselineFile, currentFile, _threshold, std::cout);
+        std::cout << regressions << " regressions beyond " << _threshold << "%." << std::endl;
+        return (regressions == 0 ? Application::EXIT_OK : Application::EXIT_SOFTWARE);
+    }
+    catch (const std::exception& exc)
+    {
+        std::cerr << "Failed to compare [" << baseline << "] and [" << current << "]: " << exc.what() << std::endl;
+        return Application::EXIT_DATAERR;
+    }
+}
+
 POCO_APP_MAIN(Stress)
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
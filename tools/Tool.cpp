@@ -12,10 +12,13 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include <Poco/Net/HTMLForm.h>
 #include <Poco/Net/HTTPClientSession.h>
@@ -45,6 +48,7 @@ public:
     Tool();
 
     unsigned    _numWorkers;
+    unsigned    _repeat;
     std::string _serverURI;
     std::string _destinationFormat;
     std::string _destinationDir;
@@ -75,28 +79,46 @@ class Worker: public Runnable
 public:
     Tool& _app;
     std::vector< std::string > _files;
+    /// How long each successful conversion took, in ms.
+    std::vector<double> _latenciesMs;
+    unsigned _failures;
+
     Worker(Tool& app, const std::vector< std::string > & files) :
-        _app(app), _files(files)
+        _app(app), _files(files), _failures(0)
     {
     }
 
     void run() override
     {
-        for (const auto& i : _files)
-            convertFile(i);
+        for (unsigned repeat = 0; repeat < _app._repeat; ++repeat)
+        {
+            for (const auto& i : _files)
+            {
+                const auto start = std::chrono::steady_clock::now();
+                if (convertFile(i))
+                {
+                    _latenciesMs.push_back(std::chrono::duration<double, std::milli>(
+                                               std::chrono::steady_clock::now() - start).count());
+                }
+                else
+                {
+                    ++_failures;
+                }
+            }
+        }
     }
 
-    void convertFile(const std::string& document)
+    bool convertFile(const std::string& document)
     {
         std::cerr << "convert file " << document << "\n";
 
         Poco::URI uri(_app._serverURI);
 
-        Poco::Net::HTTPClientSession *session;
-        if (_app._serverURI.compare(0, 5, "https"))
-            session = new Poco::Net::HTTPSClientSession(uri.getHost(), uri.getPort());
+        std::unique_ptr<Poco::Net::HTTPClientSession> session;
+        if (_app._serverURI.compare(0, 5, "https") == 0)
+            session.reset(new Poco::Net::HTTPSClientSession(uri.getHost(), uri.getPort()));
         else
-            session = new Poco::Net::HTTPClientSession(uri.getHost(), uri.getPort());
+            session.reset(new Poco::Net::HTTPClientSession(uri.getHost(), uri.getPort()));
 
         Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_POST, "/convert-to");
 
@@ -114,7 +136,7 @@ public:
         {
             std::cerr << "Failed to write data: " << e.name() <<
                   " " << e.message() << "\n";
-            return;
+            return false;
         }
 
         Poco::Net::HTTPResponse response;
@@ -127,6 +149,13 @@ public:
 
             std::cerr << "Get response\n";
 
+            if (response.getStatus() != Poco::Net::HTTPResponse::HTTP_OK)
+            {
+                std::cerr << "Failed to convert " << document << ": " << response.getStatus() <<
+                    " " << response.getReason() << "\n";
+                return false;
+            }
+
             Poco::Path path(document);
             std::string outPath = _app._destinationDir + "/" + path.getBaseName() + "." + _app._destinationFormat;
             std::ofstream fileStream(outPath);
@@ -141,15 +170,16 @@ public:
         {
             std::cerr << "Exception converting: " << e.name() <<
                   " " << e.message() << "\n";
-            return;
+            return false;
         }
 
-        delete session;
+        return true;
     }
 };
 
 Tool::Tool() :
     _numWorkers(4),
+    _repeat(1),
 #if ENABLE_SSL
     _serverURI("https://127.0.0.1:" + std::to_string(DEFAULT_CLIENT_PORT_NUMBER)),
 #else
@@ -173,6 +203,9 @@ void Tool::defineOptions(OptionSet& optionSet)
     optionSet.addOption(Option("parallelism", "", "number of simultaneous threads to use")
                         .required(false).repeatable(false)
                         .argument("threads"));
+    optionSet.addOption(Option("repeat", "", "number of times to convert each file, to measure throughput")
+                        .required(false).repeatable(false)
+                        .argument("count"));
     optionSet.addOption(Option("server", "", "URI of LOOL server")
                         .required(false).repeatable(false)
                         .argument("uri"));
@@ -201,6 +234,8 @@ void Tool::handleOption(const std::string& optionName,
         _destinationDir = value;
     else if (optionName == "parallelism")
         _numWorkers = std::max(std::stoi(value), 1);
+    else if (optionName == "repeat")
+        _repeat = std::max(std::stoi(value), 1);
     else if (optionName == "uri")
         _serverURI = value;
     else if (optionName == "no-check-certificate")
@@ -215,6 +250,8 @@ void Tool::handleOption(const std::string& optionName,
 int Tool::main(const std::vector<std::string>& args)
 {
     std::vector<std::unique_ptr<Thread>> clients(_numWorkers);
+    std::vector<std::unique_ptr<Worker>> workers;
+    const auto start = std::chrono::steady_clock::now();
 
     size_t chunk = (args.size() + _numWorkers - 1) / _numWorkers;
     size_t offset = 0;
@@ -227,7 +264,8 @@ int Tool::main(const std::vector<std::string>& args)
             std::vector< std::string > files( toCopy );
             std::copy( args.begin() + offset, args.begin() + offset + toCopy, files.begin() );
             offset += toCopy;
-            clients[i]->start(*(new Worker(*this, files)));
+            workers.emplace_back(new Worker(*this, files));
+            clients[i]->start(*workers.back());
         }
     }
 
@@ -236,7 +274,34 @@ int Tool::main(const std::vector<std::string>& args)
         clients[i]->join();
     }
 
-    return Application::EXIT_OK;
+    const double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> latenciesMs;
+    unsigned failures = 0;
+    for (const auto& worker : workers)
+    {
+        latenciesMs.insert(latenciesMs.end(), worker->_latenciesMs.begin(), worker->_latenciesMs.end());
+        failures += worker->_failures;
+    }
+
+    std::sort(latenciesMs.begin(), latenciesMs.end());
+    const auto percentile = [&latenciesMs](const double p)
+    {
+        return (latenciesMs.empty() ? 0 : latenciesMs[static_cast<size_t>(p * (latenciesMs.size() - 1))]);
+    };
+
+    double totalMs = 0;
+    for (const double latencyMs : latenciesMs)
+        totalMs += latencyMs;
+
+    std::cout << "Converted " << latenciesMs.size() << " files, " << failures << " failed, with " <<
+        _numWorkers << " workers in " << static_cast<long>(elapsedMs) << " ms: " <<
+        (elapsedMs > 0 ? latenciesMs.size() * 1000 / elapsedMs : 0) << " files/s, latency avg " <<
+        static_cast<long>(latenciesMs.empty() ? 0 : totalMs / latenciesMs.size()) << " ms, p50 " <<
+        static_cast<long>(percentile(0.5)) << " ms, p95 " << static_cast<long>(percentile(0.95)) <<
+        " ms, max " << static_cast<long>(percentile(1)) << " ms." << std::endl;
+
+    return (failures == 0 ? Application::EXIT_OK : Application::EXIT_SOFTWARE);
 }
 
 POCO_APP_MAIN(Tool)
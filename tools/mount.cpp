@@ -12,6 +12,7 @@
 
 #include "config.h"
 
+#include <string.h>
 #include <sys/mount.h>
 
 #include "security.h"
@@ -24,6 +25,10 @@ int main(int argc, char **argv)
     if (argc < 3)
         return 1;
 
+    // Unmount, when done with a jail.
+    if (strcmp(argv[1], "-u") == 0)
+        return umount2(argv[2], MNT_DETACH);
+
     int retval = mount (argv[1], argv[2], nullptr, MS_BIND, nullptr);
     if (retval)
         return retval;
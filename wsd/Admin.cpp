@@ -103,7 +103,14 @@ void AdminSocketHandler::handleMessage(bool /* fin */, WSOpCode /* code */,
              tokens[0] == "active_users_count" ||
              tokens[0] == "active_docs_count" ||
              tokens[0] == "mem_stats" ||
-             tokens[0] == "cpu_stats")
+             tokens[0] == "cpu_stats" ||
+             tokens[0] == "load_timings" ||
+             tokens[0] == "prespawn" ||
+             tokens[0] == "convert_queue" ||
+             tokens[0] == "kit_memory" ||
+             tokens[0] == "render_stats" ||
+             tokens[0] == "tile_trace" ||
+             tokens[0] == "tile_cache")
     {
         const std::string result = model.query(tokens[0]);
         if (!result.empty())
@@ -423,6 +430,48 @@ void Admin::updateMemoryDirty(const std::string& docKey, int dirty)
     _model.updateMemoryDirty(docKey, dirty);
 }
 
+void Admin::updateKitMemory(const std::string& docKey, const std::string& kitMemory)
+{
+    std::unique_lock<std::mutex> modelLock(_modelMutex);
+    _model.updateKitMemory(docKey, kitMemory);
+}
+
+void Admin::updateRenderStats(const std::string& docKey, const std::string& renderStats)
+{
+    std::unique_lock<std::mutex> modelLock(_modelMutex);
+    _model.updateRenderStats(docKey, renderStats);
+}
+
+void Admin::updateTileTraceStats(const std::string& docKey, const std::string& tileTraceStats)
+{
+    std::unique_lock<std::mutex> modelLock(_modelMutex);
+    _model.updateTileTraceStats(docKey, tileTraceStats);
+}
+
+void Admin::updateTileCacheSize(const std::string& docKey, const size_t bytes)
+{
+    std::unique_lock<std::mutex> modelLock(_modelMutex);
+    _model.updateTileCacheSize(docKey, bytes);
+}
+
+void Admin::updateLoadTimings(const std::string& docKey, const std::string& timings)
+{
+    std::unique_lock<std::mutex> modelLock(_modelMutex);
+    _model.updateLoadTimings(docKey, timings);
+}
+
+void Admin::updatePrespawnStats(const std::string& stats)
+{
+    std::unique_lock<std::mutex> modelLock(_modelMutex);
+    _model.updatePrespawnStats(stats);
+}
+
+void Admin::updateConvertStats(const std::string& stats)
+{
+    std::unique_lock<std::mutex> modelLock(_modelMutex);
+    _model.updateConvertStats(stats);
+}
+
 void Admin::dumpState(std::ostream& os)
 {
     // FIXME: be more helpful ...
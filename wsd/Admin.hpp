@@ -100,6 +100,13 @@ public:
 
     void updateLastActivityTime(const std::string& docKey);
     void updateMemoryDirty(const std::string& docKey, int dirty);
+    void updateKitMemory(const std::string& docKey, const std::string& kitMemory);
+    void updateRenderStats(const std::string& docKey, const std::string& renderStats);
+    void updateTileTraceStats(const std::string& docKey, const std::string& tileTraceStats);
+    void updateTileCacheSize(const std::string& docKey, size_t bytes);
+    void updateLoadTimings(const std::string& docKey, const std::string& timings);
+    void updatePrespawnStats(const std::string& stats);
+    void updateConvertStats(const std::string& stats);
 
     void dumpState(std::ostream& os) override;
 
@@ -125,6 +125,34 @@ std::string AdminModel::query(const std::string& command)
     {
         return std::to_string(_cpuStatsSize);
     }
+    else if (token == "load_timings")
+    {
+        return getLoadTimings();
+    }
+    else if (token == "prespawn")
+    {
+        return _prespawnStats;
+    }
+    else if (token == "convert_queue")
+    {
+        return _convertStats;
+    }
+    else if (token == "kit_memory")
+    {
+        return getKitMemory();
+    }
+    else if (token == "render_stats")
+    {
+        return getRenderStats();
+    }
+    else if (token == "tile_trace")
+    {
+        return getTileTraceStats();
+    }
+    else if (token == "tile_cache")
+    {
+        return getTileCacheSizes();
+    }
 
     return std::string("");
 }
@@ -387,6 +415,81 @@ std::string AdminModel::getDocuments() const
     return oss.str();
 }
 
+std::string AdminModel::getLoadTimings() const
+{
+    std::ostringstream oss;
+    for (const auto& it: _documents)
+    {
+        if (!it.second.isExpired() && !it.second.getLoadTimings().empty())
+        {
+            oss << it.second.getPid() << ' '
+                << it.second.getLoadTimings() << " \n ";
+        }
+    }
+
+    return oss.str();
+}
+
+std::string AdminModel::getKitMemory() const
+{
+    std::ostringstream oss;
+    for (const auto& it: _documents)
+    {
+        if (!it.second.isExpired() && !it.second.getKitMemory().empty())
+        {
+            oss << it.second.getPid() << ' '
+                << it.second.getKitMemory() << " \n ";
+        }
+    }
+
+    return oss.str();
+}
+
+std::string AdminModel::getRenderStats() const
+{
+    std::ostringstream oss;
+    for (const auto& it: _documents)
+    {
+        if (!it.second.isExpired() && !it.second.getRenderStats().empty())
+        {
+            oss << it.second.getPid() << ' '
+                << it.second.getRenderStats() << " \n ";
+        }
+    }
+
+    return oss.str();
+}
+
+std::string AdminModel::getTileTraceStats() const
+{
+    std::ostringstream oss;
+    for (const auto& it: _documents)
+    {
+        if (!it.second.isExpired() && !it.second.getTileTraceStats().empty())
+        {
+            oss << it.second.getPid() << ' '
+                << it.second.getTileTraceStats() << " \n ";
+        }
+    }
+
+    return oss.str();
+}
+
+std::string AdminModel::getTileCacheSizes() const
+{
+    std::ostringstream oss;
+    for (const auto& it: _documents)
+    {
+        if (!it.second.isExpired())
+        {
+            oss << it.second.getPid() << ' '
+                << it.second.getTileCacheSize() << " \n ";
+        }
+    }
+
+    return oss.str();
+}
+
 void AdminModel::updateLastActivityTime(const std::string& docKey)
 {
     auto docIt = _documents.find(docKey);
@@ -419,4 +522,109 @@ void AdminModel::updateMemoryDirty(const std::string& docKey, int dirty)
     }
 }
 
+bool Document::updateKitMemory(const std::string& kitMemory)
+{
+    if (_kitMemory == kitMemory)
+        return false;
+    _kitMemory = kitMemory;
+    return true;
+}
+
+void AdminModel::updateKitMemory(const std::string& docKey, const std::string& kitMemory)
+{
+    auto docIt = _documents.find(docKey);
+    if (docIt != _documents.end() &&
+        docIt->second.updateKitMemory(kitMemory))
+    {
+        notify("propchange " + std::to_string(docIt->second.getPid()) +
+               " kitmem " + kitMemory);
+    }
+}
+
+bool Document::updateRenderStats(const std::string& renderStats)
+{
+    if (_renderStats == renderStats)
+        return false;
+    _renderStats = renderStats;
+    return true;
+}
+
+void AdminModel::updateRenderStats(const std::string& docKey, const std::string& renderStats)
+{
+    auto docIt = _documents.find(docKey);
+    if (docIt != _documents.end() &&
+        docIt->second.updateRenderStats(renderStats))
+    {
+        notify("propchange " + std::to_string(docIt->second.getPid()) +
+               " render " + renderStats);
+    }
+}
+
+bool Document::updateTileTraceStats(const std::string& tileTraceStats)
+{
+    if (_tileTraceStats == tileTraceStats)
+        return false;
+    _tileTraceStats = tileTraceStats;
+    return true;
+}
+
+void AdminModel::updateTileTraceStats(const std::string& docKey, const std::string& tileTraceStats)
+{
+    auto docIt = _documents.find(docKey);
+    if (docIt != _documents.end() &&
+        docIt->second.updateTileTraceStats(tileTraceStats))
+    {
+        notify("propchange " + std::to_string(docIt->second.getPid()) +
+               " tiletrace " + tileTraceStats);
+    }
+}
+
+bool Document::updateTileCacheSize(const size_t bytes)
+{
+    if (_tileCacheBytes == bytes)
+        return false;
+    _tileCacheBytes = bytes;
+    return true;
+}
+
+void AdminModel::updateTileCacheSize(const std::string& docKey, const size_t bytes)
+{
+    auto docIt = _documents.find(docKey);
+    if (docIt != _documents.end() &&
+        docIt->second.updateTileCacheSize(bytes))
+    {
+        notify("propchange " + std::to_string(docIt->second.getPid()) +
+               " tilecache " + std::to_string(bytes));
+    }
+}
+
+void AdminModel::updateLoadTimings(const std::string& docKey, const std::string& timings)
+{
+    auto docIt = _documents.find(docKey);
+    if (docIt != _documents.end())
+    {
+        docIt->second.setLoadTimings(timings);
+        notify("propchange " + std::to_string(docIt->second.getPid()) +
+               " load " + timings);
+    }
+}
+
+void AdminModel::updatePrespawnStats(const std::string& stats)
+{
+    if (_prespawnStats != stats)
+    {
+        _prespawnStats = stats;
+        notify("prespawn " + stats);
+    }
+}
+
+void AdminModel::updateConvertStats(const std::string& stats)
+{
+    if (_convertStats != stats)
+    {
+        _convertStats = stats;
+        notify("convert_queue " + stats);
+    }
+}
+
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -50,6 +50,7 @@ public:
           _pid(pid),
           _filename(filename),
           _memoryDirty(0),
+          _tileCacheBytes(0),
           _start(std::time(nullptr)),
           _lastActivity(_start)
     {
@@ -77,6 +78,30 @@ public:
     bool updateMemoryDirty(int dirty);
     int getMemoryDirty() const { return _memoryDirty; }
 
+    /// Returns true if changed.
+    bool updateKitMemory(const std::string& kitMemory);
+    /// The private, shared and swapped memory of the Kit, and the
+    /// memory it shared after forking that it no longer does.
+    const std::string& getKitMemory() const { return _kitMemory; }
+
+    /// Returns true if changed.
+    bool updateRenderStats(const std::string& renderStats);
+    /// How long tiles waited in the Kit's queue and took to render.
+    const std::string& getRenderStats() const { return _renderStats; }
+
+    /// Returns true if changed.
+    bool updateTileTraceStats(const std::string& tileTraceStats);
+    /// How long the tiles took in each stage, from their request to being sent.
+    const std::string& getTileTraceStats() const { return _tileTraceStats; }
+
+    /// Returns true if changed.
+    bool updateTileCacheSize(size_t bytes);
+    /// The bytes on disk of the cached tiles of the document.
+    size_t getTileCacheSize() const { return _tileCacheBytes; }
+
+    void setLoadTimings(const std::string& timings) { _loadTimings = timings; }
+    const std::string& getLoadTimings() const { return _loadTimings; }
+
 private:
     const std::string _docKey;
     const Poco::Process::PID _pid;
@@ -88,6 +113,16 @@ private:
     std::string _filename;
     /// The dirty (ie. un-shared) memory of the document's Kit process.
     int _memoryDirty;
+    /// The breakdown of the Kit's memory, as "private=<kb> shared=<kb> swap=<kb> shared_lost=<kb>".
+    std::string _kitMemory;
+    /// The histograms of tile wait and render times, as reported by the Kit.
+    std::string _renderStats;
+    /// The histograms of the stages of the tiles traced by WSD.
+    std::string _tileTraceStats;
+    /// The size of the tile cache on disk.
+    size_t _tileCacheBytes;
+    /// Phases of fetching the document from storage.
+    std::string _loadTimings;
 
     std::time_t _start;
     std::time_t _lastActivity;
@@ -179,6 +214,13 @@ public:
 
     void updateLastActivityTime(const std::string& docKey);
     void updateMemoryDirty(const std::string& docKey, int dirty);
+    void updateKitMemory(const std::string& docKey, const std::string& kitMemory);
+    void updateRenderStats(const std::string& docKey, const std::string& renderStats);
+    void updateTileTraceStats(const std::string& docKey, const std::string& tileTraceStats);
+    void updateTileCacheSize(const std::string& docKey, size_t bytes);
+    void updateLoadTimings(const std::string& docKey, const std::string& timings);
+    void updatePrespawnStats(const std::string& stats);
+    void updateConvertStats(const std::string& stats);
 
 private:
     std::string getMemStats();
@@ -189,6 +231,16 @@ private:
 
     std::string getDocuments() const;
 
+    std::string getLoadTimings() const;
+
+    std::string getKitMemory() const;
+
+    std::string getRenderStats() const;
+
+    std::string getTileTraceStats() const;
+
+    std::string getTileCacheSizes() const;
+
 private:
     std::map<int, Subscriber> _subscribers;
     std::map<std::string, Document> _documents;
@@ -199,6 +251,12 @@ private:
 
     std::list<unsigned> _cpuStats;
     unsigned _cpuStatsSize = 100;
+
+    /// The latest decisions of the prespawn pool sizing.
+    std::string _prespawnStats;
+
+    /// The latest state of the convert-to queue.
+    std::string _convertStats;
 };
 
 #endif
@@ -15,10 +15,12 @@
 
 #include <Poco/URI.h>
 
+#include "Command.hpp"
 #include "Common.hpp"
 #include "DocumentBroker.hpp"
 #include "LOOLWSD.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
 #include "Protocol.hpp"
 #include "Session.hpp"
 #include "Util.hpp"
@@ -48,6 +50,9 @@ ClientSession::~ClientSession()
 {
     LOG_INF("~ClientSession dtor [" << getName() << "].");
 
+    // Torn down before the conversion completed; its client still waits.
+    failSaveAs();
+
     stop();
 }
 
@@ -63,7 +68,8 @@ bool ClientSession::_handleInput(const char *buffer, int length)
 {
     LOG_TRC(getName() << ": handling [" << getAbbreviatedMessage(buffer, length) << "].");
     const std::string firstLine = getFirstLine(buffer, length);
-    const auto tokens = LOOLProtocol::tokenize(firstLine.data(), firstLine.size());
+    // Spans over the first line; only the cold commands copy their tokens.
+    const LOOLProtocol::TokenSpans tokens(firstLine);
 
     auto docBroker = getDocumentBroker();
     if (!docBroker)
@@ -81,9 +87,12 @@ bool ClientSession::_handleInput(const char *buffer, int length)
         docBroker->updateLastActivityTime();
     }
 
-    if (tokens[0] == "loolclient")
+    const LOOLProtocol::Command command = LOOLProtocol::getCommand(tokens[0]);
+    Metrics::instance()._clientCommands[static_cast<size_t>(command)].inc();
+
+    if (command == LOOLProtocol::Command::LoolClient)
     {
-        const auto versionTuple = ParseVersion(tokens[1]);
+        const auto versionTuple = ParseVersion(tokens[1].toString());
         if (std::get<0>(versionTuple) != ProtocolMajorVersionNumber ||
             std::get<1>(versionTuple) != ProtocolMinorVersionNumber)
         {
@@ -105,7 +114,7 @@ bool ClientSession::_handleInput(const char *buffer, int length)
         return true;
     }
 
-    if (tokens[0] == "load")
+    if (command == LOOLProtocol::Command::Load)
     {
         if (_docURL != "")
         {
@@ -113,115 +122,140 @@ bool ClientSession::_handleInput(const char *buffer, int length)
             return false;
         }
 
-        return loadDocument(buffer, length, tokens, docBroker);
-    }
-    else if (tokens[0] != "canceltiles" &&
-             tokens[0] != "clientzoom" &&
-             tokens[0] != "clientvisiblearea" &&
-             tokens[0] != "commandvalues" &&
-             tokens[0] != "closedocument" &&
-             tokens[0] != "downloadas" &&
-             tokens[0] != "getchildid" &&
-             tokens[0] != "gettextselection" &&
-             tokens[0] != "paste" &&
-             tokens[0] != "insertfile" &&
-             tokens[0] != "key" &&
-             tokens[0] != "mouse" &&
-             tokens[0] != "partpagerectangles" &&
-             tokens[0] != "ping" &&
-             tokens[0] != "renderfont" &&
-             tokens[0] != "requestloksession" &&
-             tokens[0] != "resetselection" &&
-             tokens[0] != "saveas" &&
-             tokens[0] != "selectgraphic" &&
-             tokens[0] != "selecttext" &&
-             tokens[0] != "setclientpart" &&
-             tokens[0] != "setpage" &&
-             tokens[0] != "status" &&
-             tokens[0] != "tile" &&
-             tokens[0] != "tilecombine" &&
-             tokens[0] != "uno" &&
-             tokens[0] != "useractive" &&
-             tokens[0] != "userinactive")
-    {
-        sendTextFrame("error: cmd=" + tokens[0] + " kind=unknown");
-        return false;
+        return loadDocument(buffer, length, LOOLProtocol::tokenize(firstLine), docBroker);
     }
-    else if (_docURL == "")
+    else if (!LOOLProtocol::isClientCommand(command))
     {
-        sendTextFrame("error: cmd=" + tokens[0] + " kind=nodocloaded");
+        sendTextFrame("error: cmd=" + tokens[0].toString() + " kind=unknown");
         return false;
     }
-    else if (tokens[0] == "canceltiles")
-    {
-        docBroker->cancelTileRequests(shared_from_this());
-        return true;
-    }
-    else if (tokens[0] == "commandvalues")
+    else if (_docURL == "")
     {
-        return getCommandValues(buffer, length, tokens, docBroker);
+        sendTextFrame("error: cmd=" + tokens[0].toString() + " kind=nodocloaded");
+        return false;
     }
-    else if (tokens[0] == "closedocument")
+    else if (isTileCacheCommand(command))
     {
-        // If this session is the owner of the file & 'EnableOwnerTermination' feature
-        // is turned on by WOPI, let it close all sessions
-        if (_isDocumentOwner && _wopiFileInfo && _wopiFileInfo->_enableOwnerTermination)
+        if (!docBroker->hasTileCache())
         {
-            LOG_DBG("Session [" << getId() << "] requested owner termination");
-            docBroker->closeDocument("ownertermination");
+            // We are still waiting for a child. What is forwarded to it is
+            // queued meanwhile, and these wait for the tile cache likewise.
+            LOG_TRC(getName() << ": deferring [" << firstLine << "] until the document is loaded.");
+            _deferredMessages.emplace_back(buffer, length);
+            return true;
         }
 
-        return true;
-    }
-    else if (tokens[0] == "partpagerectangles")
-    {
-        // We don't support partpagerectangles any more, will be removed in the
-        // next version
-        sendTextFrame("partpagerectangles: ");
-        return true;
-    }
-    else if (tokens[0] == "ping")
-    {
-        std::string count = std::to_string(docBroker->getRenderedTileCount());
-        sendTextFrame("pong rendercount=" + count);
-        return true;
+        return handleTileCacheCommand(command, buffer, length, firstLine, tokens, docBroker);
     }
-    else if (tokens[0] == "renderfont")
-    {
-        return sendFontRendering(buffer, length, tokens, docBroker);
-    }
-    else if (tokens[0] == "status")
+
+    switch (command)
     {
-        assert(firstLine.size() == static_cast<size_t>(length));
-        return forwardToChild(firstLine, docBroker);
+        case LOOLProtocol::Command::CloseDocument:
+            // If this session is the owner of the file & 'EnableOwnerTermination' feature
+            // is turned on by WOPI, let it close all sessions
+            if (_isDocumentOwner && _wopiFileInfo && _wopiFileInfo->_enableOwnerTermination)
+            {
+                LOG_DBG("Session [" << getId() << "] requested owner termination");
+                docBroker->closeDocument("ownertermination");
+            }
+
+            return true;
+
+        case LOOLProtocol::Command::PartPageRectangles:
+            // We don't support partpagerectangles any more, will be removed in the
+            // next version
+            sendTextFrame("partpagerectangles: ");
+            return true;
+
+        case LOOLProtocol::Command::Ping:
+            sendTextFrame("pong rendercount=" + std::to_string(docBroker->getRenderedTileCount()));
+            return true;
+
+        case LOOLProtocol::Command::Status:
+            assert(firstLine.size() == static_cast<size_t>(length));
+            return forwardToChild(firstLine, docBroker);
+
+        case LOOLProtocol::Command::Thumbnail:
+            if (!_saveAsSocket)
+            {
+                // Only rendered for the thumbnail requests, which have somewhere to send it.
+                sendTextFrame("error: cmd=thumbnail kind=notallowed");
+                return false;
+            }
+
+            break;
+
+        default:
+            break;
     }
-    else if (tokens[0] == "tile")
+
+    if (!filterMessage(firstLine))
     {
-        return sendTile(buffer, length, tokens, docBroker);
+        const std::string dummyFrame = "dummymsg";
+        return forwardToChild(dummyFrame, docBroker);
     }
-    else if (tokens[0] == "tilecombine")
+    else if (command != LOOLProtocol::Command::RequestLokSession)
     {
-        return sendCombinedTiles(buffer, length, tokens, docBroker);
+        return forwardToChild(std::string(buffer, length), docBroker);
     }
-    else
+
+    return true;
+}
+
+bool ClientSession::isTileCacheCommand(const LOOLProtocol::Command command)
+{
+    return command == LOOLProtocol::Command::CancelTiles ||
+           command == LOOLProtocol::Command::CommandValues ||
+           command == LOOLProtocol::Command::RenderFont ||
+           command == LOOLProtocol::Command::Tile ||
+           command == LOOLProtocol::Command::TileCombine;
+}
+
+bool ClientSession::handleTileCacheCommand(const LOOLProtocol::Command command, const char* buffer, const int length,
+                                           const std::string& firstLine, const LOOLProtocol::TokenSpans& tokens,
+                                           const std::shared_ptr<DocumentBroker>& docBroker)
+{
+    switch (command)
     {
-        if (!filterMessage(firstLine))
-        {
-            const std::string dummyFrame = "dummymsg";
-            return forwardToChild(dummyFrame, docBroker);
-        }
-        else if (tokens[0] != "requestloksession")
-        {
-            return forwardToChild(std::string(buffer, length), docBroker);
-        }
-        else
-        {
-            assert(tokens[0] == "requestloksession");
+        case LOOLProtocol::Command::CancelTiles:
+            docBroker->cancelTileRequests(shared_from_this());
             return true;
-        }
+
+        case LOOLProtocol::Command::CommandValues:
+            return getCommandValues(buffer, length, tokens, docBroker);
+
+        case LOOLProtocol::Command::RenderFont:
+            return sendFontRendering(buffer, length, LOOLProtocol::tokenize(firstLine), docBroker);
+
+        case LOOLProtocol::Command::Tile:
+            return sendTile(buffer, length, tokens, docBroker);
+
+        case LOOLProtocol::Command::TileCombine:
+            return sendCombinedTiles(buffer, length, tokens, docBroker);
+
+        default:
+            assert(!"Not a tile cache command.");
+            return false;
     }
+}
 
-    return false;
+void ClientSession::replayDeferredMessages()
+{
+    std::vector<std::string> messages;
+    std::swap(messages, _deferredMessages);
+
+    const auto docBroker = getDocumentBroker();
+    if (!docBroker || messages.empty())
+        return;
+
+    LOG_DBG(getName() << ": handling " << messages.size() << " messages deferred until the document loaded.");
+    for (const std::string& message : messages)
+    {
+        const std::string firstLine = getFirstLine(message.data(), message.size());
+        const LOOLProtocol::TokenSpans tokens(firstLine);
+        handleTileCacheCommand(LOOLProtocol::getCommand(tokens[0]), message.data(), static_cast<int>(message.size()),
+                               firstLine, tokens, docBroker);
+    }
 }
 
 bool ClientSession::loadDocument(const char* /*buffer*/, int /*length*/,
@@ -282,15 +316,16 @@ bool ClientSession::loadDocument(const char* /*buffer*/, int /*length*/,
     return false;
 }
 
-bool ClientSession::getCommandValues(const char *buffer, int length, const std::vector<std::string>& tokens,
+bool ClientSession::getCommandValues(const char *buffer, int length, const LOOLProtocol::TokenSpans& tokens,
                                      const std::shared_ptr<DocumentBroker>& docBroker)
 {
-    std::string command;
-    if (tokens.size() != 2 || !getTokenString(tokens[1], "command", command))
+    LOOLProtocol::StringSpan value;
+    if (tokens.size() != 2 || !getTokenString(tokens[1], "command", value))
     {
         return sendTextFrame("error: cmd=commandvalues kind=syntax");
     }
 
+    const std::string command = value.toString();
     std::string cmdValues;
     if (docBroker->tileCache().getTextFile("cmdValues" + command + ".txt", cmdValues))
     {
@@ -334,12 +369,14 @@ bool ClientSession::sendFontRendering(const char *buffer, int length, const std:
     return forwardToChild(std::string(buffer, length), docBroker);
 }
 
-bool ClientSession::sendTile(const char * /*buffer*/, int /*length*/, const std::vector<std::string>& tokens,
+bool ClientSession::sendTile(const char * /*buffer*/, int /*length*/, const LOOLProtocol::TokenSpans& tokens,
                              const std::shared_ptr<DocumentBroker>& docBroker)
 {
     try
     {
         auto tileDesc = TileDesc::parse(tokens);
+        // Tiles are traced by WSD and the Kit only, never by the client.
+        tileDesc.clearTrace();
         docBroker->handleTileRequest(tileDesc, shared_from_this());
     }
     catch (const std::exception& exc)
@@ -351,12 +388,13 @@ bool ClientSession::sendTile(const char * /*buffer*/, int /*length*/, const std:
     return true;
 }
 
-bool ClientSession::sendCombinedTiles(const char* /*buffer*/, int /*length*/, const std::vector<std::string>& tokens,
+bool ClientSession::sendCombinedTiles(const char* /*buffer*/, int /*length*/, const LOOLProtocol::TokenSpans& tokens,
                                       const std::shared_ptr<DocumentBroker>& docBroker)
 {
     try
     {
         auto tileCombined = TileCombined::parse(tokens);
+        tileCombined.clearTraces();
         docBroker->handleTileCombinedRequest(tileCombined, shared_from_this());
     }
     catch (const std::exception& exc)
@@ -414,7 +452,8 @@ bool ClientSession::filterMessage(const std::string& message) const
     {
         // By default, don't allow anything
         allowed = false;
-        if (tokens[0] == "userinactive" || tokens[0] == "useractive" || tokens[0] == "saveas")
+        if (tokens[0] == "userinactive" || tokens[0] == "useractive" || tokens[0] == "saveas" ||
+            tokens[0] == "thumbnail")
         {
             allowed = true;
         }
@@ -473,6 +512,14 @@ void ClientSession::performWrites()
             LOG_ERR("Failed to send message [" << LOOLProtocol::getAbbreviatedMessage(data) <<
                     "] to " << getName() << ": " << ex.what());
         }
+
+        int traceId = 0;
+        if (item->firstToken() == "tile:" && item->getTokenInteger("traceid", traceId))
+        {
+            const auto docBroker = getDocumentBroker();
+            if (docBroker)
+                docBroker->tileTraceSent(traceId);
+        }
     }
 
     LOG_DBG(getName() << " ClientSession: performed write");
@@ -630,6 +677,10 @@ bool ClientSession::handleKitToClientMessage(const char* buffer, const int lengt
         {
             assert(firstLine.size() == static_cast<std::string::size_type>(length));
             docBroker->invalidateTiles(firstLine);
+
+            // Merged with those that follow, until the cache is invalidated.
+            if (LOOLWSD::InvalidationWindowMs > 0 && _invalidations.add(firstLine))
+                return true;
         }
         else if (tokens[0] == "invalidatecursor:")
         {
@@ -678,6 +729,16 @@ bool ClientSession::handleKitToClientMessage(const char* buffer, const int lengt
     return forwardToClient(payload);
 }
 
+void ClientSession::sendInvalidations()
+{
+    for (const auto& area : _invalidations.getAreas())
+    {
+        forwardToClient(std::make_shared<Message>(TileInvalidations::toMessage(area), Message::Dir::Out));
+    }
+
+    _invalidations.clear();
+}
+
 bool ClientSession::forwardToClient(const std::shared_ptr<Message>& payload)
 {
     const auto& message = payload->abbr();
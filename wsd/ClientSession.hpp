@@ -10,13 +10,18 @@
 #ifndef INCLUDED_CLIENTSSESSION_HPP
 #define INCLUDED_CLIENTSSESSION_HPP
 
+#include "Command.hpp"
 #include "Session.hpp"
 #include "Storage.hpp"
 #include "MessageQueue.hpp"
 #include "SenderQueue.hpp"
 #include "DocumentBroker.hpp"
+#include <Poco/Path.h>
 #include <Poco/URI.h>
 
+#include <functional>
+#include <vector>
+
 class DocumentBroker;
 
 /// Represents a session to a LOOL client, in the WSD process.
@@ -47,6 +52,10 @@ public:
     /// Handle kit-to-client message.
     bool handleKitToClientMessage(const char* data, const int size);
 
+    /// Sends the client the invalidations held back while the
+    /// DocumentBroker batched them, once it invalidated the cache.
+    void sendInvalidations();
+
     using Session::sendTextFrame;
 
     bool sendBinaryFrame(const char* buffer, int length) override
@@ -74,6 +83,13 @@ public:
             // Fail silently and return as there is no actual websocket
             // connection in this case.
             LOG_INF(getName() << ": Headless peer, not forwarding message [" << data->abbr() << "].");
+
+            // All a conversion hears of failing to load or save.
+            if (_saveAsDoneHandler && !data->tokens().empty() && data->firstToken() == "error:")
+            {
+                LOG_WRN(getName() << ": Save-as failed with [" << data->abbr() << "].");
+                failSaveAs();
+            }
         }
         else
         {
@@ -82,6 +98,9 @@ public:
         }
     }
 
+    /// The messages waiting to be sent to the client.
+    size_t getSenderQueueSize() const { return _senderQueue.size(); }
+
     bool stopping() const { return _stop || _senderQueue.stopping(); }
     void stop()
     {
@@ -94,21 +113,41 @@ public:
         _saveAsSocket = socket;
     }
 
+    /// Called once the save-as completed, after sending the result, if any,
+    /// with the local path of the result, or empty on failure: when loading
+    /// or saving fails, on failSaveAs(), or when we are destroyed before.
+    void setSaveAsDoneHandler(const std::function<void(const std::string&)>& handler)
+    {
+        _saveAsDoneHandler = handler;
+    }
+
     void setSaveAsUrl(const std::string& url)
     {
         Poco::URI resultURL(url);
         LOG_TRC("Save-as URL: " << resultURL.toString());
 
-        if (!resultURL.getPath().empty())
+        const std::string path = resultURL.getPath();
+        if (!_saveAsDoneHandler)
         {
-            const std::string mimeType = "application/octet-stream";
+            LOG_WRN(getName() << ": Save-as completed after it failed, dropping [" << path << "].");
+        }
+        else if (!path.empty())
+        {
+            // The thumbnails are all PNG, like their cached copies.
+            const std::string mimeType = (Poco::Path(path).getExtension() == "png"
+                                          ? "image/png" : "application/octet-stream");
             std::string encodedFilePath;
-            Poco::URI::encode(resultURL.getPath(), "", encodedFilePath);
+            Poco::URI::encode(path, "", encodedFilePath);
             LOG_TRC("Sending file: " << encodedFilePath);
             HttpHelper::sendFile(_saveAsSocket, encodedFilePath, mimeType);
         }
+
+        saveAsDone(path);
     }
 
+    /// Fails the save-as, unless it completed already.
+    void failSaveAs() { saveAsDone(std::string()); }
+
     std::shared_ptr<DocumentBroker> getDocumentBroker() const { return _docBroker.lock(); }
 
     /// Exact URI (including query params - access tokens etc.) with which
@@ -118,6 +157,10 @@ public:
     /// Set WOPI fileinfo object
     void setWopiFileInfo(std::unique_ptr<WopiStorage::WOPIFileInfo>& wopiFileInfo) { _wopiFileInfo = std::move(wopiFileInfo); }
 
+    /// Handles the tile cache commands received before the document had a
+    /// tile cache (see DocumentBroker::hasTileCache), now that it has.
+    void replayDeferredMessages();
+
 private:
 
     /// SocketHandler: disconnection event.
@@ -130,20 +173,36 @@ private:
 
     virtual bool _handleInput(const char* buffer, int length) override;
 
+    /// Calls the save-as done handler, only the first time.
+    void saveAsDone(const std::string& path)
+    {
+        std::function<void(const std::string&)> handler;
+        std::swap(handler, _saveAsDoneHandler);
+        if (handler)
+            handler(path);
+    }
+
     bool loadDocument(const char* buffer, int length, const std::vector<std::string>& tokens,
                       const std::shared_ptr<DocumentBroker>& docBroker);
     bool getStatus(const char* buffer, int length,
                    const std::shared_ptr<DocumentBroker>& docBroker);
-    bool getCommandValues(const char* buffer, int length, const std::vector<std::string>& tokens,
+    bool getCommandValues(const char* buffer, int length, const LOOLProtocol::TokenSpans& tokens,
                           const std::shared_ptr<DocumentBroker>& docBroker);
-    bool sendTile(const char* buffer, int length, const std::vector<std::string>& tokens,
+    bool sendTile(const char* buffer, int length, const LOOLProtocol::TokenSpans& tokens,
                   const std::shared_ptr<DocumentBroker>& docBroker);
-    bool sendCombinedTiles(const char* buffer, int length, const std::vector<std::string>& tokens,
+    bool sendCombinedTiles(const char* buffer, int length, const LOOLProtocol::TokenSpans& tokens,
                            const std::shared_ptr<DocumentBroker>& docBroker);
 
     bool sendFontRendering(const char* buffer, int length, const std::vector<std::string>& tokens,
                            const std::shared_ptr<DocumentBroker>& docBroker);
 
+    /// Whether the command is served by us from the tile cache, rather than by the child.
+    static bool isTileCacheCommand(LOOLProtocol::Command command);
+
+    bool handleTileCacheCommand(LOOLProtocol::Command command, const char* buffer, int length,
+                                const std::string& firstLine, const LOOLProtocol::TokenSpans& tokens,
+                                const std::shared_ptr<DocumentBroker>& docBroker);
+
     bool forwardToChild(const std::string& message,
                         const std::shared_ptr<DocumentBroker>& docBroker);
 
@@ -169,6 +228,7 @@ private:
 
     /// The socket to which the converted (saveas) doc is sent.
     std::shared_ptr<StreamSocket> _saveAsSocket;
+    std::function<void(const std::string&)> _saveAsDoneHandler;
 
     bool _isLoaded;
 
@@ -177,6 +237,12 @@ private:
 
     SenderQueue<std::shared_ptr<Message>> _senderQueue;
     std::atomic<bool> _stop;
+
+    /// The invalidations from the Kit not sent to the client yet.
+    TileInvalidations _invalidations;
+
+    /// The tile cache commands received before there was a tile cache.
+    std::vector<std::string> _deferredMessages;
 };
 
 #endif
@@ -0,0 +1,203 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "ConvertQueue.hpp"
+
+#include <cmath>
+#include <sstream>
+
+ConvertQueue::ConvertQueue() :
+    _maxRunning(0),
+    _maxQueued(0),
+    _timeout(0),
+    _nextId(1),
+    _started(0),
+    _completed(0),
+    _rejected(0),
+    _timedOut(0),
+    _waitMs(0),
+    _runMs(0)
+{
+}
+
+void ConvertQueue::configure(const size_t maxRunning, const size_t maxQueued, const std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _maxRunning = maxRunning;
+    _maxQueued = maxQueued;
+    _timeout = timeout;
+}
+
+unsigned ConvertQueue::submit(const TimePoint now, const Callback& start, const Callback& cancel)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    const bool canRun = (_maxRunning == 0 || _running.size() < _maxRunning);
+    if (!canRun && _queued.size() >= _maxQueued)
+    {
+        ++_rejected;
+        return 0;
+    }
+
+    Job job = { _nextId++, now, now, start, cancel };
+    const unsigned id = job._id;
+    if (!canRun)
+    {
+        _queued.push_back(job);
+        return id;
+    }
+
+    _running[id] = job;
+    addWaitSample(0);
+    lock.unlock();
+
+    start(id);
+    return id;
+}
+
+void ConvertQueue::finished(const unsigned id, const TimePoint now)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    const auto it = _running.find(id);
+    if (it == _running.end())
+    {
+        // Timed out already, or finished twice.
+        return;
+    }
+
+    const double runMs = std::chrono::duration<double, std::milli>(now - it->second._started).count();
+    _runMs = (_completed == 0 ? runMs : _runMs + TimeWeight * (runMs - _runMs));
+    ++_completed;
+    _running.erase(it);
+
+    std::vector<Job> toStart;
+    startQueued(now, toStart);
+    lock.unlock();
+
+    for (const Job& job : toStart)
+    {
+        job._start(job._id);
+    }
+}
+
+void ConvertQueue::expire(const TimePoint now)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_timeout.count() <= 0)
+        return;
+
+    std::vector<Job> toCancel;
+    for (auto it = _running.begin(); it != _running.end(); )
+    {
+        if (now - it->second._submitted >= _timeout)
+        {
+            toCancel.push_back(it->second);
+            it = _running.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    // Queued in order of arrival, so the oldest are first.
+    while (!_queued.empty() && now - _queued.front()._submitted >= _timeout)
+    {
+        toCancel.push_back(_queued.front());
+        _queued.pop_front();
+    }
+
+    _timedOut += toCancel.size();
+
+    std::vector<Job> toStart;
+    startQueued(now, toStart);
+    lock.unlock();
+
+    for (const Job& job : toCancel)
+    {
+        job._cancel(job._id);
+    }
+
+    for (const Job& job : toStart)
+    {
+        job._start(job._id);
+    }
+}
+
+void ConvertQueue::startQueued(const TimePoint now, std::vector<Job>& toStart)
+{
+    while (!_queued.empty() && (_maxRunning == 0 || _running.size() < _maxRunning))
+    {
+        Job job = _queued.front();
+        _queued.pop_front();
+
+        job._started = now;
+        addWaitSample(std::chrono::duration<double, std::milli>(now - job._submitted).count());
+
+        _running[job._id] = job;
+        toStart.push_back(job);
+    }
+}
+
+void ConvertQueue::addWaitSample(const double waitMs)
+{
+    _waitMs = (_started++ == 0 ? waitMs : _waitMs + TimeWeight * (waitMs - _waitMs));
+}
+
+size_t ConvertQueue::getRunning() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _running.size();
+}
+
+size_t ConvertQueue::getQueued() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _queued.size();
+}
+
+unsigned ConvertQueue::getCompleted() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _completed;
+}
+
+unsigned ConvertQueue::getRejected() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _rejected;
+}
+
+unsigned ConvertQueue::getTimedOut() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _timedOut;
+}
+
+std::string ConvertQueue::toString() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    std::ostringstream oss;
+    oss << "running=" << _running.size()
+        << " queued=" << _queued.size()
+        << " max_running=" << _maxRunning
+        << " max_queued=" << _maxQueued
+        << " completed=" << _completed
+        << " rejected=" << _rejected
+        << " timedout=" << _timedOut
+        << " wait_ms=" << std::lround(_waitMs)
+        << " run_ms=" << std::lround(_runMs);
+    return oss.str();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,103 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_CONVERTQUEUE_HPP
+#define INCLUDED_CONVERTQUEUE_HPP
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Admission control for convert-to requests.
+/// Runs up to a number of conversions at a time and queues up to a
+/// number more, in order of arrival, rejecting the rest, so that a
+/// burst of batch conversions can't take all the children.
+/// Conversions not finished within the timeout, counting the time
+/// spent queued, are cancelled.
+/// Thread-safe. The callbacks are invoked without holding the lock,
+/// so they are free to call back into the queue.
+class ConvertQueue
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    /// Called with the id of the conversion.
+    typedef std::function<void(unsigned)> Callback;
+
+    ConvertQueue();
+
+    /// A maxRunning of 0 means no limit.
+    void configure(size_t maxRunning, size_t maxQueued, std::chrono::milliseconds timeout);
+
+    /// Starts the conversion right away, by calling start(), if fewer than
+    /// the maximum are running, otherwise queues it to start later.
+    /// cancel() is called instead of finished() if it times out.
+    /// Returns the id of the conversion, or 0 if the queue is full.
+    unsigned submit(TimePoint now, const Callback& start, const Callback& cancel);
+
+    /// The conversion finished, successfully or not. Starts the next one queued, if any.
+    void finished(unsigned id, TimePoint now);
+
+    /// Cancels the conversions that took longer than the timeout,
+    /// and starts queued ones in place of those that were running.
+    void expire(TimePoint now);
+
+    size_t getRunning() const;
+    size_t getQueued() const;
+
+    unsigned getCompleted() const;
+    unsigned getRejected() const;
+    unsigned getTimedOut() const;
+
+    /// Formats as "running=<n> queued=<n> max_running=<n> max_queued=<n> completed=<n>
+    /// rejected=<n> timedout=<n> wait_ms=<ms> run_ms=<ms>".
+    std::string toString() const;
+
+private:
+    struct Job
+    {
+        unsigned _id;
+        TimePoint _submitted;
+        TimePoint _started;
+        Callback _start;
+        Callback _cancel;
+    };
+
+    /// Moves queued jobs to running while under the limit,
+    /// collecting them to start once the lock is released.
+    void startQueued(TimePoint now, std::vector<Job>& toStart);
+
+    /// Accounts for how long a job waited to start.
+    void addWaitSample(double waitMs);
+
+private:
+    /// Weight of a new sample in the wait and run time averages.
+    static constexpr double TimeWeight = 0.25;
+
+    mutable std::mutex _mutex;
+    size_t _maxRunning;
+    size_t _maxQueued;
+    std::chrono::milliseconds _timeout;
+    unsigned _nextId;
+    std::map<unsigned, Job> _running;
+    std::deque<Job> _queued;
+    unsigned _started;
+    unsigned _completed;
+    unsigned _rejected;
+    unsigned _timedOut;
+    double _waitMs;
+    double _runMs;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -25,8 +25,10 @@
 
 #include "Admin.hpp"
 #include "ClientSession.hpp"
+#include "Common.hpp"
 #include "Exceptions.hpp"
 #include "Message.hpp"
+#include "Metrics.hpp"
 #include "Protocol.hpp"
 #include "LOOLWSD.hpp"
 #include "Log.hpp"
@@ -153,12 +155,21 @@ DocumentBroker::DocumentBroker(const std::string& uri,
     _cursorHeight(0),
     _poll(new DocumentBrokerPoll("docbrk_poll", *this)),
     _stop(false),
+    _childRecyclable(false),
+    _recycleIdentityLoaded(false),
     _tileVersion(0),
-    _debugRenderedTileCount(0)
+    _debugRenderedTileCount(0),
+    _bufferedInBytes(0),
+    _bufferedOutBytes(0),
+    _queuedMessages(0),
+    _tileTracesPublished(0)
 {
     assert(!_docKey.empty());
     assert(!_childRoot.empty());
 
+    _tileTracer.setEnabled(LOOLWSD::TraceTiles);
+    _tileTracer.setSampleEvery(LOOLWSD::TileTraceSampleEvery);
+
     LOG_INF("DocumentBroker [" << _uriPublic.toString() << "] created. DocKey: [" << _docKey << "]");
 }
 
@@ -182,10 +193,44 @@ void DocumentBroker::pollThread()
 
     _threadStart = std::chrono::steady_clock::now();
 
-    // Request a kit process for this doc.
-    _childProcess = getNewChild_Blocks();
-    if (!_childProcess)
+    // A child recycled for the same user saves us a spare, but we only
+    // know who they are from the storage, before their session loads.
+    if (LOOLWSD::MaxKitReuses > 0 && hasRecycledChild(getRecycleTenant(_uriPublic)))
+        _recycleIdentity = lookupRecycleIdentity();
+
+    // Request a kit process for this doc. Meanwhile we keep polling,
+    // so the clients' messages are queued rather than left unread.
+    bool haveChild = requestNewChild(shared_from_this(), _recycleIdentity);
+
+    // With valgrind we need extended time to spawn kits.
+#ifdef KIT_IN_PROCESS
+    const auto childTimeoutMs = CHILD_TIMEOUT_MS * 4;
+#else
+    const auto childTimeoutMs = CHILD_TIMEOUT_MS * 4 * (LOOLWSD::NoCapsForKit ? 100 : 1);
+#endif
+    while (haveChild && !acquireChild())
+    {
+        const auto waitedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - _threadStart).count();
+        if (waitedMs >= childTimeoutMs || _stop || TerminationFlag || ShutdownRequestFlag)
+        {
+            haveChild = false;
+            break;
+        }
+
+        _poll->poll(SocketPoll::DefaultPollTimeoutMs);
+    }
+
+    if (!haveChild)
     {
+        // Refuse any child handed over from now on.
+        std::unique_lock<std::mutex> lock(_newChildMutex);
+        _stop = true;
+        lock.unlock();
+
+        // Nor count on a child being spawned for us.
+        cancelChildRequest(shared_from_this());
+
         // Let the client know we can't serve now.
         LOG_ERR("Failed to get new child.");
 
@@ -197,13 +242,17 @@ void DocumentBroker::pollThread()
         ws.shutdown(WebSocketHandler::StatusCodes::ENDPOINT_GOING_AWAY);
 #endif
         // FIXME: return something good down the websocket ...
-        _stop = true;
         return;
     }
 
+    LOG_DBG("Acquired child [" << _childProcess->getPid() << "] for docKey [" << _docKey << "] in " <<
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - _threadStart).count() << " ms.");
+
     _childProcess->setDocumentBroker(shared_from_this());
 
     auto last30SecCheckTime = std::chrono::steady_clock::now();
+    auto lastMetricsTime = last30SecCheckTime;
 
     // Main polling loop goodness.
     while (!_stop && !TerminationFlag && !ShutdownRequestFlag)
@@ -215,6 +264,8 @@ void DocumentBroker::pollThread()
                 break;
 
             NewSession& newSession = _newSessions.front();
+            const std::shared_ptr<ClientSession> session = newSession._session;
+            bool added = false;
             try
             {
                 addSession(newSession._session);
@@ -231,6 +282,8 @@ void DocumentBroker::pollThread()
                     LOG_DBG("Sending a queued message: " + message);
                     _childProcess->sendTextFrame(message);
                 }
+
+                added = true;
             }
             catch (const std::exception& exc)
             {
@@ -238,9 +291,39 @@ void DocumentBroker::pollThread()
             }
 
             _newSessions.pop_front();
+
+            // The tile requests that came before we had a tile cache,
+            // which take our lock.
+            if (added)
+            {
+                lock.unlock();
+                session->replayDeferredMessages();
+            }
         }
 
-        _poll->poll(SocketPoll::DefaultPollTimeoutMs);
+        // Wake up in time to flush the invalidations batched.
+        int timeoutMs = SocketPoll::DefaultPollTimeoutMs;
+        if (!_invalidations.empty())
+        {
+            const auto dueMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                _invalidationsDue - std::chrono::steady_clock::now()).count();
+            timeoutMs = std::max(0, std::min(timeoutMs, static_cast<int>(dueMs)));
+        }
+
+        _poll->poll(timeoutMs);
+
+        const auto now = std::chrono::steady_clock::now();
+        if (!_invalidations.empty() && now >= _invalidationsDue)
+        {
+            flushInvalidations();
+        }
+
+        if (now - lastMetricsTime >= std::chrono::seconds(1))
+        {
+            updateBufferMetrics(false);
+            updateTileTraceStats();
+            lastMetricsTime = now;
+        }
 
         if (!std::getenv("LOOL_NO_AUTOSAVE") && !_stop &&
             std::chrono::duration_cast<std::chrono::seconds>
@@ -252,9 +335,170 @@ void DocumentBroker::pollThread()
         }
     }
 
+    // The cache outlives us.
+    flushInvalidations();
+
+    updateBufferMetrics(true);
+
+    if (LOOLWSD::MaxKitReuses > 0)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        const bool done = _sessions.empty() && _newSessions.empty();
+        lock.unlock();
+
+        if (done && _childProcess)
+            handOverChild();
+    }
+
     LOG_INF("Finished docBroker polling thread for docKey [" << _docKey << "].");
 }
 
+void DocumentBroker::updateBufferMetrics(const bool stopping)
+{
+    assert(isCorrectThread());
+
+    size_t inBytes = 0;
+    size_t outBytes = 0;
+    size_t messages = 0;
+    if (!stopping)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (const auto& it : _sessions)
+        {
+            it.second->addBufferSizes(inBytes, outBytes);
+            messages += it.second->getSenderQueueSize();
+        }
+
+        if (_childProcess)
+            _childProcess->addBufferSizes(inBytes, outBytes);
+    }
+
+    Metrics& metrics = Metrics::instance();
+    metrics._socketInBufferBytes.add(static_cast<int64_t>(inBytes) - static_cast<int64_t>(_bufferedInBytes));
+    metrics._socketOutBufferBytes.add(static_cast<int64_t>(outBytes) - static_cast<int64_t>(_bufferedOutBytes));
+    metrics._clientQueueMessages.add(static_cast<int64_t>(messages) - static_cast<int64_t>(_queuedMessages));
+    _bufferedInBytes = inBytes;
+    _bufferedOutBytes = outBytes;
+    _queuedMessages = messages;
+}
+
+void DocumentBroker::updateTileTraceStats()
+{
+    assert(isCorrectThread());
+
+    if (_tileTracer.getCompleted() != _tileTracesPublished)
+    {
+        _tileTracesPublished = _tileTracer.getCompleted();
+        Admin::instance().updateTileTraceStats(_docKey, _tileTracer.toString());
+    }
+}
+
+void DocumentBroker::handOverChild()
+{
+    assert(isCorrectThread());
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::shared_ptr<ChildProcess> child = std::move(_childProcess);
+    _childProcess.reset();
+    const std::string identity = _recycleIdentity;
+    lock.unlock();
+
+    if (!child)
+        return;
+
+    if (!identity.empty() && child->isAlive() && !TerminationFlag && !ShutdownRequestFlag)
+    {
+        // Whatever the child tells from now on isn't for us. If it hasn't
+        // unloaded our document yet, it tells whoever polls it next.
+        child->resetDocumentBroker();
+        _poll->releaseSocket(child->getSocket());
+        if (recycleChild(child, identity, _childRecyclable))
+        {
+            LOG_INF("Handed child [" << child->getPid() << "] of doc [" << _docKey << "] over for recycling.");
+            return;
+        }
+    }
+
+    LOG_INF("Stopping child [" << child->getPid() << "] of doc [" << _docKey << "], not recycled.");
+    child->close(false);
+}
+
+std::string DocumentBroker::lookupRecycleIdentity()
+{
+    try
+    {
+        // The jail isn't known yet, load() sets it.
+        std::unique_ptr<StorageBase> storage = StorageBase::create(_uriPublic, "", "");
+        WopiStorage* wopiStorage = dynamic_cast<WopiStorage*>(storage.get());
+        if (wopiStorage != nullptr)
+        {
+            // So that load() doesn't ask again.
+            _lookupFileInfo = wopiStorage->getWOPIFileInfo(_uriPublic);
+            _lookupStorage = std::move(storage);
+            return getRecycleIdentity(_uriPublic, _lookupFileInfo->_userid);
+        }
+
+        LocalStorage* localStorage = dynamic_cast<LocalStorage*>(storage.get());
+        if (localStorage != nullptr)
+            return getRecycleIdentity(_uriPublic, localStorage->getLocalFileInfo(_uriPublic)->_userid);
+    }
+    catch (const std::exception& exc)
+    {
+        LOG_WRN("Can't tell who opens doc [" << _docKey << "] to reuse a recycled child: " << exc.what());
+    }
+
+    return std::string();
+}
+
+std::string DocumentBroker::getRecycleTenant(const Poco::URI& uri)
+{
+    // Local files, converted ones included, are all ours.
+    if (uri.isRelative() || uri.getScheme() == "file")
+        return "file://";
+
+    if (uri.getScheme() != "http" && uri.getScheme() != "https")
+        return std::string();
+
+    // Tenants of a host are told apart by the path to their WOPI endpoint.
+    const std::string& path = uri.getPath();
+    const size_t filesPos = path.rfind("/files/");
+    return uri.getScheme() + "://" + uri.getAuthority() +
+           (filesPos == std::string::npos ? path : path.substr(0, filesPos));
+}
+
+std::string DocumentBroker::getRecycleIdentity(const Poco::URI& uri, const std::string& userId)
+{
+    const std::string tenant = getRecycleTenant(uri);
+    if (tenant.empty() || userId.empty())
+        return std::string();
+
+    return tenant + '\n' + userId;
+}
+
+bool DocumentBroker::setNewChild(const std::shared_ptr<ChildProcess>& child)
+{
+    std::unique_lock<std::mutex> lock(_newChildMutex);
+    if (_stop || _newChild)
+        return false;
+
+    _newChild = child;
+    lock.unlock();
+
+    _poll->wakeup();
+    return true;
+}
+
+bool DocumentBroker::acquireChild()
+{
+    std::unique_lock<std::mutex> lock(_newChildMutex);
+    if (!_newChild)
+        return false;
+
+    _childProcess = std::move(_newChild);
+    _newChild.reset();
+    return true;
+}
+
 bool DocumentBroker::isAlive() const
 {
     if (_poll->isAlive())
@@ -279,6 +523,16 @@ DocumentBroker::~DocumentBroker()
     // Need to first make sure the child exited, socket closed,
     // and thread finished before we are destroyed.
     _childProcess.reset();
+
+    // Don't leave a download running for nobody.
+    abortPrefetch();
+}
+
+void DocumentBroker::abortPrefetch()
+{
+    WopiStorage* wopiStorage = dynamic_cast<WopiStorage*>(_storage.get());
+    if (wopiStorage != nullptr)
+        wopiStorage->abortPrefetch();
 }
 
 bool DocumentBroker::load(std::shared_ptr<ClientSession>& session, const std::string& jailId)
@@ -323,11 +577,20 @@ bool DocumentBroker::load(std::shared_ptr<ClientSession>& session, const std::st
     LOG_INF("jailPath: " << jailPath.toString() << ", jailRoot: " << jailRoot);
 
     bool firstInstance = false;
-    if (_storage == nullptr)
+    if (_storage == nullptr && _lookupStorage != nullptr && _lookupStorage->getUri() == uriPublic.toString())
+    {
+        // The storage asked before we had a child, with the CheckFileInfo response.
+        LOG_DBG("Reusing the storage instance for URI [" << uriPublic.toString() << "].");
+        _storage = std::move(_lookupStorage);
+        _storage->setJailPaths(jailRoot, jailPath.toString());
+        firstInstance = true;
+    }
+    else if (_storage == nullptr)
     {
         // Pass the public URI to storage as it needs to load using the token
         // and other storage-specific data provided in the URI.
         LOG_DBG("Creating new storage instance for URI [" << uriPublic.toString() << "].");
+        _lookupFileInfo.reset();
         _storage = StorageBase::create(uriPublic, jailRoot, jailPath.toString());
         if (_storage == nullptr)
         {
@@ -347,7 +610,8 @@ bool DocumentBroker::load(std::shared_ptr<ClientSession>& session, const std::st
     if (wopiStorage != nullptr)
     {
         std::unique_ptr<WopiStorage::WOPIFileInfo> wopifileinfo =
-                                     wopiStorage->getWOPIFileInfo(uriPublic);
+            _lookupFileInfo ? std::move(_lookupFileInfo) : wopiStorage->getWOPIFileInfo(uriPublic);
+        _lookupStorage.reset();
         userid = wopifileinfo->_userid;
         username = wopifileinfo->_username;
 
@@ -405,6 +669,15 @@ bool DocumentBroker::load(std::shared_ptr<ClientSession>& session, const std::st
         }
     }
 
+    // Our child may only host the documents of the same user after ours.
+    const std::string identity = getRecycleIdentity(uriPublic, userid);
+    if (!_recycleIdentityLoaded && (_recycleIdentity.empty() || _recycleIdentity == identity))
+        _recycleIdentity = identity;
+    else if (_recycleIdentity != identity)
+        _recycleIdentity.clear();
+
+    _recycleIdentityLoaded = true;
+
     LOG_DBG("Setting username [" << username << "] and userId [" << userid << "] for session [" << sessionId << "]");
     session->setUserId(userid);
     session->setUserName(username);
@@ -417,6 +690,10 @@ bool DocumentBroker::load(std::shared_ptr<ClientSession>& session, const std::st
         return false;
     }
 
+    // Only now that CheckFileInfo authorized the user.
+    if (wopiStorage != nullptr && !_storage->isLoaded())
+        wopiStorage->prefetchStorageFile();
+
     if (firstInstance)
     {
         _documentLastModifiedTime = fileInfo._modifiedTime;
@@ -542,7 +819,10 @@ bool DocumentBroker::saveToStorageInternal(const std::string& sessionId,
     // storage behind our backs.
 
     assert(_storage && _tileCache);
+    const auto saveStart = std::chrono::steady_clock::now();
     StorageBase::SaveResult storageSaveResult = _storage->saveLocalFileToStorage(uriPublic);
+    Metrics::instance()._storageSave.addMs(std::chrono::duration<double, std::milli>(
+                                               std::chrono::steady_clock::now() - saveStart).count());
     if (storageSaveResult == StorageBase::SaveResult::OK)
     {
         _isModified = false;
@@ -560,6 +840,9 @@ bool DocumentBroker::saveToStorageInternal(const std::string& sessionId,
         if (dynamic_cast<WopiStorage*>(_storage.get()) != nullptr)
         {
             auto wopiFileInfo = static_cast<WopiStorage*>(_storage.get())->getWOPIFileInfo(uriPublic);
+
+            // What we just uploaded is now the current version in storage.
+            static_cast<WopiStorage*>(_storage.get())->updateDocumentCache();
         }
         else if (dynamic_cast<LocalStorage*>(_storage.get()) != nullptr)
         {
@@ -573,7 +856,9 @@ bool DocumentBroker::saveToStorageInternal(const std::string& sessionId,
                                                                Poco::DateTimeFormat::ISO8601_FORMAT));
         return true;
     }
-    else if (storageSaveResult == StorageBase::SaveResult::DISKFULL)
+
+    Metrics::instance()._storageSaveFailures.inc();
+    if (storageSaveResult == StorageBase::SaveResult::DISKFULL)
     {
         LOG_WRN("Disk full while saving docKey [" << _docKey << "] to URI [" << uri <<
                 "]. Making all sessions on doc read-only and notifying clients.");
@@ -738,6 +1023,7 @@ size_t DocumentBroker::addSession(std::shared_ptr<ClientSession>& session)
     }
     catch (const StorageSpaceLowException&)
     {
+        abortPrefetch();
         LOG_ERR("Out of storage while loading document with URI [" << session->getPublicUri().toString() << "].");
 
         // We use the same message as is sent when some of lool's own locations are full,
@@ -747,6 +1033,11 @@ size_t DocumentBroker::addSession(std::shared_ptr<ClientSession>& session)
         alertAllUsers("internal", "diskfull");
         throw;
     }
+    catch (const std::exception&)
+    {
+        abortPrefetch();
+        throw;
+    }
 
     // Below values are recalculated when startDestroy() is called (before destroying the
     // document). It is safe to reset their values to their defaults whenever a new session is added.
@@ -769,6 +1060,13 @@ size_t DocumentBroker::addSession(std::shared_ptr<ClientSession>& session)
     // Tell the admin console about this new doc
     Admin::instance().addDoc(_docKey, getPid(), getFilename(), id);
 
+    // And how long fetching it from storage took.
+    const WopiStorage* wopiStorage = dynamic_cast<const WopiStorage*>(_storage.get());
+    if (wopiStorage != nullptr && count == 1)
+    {
+        Admin::instance().updateLoadTimings(_docKey, wopiStorage->getLoadTimings().toString());
+    }
+
     LOG_TRC("Added " << (session->isReadOnly() ? "readonly" : "non-readonly") <<
             " session [" << id << "] to docKey [" <<
             _docKey << "] to have " << count << " sessions.");
@@ -848,6 +1146,11 @@ void DocumentBroker::addSocketToPoll(const std::shared_ptr<Socket>& socket)
     _poll->insertNewSocket(socket);
 }
 
+void DocumentBroker::addCallback(const SocketPoll::CallbackFn& fn)
+{
+    _poll->addCallback(fn);
+}
+
 void DocumentBroker::alertAllUsers(const std::string& msg)
 {
     Util::assertIsLocked(_mutex);
@@ -877,6 +1180,12 @@ bool DocumentBroker::handleInput(const std::vector<char>& payload)
     else
     {
         const auto& command = message->firstToken();
+        if (command == "tile:" || command == "tilecombine:")
+        {
+            // Not to remove from the cache the tiles rendered after the invalidations.
+            flushInvalidations();
+        }
+
         if (command == "tile:")
         {
             handleTileResponse(payload);
@@ -895,6 +1204,11 @@ bool DocumentBroker::handleInput(const std::vector<char>& payload)
             LOG_CHECK_RET(kind != "", false);
             Util::alertAllUsers(cmd, kind);
         }
+        else if (command == "recyclable:")
+        {
+            LOG_DBG("Child [" << getPid() << "] of doc [" << _docKey << "] can be recycled.");
+            _childRecyclable = true;
+        }
         else if (command == "procmemstats:")
         {
             int dirty;
@@ -902,6 +1216,24 @@ bool DocumentBroker::handleInput(const std::vector<char>& payload)
             {
                 Admin::instance().updateMemoryDirty(_docKey, dirty);
             }
+
+            // Older kits only report the above.
+            int privateKb, sharedKb, swapKb, sharedLostKb;
+            if (message->getTokenInteger("private", privateKb) &&
+                message->getTokenInteger("shared", sharedKb) &&
+                message->getTokenInteger("swap", swapKb) &&
+                message->getTokenInteger("shared_lost", sharedLostKb))
+            {
+                Admin::instance().updateKitMemory(_docKey,
+                                                  "private=" + std::to_string(privateKb) +
+                                                  " shared=" + std::to_string(sharedKb) +
+                                                  " swap=" + std::to_string(swapKb) +
+                                                  " shared_lost=" + std::to_string(sharedLostKb));
+            }
+        }
+        else if (command == "renderstats:")
+        {
+            Admin::instance().updateRenderStats(_docKey, message->firstLine().substr(command.size() + 1));
         }
         else
         {
@@ -915,20 +1247,80 @@ bool DocumentBroker::handleInput(const std::vector<char>& payload)
 
 void DocumentBroker::invalidateTiles(const std::string& tiles)
 {
-    // Remove from cache.
-    _tileCache->invalidateTiles(tiles);
+    assert(isCorrectThread());
+
+    if (LOOLWSD::InvalidationWindowMs == 0)
+    {
+        // Remove from cache.
+        _tileCache->invalidateTiles(tiles);
+        return;
+    }
+
+    if (_invalidations.empty())
+    {
+        _invalidationsDue = std::chrono::steady_clock::now() +
+                            std::chrono::milliseconds(LOOLWSD::InvalidationWindowMs);
+    }
+
+    if (!_invalidations.add(tiles))
+    {
+        LOG_ERR("Unexpected invalidatetiles message [" << tiles << "].");
+    }
+}
+
+void DocumentBroker::flushInvalidations()
+{
+    assert(isCorrectThread());
+
+    if (_invalidations.empty())
+        return;
+
+    // Remove from cache first, lest the clients get the invalidated tiles again.
+    LOG_TRC("Invalidating " << _invalidations.getAreas().size() << " areas of the tile cache.");
+    for (const auto& area : _invalidations.getAreas())
+    {
+        _tileCache->invalidateTiles(area.Part, area.X, area.Y, area.Width, area.Height);
+    }
+
+    _invalidations.clear();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (const auto& it : _sessions)
+    {
+        it.second->sendInvalidations();
+    }
+}
+
+bool DocumentBroker::isInvalidationPending(const TileDesc& tile) const
+{
+    for (const auto& area : _invalidations.getAreas())
+    {
+        if ((area.Part < 0 || area.Part == tile.getPart()) &&
+            tile.intersectsWithRect(area.X, area.Y, area.Width, area.Height))
+        {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 void DocumentBroker::handleTileRequest(TileDesc& tile,
                                        const std::shared_ptr<ClientSession>& session)
 {
+    const uint64_t requestedUs = TileTrace::now();
+
     std::unique_lock<std::mutex> lock(_mutex);
 
     tile.setVersion(++_tileVersion);
     const auto tileMsg = tile.serialize();
     LOG_TRC("Tile request for " << tileMsg);
 
-    std::unique_ptr<std::fstream> cachedTile = _tileCache->lookupTile(tile);
+    // Stale if its invalidation is held back.
+    std::unique_ptr<std::fstream> cachedTile;
+    if (!isInvalidationPending(tile))
+        cachedTile = _tileCache->lookupTile(tile);
+
     if (cachedTile)
     {
 #if ENABLE_DEBUG
@@ -970,14 +1362,18 @@ void DocumentBroker::handleTileRequest(TileDesc& tile,
     // Forward to child to render.
     LOG_DBG("Sending render request for tile (" << tile.getPart() << ',' <<
             tile.getTilePosX() << ',' << tile.getTilePosY() << ").");
-    const std::string request = "tile " + tileMsg;
+    _tileTracer.requested(tile, requestedUs);
+    const std::string request = "tile " + (tile.getTraceId() > 0 ? tile.serialize() : tileMsg);
     _childProcess->sendTextFrame(request);
+    _tileTracer.forwarded(tile);
     _debugRenderedTileCount++;
 }
 
 void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined,
                                                const std::shared_ptr<ClientSession>& session)
 {
+    const uint64_t requestedUs = TileTrace::now();
+
     std::unique_lock<std::mutex> lock(_mutex);
 
     LOG_TRC("TileCombined request for " << tileCombined.serialize());
@@ -986,7 +1382,10 @@ void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined,
     std::vector<TileDesc> tiles;
     for (auto& tile : tileCombined.getTiles())
     {
-        std::unique_ptr<std::fstream> cachedTile = _tileCache->lookupTile(tile);
+        std::unique_ptr<std::fstream> cachedTile;
+        if (!isInvalidationPending(tile))
+            cachedTile = _tileCache->lookupTile(tile);
+
         if (cachedTile)
         {
             //TODO: Combine the response to reduce latency.
@@ -1017,6 +1416,7 @@ void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined,
             // Not cached, needs rendering.
             tile.setVersion(++_tileVersion);
             tileCache().subscribeToTileRendering(tile, session);
+            _tileTracer.requested(tile, requestedUs);
             tiles.push_back(tile);
             _debugRenderedTileCount++;
         }
@@ -1030,6 +1430,11 @@ void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined,
         const auto req = newTileCombined.serialize("tilecombine");
         LOG_DBG("Sending residual tilecombine: " << req);
         _childProcess->sendTextFrame(req);
+
+        for (const auto& tile : tiles)
+        {
+            _tileTracer.forwarded(tile);
+        }
     }
 }
 
@@ -1045,6 +1450,18 @@ void DocumentBroker::cancelTileRequests(const std::shared_ptr<ClientSession>& se
     }
 }
 
+/// Accounts for the time the Kit took to paint and encode the tiles of a response.
+static void addRenderTimes(const LOOLProtocol::TokenSpans& tokens)
+{
+    int paintUs = 0;
+    if (LOOLProtocol::getTokenInteger(tokens, "paintus", paintUs) && paintUs >= 0)
+        Metrics::instance()._tilePaint.add(paintUs);
+
+    int encodeUs = 0;
+    if (LOOLProtocol::getTokenInteger(tokens, "encodeus", encodeUs) && encodeUs >= 0)
+        Metrics::instance()._tileEncode.add(encodeUs);
+}
+
 void DocumentBroker::handleTileResponse(const std::vector<char>& payload)
 {
     const std::string firstLine = getFirstLine(payload);
@@ -1055,13 +1472,20 @@ void DocumentBroker::handleTileResponse(const std::vector<char>& payload)
         const auto length = payload.size();
         if (firstLine.size() < static_cast<std::string::size_type>(length) - 1)
         {
-            const auto tile = TileDesc::parse(firstLine);
+            const LOOLProtocol::TokenSpans tokens(firstLine);
+            auto tile = TileDesc::parse(tokens);
             const auto buffer = payload.data();
             const auto offset = firstLine.size() + 1;
+            addRenderTimes(tokens);
 
             std::unique_lock<std::mutex> lock(_mutex);
 
+            // The stamps of the Kit are of no use to the clients.
+            _tileTracer.received(tile);
+            tile.clearKitStamps();
+
             tileCache().saveTileAndNotify(tile, buffer + offset, length - offset);
+            _tileTracer.enqueued(tile.getTraceId());
         }
         else
         {
@@ -1085,15 +1509,21 @@ void DocumentBroker::handleTileCombinedResponse(const std::vector<char>& payload
         const auto length = payload.size();
         if (firstLine.size() < static_cast<std::string::size_type>(length) - 1)
         {
-            const auto tileCombined = TileCombined::parse(firstLine);
+            const LOOLProtocol::TokenSpans tokens(firstLine);
+            auto tileCombined = TileCombined::parse(tokens);
             const auto buffer = payload.data();
             auto offset = firstLine.size() + 1;
+            addRenderTimes(tokens);
 
             std::unique_lock<std::mutex> lock(_mutex);
 
-            for (const auto& tile : tileCombined.getTiles())
+            for (auto& tile : tileCombined.getTiles())
             {
+                _tileTracer.received(tile);
+                tile.clearKitStamps();
+
                 tileCache().saveTileAndNotify(tile, buffer + offset, tile.getImgSize());
+                _tileTracer.enqueued(tile.getTraceId());
                 offset += tile.getImgSize();
             }
         }
@@ -1109,6 +1539,13 @@ void DocumentBroker::handleTileCombinedResponse(const std::vector<char>& payload
     }
 }
 
+void DocumentBroker::tileTraceSent(const int traceId)
+{
+    assert(isCorrectThread());
+
+    _tileTracer.sent(traceId);
+}
+
 void DocumentBroker::destroyIfLastEditor(const std::string& id)
 {
     Util::assertIsLocked(_mutex);
@@ -1272,18 +1709,29 @@ void DocumentBroker::terminateChild(std::unique_lock<std::mutex>& lock, const st
         }
     }
 
+    // A child done with our document may be recycled, which the polling thread takes care of.
+    if (_childProcess && LOOLWSD::MaxKitReuses > 0 && closeReason.empty() &&
+        _sessions.empty() && _poll->isAlive())
+    {
+        LOG_INF("Leaving child [" << getPid() << "] of doc [" << _docKey << "] to be recycled.");
+        _stop = true;
+        _poll->wakeup();
+        return;
+    }
+
     if (_childProcess)
     {
         LOG_INF("Terminating child [" << getPid() << "] of doc [" << _docKey << "].");
 
         // First flag to stop as it might be waiting on our lock
         // to process some incoming message.
-        _childProcess->stop();
+        const auto child = _childProcess;
+        child->stop();
 
         // Release the lock and wait for the thread to finish.
         lock.unlock();
 
-        _childProcess->close(false);
+        child->close(false);
     }
 
     // Stop the polling thread.
@@ -26,7 +26,10 @@
 
 #include "IoUtil.hpp"
 #include "Log.hpp"
+#include "Storage.hpp"
 #include "TileDesc.hpp"
+#include "TileInvalidations.hpp"
+#include "TileTracer.hpp"
 #include "Util.hpp"
 #include "net/Socket.hpp"
 #include "net/WebSocketHandler.hpp"
@@ -36,7 +39,6 @@
 // Forwards.
 class PrisonerRequestDispatcher;
 class DocumentBroker;
-class StorageBase;
 class TileCache;
 class Message;
 
@@ -89,6 +91,9 @@ public:
     void setDocumentBroker(const std::shared_ptr<DocumentBroker>& docBroker);
     std::shared_ptr<DocumentBroker> getDocumentBroker() const { return _docBroker.lock(); }
 
+    /// Detaches us from our DocumentBroker, before handing us over for recycling.
+    void resetDocumentBroker() { _docBroker.reset(); }
+
     void stop()
     {
         // Request the child to exit.
@@ -142,6 +147,15 @@ public:
 
     Poco::Process::PID getPid() const { return _pid; }
 
+    std::shared_ptr<Socket> getSocket() const { return _socket; }
+
+    /// Adds the bytes waiting in the buffers of the socket to the child.
+    void addBufferSizes(size_t& inBytes, size_t& outBytes)
+    {
+        if (_ws)
+            _ws->addBufferSizes(inBytes, outBytes);
+    }
+
     /// Send a text payload to the child-process WS.
     bool sendTextFrame(const std::string& data)
     {
@@ -239,11 +253,25 @@ public:
     bool autoSave(const bool force);
 
     Poco::URI getPublicUri() const { return _uriPublic; }
+
+    /// The host of the documents given by their URI, and the WOPI
+    /// endpoint on it, up to the file id. Empty if we don't recycle
+    /// children for the documents of the URI.
+    static std::string getRecycleTenant(const Poco::URI& uri);
+
+    /// Whose documents a child may host after ours: the tenant and the user.
+    /// Empty if unknown, in which case the child isn't recycled.
+    static std::string getRecycleIdentity(const Poco::URI& uri, const std::string& userId);
     Poco::URI getJailedUri() const { return _uriJailed; }
     const std::string& getJailId() const { return _jailId; }
     const std::string& getDocKey() const { return _docKey; }
+    /// The directory of the tile cache.
+    const std::string& getCacheRoot() const { return _cacheRoot; }
     const std::string& getFilename() const { return _filename; };
     TileCache& tileCache() { return *_tileCache; }
+    /// True once we have a child with the document loaded into the jail,
+    /// so that the tile cache is there to serve from.
+    bool hasTileCache() const { return _childProcess && _tileCache; }
     bool isAlive() const;
     size_t getSessionsCount() const
     {
@@ -269,6 +297,14 @@ public:
 
     void addSocketToPoll(const std::shared_ptr<Socket>& socket);
 
+    /// Runs the callback in our polling thread.
+    void addCallback(const SocketPoll::CallbackFn& fn);
+
+    /// Hands over the Kit for this document. Called from the
+    /// PrisonerPoll when a child connects, or by requestNewChild().
+    /// Returns false if we no longer want one.
+    bool setNewChild(const std::shared_ptr<ChildProcess>& child);
+
     void alertAllUsers(const std::string& msg);
 
     void alertAllUsers(const std::string& cmd, const std::string& kind)
@@ -285,6 +321,9 @@ public:
         _cursorHeight = h;
     }
 
+    /// Invalidates the tiles of the invalidatetiles message from the Kit in the cache.
+    /// Batched with those that follow for LOOLWSD::InvalidationWindowMs, if not 0, when
+    /// the sessions hold theirs back for their clients until flushInvalidations().
     void invalidateTiles(const std::string& tiles);
     void handleTileRequest(TileDesc& tile,
                            const std::shared_ptr<ClientSession>& session);
@@ -293,6 +332,8 @@ public:
     void cancelTileRequests(const std::shared_ptr<ClientSession>& session);
     void handleTileResponse(const std::vector<char>& payload);
     void handleTileCombinedResponse(const std::vector<char>& payload);
+    /// A traced tile was written to a client.
+    void tileTraceSent(int traceId);
 
     void destroyIfLastEditor(const std::string& id);
     bool isMarkedToDestroy() const { return _markToDestroy; }
@@ -320,7 +361,7 @@ public:
     void terminateChild(std::unique_lock<std::mutex>& lock, const std::string& closeReason);
 
     /// Get the PID of the associated child process
-    Poco::Process::PID getPid() const { return _childProcess->getPid(); }
+    Poco::Process::PID getPid() const { return _childProcess ? _childProcess->getPid() : 0; }
 
     std::unique_lock<std::mutex> getLock() { return std::unique_lock<std::mutex>(_mutex); }
     std::unique_lock<std::mutex> getDeferredLock() { return std::unique_lock<std::mutex>(_mutex, std::defer_lock); }
@@ -353,6 +394,38 @@ private:
     /// associated with this document.
     void pollThread();
 
+    /// Hands our child over for recycling (see recycleChild) once we are
+    /// done, if it only hosted documents of a single user and tenant, and
+    /// stops it otherwise.
+    void handOverChild();
+
+    /// Asks the storage who opens our document, to find a child recycled
+    /// for them before a session loads it. Empty if we can't tell.
+    /// The storage and what it told are kept for load() to reuse.
+    std::string lookupRecycleIdentity();
+
+    /// Takes the child handed over by setNewChild(), if any.
+    /// Returns false if we gave up waiting.
+    bool acquireChild();
+
+    /// Stops downloading our document in the background, if we are.
+    void abortPrefetch();
+
+    /// Publishes what waits in the buffers of our sockets and in the queues
+    /// of our sessions to the metrics, in place of what we published last.
+    /// Withdraws it all when stopping.
+    void updateBufferMetrics(bool stopping);
+
+    /// Publishes the latency of the tiles traced to the admin console.
+    void updateTileTraceStats();
+
+    /// Invalidates the cache in the areas batched, then has the
+    /// sessions send their clients the invalidations they hold.
+    void flushInvalidations();
+
+    /// Whether the tile is in an area batched, not to be served from the cache.
+    bool isInvalidationPending(const TileDesc& tile) const;
+
 private:
     const std::string _uriOrig;
     const Poco::URI _uriPublic;
@@ -360,6 +433,9 @@ private:
     const std::string _childRoot;
     const std::string _cacheRoot;
     std::shared_ptr<ChildProcess> _childProcess;
+    /// The child handed over from another thread, until we take it.
+    std::shared_ptr<ChildProcess> _newChild;
+    std::mutex _newChildMutex;
     Poco::URI _uriJailed;
     std::string _jailId;
     std::string _filename;
@@ -391,6 +467,10 @@ private:
     std::deque<NewSession> _newSessions;
 
     std::unique_ptr<StorageBase> _storage;
+    /// The storage asked by lookupRecycleIdentity(), and its CheckFileInfo
+    /// response, until the session that created us loads.
+    std::unique_ptr<StorageBase> _lookupStorage;
+    std::unique_ptr<WopiStorage::WOPIFileInfo> _lookupFileInfo;
     std::unique_ptr<TileCache> _tileCache;
     std::atomic<bool> _markToDestroy;
     std::atomic<bool> _lastEditableSession;
@@ -403,6 +483,13 @@ private:
     mutable std::mutex _mutex;
     std::unique_ptr<DocumentBrokerPoll> _poll;
     std::atomic<bool> _stop;
+    /// The child unloaded our document and can host another one.
+    std::atomic<bool> _childRecyclable;
+    /// Whose documents our child may host after ours (see getRecycleIdentity),
+    /// empty if the sessions aren't all of the same user and tenant.
+    std::string _recycleIdentity;
+    /// Whether a session loaded, so that _recycleIdentity is theirs.
+    bool _recycleIdentityLoaded;
 
     /// Versioning is used to prevent races between
     /// painting and invalidation.
@@ -414,6 +501,21 @@ private:
     std::chrono::steady_clock::time_point _threadStart;
     std::chrono::milliseconds _loadDuration;
 
+    /// What we last published to the metrics.
+    size_t _bufferedInBytes;
+    size_t _bufferedOutBytes;
+    size_t _queuedMessages;
+
+    /// Traces the latency of the tiles rendered, on our thread only.
+    TileTracer _tileTracer;
+    /// The number of traces last published to the admin console.
+    unsigned _tileTracesPublished;
+
+    /// The areas to invalidate in the cache, on our thread only,
+    /// and when the first of them is due.
+    TileInvalidations _invalidations;
+    std::chrono::steady_clock::time_point _invalidationsDue;
+
     static constexpr auto IdleSaveDurationMs = 30 * 1000;
     static constexpr auto AutoSaveDurationMs = 300 * 1000;
 };
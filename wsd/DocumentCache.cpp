@@ -0,0 +1,234 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "DocumentCache.hpp"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <ostream>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/SHA1Engine.h>
+
+#include "FileUtil.hpp"
+#include "Log.hpp"
+
+namespace
+{
+
+std::string getKey(const std::string& fileId, const std::string& version)
+{
+    Poco::SHA1Engine digestEngine;
+
+    const std::string id = fileId + ':' + version;
+    digestEngine.update(id.c_str(), id.size());
+
+    return Poco::DigestEngine::digestToHex(digestEngine.digest());
+}
+
+}
+
+DocumentCache::DocumentCache() :
+    _maxSizeBytes(0),
+    _sizeBytes(0),
+    _hits(0),
+    _misses(0),
+    _lastTempId(0)
+{
+}
+
+void DocumentCache::initialize(const std::string& cacheDir, const size_t maxSizeBytes)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _cacheDir = cacheDir;
+    _maxSizeBytes = maxSizeBytes;
+    _sizeBytes = 0;
+    _entries.clear();
+    _files.clear();
+
+    // We don't persist the index, so whatever is left is stale.
+    FileUtil::removeFile(_cacheDir, true);
+    if (_maxSizeBytes > 0)
+    {
+        Poco::File(_cacheDir).createDirectories();
+        LOG_INF("Document cache in [" << _cacheDir << "] of up to " << _maxSizeBytes << " bytes.");
+    }
+}
+
+std::string DocumentCache::getCachePath(const std::string& key) const
+{
+    return Poco::Path(_cacheDir, key).toString();
+}
+
+std::string DocumentCache::getTempPath(const std::string& key)
+{
+    return getCachePath(key) + '.' + std::to_string(++_lastTempId);
+}
+
+bool DocumentCache::hasFile(const std::string& fileId)
+{
+    if (!isEnabled())
+        return false;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _files.find(fileId) != _files.end();
+}
+
+bool DocumentCache::fetch(const std::string& fileId, const std::string& version, const std::string& path)
+{
+    if (!isEnabled() || version.empty())
+        return false;
+
+    const auto key = getKey(fileId, version);
+    const std::string pinPath = getTempPath(key);
+    size_t size = 0;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto it = _entries.find(key);
+        if (it == _entries.end())
+        {
+            ++_misses;
+            LOG_DBG("Document cache miss for [" << fileId << "].");
+            return false;
+        }
+
+        // A second link keeps the content around should the entry
+        // be evicted while we copy it.
+        if (link(getCachePath(key).c_str(), pinPath.c_str()) != 0)
+        {
+            LOG_SYS("Failed to link cached [" << fileId << "]. Dropping it.");
+            remove(key);
+            ++_misses;
+            return false;
+        }
+
+        it->second._lastUsed = std::chrono::steady_clock::now();
+        size = it->second._size;
+    }
+
+    const bool copied = FileUtil::copyFileTo(pinPath, path);
+    FileUtil::removeFile(pinPath);
+    if (!copied)
+    {
+        LOG_WRN("Failed to copy cached [" << fileId << "] to [" << path << "].");
+        ++_misses;
+        return false;
+    }
+
+    ++_hits;
+    LOG_INF("Document cache hit for [" << fileId << "] (" << size << " bytes). Have " <<
+            _hits << " hits and " << _misses << " misses.");
+    return true;
+}
+
+void DocumentCache::insert(const std::string& fileId, const std::string& version, const std::string& path)
+{
+    if (!isEnabled() || version.empty())
+        return;
+
+    const auto key = getKey(fileId, version);
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        const auto fileIt = _files.find(fileId);
+        if (fileIt != _files.end() && fileIt->second == key)
+            return;
+    }
+
+    const size_t size = Poco::File(path).getSize();
+    if (size > _maxSizeBytes)
+    {
+        LOG_DBG("Not caching [" << fileId << "] of " << size << " bytes, larger than the cache.");
+        return;
+    }
+
+    const std::string tempPath = getTempPath(key);
+    if (!FileUtil::copyFileTo(path, tempPath))
+    {
+        LOG_WRN("Failed to cache [" << fileId << "] from [" << path << "].");
+        FileUtil::removeFile(tempPath);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // Only keep the latest version, unless another session beat us to it.
+    const auto fileIt = _files.find(fileId);
+    if (fileIt != _files.end())
+    {
+        if (fileIt->second == key)
+        {
+            FileUtil::removeFile(tempPath);
+            return;
+        }
+
+        remove(fileIt->second);
+    }
+
+    if (rename(tempPath.c_str(), getCachePath(key).c_str()) != 0)
+    {
+        LOG_SYS("Failed to move [" << tempPath << "] into the document cache.");
+        FileUtil::removeFile(tempPath);
+        return;
+    }
+
+    _entries[key] = Entry({ fileId, size, std::chrono::steady_clock::now() });
+    _files[fileId] = key;
+    _sizeBytes += size;
+    LOG_DBG("Cached [" << fileId << "] of " << size << " bytes. Cache has " << _entries.size() <<
+            " documents in " << _sizeBytes << " bytes.");
+
+    evict();
+}
+
+void DocumentCache::remove(const std::string& key)
+{
+    const auto it = _entries.find(key);
+    if (it != _entries.end())
+    {
+        _sizeBytes -= it->second._size;
+        _files.erase(it->second._fileId);
+        _entries.erase(it);
+    }
+
+    FileUtil::removeFile(getCachePath(key));
+}
+
+void DocumentCache::evict()
+{
+    while (_sizeBytes > _maxSizeBytes && !_entries.empty())
+    {
+        auto oldest = _entries.begin();
+        for (auto it = _entries.begin(); it != _entries.end(); ++it)
+        {
+            if (it->second._lastUsed < oldest->second._lastUsed)
+                oldest = it;
+        }
+
+        LOG_DBG("Evicting [" << oldest->second._fileId << "] from document cache.");
+        remove(oldest->first);
+    }
+}
+
+void DocumentCache::dumpState(std::ostream& os)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    os << "DocumentCache:\n"
+       << "  path: " << _cacheDir << "\n"
+       << "  documents: " << _entries.size() << "\n"
+       << "  size: " << _sizeBytes << " of " << _maxSizeBytes << " bytes\n"
+       << "  hits: " << _hits << " misses: " << _misses << "\n";
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
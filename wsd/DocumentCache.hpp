@@ -0,0 +1,96 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_DOCUMENTCACHE_HPP
+#define INCLUDED_DOCUMENTCACHE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+
+/// Keeps local copies of documents downloaded from storage, so that
+/// reopening an unchanged document (typically after a browser refresh)
+/// doesn't download it again.
+/// Entries are keyed by the file id and a version string identifying
+/// the content actually downloaded, and only the latest version of each
+/// file is kept. The files are copied in and out without holding the
+/// lock. The least recently used entries are evicted beyond the
+/// configured size.
+class DocumentCache
+{
+    DocumentCache();
+
+public:
+    static DocumentCache& instance()
+    {
+        static DocumentCache cache;
+        return cache;
+    }
+
+    /// Wipes and sets up the cache directory.
+    /// A maxSizeBytes of 0 disables the cache.
+    void initialize(const std::string& cacheDir, const size_t maxSizeBytes);
+
+    bool isEnabled() const { return _maxSizeBytes > 0; }
+
+    /// True if we have any version of the given file.
+    bool hasFile(const std::string& fileId);
+
+    /// Copies the given version of the file to path.
+    /// @return false if we don't have that version, or on failure.
+    bool fetch(const std::string& fileId, const std::string& version, const std::string& path);
+
+    /// Copies the file at path into the cache as the given version of the file,
+    /// replacing any older version. An empty version is never cached.
+    void insert(const std::string& fileId, const std::string& version, const std::string& path);
+
+    void dumpState(std::ostream& os);
+
+private:
+    std::string getCachePath(const std::string& key) const;
+
+    /// A unique path next to the cache file of key, for copying
+    /// outside the lock.
+    std::string getTempPath(const std::string& key);
+
+    /// Removes the given entry and its file. Must be called under the lock.
+    void remove(const std::string& key);
+
+    /// Evicts least recently used entries to fit the size limit.
+    void evict();
+
+private:
+    struct Entry
+    {
+        std::string _fileId;
+        size_t _size;
+        std::chrono::steady_clock::time_point _lastUsed;
+    };
+
+    std::mutex _mutex;
+    std::string _cacheDir;
+    size_t _maxSizeBytes;
+    size_t _sizeBytes;
+
+    /// The entries keyed by file id and version.
+    std::map<std::string, Entry> _entries;
+    /// Maps file ids to the key of their cached version.
+    std::map<std::string, std::string> _files;
+
+    std::atomic<unsigned> _hits;
+    std::atomic<unsigned> _misses;
+    std::atomic<unsigned> _lastTempId;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -34,6 +34,13 @@ public:
     using LoolException::LoolException;
 };
 
+/// Talking to the storage failed, or it answered with an error.
+class StorageConnectionException : public LoolException
+{
+public:
+    using LoolException::LoolException;
+};
+
 /// A bad-request exception that is meant to signify,
 /// and translate into, an HTTP bad request.
 class BadRequestException : public LoolException
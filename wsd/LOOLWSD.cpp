@@ -33,6 +33,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <clocale>
@@ -40,6 +41,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -89,18 +91,26 @@
 #include "Auth.hpp"
 #include "ClientSession.hpp"
 #include "Common.hpp"
+#include "ConvertQueue.hpp"
 #include "DocumentBroker.hpp"
+#include "DocumentCache.hpp"
 #include "Exceptions.hpp"
 #include "FileServer.hpp"
 #include "IoUtil.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
+#include "PrespawnController.hpp"
+#include "PreviewCache.hpp"
 #include "Protocol.hpp"
 #include "ServerSocket.hpp"
 #include "Session.hpp"
+#include "ShardedMap.hpp"
 #if ENABLE_SSL
 #  include "SslSocket.hpp"
 #endif
 #include "Storage.hpp"
+#include "TileCachePolicy.hpp"
+#include "TileCacheSweeper.hpp"
 #include "TraceFile.hpp"
 #include "Unit.hpp"
 #include "UnitHTTP.hpp"
@@ -173,11 +183,53 @@ static bool DisplayVersion = false;
 static std::mutex NewChildrenMutex;
 static std::condition_variable NewChildrenCV;
 static std::vector<std::shared_ptr<ChildProcess> > NewChildren;
+/// DocumentBrokers waiting for a child, in order of request.
+static std::deque<std::weak_ptr<DocumentBroker> > ChildWaiters;
+/// Sizes the spare children pool to the demand.
+static PrespawnController Prespawn;
+/// How often to sample the memory used by a new child, for sizing the spares.
+static constexpr std::chrono::seconds MemorySampleInterval(30);
+/// Limits the convert-to requests processed at a time.
+static ConvertQueue ConvertJobs;
+/// The largest width or height of a thumbnail, in pixels.
+static int MaxThumbnailSize = 1024;
+/// How often to evict from the tile caches to fit their budget.
+static std::chrono::seconds TileCacheSweepInterval(60);
+/// Whether to serve the metrics at /lool/metrics.
+static bool ServeMetrics = false;
+class PrisonerPoll : public TerminatingPoll {
+public:
+    PrisonerPoll() : TerminatingPoll("prisoner_poll") {}
+
+    /// Check prisoners are still alive and balaned.
+    void wakeupHook() override;
+};
+
+/// This thread listens for and accepts prisoner kit processes.
+/// And also cleans up and balances the correct number of childen.
+PrisonerPoll PrisonerPoll;
+
+/// A child that hosted documents of a user, and can host another one of theirs.
+struct RecycledChild
+{
+    /// Whose documents it hosted, see DocumentBroker::getRecycleIdentity().
+    std::string _identity;
+    std::shared_ptr<ChildProcess> _child;
+    /// When it was handed over to us.
+    std::chrono::steady_clock::time_point _since;
+    /// Whether it unloaded the last document, so that it can host another.
+    bool _unloaded;
+};
+
+/// The recycled children, oldest first. Their sockets are polled
+/// by PrisonerPoll, until they host another document.
+static std::vector<RecycledChild> RecycledChildren;
 
 static std::chrono::steady_clock::time_point LastForkRequestTime = std::chrono::steady_clock::now();
 static std::atomic<int> OutstandingForks(0);
-static std::map<std::string, std::shared_ptr<DocumentBroker> > DocBrokers;
-static std::mutex DocBrokersMutex;
+/// All the DocumentBrokers, by docKey. Sharded, so that
+/// unrelated documents don't serialize on a single lock.
+static ShardedMap<DocumentBroker> DocBrokers;
 
 extern "C" { void dump_state(void); /* easy for gdb */ }
 
@@ -211,14 +263,12 @@ inline void shutdownLimitReached(WebSocketHandler& ws)
 /// connected to any document.
 void alertAllUsersInternal(const std::string& msg)
 {
-    Util::assertIsLocked(DocBrokersMutex);
-
     LOG_INF("Alerting all users: [" << msg << "]");
 
-    for (auto& brokerIt : DocBrokers)
+    for (const auto& pair : DocBrokers.snapshot())
     {
-        auto lock = brokerIt.second->getLock();
-        brokerIt.second->alertAllUsers(msg);
+        auto lock = pair.second->getLock();
+        pair.second->alertAllUsers(msg);
     }
 }
 }
@@ -228,12 +278,10 @@ void alertAllUsersInternal(const std::string& msg)
 /// Returns true if at least one is removed.
 bool cleanupDocBrokers()
 {
-    Util::assertIsLocked(DocBrokersMutex);
-
-    const auto count = DocBrokers.size();
-    for (auto it = DocBrokers.begin(); it != DocBrokers.end(); )
+    bool removed = false;
+    for (const auto& pair : DocBrokers.snapshot())
     {
-        auto docBroker = it->second;
+        const auto& docBroker = pair.second;
 
         // If document busy at the moment, cleanup later.
         auto lock = docBroker->getDeferredLock();
@@ -247,30 +295,27 @@ bool cleanupDocBrokers()
                 (docBroker->getSessionsCount() == 0 || !docBroker->isAlive() || idle))
             {
                 LOG_INF("Terminating " << (idle ? "idle" : "dead") <<
-                        " DocumentBroker for docKey [" << it->first << "].");
+                        " DocumentBroker for docKey [" << pair.first << "].");
                 docBroker->terminateChild(lock, idle ? "idle" : "");
 
                 // Remove only when not alive.
                 if (!docBroker->isAlive())
                 {
                     LOG_INF("Removing " << (idle ? "idle" : "dead") <<
-                            " DocumentBroker for docKey [" << it->first << "].");
-                    it = DocBrokers.erase(it);
-                    continue;
+                            " DocumentBroker for docKey [" << pair.first << "].");
+                    removed |= DocBrokers.erase(pair.first, docBroker);
                 }
             }
         }
-
-        ++it;
     }
 
-    if (count != DocBrokers.size())
+    if (removed)
     {
         auto logger = Log::trace();
         if (logger.enabled())
         {
             logger << "Have " << DocBrokers.size() << " DocBrokers after cleanup.\n";
-            for (auto& pair : DocBrokers)
+            for (const auto& pair : DocBrokers.snapshot())
             {
                 logger << "DocumentBroker [" << pair.first << "].\n";
             }
@@ -289,7 +334,6 @@ bool cleanupDocBrokers()
 /// -1 for error.
 static bool forkChildren(const int number)
 {
-    Util::assertIsLocked(DocBrokersMutex);
     Util::assertIsLocked(NewChildrenMutex);
 
     if (number > 0)
@@ -304,7 +348,9 @@ static bool forkChildren(const int number)
 #ifdef KIT_IN_PROCESS
         forkLibreOfficeKit(LOOLWSD::ChildRoot, LOOLWSD::SysTemplate, LOOLWSD::LoTemplate, LO_JAIL_SUBPATH, number);
 #else
-        const std::string aMessage = "spawn " + std::to_string(number) + "\n";
+        // ForKit is told all we are waiting for, so that it doesn't fork
+        // again those it is still spawning when we re-request them.
+        const std::string aMessage = "spawn " + std::to_string(OutstandingForks + number) + "\n";
         LOG_DBG("MasterToForKit: " << aMessage.substr(0, aMessage.length() - 1));
         if (IoUtil::writeToPipe(LOOLWSD::ForKitWritePipe, aMessage) > 0)
 #endif
@@ -321,6 +367,16 @@ static bool forkChildren(const int number)
     return 0;
 }
 
+/// Stops a recycled child, in PrisonerPoll, which polls its socket.
+static void stopRecycledChild(const std::shared_ptr<ChildProcess>& child)
+{
+    PrisonerPoll.addCallback([child]()
+        {
+            PrisonerPoll.releaseSocketIfPolled(child->getSocket());
+            child->close(false);
+        });
+}
+
 /// Cleans up dead children.
 /// Returns true if removed at least one.
 static bool cleanupChildren()
@@ -339,6 +395,28 @@ static bool cleanupChildren()
         }
     }
 
+    // These don't count as spares, so don't affect the rebalancing.
+    const auto now = std::chrono::steady_clock::now();
+    for (int i = RecycledChildren.size() - 1; i >= 0; --i)
+    {
+        const RecycledChild& recycled = RecycledChildren[i];
+        if (!recycled._child->isAlive())
+        {
+            LOG_WRN("Removing dead recycled child [" << recycled._child->getPid() << "].");
+        }
+        else if (!recycled._unloaded && now - recycled._since > std::chrono::milliseconds(COMMAND_TIMEOUT_MS))
+        {
+            LOG_WRN("Recycled child [" << recycled._child->getPid() << "] didn't unload its document in time.");
+        }
+        else
+        {
+            continue;
+        }
+
+        stopRecycledChild(recycled._child);
+        RecycledChildren.erase(RecycledChildren.begin() + i);
+    }
+
     return removed;
 }
 
@@ -348,7 +426,6 @@ static bool cleanupChildren()
 /// -1 for error.
 static int rebalanceChildren(int balance)
 {
-    Util::assertIsLocked(DocBrokersMutex);
     Util::assertIsLocked(NewChildrenMutex);
 
     // Do the cleanup first.
@@ -380,6 +457,58 @@ static int rebalanceChildren(int balance)
     return 0;
 }
 
+/// The number of spare children to keep, as sized to the demand.
+static size_t getPrespawnTarget()
+{
+    Util::assertIsLocked(NewChildrenMutex);
+
+    return Prespawn.getTarget(std::chrono::steady_clock::now(),
+                              LOOLWSD::NumPreSpawnedChildren,
+                              LOOLWSD::MaxPreSpawnedChildren);
+}
+
+/// The number of DocumentBrokers still waiting for a child,
+/// after forgetting those gone meanwhile.
+static size_t getChildWaiterCount()
+{
+    Util::assertIsLocked(NewChildrenMutex);
+
+    ChildWaiters.erase(std::remove_if(ChildWaiters.begin(), ChildWaiters.end(),
+                                      [](const std::weak_ptr<DocumentBroker>& waiter)
+                                      {
+                                          return waiter.expired();
+                                      }),
+                       ChildWaiters.end());
+    return ChildWaiters.size();
+}
+
+/// Publishes the prespawn decisions to the admin console.
+static void notifyPrespawn()
+{
+    Util::assertIsLocked(NewChildrenMutex);
+
+    Admin::instance().updatePrespawnStats(Prespawn.toString(std::chrono::steady_clock::now(),
+                                                            LOOLWSD::NumPreSpawnedChildren,
+                                                            LOOLWSD::MaxPreSpawnedChildren));
+}
+
+/// Publishes the state of the convert-to queue to the admin console.
+static void notifyConvertQueue()
+{
+    Admin::instance().updateConvertStats(ConvertJobs.toString());
+}
+
+/// Publishes the size of the tile cache of each document to the admin console.
+static void notifyTileCacheSizes()
+{
+    const TileCachePolicy& policy = TileCachePolicy::instance();
+    for (const auto& it : DocBrokers.snapshot())
+    {
+        Admin::instance().updateTileCacheSize(it.second->getDocKey(),
+                                              policy.getBytes(it.second->getCacheRoot()));
+    }
+}
+
 /// Proactively spawn children processes
 /// to load documents with alacrity.
 /// Returns true only if at least one child was requested to spawn.
@@ -387,13 +516,6 @@ static bool prespawnChildren()
 {
 #if 1 // FIXME: why re-balance DockBrokers here ? ...
     // First remove dead DocBrokers, if possible.
-    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex, std::defer_lock);
-    if (!docBrokersLock.try_lock())
-    {
-        // Busy, try again later.
-        return false;
-    }
-
     cleanupDocBrokers();
 #endif
 
@@ -404,14 +526,85 @@ static bool prespawnChildren()
         return false;
     }
 
-    return rebalanceChildren(LOOLWSD::NumPreSpawnedChildren) > 0;
+    // Make sure those waiting get served too.
+    const size_t target = getPrespawnTarget() + getChildWaiterCount();
+    const bool spawned = rebalanceChildren(target) > 0;
+
+    // Stop the spares beyond the target, once the demand dropped.
+    std::vector<std::shared_ptr<ChildProcess>> surplus;
+    while (NewChildren.size() > target)
+    {
+        surplus.emplace_back(NewChildren.front());
+        NewChildren.erase(NewChildren.begin());
+    }
+
+    lock.unlock();
+
+    for (const auto& child : surplus)
+    {
+        LOG_INF("Stopping surplus spare child [" << child->getPid() << "], keeping " << target << ".");
+        child->close(false);
+    }
+
+    return spawned;
 }
 
-static size_t addNewChild(const std::shared_ptr<ChildProcess>& child)
+/// Adds a newly connected child to the spares, or hands it to a waiting DocumentBroker.
+/// @param phases How long the child took to start, if it reported that.
+static size_t addNewChild(const std::shared_ptr<ChildProcess>& child, const SpawnPhases& phases)
 {
+    // Parsing smaps is slow, so only sample the memory of a child every so often,
+    // and without the lock, which those requesting a child wait on.
+    static std::chrono::steady_clock::time_point LastMemorySampleTime;
+    size_t availableKb = 0;
+    size_t childKb = 0;
+    const auto now = std::chrono::steady_clock::now();
+    if (LOOLWSD::MaxPreSpawnedChildren > LOOLWSD::NumPreSpawnedChildren &&
+        now - LastMemorySampleTime >= MemorySampleInterval)
+    {
+        availableKb = Util::getAvailableMemory();
+        childKb = Util::getMemoryUsagePSS(child->getPid());
+        LastMemorySampleTime = now;
+    }
+
     std::unique_lock<std::mutex> lock(NewChildrenMutex);
 
     --OutstandingForks;
+
+    if (phases.getTotalMs() > 0)
+    {
+        Prespawn.childSpawned(phases);
+    }
+    else
+    {
+        // Approximate, as forks are requested in batches.
+        Prespawn.childSpawned(std::chrono::steady_clock::now() - LastForkRequestTime);
+    }
+    if (childKb > 0)
+        Prespawn.setMemory(availableKb, childKb);
+
+    notifyPrespawn();
+
+    // Serve the oldest waiting DocumentBroker first, if any.
+    while (!ChildWaiters.empty())
+    {
+        std::shared_ptr<DocumentBroker> docBroker = ChildWaiters.front().lock();
+        ChildWaiters.pop_front();
+        if (docBroker)
+        {
+            // Don't call out with the lock held.
+            lock.unlock();
+            if (docBroker->setNewChild(child))
+            {
+                LOG_INF("Handed new child [" << child->getPid() << "] to waiting DocumentBroker [" <<
+                        docBroker->getDocKey() << "].");
+                return 0;
+            }
+
+            lock.lock();
+        }
+    }
+
     NewChildren.emplace_back(child);
     const auto count = NewChildren.size();
     LOG_INF("Have " << count << " spare " <<
@@ -422,70 +615,181 @@ static size_t addNewChild(const std::shared_ptr<ChildProcess>& child)
     return count;
 }
 
-std::shared_ptr<ChildProcess> getNewChild_Blocks()
+bool requestNewChild(const std::shared_ptr<DocumentBroker>& docBroker, const std::string& identity)
 {
-    std::unique_lock<std::mutex> locka(DocBrokersMutex);
-    std::unique_lock<std::mutex> lockb(NewChildrenMutex);
+    std::unique_lock<std::mutex> lock(NewChildrenMutex);
 
-    namespace chrono = std::chrono;
-    const auto startTime = chrono::steady_clock::now();
-    do
+    // A child recycled for the same user saves us a spare, if we have one.
+    for (int i = RecycledChildren.size() - 1; i >= 0 && !identity.empty(); --i)
     {
-        LOG_DBG("getNewChild: Rebalancing children.");
-        int numPreSpawn = LOOLWSD::NumPreSpawnedChildren;
-        ++numPreSpawn; // Replace the one we'll dispatch just now.
-        if (rebalanceChildren(numPreSpawn) < 0)
+        if (RecycledChildren[i]._identity != identity || !RecycledChildren[i]._unloaded)
+            continue;
+
+        const auto child = RecycledChildren[i]._child;
+        RecycledChildren.erase(RecycledChildren.begin() + i);
+        if (!child->isAlive())
         {
-            // Fatal. Let's fail and retry at a higher level.
-            LOG_DBG("getNewChild: rebalancing of children failed.");
-            return nullptr;
+            LOG_WRN("requestNewChild: Dropping dead recycled child [" << child->getPid() << "].");
+            stopRecycledChild(child);
+            continue;
         }
 
-        // With valgrind we need extended time to spawn kits.
-#ifdef KIT_IN_PROCESS
-        const auto timeoutMs = CHILD_TIMEOUT_MS;
-#else
-        const auto timeoutMs = CHILD_TIMEOUT_MS * (LOOLWSD::NoCapsForKit ? 100 : 1);
-#endif
-        LOG_TRC("Waiting for a new child for a max of " << timeoutMs << " ms.");
-        const auto timeout = chrono::milliseconds(timeoutMs);
-        // FIXME: blocks ...
-        if (NewChildrenCV.wait_for(lockb, timeout, []() { return !NewChildren.empty(); }))
-        {
-            auto child = NewChildren.back();
-            NewChildren.pop_back();
-            const auto available = NewChildren.size();
+        LOG_DBG("requestNewChild: Reusing recycled child [" << child->getPid() <<
+                "] for doc [" << docBroker->getDocKey() << "].");
+        Prespawn.documentOpened(std::chrono::steady_clock::now(), true);
+        notifyPrespawn();
+        lock.unlock();
 
-            // Validate before returning.
-            if (child && child->isAlive())
+        // PrisonerPoll polls it until then, so must hand it over.
+        PrisonerPoll.addCallback([child, docBroker]()
             {
-                LOG_DBG("getNewChild: Have " << available << " spare " <<
-                        (available == 1 ? "child" : "children") <<
-                        " after poping [" << child->getPid() << "] to return.");
-                return child;
-            }
+                if (PrisonerPoll.releaseSocketIfPolled(child->getSocket()))
+                {
+                    if (!docBroker->setNewChild(child))
+                        child->close(false);
+                    return;
+                }
 
-            LOG_WRN("getNewChild: popped dead child, need to find another.");
-        }
-        else
+                LOG_WRN("Recycled child [" << child->getPid() << "] disconnected before hosting doc [" <<
+                        docBroker->getDocKey() << "], requesting another.");
+                child->close(false);
+                requestNewChild(docBroker, std::string());
+            });
+        return true;
+    }
+
+    LOG_DBG("requestNewChild: Rebalancing children.");
+    // Replace the one we'll dispatch just now, and serve those already waiting.
+    const int numPreSpawn = getPrespawnTarget() + getChildWaiterCount() + 1;
+    if (rebalanceChildren(numPreSpawn) < 0)
+    {
+        // Fatal. Let's fail and retry at a higher level.
+        LOG_DBG("requestNewChild: rebalancing of children failed.");
+        return false;
+    }
+
+    while (!NewChildren.empty())
+    {
+        auto child = NewChildren.back();
+        NewChildren.pop_back();
+        const auto available = NewChildren.size();
+
+        // Validate before returning.
+        if (child && child->isAlive())
         {
-            LOG_WRN("getNewChild: No available child. Sending spawn request to forkit and failing.");
+            LOG_DBG("requestNewChild: Have " << available << " spare " <<
+                    (available == 1 ? "child" : "children") <<
+                    " after popping [" << child->getPid() << "] to return.");
+            Prespawn.documentOpened(std::chrono::steady_clock::now(), true);
+            notifyPrespawn();
+            lock.unlock();
+            docBroker->setNewChild(child);
+            return true;
         }
+
+        LOG_WRN("requestNewChild: popped dead child, need to find another.");
     }
-    while (chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime).count() <
-           CHILD_TIMEOUT_MS * 4);
 
-    LOG_DBG("getNewChild: Timed out while waiting for new child.");
-    return nullptr;
+    LOG_DBG("requestNewChild: No available child. Waiting for forkit to spawn one.");
+    Prespawn.documentOpened(std::chrono::steady_clock::now(), false);
+    notifyPrespawn();
+    ChildWaiters.emplace_back(docBroker);
+    return true;
+}
+
+void cancelChildRequest(const std::shared_ptr<DocumentBroker>& docBroker)
+{
+    std::unique_lock<std::mutex> lock(NewChildrenMutex);
+
+    ChildWaiters.erase(std::remove_if(ChildWaiters.begin(), ChildWaiters.end(),
+                                      [&docBroker](const std::weak_ptr<DocumentBroker>& waiter)
+                                      {
+                                          // Without locking, as the last reference would
+                                          // destroy a DocumentBroker with our lock held.
+                                          return waiter.expired() ||
+                                                 (!waiter.owner_before(docBroker) &&
+                                                  !docBroker.owner_before(waiter));
+                                      }),
+                       ChildWaiters.end());
+}
+
+bool recycleChild(const std::shared_ptr<ChildProcess>& child, const std::string& identity, const bool unloaded)
+{
+    if (LOOLWSD::MaxKitReuses == 0 || identity.empty() || !child || !child->isAlive())
+        return false;
+
+    std::unique_lock<std::mutex> lock(NewChildrenMutex);
+
+    RecycledChildren.push_back({ identity, child, std::chrono::steady_clock::now(), unloaded });
+    std::shared_ptr<ChildProcess> oldest;
+    if (RecycledChildren.size() > LOOLWSD::MaxRecycledChildren)
+    {
+        oldest = RecycledChildren.front()._child;
+        RecycledChildren.erase(RecycledChildren.begin());
+    }
+
+    LOG_INF("Recycled child [" << child->getPid() << "]. Have " <<
+            RecycledChildren.size() << " recycled children.");
+
+    // So that we hear when it unloaded the document, or went away.
+    // Before anyone can take it, as it's handed over by PrisonerPoll.
+    PrisonerPoll.insertNewSocket(child->getSocket());
+    lock.unlock();
+
+    if (oldest)
+    {
+        LOG_INF("Too many recycled children, stopping the oldest [" << oldest->getPid() << "].");
+        stopRecycledChild(oldest);
+    }
+
+    return true;
+}
+
+bool hasRecycledChild(const std::string& tenant)
+{
+    if (tenant.empty())
+        return false;
+
+    // The identities start with the tenant, see DocumentBroker::getRecycleIdentity().
+    const std::string prefix = tenant + '\n';
+
+    std::unique_lock<std::mutex> lock(NewChildrenMutex);
+    for (const RecycledChild& recycled : RecycledChildren)
+    {
+        if (recycled._identity.compare(0, prefix.size(), prefix) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/// Marks a recycled child as having unloaded its last document, once
+/// it tells us so after its DocumentBroker handed it over.
+static void setRecycledChildUnloaded(const std::shared_ptr<ChildProcess>& child)
+{
+    std::unique_lock<std::mutex> lock(NewChildrenMutex);
+    for (RecycledChild& recycled : RecycledChildren)
+    {
+        if (recycled._child == child)
+        {
+            LOG_DBG("Recycled child [" << child->getPid() << "] unloaded its document.");
+            recycled._unloaded = true;
+            return;
+        }
+    }
 }
 
 /// Handles the filename part of the convert-to POST request payload.
+/// When given a digest, the contents are hashed into it as they are saved,
+/// see PreviewCache::getKey().
 class ConvertToPartHandler : public PartHandler
 {
     std::string& _filename;
+    std::string* _digest;
 public:
-    ConvertToPartHandler(std::string& filename)
-        : _filename(filename)
+    ConvertToPartHandler(std::string& filename, std::string* digest = nullptr)
+        : _filename(filename),
+          _digest(digest)
     {
     }
 
@@ -514,11 +818,21 @@ public:
         // Copy the stream to _filename.
         std::ofstream fileStream;
         fileStream.open(_filename);
-        StreamCopier::copyStream(stream, fileStream);
+        if (_digest)
+            *_digest = PreviewCache::copyDigested(stream, fileStream);
+        else
+            StreamCopier::copyStream(stream, fileStream);
         fileStream.close();
     }
 };
 
+/// Removes the document uploaded to fromPath by ConvertToPartHandler, with its directory.
+static void removeUpload(const std::string& fromPath)
+{
+    if (!fromPath.empty())
+        FileUtil::removeFile(Path(fromPath).parent().toString(), true);
+}
+
 namespace
 {
 
@@ -591,6 +905,12 @@ Util::RuntimeConstant<bool> LOOLWSD::SSLTermination;
 static std::string UnitTestLibrary;
 
 unsigned int LOOLWSD::NumPreSpawnedChildren = 0;
+unsigned int LOOLWSD::MaxPreSpawnedChildren = 0;
+unsigned int LOOLWSD::MaxKitReuses = 0;
+unsigned int LOOLWSD::MaxRecycledChildren = 0;
+bool LOOLWSD::TraceTiles = false;
+unsigned int LOOLWSD::TileTraceSampleEvery = 0;
+unsigned int LOOLWSD::InvalidationWindowMs = 0;
 std::atomic<unsigned> LOOLWSD::NumConnections;
 std::unique_ptr<TraceFileWriter> LOOLWSD::TraceDumper;
 
@@ -599,18 +919,6 @@ std::unique_ptr<TraceFileWriter> LOOLWSD::TraceDumper;
 /// relevant DocumentBroker poll instead.
 TerminatingPoll WebServerPoll("websrv_poll");
 
-class PrisonerPoll : public TerminatingPoll {
-public:
-    PrisonerPoll() : TerminatingPoll("prisoner_poll") {}
-
-    /// Check prisoners are still alive and balaned.
-    void wakeupHook() override;
-};
-
-/// This thread listens for and accepts prisoner kit processes.
-/// And also cleans up and balances the correct number of childen.
-PrisonerPoll PrisonerPoll;
-
 /// Helper class to hold default configuration entries.
 class AppConfigMap final : public Poco::Util::MapConfiguration
 {
@@ -652,14 +960,35 @@ void LOOLWSD::initialize(Application& self)
             { "sys_template_path", "systemplate" },
             { "lo_template_path", "/opt/collaboraoffice5.3" },
             { "child_root_path", "jails" },
+            { "fast_jail", "false" },
             { "lo_jail_subpath", "lo" },
             { "server_name", "" },
             { "file_server_root_path", "loleaflet/.." },
             { "num_prespawn_children", "1" },
+            { "max_prespawn_children", "1" },
             { "per_document.max_concurrency", "4" },
+            { "per_document.prefetch_tiles", "48" },
+            { "per_document.render_budget_ms", "50" },
+            { "per_document.invalidation_window_ms", "5" },
+            { "convert_to.max_running", "4" },
+            { "convert_to.max_queued", "100" },
+            { "convert_to.timeout_secs", "120" },
+            { "thumbnail.max_size", "1024" },
+            { "thumbnail.cache_size", "32" },
+            { "tile_cache.max_size", "1024" },
+            { "tile_cache.sweep_interval_secs", "60" },
+            { "metrics[@enable]", "false" },
+            { "tile_trace[@enable]", "false" },
+            { "tile_trace.sample_every", "0" },
+            { "kit_recycling[@enable]", "false" },
+            { "kit_recycling.max_reuses", "10" },
+            { "kit_recycling.max_idle", "4" },
+            { "kit_recycling.max_memory_growth", "100" },
             { "loleaflet_html", "loleaflet.html" },
             { "logging.color", "true" },
             { "logging.level", "trace" },
+            { "logging.async[@enable]", "false" },
+            { "logging.async.buffer_lines", "4096" },
             { "loleaflet_logging", "false" },
             { "ssl.enable", "true" },
             { "ssl.termination", "true" },
@@ -671,6 +1000,7 @@ void LOOLWSD::initialize(Application& self)
             { "storage.wopi.host[0][@allow]", "true" },
             { "storage.wopi.host[0]", "localhost" },
             { "storage.wopi.max_file_size", "0" },
+            { "storage.wopi.document_cache_size", "0" },
             { "storage.webdav[@allow]", "false" },
             { "logging.file[@enable]", "false" },
             { "logging.file.property[0][@name]", "path" },
@@ -742,6 +1072,13 @@ void LOOLWSD::initialize(Application& self)
 
     Log::initialize("wsd", logLevel, withColor, logToFile, logProperties);
 
+    if (getConfigValue<bool>(conf, "logging.async[@enable]", false))
+    {
+        const auto bufferLines = std::max(1, getConfigValue<int>(conf, "logging.async.buffer_lines", 4096));
+        setenv("LOOL_LOGASYNC", std::to_string(bufferLines).c_str(), true);
+        Log::startAsync(bufferLines);
+    }
+
 #if ENABLE_SSL
     LOOLWSD::SSLEnabled.set(getConfigValue<bool>(conf, "ssl.enable", true));
 #else
@@ -777,12 +1114,70 @@ void LOOLWSD::initialize(Application& self)
         NumPreSpawnedChildren = 1;
     }
 
+    MaxPreSpawnedChildren = getConfigValue<int>(conf, "max_prespawn_children", 1);
+    if (MaxPreSpawnedChildren > NumPreSpawnedChildren)
+    {
+        LOG_INF("Sizing prespawned children adaptively between " << NumPreSpawnedChildren <<
+                " and " << MaxPreSpawnedChildren << ".");
+    }
+
     const auto maxConcurrency = getConfigValue<int>(conf, "per_document.max_concurrency", 4);
     if (maxConcurrency > 0)
     {
         setenv("MAX_CONCURRENCY", std::to_string(maxConcurrency).c_str(), 1);
     }
 
+    const auto prefetchTiles = getConfigValue<int>(conf, "per_document.prefetch_tiles", 48);
+    setenv("LOOL_PREFETCH_TILES", std::to_string(std::max(0, prefetchTiles)).c_str(), 1);
+
+    const auto renderBudgetMs = getConfigValue<int>(conf, "per_document.render_budget_ms", 50);
+    setenv("LOOL_RENDER_BUDGET_MS", std::to_string(std::max(0, renderBudgetMs)).c_str(), 1);
+
+    InvalidationWindowMs = std::max(0, getConfigValue<int>(conf, "per_document.invalidation_window_ms", 5));
+    setenv("LOOL_INVALIDATION_WINDOW_MS", std::to_string(InvalidationWindowMs).c_str(), 1);
+
+    const auto maxRunningConversions = getConfigValue<int>(conf, "convert_to.max_running", 4);
+    const auto maxQueuedConversions = getConfigValue<int>(conf, "convert_to.max_queued", 100);
+    const auto conversionTimeoutSecs = getConfigValue<int>(conf, "convert_to.timeout_secs", 120);
+    ConvertJobs.configure(std::max(0, maxRunningConversions), std::max(0, maxQueuedConversions),
+                          std::chrono::seconds(std::max(0, conversionTimeoutSecs)));
+
+    MaxThumbnailSize = std::min(std::max(1, getConfigValue<int>(conf, "thumbnail.max_size", 1024)),
+                                MAX_THUMBNAIL_SIZE);
+    const auto previewCacheSizeMB = getConfigValue<int>(conf, "thumbnail.cache_size", 32);
+    PreviewCache::instance().initialize(Cache + "/previews", std::max(0, previewCacheSizeMB) * 1024 * 1024);
+
+    const auto tileCacheSizeMB = getConfigValue<int>(conf, "tile_cache.max_size", 1024);
+    TileCachePolicy::instance().setMaxBytes(static_cast<size_t>(std::max(0, tileCacheSizeMB)) * 1024 * 1024);
+    TileCacheSweepInterval = std::chrono::seconds(
+        std::max(1, getConfigValue<int>(conf, "tile_cache.sweep_interval_secs", 60)));
+
+    ServeMetrics = getConfigValue<bool>(conf, "metrics[@enable]", false);
+    TraceTiles = getConfigValue<bool>(conf, "tile_trace[@enable]", false);
+    TileTraceSampleEvery = std::max(0, getConfigValue<int>(conf, "tile_trace.sample_every", 0));
+
+    if (getConfigValue<bool>(conf, "kit_recycling[@enable]", false))
+    {
+        const auto maxReuses = getConfigValue<int>(conf, "kit_recycling.max_reuses", 10);
+        const auto maxIdle = getConfigValue<int>(conf, "kit_recycling.max_idle", 4);
+        const auto maxGrowthMb = getConfigValue<int>(conf, "kit_recycling.max_memory_growth", 100);
+        if (maxReuses > 0 && maxIdle > 0)
+        {
+            MaxKitReuses = maxReuses;
+            MaxRecycledChildren = maxIdle;
+
+            // The kits only recycle themselves when told how often they may.
+            setenv("LOOL_KIT_MAX_REUSES", std::to_string(maxReuses).c_str(), 1);
+            setenv("LOOL_KIT_MAX_MEMORY_GROWTH_MB", std::to_string(std::max(0, maxGrowthMb)).c_str(), 1);
+            LOG_INF("Recycling kits up to " << maxReuses << " times, keeping up to " << maxIdle <<
+                    " idle, if they grow less than " << maxGrowthMb << " MB.");
+        }
+        else
+        {
+            LOG_WRN("Invalid kit_recycling limits in config. Not recycling kits.");
+        }
+    }
+
     // Otherwise we profile the soft-device at jail creation time.
     setenv("SAL_DISABLE_OPENCL", "true", 1);
 
@@ -815,9 +1210,10 @@ void LOOLWSD::initialize(Application& self)
         }
 
         const auto compress = getConfigValue<bool>(conf, "trace.path[@compress]", false);
+        const auto binary = (getConfigValue<std::string>(conf, "trace.path[@format]", "text") == "binary");
         const auto takeSnapshot = getConfigValue<bool>(conf, "trace.path[@snapshot]", false);
-        TraceDumper.reset(new TraceFileWriter(path, recordOutgoing, compress, takeSnapshot, filters));
-        LOG_INF("Command trace dumping enabled to file: " << path);
+        TraceDumper.reset(new TraceFileWriter(path, recordOutgoing, compress, binary, takeSnapshot, filters));
+        LOG_INF("Command trace dumping enabled to " << (binary ? "binary" : "text") << " file: " << path);
     }
 
     StorageBase::initialize();
@@ -1178,6 +1574,11 @@ bool LOOLWSD::createForKit()
         args.push_back("--version");
     }
 
+    if (getConfigValue<bool>(config(), "fast_jail", false))
+    {
+        args.push_back("--fastjail");
+    }
+
     std::string forKitPath = Path(Application::instance().commandPath()).parent().toString() + "loolforkit";
     if (NoCapsForKit)
     {
@@ -1185,8 +1586,7 @@ bool LOOLWSD::createForKit()
         args.push_back("--nocaps");
     }
 
-    // If we're recovering forkit, don't allow processing new requests.
-    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
+    // If we're recovering forkit, don't hand out children meanwhile.
     std::unique_lock<std::mutex> newChildrenLock(NewChildrenMutex);
 
     // Always reap first, in case we haven't done so yet.
@@ -1231,30 +1631,6 @@ bool LOOLWSD::createForKit()
 std::mutex Connection::Mutex;
 #endif
 
-static std::shared_ptr<DocumentBroker> createDocBroker(WebSocketHandler& ws,
-                                                       const std::string& uri,
-                                                       const std::string& docKey,
-                                                       const Poco::URI& uriPublic)
-{
-    Util::assertIsLocked(DocBrokersMutex);
-
-    static_assert(MAX_DOCUMENTS > 0, "MAX_DOCUMENTS must be positive");
-    if (DocBrokers.size() + 1 > MAX_DOCUMENTS)
-    {
-        LOG_ERR("Maximum number of open documents reached.");
-        shutdownLimitReached(ws);
-        return nullptr;
-    }
-
-    // Set the one we just created.
-    LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
-    auto docBroker = std::make_shared<DocumentBroker>(uri, uriPublic, docKey, LOOLWSD::ChildRoot);
-    DocBrokers.emplace(docKey, docBroker);
-    LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after inserting [" << docKey << "].");
-
-    return docBroker;
-}
-
 /// Find the DocumentBroker for the given docKey, if one exists.
 /// Otherwise, creates and adds a new one to DocBrokers.
 /// May return null if terminating or MaxDocuments limit is reached.
@@ -1268,8 +1644,6 @@ static std::shared_ptr<DocumentBroker> findOrCreateDocBroker(WebSocketHandler& w
     LOG_INF("Find or create DocBroker for docKey [" << docKey <<
             "] for session [" << id << "] on url [" << uriPublic.toString() << "].");
 
-    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-
     cleanupDocBrokers();
 
     if (TerminationFlag)
@@ -1278,15 +1652,37 @@ static std::shared_ptr<DocumentBroker> findOrCreateDocBroker(WebSocketHandler& w
         return nullptr;
     }
 
-    std::shared_ptr<DocumentBroker> docBroker;
+    // Indicate to the client that we're connecting to the docbroker.
+    const std::string statusConnect = "statusindicator: connect";
+    LOG_TRC("Sending to Client [" << statusConnect << "].");
+    ws.sendFrame(statusConnect);
+
+    // Lookup this document, creating it atomically if missing,
+    // so concurrent sessions of the same document share it.
+    static_assert(MAX_DOCUMENTS > 0, "MAX_DOCUMENTS must be positive");
+    bool created = false;
+    auto docBroker = DocBrokers.findOrCreate(docKey, MAX_DOCUMENTS,
+        [&]()
+        {
+            LOG_DBG("No DocumentBroker with docKey [" << docKey << "] found. New Child and Document.");
+            created = true;
+            return std::make_shared<DocumentBroker>(uri, uriPublic, docKey, LOOLWSD::ChildRoot);
+        });
+
+    if (!docBroker)
+    {
+        LOG_ERR("Maximum number of open documents reached.");
+        shutdownLimitReached(ws);
+        return nullptr;
+    }
 
-    // Lookup this document.
-    auto it = DocBrokers.find(docKey);
-    if (it != DocBrokers.end() && it->second)
+    if (created)
+    {
+        LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after inserting [" << docKey << "].");
+    }
+    else
     {
-        // Get the DocumentBroker from the Cache.
         LOG_DBG("Found DocumentBroker with docKey [" << docKey << "].");
-        docBroker = it->second;
 
         // Avoid notifying the client - either we catch and stop the
         // destruction when we add the session, -or- the client
@@ -1294,24 +1690,6 @@ static std::shared_ptr<DocumentBroker> findOrCreateDocBroker(WebSocketHandler& w
         if (docBroker->isMarkedToDestroy())
             LOG_WRN("Associating with Document Broker with docKey [" << docKey << "] that is marked to be destroyed!");
     }
-    else
-    {
-        LOG_DBG("No DocumentBroker with docKey [" << docKey << "] found. New Child and Document.");
-    }
-
-    if (TerminationFlag)
-    {
-        LOG_ERR("Termination flag set. No loading new session [" << id << "]");
-        return nullptr;
-    }
-
-    // Indicate to the client that we're connecting to the docbroker.
-    const std::string statusConnect = "statusindicator: connect";
-    LOG_TRC("Sending to Client [" << statusConnect << "].");
-    ws.sendFrame(statusConnect);
-
-    if (!docBroker)
-        docBroker = createDocBroker(ws, uri, docKey, uriPublic);
 
     return docBroker;
 }
@@ -1324,7 +1702,6 @@ static void removeDocBrokerSession(const std::shared_ptr<DocumentBroker>& docBro
     const auto docKey = docBroker->getDocKey();
     LOG_DBG("Removing docBroker [" << docKey << "]" << (id.empty() ? "" : (" and session [" + id + "].")));
 
-    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
     auto lock = docBroker->getLock();
 
     if (!id.empty())
@@ -1333,7 +1710,7 @@ static void removeDocBrokerSession(const std::shared_ptr<DocumentBroker>& docBro
     if (docBroker->getSessionsCount() == 0 || !docBroker->isAlive())
     {
         LOG_INF("Removing unloaded DocumentBroker for docKey [" << docKey << "].");
-        DocBrokers.erase(docKey);
+        DocBrokers.erase(docKey, docBroker);
         docBroker->terminateChild(lock, "");
     }
 }
@@ -1389,6 +1766,236 @@ static std::shared_ptr<ClientSession> createNewClientSession(const WebSocketHand
     return nullptr;
 }
 
+/// Responds with just the status line, and closes the connection.
+static void sendHttpStatus(const std::shared_ptr<StreamSocket>& socket, const std::string& status)
+{
+    std::ostringstream oss;
+    oss << "HTTP/1.1 " << status << "\r\n"
+        << "Date: " << Poco::DateTimeFormatter::format(Poco::Timestamp(), Poco::DateTimeFormat::HTTP_FORMAT) << "\r\n"
+        << "User-Agent: LOOLWSD WOPI Agent\r\n"
+        << "Content-Length: 0\r\n"
+        << "\r\n";
+    socket->send(oss.str());
+    socket->shutdown();
+}
+
+/// A conversion submitted to ConvertJobs, as seen from WebServerPoll,
+/// which owns its socket until it's started.
+struct Conversion
+{
+    Conversion() :
+        _started(false),
+        _cancelled(false)
+    {
+    }
+
+    bool _started;
+    /// Timed out, and responded to.
+    bool _cancelled;
+    /// The session converting, once started.
+    std::weak_ptr<ClientSession> _session;
+};
+
+/// Loads the uploaded document at fromPath, saves it in the given format, and
+/// sends the result on the socket. The document is unloaded once sent, and
+/// the ConvertJobs slot of jobId released.
+/// When thumbnailArgs are given, the "thumbnail" command is sent with them
+/// instead of "saveas", to render a PNG preview, and the result is stored in
+/// the PreviewCache under previewKey.
+/// Whatever the outcome, the session responds, releases the slot, and
+/// removes the upload, once.
+/// Must be called from WebServerPoll, which owns the socket until we hand it
+/// over to the DocumentBroker.
+/// Returns false, having responded, if the conversion couldn't be started.
+static bool startConversion(const std::shared_ptr<StreamSocket>& socket, const std::string& id,
+                            const std::string& fromPath, const std::string& format,
+                            const std::string& thumbnailArgs, const std::string& previewKey,
+                            const unsigned jobId, Conversion& conversion)
+{
+    LOG_INF("Conversion request for URI [" << fromPath << "].");
+
+    auto uriPublic = DocumentBroker::sanitizeURI(fromPath);
+    const auto docKey = DocumentBroker::getDocKey(uriPublic);
+
+    LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
+    auto docBroker = std::make_shared<DocumentBroker>(fromPath, uriPublic, docKey, LOOLWSD::ChildRoot);
+
+    cleanupDocBrokers();
+
+    // FIXME: What if the same document is already open? Need a fake dockey here?
+    LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
+    if (!DocBrokers.insert(docKey, docBroker, MAX_DOCUMENTS))
+    {
+        LOG_WRN("Limit of " << MAX_DOCUMENTS << " documents reached, or [" << docKey <<
+                "] already open. Rejecting its conversion.");
+        sendHttpStatus(socket, "503 Service Unavailable");
+        return false;
+    }
+
+    LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after inserting [" << docKey << "].");
+
+    // Load the document.
+    // TODO: Move to DocumentBroker.
+    const bool isReadOnly = true;
+    auto clientSession = createNewClientSession(nullptr, id, uriPublic, docBroker, isReadOnly);
+    if (!clientSession)
+    {
+        LOG_WRN("Failed to create Client Session with id [" << id << "] on docKey [" << docKey << "].");
+        sendHttpStatus(socket, "500 Internal Server Error");
+        return false;
+    }
+
+    // Transfer the client socket to the DocumentBroker.
+    // Move the socket into DocBroker.
+    WebServerPoll.releaseSocket(socket);
+    docBroker->addSocketToPoll(socket);
+
+    clientSession->setSaveAsSocket(socket);
+    conversion._session = clientSession;
+
+    // Unload as soon as the result is sent, so the child is free
+    // for the next conversion, rather than lingering until idle.
+    std::weak_ptr<DocumentBroker> weakDocBroker = docBroker;
+    std::weak_ptr<StreamSocket> weakSocket = socket;
+    clientSession->setSaveAsDoneHandler([weakDocBroker, weakSocket, id, fromPath, previewKey, jobId](const std::string& path)
+        {
+            if (path.empty())
+            {
+                auto socket = weakSocket.lock();
+                if (socket)
+                    sendHttpStatus(socket, "500 Internal Server Error");
+            }
+            else if (!previewKey.empty())
+            {
+                PreviewCache::instance().insert(previewKey, path);
+            }
+
+            // Loaded into the jail, if at all, so no longer needed.
+            removeUpload(fromPath);
+
+            ConvertJobs.finished(jobId, std::chrono::steady_clock::now());
+            notifyConvertQueue();
+
+            auto docBroker = weakDocBroker.lock();
+            if (docBroker)
+            {
+                docBroker->addCallback([weakDocBroker, id]()
+                    {
+                        auto docBroker = weakDocBroker.lock();
+                        if (docBroker)
+                            docBroker->removeSession(id);
+                    });
+            }
+        });
+
+    docBroker->startThread();
+
+    // Load the document manually and request saving in the target format.
+    std::string encodedFrom;
+    URI::encode(docBroker->getPublicUri().getPath(), "", encodedFrom);
+    const std::string load = "load url=" + encodedFrom;
+    std::vector<char> loadRequest(load.begin(), load.end());
+    clientSession->handleMessage(true, WebSocketHandler::WSOpCode::Text, loadRequest);
+
+    // FIXME: Check for security violations.
+    Path toPath(docBroker->getPublicUri().getPath());
+    toPath.setExtension(format);
+    const std::string toJailURL = "file://" + std::string(JAILED_DOCUMENT_ROOT) + toPath.getFileName();
+    std::string encodedTo;
+    URI::encode(toJailURL, "", encodedTo);
+
+    // Convert it to the requested format, or render the thumbnail.
+    const auto saveas = (thumbnailArgs.empty()
+                         ? "saveas url=" + encodedTo + " format=" + format + " options="
+                         : "thumbnail url=" + encodedTo + ' ' + thumbnailArgs);
+    std::vector<char> saveasRequest(saveas.begin(), saveas.end());
+    clientSession->handleMessage(true, WebSocketHandler::WSOpCode::Text, saveasRequest);
+
+    return true;
+}
+
+/// Queues the conversion of the uploaded document at fromPath, see startConversion().
+/// The upload is removed once done, whether converted or not.
+/// Must be called from WebServerPoll.
+/// Returns false, having responded, if the queue is full.
+static bool submitConversion(const std::shared_ptr<StreamSocket>& socket, const std::string& id,
+                             const std::string& fromPath, const std::string& format,
+                             const std::string& thumbnailArgs, const std::string& previewKey)
+{
+    std::weak_ptr<StreamSocket> weakSocket = socket;
+
+    // Whether it started or timed out is only decided in WebServerPoll,
+    // so that the socket is responded to once, by whoever owns it.
+    auto conversion = std::make_shared<Conversion>();
+
+    // Started right away if we have room, otherwise once others finish.
+    const unsigned jobId = ConvertJobs.submit(std::chrono::steady_clock::now(),
+        [weakSocket, id, fromPath, format, thumbnailArgs, previewKey, conversion](const unsigned jobId)
+        {
+            WebServerPoll.addCallback([weakSocket, id, fromPath, format, thumbnailArgs, previewKey, conversion, jobId]()
+                {
+                    if (conversion->_cancelled)
+                        return;
+
+                    conversion->_started = true;
+                    auto socket = weakSocket.lock();
+                    if (!socket ||
+                        !startConversion(socket, id, fromPath, format, thumbnailArgs, previewKey, jobId, *conversion))
+                    {
+                        LOG_WRN("Failed to start conversion of [" << fromPath << "].");
+                        removeUpload(fromPath);
+                        ConvertJobs.finished(jobId, std::chrono::steady_clock::now());
+                        notifyConvertQueue();
+                    }
+                });
+        },
+        [weakSocket, fromPath, conversion](const unsigned)
+        {
+            WebServerPoll.addCallback([weakSocket, fromPath, conversion]()
+                {
+                    LOG_WRN("Conversion of [" << fromPath << "] timed out.");
+                    conversion->_cancelled = true;
+                    if (!conversion->_started)
+                    {
+                        // Still queued, the socket and the upload are ours.
+                        removeUpload(fromPath);
+                        auto socket = weakSocket.lock();
+                        if (socket)
+                            sendHttpStatus(socket, "503 Service Unavailable");
+                        return;
+                    }
+
+                    // The session responds, from the thread of its DocumentBroker.
+                    std::weak_ptr<ClientSession> weakSession = conversion->_session;
+                    auto session = weakSession.lock();
+                    auto docBroker = session ? session->getDocumentBroker() : nullptr;
+                    if (docBroker)
+                    {
+                        docBroker->addCallback([weakSession]()
+                            {
+                                auto session = weakSession.lock();
+                                auto docBroker = session ? session->getDocumentBroker() : nullptr;
+                                if (session)
+                                    session->failSaveAs();
+                                if (docBroker)
+                                    docBroker->closeDocument("timeout");
+                            });
+                    }
+                });
+        });
+    notifyConvertQueue();
+
+    if (jobId == 0)
+    {
+        LOG_WRN("Too many conversions queued, rejecting [" << fromPath << "].");
+        removeUpload(fromPath);
+        sendHttpStatus(socket, "503 Service Unavailable");
+        return false;
+    }
+
+    return true;
+}
+
 /// Handles the socket that the prisoner kit connected to WSD on.
 class PrisonerRequestDispatcher : public WebSocketHandler
 {
@@ -1484,6 +2091,8 @@ private:
             // New Child is spawned.
             const auto params = Poco::URI(request.getURI()).getQueryParameters();
             Poco::Process::PID pid = -1;
+            SpawnPhases phases;
+            long spawnUs = 0;
             for (const auto& param : params)
             {
                 if (param.first == "pid")
@@ -1494,6 +2103,35 @@ private:
                 {
                     LOOLWSD::LOKitVersion = param.second;
                 }
+                else if (param.first == "fork_ms")
+                {
+                    phases._forkMs = std::stod(param.second);
+                }
+                else if (param.first == "jail_ms")
+                {
+                    phases._jailMs = std::stod(param.second);
+                }
+                else if (param.first == "init_ms")
+                {
+                    phases._initMs = std::stod(param.second);
+                }
+                else if (param.first == "spawn_us")
+                {
+                    spawnUs = std::stol(param.second);
+                }
+            }
+
+            // The steady clock is shared with ForKit, so we can tell
+            // how long the child took to connect after starting up.
+            if (spawnUs > 0)
+            {
+                const auto nowUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+                const double totalMs = (nowUs - spawnUs) / 1000.0;
+                phases._connectMs = std::max(0.0, totalMs - phases._forkMs - phases._jailMs - phases._initMs);
+                LOG_INF("Child [" << pid << "] took " << static_cast<long>(totalMs) << " ms to spawn (fork: " <<
+                        phases._forkMs << " ms, jail: " << phases._jailMs << " ms, lok init: " <<
+                        phases._initMs << " ms, connect: " << static_cast<long>(phases._connectMs) << " ms).");
             }
 
             if (pid <= 0)
@@ -1508,13 +2146,15 @@ private:
 
             auto child = std::make_shared<ChildProcess>(pid, socket, request);
             _childProcess = child; // weak
-            addNewChild(child);
 
             // Remove from prisoner poll since there is no activity
             // until we attach the childProcess (with this socket)
             // to a docBroker, which will do the polling.
+            // Do so before adding, as a waiting docBroker may take it right away.
             PrisonerPoll.releaseSocket(socket);
 
+            addNewChild(child, phases);
+
             in.clear();
         }
         catch (const std::exception& exc)
@@ -1545,6 +2185,12 @@ private:
             return;
         }
 
+        if (child && LOOLProtocol::getFirstToken(data) == "recyclable:")
+        {
+            setRecycledChildUnloaded(child);
+            return;
+        }
+
         LOG_WRN("Child " << child->getPid() <<
                 " has no DocumentBroker to handle message: [" <<
                 LOOLProtocol::getAbbreviatedMessage(data) << "].");
@@ -1719,6 +2365,11 @@ private:
             {
                 handleWopiDiscoveryRequest(request);
             }
+            else if (ServeMetrics && request.getMethod() == HTTPRequest::HTTP_GET &&
+                     reqPathSegs.size() == 2 && reqPathSegs[0] == "lool" && reqPathSegs[1] == "metrics")
+            {
+                handleMetricsRequest(request);
+            }
             else
             {
                 StringTokenizer reqPathTokens(request.getURI(), "/?", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
@@ -1801,6 +2452,44 @@ private:
         LOG_INF("Sent / response successfully.");
     }
 
+    /// Serves the metrics in the Prometheus text format.
+    void handleMetricsRequest(const Poco::Net::HTTPRequest& request)
+    {
+        LOG_DBG("Metrics request: " << request.getURI());
+
+        std::vector<MetricSample> samples;
+        samples.emplace_back("loolwsd_sessions", "Client connections to documents.",
+                             LOOLWSD::NumConnections.load());
+        samples.emplace_back("loolwsd_documents", "Documents open.", DocBrokers.size());
+        samples.emplace_back("loolwsd_convert_running", "Conversions being processed.",
+                             ConvertJobs.getRunning());
+        samples.emplace_back("loolwsd_convert_queued", "Conversions waiting to be processed.",
+                             ConvertJobs.getQueued());
+        samples.emplace_back("loolwsd_tile_cache_bytes", "Bytes of the tile caches on disk.",
+                             TileCachePolicy::instance().getBytes());
+        samples.emplace_back("loolwsd_tile_cache_tiles", "Tiles in the tile caches on disk.",
+                             TileCachePolicy::instance().getTileCount());
+
+        std::ostringstream body;
+        Metrics::instance().write(body, samples);
+        const std::string responseString = body.str();
+
+        std::ostringstream oss;
+        oss << "HTTP/1.1 200 OK\r\n"
+            << "Last-Modified: " << Poco::DateTimeFormatter::format(Poco::Timestamp(), Poco::DateTimeFormat::HTTP_FORMAT) << "\r\n"
+            << "User-Agent: LOOLWSD WOPI Agent\r\n"
+            << "Content-Length: " << responseString.size() << "\r\n"
+            << "Content-Type: text/plain; version=0.0.4\r\n"
+            << "Cache-Control: no-cache\r\n"
+            << "\r\n"
+            << responseString;
+
+        auto socket = _socket.lock();
+        socket->send(oss.str());
+        socket->shutdown();
+        LOG_INF("Sent metrics response successfully.");
+    }
+
     void handleFaviconRequest(const Poco::Net::HTTPRequest& request)
     {
         LOG_DBG("Favicon request: " << request.getURI());
@@ -1905,76 +2594,76 @@ private:
             const std::string format = (form.has("format") ? form.get("format") : "");
 
             bool sent = false;
-            if (!fromPath.empty())
+            if (!fromPath.empty() && !format.empty())
             {
-                if (!format.empty())
-                {
-                    LOG_INF("Conversion request for URI [" << fromPath << "].");
-
-                    auto uriPublic = DocumentBroker::sanitizeURI(fromPath);
-                    const auto docKey = DocumentBroker::getDocKey(uriPublic);
-
-                    // This lock could become a bottleneck.
-                    // In that case, we can use a pool and index by publicPath.
-                    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
+                submitConversion(socket, _id, fromPath, format, "", "");
+                sent = true;
+            }
 
-                    LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
-                    auto docBroker = std::make_shared<DocumentBroker>(fromPath, uriPublic, docKey, LOOLWSD::ChildRoot);
+            if (!sent)
+            {
+                removeUpload(fromPath);
+                // TODO: We should differentiate between bad request and failed conversion.
+                throw BadRequestException("Failed to convert and send file.");
+            }
 
-                    cleanupDocBrokers();
+            return;
+        }
+        else if (tokens.count() >= 3 && tokens[2] == "thumbnail")
+        {
+            // Identical documents share their previews, whatever they are called,
+            // so the upload is hashed as it's saved, rather than read again.
+            std::string fromPath;
+            std::string digest;
+            ConvertToPartHandler handler(fromPath, &digest);
+            HTMLForm form(request, message, handler);
 
-                    // FIXME: What if the same document is already open? Need a fake dockey here?
-                    LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
-                    DocBrokers.emplace(docKey, docBroker);
-                    LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after inserting [" << docKey << "].");
+            int width = 0;
+            int height = 0;
+            int part = 0;
+            try
+            {
+                width = std::stoi(form.get("width", "0"));
+                height = std::stoi(form.get("height", "0"));
+                part = std::stoi(form.get("part", "0"));
+            }
+            catch (const std::exception&)
+            {
+                removeUpload(fromPath);
+                throw BadRequestException("Invalid thumbnail size or part.");
+            }
 
-                    // Load the document.
-                    // TODO: Move to DocumentBroker.
-                    const bool isReadOnly = true;
-                    auto clientSession = createNewClientSession(nullptr, _id, uriPublic, docBroker, isReadOnly);
-                    if (clientSession)
-                    {
-                        // Transfer the client socket to the DocumentBroker.
-                        // Move the socket into DocBroker.
-                        WebServerPoll.releaseSocket(socket);
-                        docBroker->addSocketToPoll(socket);
-
-                        clientSession->setSaveAsSocket(socket);
-
-                        docBroker->startThread();
-
-                        // Load the document manually and request saving in the target format.
-                        std::string encodedFrom;
-                        URI::encode(docBroker->getPublicUri().getPath(), "", encodedFrom);
-                        const std::string load = "load url=" + encodedFrom;
-                        std::vector<char> loadRequest(load.begin(), load.end());
-                        clientSession->handleMessage(true, WebSocketHandler::WSOpCode::Text, loadRequest);
-
-                        // FIXME: Check for security violations.
-                        Path toPath(docBroker->getPublicUri().getPath());
-                        toPath.setExtension(format);
-                        const std::string toJailURL = "file://" + std::string(JAILED_DOCUMENT_ROOT) + toPath.getFileName();
-                        std::string encodedTo;
-                        URI::encode(toJailURL, "", encodedTo);
-
-                        // Convert it to the requested format.
-                        const auto saveas = "saveas url=" + encodedTo + " format=" + format + " options=";
-                        std::vector<char> saveasRequest(saveas.begin(), saveas.end());
-                        clientSession->handleMessage(true, WebSocketHandler::WSOpCode::Text, saveasRequest);
-
-                        sent = true;
-                    }
-                    else
-                        LOG_WRN("Failed to create Client Session with id [" << _id << "] on docKey [" << docKey << "].");
-                }
+            if (fromPath.empty() || width <= 0 || height <= 0 || part < 0 ||
+                width > MaxThumbnailSize || height > MaxThumbnailSize)
+            {
+                removeUpload(fromPath);
+                throw BadRequestException("Invalid thumbnail request.");
             }
 
-            if (!sent)
+            const std::string previewKey = PreviewCache::getKey(digest, part, width, height);
+            std::string png;
+            if (PreviewCache::instance().fetch(previewKey, png))
             {
-                // TODO: We should differentiate between bad request and failed conversion.
-                throw BadRequestException("Failed to convert and send file.");
+                LOG_DBG("Serving cached thumbnail [" << previewKey << "].");
+                removeUpload(fromPath);
+
+                std::ostringstream oss;
+                oss << "HTTP/1.1 200 OK\r\n"
+                    << "Date: " << Poco::DateTimeFormatter::format(Poco::Timestamp(), Poco::DateTimeFormat::HTTP_FORMAT) << "\r\n"
+                    << "User-Agent: LOOLWSD WOPI Agent\r\n"
+                    << "Content-Length: " << png.size() << "\r\n"
+                    << "Content-Type: image/png\r\n"
+                    << "\r\n"
+                    << png;
+                socket->send(oss.str());
+                socket->shutdown();
+                return;
             }
 
+            // Rendered by a child, as many at a time as the conversions.
+            std::ostringstream args;
+            args << "part=" << part << " width=" << width << " height=" << height;
+            submitConversion(socket, _id, fromPath, "png", args.str(), previewKey);
             return;
         }
         else if (tokens.count() >= 4 && tokens[3] == "insertfile")
@@ -1994,18 +2683,16 @@ private:
                 const std::string formName(form.get("name"));
 
                 // Validate the docKey
-                std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
                 std::string decodedUri;
                 URI::decode(tokens[2], decodedUri);
                 const auto docKey = DocumentBroker::getDocKey(DocumentBroker::sanitizeURI(decodedUri));
-                auto docBrokerIt = DocBrokers.find(docKey);
+                const auto docBroker = DocBrokers.find(docKey);
 
                 // Maybe just free the client from sending childid in form ?
-                if (docBrokerIt == DocBrokers.end() || docBrokerIt->second->getJailId() != formChildid)
+                if (!docBroker || docBroker->getJailId() != formChildid)
                 {
                     throw BadRequestException("DocKey [" + docKey + "] or childid [" + formChildid + "] is invalid.");
                 }
-                docBrokersLock.unlock();
 
                 // protect against attempts to inject something funny here
                 if (formChildid.find('/') == std::string::npos && formName.find('/') == std::string::npos)
@@ -2031,15 +2718,14 @@ private:
             std::string decodedUri;
             URI::decode(tokens[2], decodedUri);
             const auto docKey = DocumentBroker::getDocKey(DocumentBroker::sanitizeURI(decodedUri));
-            std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-            auto docBrokerIt = DocBrokers.find(docKey);
-            if (docBrokerIt == DocBrokers.end())
+            const auto docBroker = DocBrokers.find(docKey);
+            if (!docBroker)
             {
                 throw BadRequestException("DocKey [" + docKey + "] is invalid.");
             }
 
             // 2. Cross-check if received child id is correct
-            if (docBrokerIt->second->getJailId() != tokens[3])
+            if (docBroker->getJailId() != tokens[3])
             {
                 throw BadRequestException("ChildId does not correspond to docKey");
             }
@@ -2047,11 +2733,10 @@ private:
             // 3. Don't let user download the file in main doc directory containing
             // the document being edited otherwise we will end up deleting main directory
             // after download finishes
-            if (docBrokerIt->second->getJailId() == tokens[4])
+            if (docBroker->getJailId() == tokens[4])
             {
                 throw BadRequestException("RandomDir cannot be equal to ChildId");
             }
-            docBrokersLock.unlock();
 
             std::string fileName;
             bool responded = false;
@@ -2228,6 +2913,7 @@ public:
         _acceptPoll.startThread();
         WebServerPoll.startThread();
         Admin::instance().start();
+        TileCacheSweeper::instance().start(LOOLWSD::Cache, TileCacheSweepInterval, notifyTileCacheSizes);
     }
 
     void stop()
@@ -2245,7 +2931,9 @@ public:
            << "  TerminationFlag: " << TerminationFlag << "\n"
            << "  isShuttingDown: " << ShutdownRequestFlag << "\n"
            << "  NewChildren: " << NewChildren.size() << "\n"
-           << "  OutstandingForks: " << OutstandingForks << "\n";
+           << "  RecycledChildren: " << RecycledChildren.size() << "\n"
+           << "  OutstandingForks: " << OutstandingForks << "\n"
+           << "  Log: " << Log::getAsyncStats() << "\n";
 
         os << "Server poll:\n";
         _acceptPoll.dumpState(os);
@@ -2259,9 +2947,13 @@ public:
         os << "Admin poll:\n";
         Admin::instance().dumpState(os);
 
+        DocumentCache::instance().dumpState(os);
+        PreviewCache::instance().dumpState(os);
+        TileCacheSweeper::instance().dumpState(os);
+
         os << "Document Broker polls "
                   << "[ " << DocBrokers.size() << " ]:\n";
-        for (auto &i : DocBrokers)
+        for (auto &i : DocBrokers.snapshot())
             i.second->dumpState(os);
     }
 
@@ -2485,9 +3177,11 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
             UnitWSD::get().getTimeoutMilliSeconds())
             UnitWSD::get().timeout();
 
-        std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
         cleanupDocBrokers();
 
+        ConvertJobs.expire(std::chrono::steady_clock::now());
+        notifyConvertQueue();
+
 #if ENABLE_DEBUG
         if (careerSpanSeconds > 0 && time(nullptr) > startTimeSpan + careerSpanSeconds)
         {
@@ -2505,6 +3199,7 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
     // Wait until documents are saved and sessions closed.
     srv.stop();
     WebServerPoll.stop();
+    TileCacheSweeper::instance().stop();
 
     // atexit handlers tend to free Admin before Documents
     LOG_INF("Cleaning up lingering documents.");
@@ -2523,6 +3218,11 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
         child->close(true);
     }
 
+    for (auto& recycled : RecycledChildren)
+    {
+        recycled._child->close(true);
+    }
+
 #ifndef KIT_IN_PROCESS
     // Wait for forkit process finish.
     int status = 0;
@@ -2531,14 +3231,26 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
 #endif
 
     // In case forkit didn't cleanup properly, don't leave jails behind.
+    // Unmount the skeleton from them first, and only then remove it.
     LOG_INF("Cleaning up childroot directory [" << ChildRoot << "].");
+    const std::string skeleton = ChildRoot + FileUtil::JailSkeletonName;
+    const bool haveSkeleton = File(skeleton).exists();
     std::vector<std::string> jails;
     File(ChildRoot).list(jails);
     for (auto& jail : jails)
     {
+        if (jail == FileUtil::JailSkeletonName)
+            continue;
+
         const auto path = ChildRoot + jail;
         LOG_INF("Removing jail [" << path << "].");
-        FileUtil::removeFile(path, true);
+        FileUtil::removeJail(path, haveSkeleton ? skeleton : std::string());
+    }
+
+    if (haveSkeleton)
+    {
+        LOG_INF("Removing jail skeleton [" << skeleton << "].");
+        FileUtil::removeFile(skeleton, true);
     }
 
     // Finally, we no longer need SSL.
@@ -2555,6 +3267,7 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
     UnitWSD::get().returnValue(returnValue);
 
     LOG_INF("Process [loolwsd] finished.");
+    Log::stopAsync();
     return returnValue;
 }
 
@@ -2587,8 +3300,6 @@ void alertAllUsers(const std::string& cmd, const std::string& kind)
 
 void alertAllUsers(const std::string& msg)
 {
-    std::lock_guard<std::mutex> docBrokersLock(DocBrokersMutex);
-
     alertAllUsersInternal(msg);
 }
 
@@ -22,9 +22,29 @@
 #include "Util.hpp"
 
 class ChildProcess;
+class DocumentBroker;
 class TraceFileWriter;
 
-std::shared_ptr<ChildProcess> getNewChild_Blocks();
+/// Requests a Kit for the given DocumentBroker, without blocking.
+/// The child is handed over via DocumentBroker::setNewChild(), right
+/// away if we have a spare one, otherwise once a new one connects.
+/// A recycled child is reused instead, if one hosted documents of the
+/// given identity (see DocumentBroker::getRecycleIdentity) and unloaded them.
+/// Returns false if we failed to request spawning more children.
+bool requestNewChild(const std::shared_ptr<DocumentBroker>& docBroker, const std::string& identity);
+
+/// Withdraws the request of a DocumentBroker that gave up waiting for a child,
+/// so that it's no longer served, nor counted in the children to spawn.
+void cancelChildRequest(const std::shared_ptr<DocumentBroker>& docBroker);
+
+/// Whether a recycled child hosted documents of the given tenant, for any user.
+bool hasRecycledChild(const std::string& tenant);
+
+/// Takes the child of a DocumentBroker done with its document, to host
+/// another document of the same identity, and polls it meanwhile.
+/// It's reused only once it unloaded the document, if it hasn't already.
+/// Returns false if recycling is disabled, and the child should be stopped.
+bool recycleChild(const std::shared_ptr<ChildProcess>& child, const std::string& identity, bool unloaded);
 
 /// The Server class which is responsible for all
 /// external interactions.
@@ -38,6 +58,16 @@ public:
     // so just keep these as statics.
     static std::atomic<unsigned> NextSessionId;
     static unsigned int NumPreSpawnedChildren;
+    static unsigned int MaxPreSpawnedChildren;
+    /// How many more documents a Kit may host after the first. 0 disables recycling.
+    static unsigned int MaxKitReuses;
+    static unsigned int MaxRecycledChildren;
+    /// Whether to trace the latency of the tiles by stage.
+    static bool TraceTiles;
+    /// Log the stages of every nth tile traced. 0 disables.
+    static unsigned int TileTraceSampleEvery;
+    /// How long, in ms, to batch the tile invalidations from the Kits. 0 disables.
+    static unsigned int InvalidationWindowMs;
     static bool NoCapsForKit;
     static std::atomic<int> ForKitWritePipe;
     static std::atomic<int> ForKitProcId;
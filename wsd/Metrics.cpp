@@ -0,0 +1,201 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "Metrics.hpp"
+
+#include <iomanip>
+#include <limits>
+
+MetricHistogram::MetricHistogram() :
+    _count(0),
+    _sum(0)
+{
+    for (auto& bucket : _buckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void MetricHistogram::add(const uint64_t us)
+{
+    _buckets[getIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(us, std::memory_order_relaxed);
+}
+
+size_t MetricHistogram::getIndex(const uint64_t us)
+{
+    if (us < SubBucketCount)
+        return us;
+
+    if (us >= (static_cast<uint64_t>(1) << MaxExponent))
+        return BucketCount - 1;
+
+    unsigned exponent = SubBucketBits;
+    while ((us >> (exponent + 1)) != 0)
+        ++exponent;
+
+    const uint64_t subBucket = (us >> (exponent - SubBucketBits)) - SubBucketCount;
+    return SubBucketCount + (exponent - SubBucketBits) * SubBucketCount + subBucket;
+}
+
+uint64_t MetricHistogram::getUpperBound(const size_t index)
+{
+    if (index < SubBucketCount)
+        return index + 1;
+
+    if (index >= BucketCount - 1)
+        return std::numeric_limits<uint64_t>::max();
+
+    const size_t offset = index - SubBucketCount;
+    const unsigned shift = offset / SubBucketCount;
+    return (SubBucketCount + offset % SubBucketCount + 1) << shift;
+}
+
+uint64_t MetricHistogram::getCountBelow(const uint64_t us) const
+{
+    uint64_t count = 0;
+    for (size_t index = 0; index < BucketCount && getUpperBound(index) <= us; ++index)
+    {
+        count += getBucket(index);
+    }
+
+    return count;
+}
+
+uint64_t MetricHistogram::getPercentile(const double fraction) const
+{
+    std::array<uint64_t, BucketCount> buckets;
+    uint64_t total = 0;
+    for (size_t index = 0; index < BucketCount; ++index)
+    {
+        buckets[index] = getBucket(index);
+        total += buckets[index];
+    }
+
+    if (total == 0)
+        return 0;
+
+    const double wanted = fraction * total;
+    uint64_t seen = 0;
+    for (size_t index = 0; index < BucketCount - 1; ++index)
+    {
+        seen += buckets[index];
+        if (seen >= wanted)
+            return getUpperBound(index);
+    }
+
+    return static_cast<uint64_t>(1) << MaxExponent;
+}
+
+Metrics& Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+void Metrics::write(std::ostream& os, const std::vector<MetricSample>& samples) const
+{
+    writeHistogram(os, "loolwsd_tile_latency_seconds",
+                   "Time from a tile being requested to it being rendered and sent.", _tileLatency);
+    writeHistogram(os, "loolwsd_tile_paint_seconds",
+                   "Time spent painting a tile, or combined tiles, in the Kit.", _tilePaint);
+    writeHistogram(os, "loolwsd_tile_encode_seconds",
+                   "Time spent encoding the tiles of a paint into PNG in the Kit.", _tileEncode);
+    writeHistogram(os, "loolwsd_storage_save_seconds",
+                   "Time to upload a saved document to its storage.", _storageSave);
+
+    const uint64_t hits = _tileCacheHits.get();
+    const uint64_t misses = _tileCacheMisses.get();
+    writeCounter(os, "loolwsd_tile_cache_hits_total", "Tiles requested and found in the cache.", hits);
+    writeCounter(os, "loolwsd_tile_cache_misses_total", "Tiles requested and not found in the cache.", misses);
+    writeGauge(os, "loolwsd_tile_cache_hit_ratio", "The share of the tiles requested found in the cache.",
+               (hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0));
+    writeCounter(os, "loolwsd_storage_save_failures_total", "Documents that failed to upload to their storage.",
+                 _storageSaveFailures.get());
+
+    const std::string commands = "loolwsd_client_commands_total";
+    os << "# HELP " << commands << " Messages received from the clients, by command.\n"
+       << "# TYPE " << commands << " counter\n";
+    for (size_t index = 0; index < LOOLProtocol::CommandCount; ++index)
+    {
+        const auto command = static_cast<LOOLProtocol::Command>(index);
+        if (command == LOOLProtocol::Command::Unknown || LOOLProtocol::isClientCommand(command))
+        {
+            os << commands << "{command=\"" << LOOLProtocol::getCommandName(command) << "\"} "
+               << _clientCommands[index].get() << '\n';
+        }
+    }
+
+    writeGauge(os, "loolwsd_socket_in_buffer_bytes",
+               "Bytes received from the clients and the Kits and not yet processed.", _socketInBufferBytes.get());
+    writeGauge(os, "loolwsd_socket_out_buffer_bytes",
+               "Bytes waiting to be sent to the clients and the Kits.", _socketOutBufferBytes.get());
+    writeGauge(os, "loolwsd_client_queue_messages",
+               "Messages waiting to be sent to the clients.", _clientQueueMessages.get());
+
+    for (const MetricSample& sample : samples)
+    {
+        writeGauge(os, sample._name, sample._help, sample._value);
+    }
+}
+
+void Metrics::writeCounter(std::ostream& os, const std::string& name, const std::string& help,
+                           const uint64_t value)
+{
+    os << "# HELP " << name << ' ' << help << '\n'
+       << "# TYPE " << name << " counter\n"
+       << name << ' ' << value << '\n';
+}
+
+void Metrics::writeGauge(std::ostream& os, const std::string& name, const std::string& help,
+                         const double value)
+{
+    os << "# HELP " << name << ' ' << help << '\n'
+       << "# TYPE " << name << " gauge\n"
+       << name << ' ' << std::setprecision(9) << value << '\n';
+}
+
+void Metrics::writeHistogram(std::ostream& os, const std::string& name, const std::string& help,
+                             const MetricHistogram& histogram)
+{
+    static constexpr unsigned FirstExponent = 7;
+    static constexpr unsigned LastExponent = 26;
+
+    os << "# HELP " << name << ' ' << help << '\n'
+       << "# TYPE " << name << " histogram\n"
+       << std::setprecision(9);
+
+    // Read the buckets once, so that they add up even while samples are added.
+    uint64_t count = 0;
+    size_t index = 0;
+    for (unsigned exponent = FirstExponent; exponent <= LastExponent; ++exponent)
+    {
+        const uint64_t bound = static_cast<uint64_t>(1) << exponent;
+        for (; index < MetricHistogram::BucketCount && MetricHistogram::getUpperBound(index) <= bound; ++index)
+        {
+            count += histogram.getBucket(index);
+        }
+
+        os << name << "_bucket{le=\"" << bound / 1e6 << "\"} " << count << '\n';
+    }
+
+    for (; index < MetricHistogram::BucketCount; ++index)
+    {
+        count += histogram.getBucket(index);
+    }
+
+    os << name << "_bucket{le=\"+Inf\"} " << count << '\n'
+       << name << "_sum " << histogram.getSum() / 1e6 << '\n'
+       << name << "_count " << count << '\n';
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
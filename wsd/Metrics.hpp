@@ -0,0 +1,166 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_METRICS_HPP
+#define INCLUDED_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Command.hpp"
+
+/// A count that only goes up. Lock-free.
+class MetricCounter
+{
+public:
+    MetricCounter() :
+        _value(0)
+    {
+    }
+
+    void inc(const uint64_t count = 1) { _value.fetch_add(count, std::memory_order_relaxed); }
+
+    uint64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> _value;
+};
+
+/// A value that goes up and down. Lock-free.
+class MetricGauge
+{
+public:
+    MetricGauge() :
+        _value(0)
+    {
+    }
+
+    void set(const int64_t value) { _value.store(value, std::memory_order_relaxed); }
+    void add(const int64_t delta) { _value.fetch_add(delta, std::memory_order_relaxed); }
+
+    int64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> _value;
+};
+
+/// A histogram of durations in microseconds, in log-linear buckets
+/// (as in HdrHistogram): each power of two is split in SubBucketCount
+/// buckets of equal width, so that the bucket a sample falls into is
+/// within 25% of it, from 1 us to over 9 hours.
+/// Lock-free; a sample costs a few relaxed atomic increments.
+class MetricHistogram
+{
+public:
+    static constexpr unsigned SubBucketBits = 2;
+    static constexpr uint64_t SubBucketCount = 1 << SubBucketBits;
+    /// The samples of 2^MaxExponent us or more share the last bucket.
+    static constexpr unsigned MaxExponent = 35;
+    static constexpr size_t BucketCount = SubBucketCount * (MaxExponent - SubBucketBits + 1) + 1;
+
+    MetricHistogram();
+
+    void add(uint64_t us);
+    void addMs(double ms) { add(ms > 0 ? static_cast<uint64_t>(ms * 1000) : 0); }
+
+    uint64_t getCount() const { return _count.load(std::memory_order_relaxed); }
+    /// The sum of the samples, in microseconds.
+    uint64_t getSum() const { return _sum.load(std::memory_order_relaxed); }
+    uint64_t getBucket(size_t index) const { return _buckets[index].load(std::memory_order_relaxed); }
+
+    /// The number of samples below the given bound, in microseconds.
+    /// Exact when the bound is a power of two.
+    uint64_t getCountBelow(uint64_t us) const;
+
+    /// The upper bound, in microseconds, of the bucket the given
+    /// fraction of the samples fall into, 0 when empty.
+    uint64_t getPercentile(double fraction) const;
+
+    /// The bucket a sample falls into.
+    static size_t getIndex(uint64_t us);
+    /// The (exclusive) upper bound of a bucket, in microseconds.
+    static uint64_t getUpperBound(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, BucketCount> _buckets;
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _sum;
+};
+
+/// A value computed when the metrics are scraped.
+struct MetricSample
+{
+    MetricSample(const std::string& name, const std::string& help, const double value) :
+        _name(name),
+        _help(help),
+        _value(value)
+    {
+    }
+
+    std::string _name;
+    std::string _help;
+    double _value;
+};
+
+/// The performance metrics of WSD, served at /lool/metrics in the
+/// Prometheus text format.
+/// Recorded lock-free from any thread. The values that are cheaper to
+/// compute than to keep up to date are passed in when scraping.
+class Metrics
+{
+public:
+    static Metrics& instance();
+
+    /// From a client requesting a tile to the tile being sent, as clocked by TileCache.
+    MetricHistogram _tileLatency;
+    /// Time spent in paintPartTile, per tile or combined tiles, as reported by the Kit.
+    MetricHistogram _tilePaint;
+    /// Time spent encoding the tiles of a render into PNG, as reported by the Kit.
+    MetricHistogram _tileEncode;
+    /// Time to upload a saved document to its storage.
+    MetricHistogram _storageSave;
+
+    MetricCounter _tileCacheHits;
+    MetricCounter _tileCacheMisses;
+    MetricCounter _storageSaveFailures;
+    /// The messages received from the clients, by command.
+    std::array<MetricCounter, LOOLProtocol::CommandCount> _clientCommands;
+
+    /// Bytes waiting in the buffers of the sockets of the documents.
+    MetricGauge _socketInBufferBytes;
+    MetricGauge _socketOutBufferBytes;
+    /// Messages waiting to be sent to the clients.
+    MetricGauge _clientQueueMessages;
+
+    /// Writes all the metrics, and the given samples as gauges, in the
+    /// Prometheus text exposition format, version 0.0.4.
+    void write(std::ostream& os, const std::vector<MetricSample>& samples) const;
+
+    static void writeCounter(std::ostream& os, const std::string& name, const std::string& help,
+                             uint64_t value);
+    static void writeGauge(std::ostream& os, const std::string& name, const std::string& help,
+                           double value);
+    /// Durations are exported in seconds, with a bucket per power of two
+    /// from about 0.1 ms to about a minute.
+    static void writeHistogram(std::ostream& os, const std::string& name, const std::string& help,
+                               const MetricHistogram& histogram);
+
+private:
+    Metrics() = default;
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,117 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "PrespawnController.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+PrespawnController::PrespawnController() :
+    _openRate(0),
+    _lastOpen(std::chrono::steady_clock::now()),
+    _spawnSecs(0),
+    _phaseSamples(0),
+    _availableKb(0),
+    _childKb(0),
+    _hits(0),
+    _misses(0)
+{
+}
+
+void PrespawnController::documentOpened(const TimePoint now, const bool hit)
+{
+    // Each open adds 1/window to a rate that decays with the window.
+    _openRate = getOpenRate(now) + 1 / RateWindowSecs;
+    _lastOpen = now;
+
+    if (hit)
+        ++_hits;
+    else
+        ++_misses;
+}
+
+void PrespawnController::childSpawned(const std::chrono::steady_clock::duration spawnDuration)
+{
+    const double secs = std::chrono::duration<double>(spawnDuration).count();
+    if (_spawnSecs <= 0)
+        _spawnSecs = secs;
+    else
+        _spawnSecs += SpawnWeight * (secs - _spawnSecs);
+}
+
+void PrespawnController::childSpawned(const SpawnPhases& phases)
+{
+    childSpawned(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                     std::chrono::duration<double, std::milli>(phases.getTotalMs())));
+
+    const double weight = (_phaseSamples++ == 0 ? 1 : SpawnWeight);
+    _phases._forkMs += weight * (phases._forkMs - _phases._forkMs);
+    _phases._jailMs += weight * (phases._jailMs - _phases._jailMs);
+    _phases._initMs += weight * (phases._initMs - _phases._initMs);
+    _phases._connectMs += weight * (phases._connectMs - _phases._connectMs);
+}
+
+void PrespawnController::setMemory(const size_t availableKb, const size_t childKb)
+{
+    _availableKb = availableKb;
+    _childKb = childKb;
+}
+
+double PrespawnController::getOpenRate(const TimePoint now) const
+{
+    const double elapsed = std::chrono::duration<double>(now - _lastOpen).count();
+    return (elapsed > 0 ? _openRate * std::exp(-elapsed / RateWindowSecs) : _openRate);
+}
+
+double PrespawnController::getMissRate() const
+{
+    const unsigned total = _hits + _misses;
+    return (total > 0 ? static_cast<double>(_misses) / total : 0);
+}
+
+size_t PrespawnController::getTarget(const TimePoint now, const size_t minChildren, const size_t maxChildren) const
+{
+    if (maxChildren <= minChildren)
+        return minChildren;
+
+    // Cover the opens we expect while the replacements spawn.
+    const double expected = getOpenRate(now) * _spawnSecs * Headroom;
+    size_t target = std::max(minChildren, static_cast<size_t>(std::ceil(expected)));
+    target = std::min(target, maxChildren);
+
+    // Don't let spare children squeeze the memory out of the working ones.
+    if (_childKb > 0 && _availableKb > 0)
+    {
+        const size_t affordable = static_cast<size_t>(_availableKb * MemoryShare / _childKb);
+        target = std::max(minChildren, std::min(target, affordable));
+    }
+
+    return target;
+}
+
+std::string PrespawnController::toString(const TimePoint now, const size_t minChildren, const size_t maxChildren) const
+{
+    std::ostringstream oss;
+    oss << "target=" << getTarget(now, minChildren, maxChildren)
+        << " rate=" << std::lround(getOpenRate(now) * 60)
+        << " spawn_ms=" << std::lround(_spawnSecs * 1000)
+        << " hits=" << _hits
+        << " misses=" << _misses
+        << " miss_rate=" << std::lround(getMissRate() * 100)
+        << " fork_ms=" << std::lround(_phases._forkMs)
+        << " jail_ms=" << std::lround(_phases._jailMs)
+        << " init_ms=" << std::lround(_phases._initMs)
+        << " connect_ms=" << std::lround(_phases._connectMs);
+    return oss.str();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,111 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_PRESPAWNCONTROLLER_HPP
+#define INCLUDED_PRESPAWNCONTROLLER_HPP
+
+#include <chrono>
+#include <string>
+
+/// How long, in ms, each phase of starting a child took, as reported by the child.
+struct SpawnPhases
+{
+    SpawnPhases() :
+        _forkMs(0),
+        _jailMs(0),
+        _initMs(0),
+        _connectMs(0)
+    {
+    }
+
+    double getTotalMs() const { return _forkMs + _jailMs + _initMs + _connectMs; }
+
+    /// From the fork request to the child running.
+    double _forkMs;
+    /// Setting up the jail.
+    double _jailMs;
+    /// Initializing LibreOfficeKit.
+    double _initMs;
+    /// Connecting to WSD.
+    double _connectMs;
+};
+
+/// Decides how many spare Kit processes to keep ready.
+/// Tracks the rate at which documents are opened (an exponentially
+/// decaying average, so it follows spikes and falls back when idle)
+/// and how long a child takes to spawn, and keeps enough spares to
+/// cover the opens expected while replacements are being spawned.
+/// The result is bounded by the configured min/max and by the memory
+/// available for spare children.
+/// Not thread-safe; the caller is expected to serialize access.
+class PrespawnController
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    PrespawnController();
+
+    /// A document requested a child. hit is true if a spare one was ready.
+    void documentOpened(TimePoint now, bool hit);
+
+    /// A child connected, spawnDuration after it was requested.
+    void childSpawned(std::chrono::steady_clock::duration spawnDuration);
+
+    /// A child connected and reported how long it took to start.
+    void childSpawned(const SpawnPhases& phases);
+
+    /// Available system memory and the memory used by a spare child, in KB.
+    void setMemory(size_t availableKb, size_t childKb);
+
+    /// The number of spare children to keep, within [minChildren, maxChildren].
+    size_t getTarget(TimePoint now, size_t minChildren, size_t maxChildren) const;
+
+    /// Document opens per second, decayed to now.
+    double getOpenRate(TimePoint now) const;
+
+    /// The average time to spawn a child, in seconds.
+    double getSpawnSecs() const { return _spawnSecs; }
+
+    /// The average time of each phase of spawning a child, as reported by them.
+    const SpawnPhases& getSpawnPhases() const { return _phases; }
+
+    unsigned getHits() const { return _hits; }
+    unsigned getMisses() const { return _misses; }
+
+    /// The fraction of opens that had to wait for a child.
+    double getMissRate() const;
+
+    /// Formats as "target=<n> rate=<opens/min> spawn_ms=<ms> hits=<n> misses=<n> miss_rate=<%>
+    /// fork_ms=<ms> jail_ms=<ms> init_ms=<ms> connect_ms=<ms>".
+    std::string toString(TimePoint now, size_t minChildren, size_t maxChildren) const;
+
+private:
+    /// Time constant of the open rate average.
+    static constexpr double RateWindowSecs = 60;
+    /// Weight of a new sample in the spawn duration average.
+    static constexpr double SpawnWeight = 0.25;
+    /// How many times the expected opens during a spawn to keep ready.
+    static constexpr double Headroom = 2;
+    /// The share of available memory spare children may use.
+    static constexpr double MemoryShare = 0.5;
+
+    double _openRate;
+    TimePoint _lastOpen;
+    double _spawnSecs;
+    SpawnPhases _phases;
+    unsigned _phaseSamples;
+    size_t _availableKb;
+    size_t _childKb;
+    unsigned _hits;
+    unsigned _misses;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,185 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "PreviewCache.hpp"
+
+#include <fstream>
+#include <ostream>
+#include <sstream>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/SHA1Engine.h>
+
+#include "FileUtil.hpp"
+#include "Log.hpp"
+
+PreviewCache::PreviewCache() :
+    _maxSizeBytes(0),
+    _sizeBytes(0),
+    _hits(0),
+    _misses(0)
+{
+}
+
+void PreviewCache::initialize(const std::string& cacheDir, const size_t maxSizeBytes)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _cacheDir = cacheDir;
+    _maxSizeBytes = maxSizeBytes;
+    _sizeBytes = 0;
+    _entries.clear();
+
+    // We don't persist the index, so whatever is left is stale.
+    FileUtil::removeFile(_cacheDir, true);
+    if (_maxSizeBytes > 0)
+    {
+        Poco::File(_cacheDir).createDirectories();
+        LOG_INF("Preview cache in [" << _cacheDir << "] of up to " << _maxSizeBytes << " bytes.");
+    }
+}
+
+std::string PreviewCache::copyDigested(std::istream& in, std::ostream& out)
+{
+    Poco::SHA1Engine digestEngine;
+
+    char buf[16 * 1024];
+    while (in)
+    {
+        in.read(buf, sizeof(buf));
+        digestEngine.update(buf, in.gcount());
+        out.write(buf, in.gcount());
+    }
+
+    return Poco::DigestEngine::digestToHex(digestEngine.digest());
+}
+
+std::string PreviewCache::getKey(const std::string& digest, const int part, const int width, const int height)
+{
+    std::ostringstream oss;
+    oss << digest << '_' << part << '_' << width << 'x' << height;
+    return oss.str();
+}
+
+std::string PreviewCache::getCachePath(const std::string& key) const
+{
+    return Poco::Path(_cacheDir, key + ".png").toString();
+}
+
+bool PreviewCache::fetch(const std::string& key, std::string& png)
+{
+    if (!isEnabled())
+        return false;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    if (it == _entries.end())
+    {
+        ++_misses;
+        return false;
+    }
+
+    // Opened under the lock, so that it's still ours to read if evicted
+    // meanwhile, but read without it, so as not to hold up the others.
+    std::ifstream file(getCachePath(key), std::ios::binary);
+    const size_t size = it->second._size;
+    it->second._lastUsed = std::chrono::steady_clock::now();
+    lock.unlock();
+
+    std::ostringstream oss;
+    oss << file.rdbuf();
+    if (!file || oss.str().size() != size)
+    {
+        LOG_WRN("Failed to read cached preview [" << key << "]. Dropping it.");
+        lock.lock();
+        remove(key);
+        ++_misses;
+        return false;
+    }
+
+    png = oss.str();
+    ++_hits;
+    LOG_DBG("Preview cache hit for [" << key << "]. Have " << _hits << " hits and " <<
+            _misses << " misses.");
+    return true;
+}
+
+void PreviewCache::insert(const std::string& key, const std::string& path)
+{
+    if (!isEnabled())
+        return;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_entries.find(key) != _entries.end())
+        return;
+
+    const size_t size = Poco::File(path).getSize();
+    if (size > _maxSizeBytes)
+    {
+        LOG_DBG("Not caching preview [" << key << "] of " << size << " bytes, larger than the cache.");
+        return;
+    }
+
+    if (!FileUtil::copyFileTo(path, getCachePath(key)))
+    {
+        LOG_WRN("Failed to cache preview [" << key << "] from [" << path << "].");
+        return;
+    }
+
+    _entries[key] = Entry({ size, std::chrono::steady_clock::now() });
+    _sizeBytes += size;
+    LOG_DBG("Cached preview [" << key << "] of " << size << " bytes. Cache has " << _entries.size() <<
+            " previews in " << _sizeBytes << " bytes.");
+
+    evict();
+}
+
+void PreviewCache::remove(const std::string& key)
+{
+    const auto it = _entries.find(key);
+    if (it != _entries.end())
+    {
+        _sizeBytes -= it->second._size;
+        _entries.erase(it);
+    }
+
+    FileUtil::removeFile(getCachePath(key));
+}
+
+void PreviewCache::evict()
+{
+    while (_sizeBytes > _maxSizeBytes && !_entries.empty())
+    {
+        auto oldest = _entries.begin();
+        for (auto it = _entries.begin(); it != _entries.end(); ++it)
+        {
+            if (it->second._lastUsed < oldest->second._lastUsed)
+                oldest = it;
+        }
+
+        LOG_DBG("Evicting [" << oldest->first << "] from preview cache.");
+        remove(oldest->first);
+    }
+}
+
+void PreviewCache::dumpState(std::ostream& os)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    os << "PreviewCache:\n"
+       << "  path: " << _cacheDir << "\n"
+       << "  previews: " << _entries.size() << "\n"
+       << "  size: " << _sizeBytes << " of " << _maxSizeBytes << " bytes\n"
+       << "  hits: " << _hits << " misses: " << _misses << "\n";
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,88 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_PREVIEWCACHE_HPP
+#define INCLUDED_PREVIEWCACHE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+
+/// Keeps the thumbnails rendered for the thumbnail requests, so that
+/// asking again for the same preview of the same document is served
+/// without loading the document.
+/// Entries are keyed by the hash of the document contents and the
+/// rendering parameters, so they never go stale, and the least
+/// recently used entries are evicted beyond the configured size.
+class PreviewCache
+{
+    PreviewCache();
+
+public:
+    static PreviewCache& instance()
+    {
+        static PreviewCache cache;
+        return cache;
+    }
+
+    /// Wipes and sets up the cache directory.
+    /// A maxSizeBytes of 0 disables the cache.
+    void initialize(const std::string& cacheDir, const size_t maxSizeBytes);
+
+    bool isEnabled() const { return _maxSizeBytes > 0; }
+
+    /// Copies a document from in to out, returning the digest of its
+    /// contents for getKey(), so that it's hashed as it's received.
+    static std::string copyDigested(std::istream& in, std::ostream& out);
+
+    /// The key of the thumbnail of the given part of the document
+    /// of the given digest, at the given size.
+    static std::string getKey(const std::string& digest, int part, int width, int height);
+
+    /// Reads the cached thumbnail into png, without holding the lock.
+    /// @return false if we don't have it, or on failure.
+    bool fetch(const std::string& key, std::string& png);
+
+    /// Copies the thumbnail at path into the cache.
+    void insert(const std::string& key, const std::string& path);
+
+    void dumpState(std::ostream& os);
+
+private:
+    std::string getCachePath(const std::string& key) const;
+
+    /// Removes the given entry and its file. Must be called under the lock.
+    void remove(const std::string& key);
+
+    /// Evicts least recently used entries to fit the size limit.
+    void evict();
+
+private:
+    struct Entry
+    {
+        size_t _size;
+        std::chrono::steady_clock::time_point _lastUsed;
+    };
+
+    std::mutex _mutex;
+    std::string _cacheDir;
+    size_t _maxSizeBytes;
+    size_t _sizeBytes;
+    std::map<std::string, Entry> _entries;
+
+    std::atomic<unsigned> _hits;
+    std::atomic<unsigned> _misses;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
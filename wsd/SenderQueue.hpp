@@ -131,24 +131,14 @@ private:
         {
             // Remove previous cursor invalidation for same view,
             // if any, and use most recent (incoming).
-            const std::string newMsg = item->jsonString();
-            Poco::JSON::Parser newParser;
-            const auto newResult = newParser.parse(newMsg);
-            const auto& newJson = newResult.extract<Poco::JSON::Object::Ptr>();
-            const auto viewId = newJson->get("viewId").toString();
+            const int viewId = getViewId(item);
+            if (viewId < 0)
+                return true;
+
             const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                [command, viewId](const queue_item_t& cur)
+                [&command, viewId](const queue_item_t& cur)
                 {
-                    if (cur->firstToken() == command)
-                    {
-                        const std::string msg = cur->jsonString();
-                        Poco::JSON::Parser parser;
-                        const auto result = parser.parse(msg);
-                        const auto& json = result.extract<Poco::JSON::Object::Ptr>();
-                        return (viewId == json->get("viewId").toString());
-                    }
-
-                    return false;
+                    return (cur->firstToken() == command && getViewId(cur) == viewId);
                 });
 
             if (pos != _queue.end())
@@ -158,6 +148,15 @@ private:
         return true;
     }
 
+    /// The viewId of the JSON payload of a message, -1 if none.
+    static int getViewId(const Item& item)
+    {
+        const std::vector<char>& data = item->data();
+        int viewId = -1;
+        LOOLProtocol::getJsonInteger(LOOLProtocol::StringSpan(data.data(), data.size()), "viewId", viewId);
+        return viewId;
+    }
+
 private:
     mutable std::mutex _mutex;
     std::deque<Item> _queue;
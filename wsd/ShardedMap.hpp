@@ -0,0 +1,193 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_SHARDEDMAP_HPP
+#define INCLUDED_SHARDEDMAP_HPP
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// A map of shared objects keyed by string, split into
+/// independently locked shards so that lookups and inserts
+/// of different keys rarely contend.
+/// The shard locks are only ever held for the map operation
+/// itself, never while calling out (other than to the factory
+/// of findOrCreate), so callers are free to lock the objects
+/// themselves without risking lock-order inversions.
+template <typename T>
+class ShardedMap
+{
+public:
+    using Ptr = std::shared_ptr<T>;
+
+    static constexpr size_t DefaultShardCount = 16;
+
+    explicit ShardedMap(const size_t shardCount = DefaultShardCount) :
+        _shards(shardCount > 0 ? shardCount : 1),
+        _size(0)
+    {
+    }
+
+    ShardedMap(const ShardedMap&) = delete;
+    ShardedMap& operator=(const ShardedMap&) = delete;
+
+    /// The number of entries. Only approximate while being modified.
+    size_t size() const { return _size; }
+
+    bool empty() const { return _size == 0; }
+
+    /// Returns the entry for the key, or null.
+    Ptr find(const std::string& key) const
+    {
+        const Shard& shard = getShard(key);
+        std::unique_lock<std::mutex> lock(shard._mutex);
+        const auto it = shard._map.find(key);
+        return (it != shard._map.end() ? it->second : nullptr);
+    }
+
+    /// Returns the entry for the key if it exists, otherwise calls
+    /// create() and inserts what it returns, unless null.
+    /// Nothing is created when there are maxSize entries already,
+    /// and null is returned.
+    /// create() is called under the shard lock, so that concurrent
+    /// callers for the same key get the same instance; it must not
+    /// call back into the map.
+    template <typename Factory>
+    Ptr findOrCreate(const std::string& key, const size_t maxSize, Factory create)
+    {
+        Shard& shard = getShard(key);
+        std::unique_lock<std::mutex> lock(shard._mutex);
+        const auto it = shard._map.find(key);
+        if (it != shard._map.end() && it->second)
+            return it->second;
+
+        if (!reserve(maxSize))
+            return nullptr;
+
+        Ptr value = create();
+        if (!value)
+        {
+            --_size;
+            return nullptr;
+        }
+
+        shard._map[key] = value;
+        return value;
+    }
+
+    /// Inserts the value unless the key exists or there are
+    /// maxSize entries already.
+    /// Returns true if inserted.
+    bool insert(const std::string& key, const Ptr& value, const size_t maxSize)
+    {
+        Shard& shard = getShard(key);
+        std::unique_lock<std::mutex> lock(shard._mutex);
+        if (shard._map.find(key) != shard._map.end() || !reserve(maxSize))
+            return false;
+
+        shard._map.emplace(key, value);
+        return true;
+    }
+
+    /// Removes the entry for the key, if any.
+    /// Returns true if removed.
+    bool erase(const std::string& key)
+    {
+        Shard& shard = getShard(key);
+        std::unique_lock<std::mutex> lock(shard._mutex);
+        if (shard._map.erase(key) == 0)
+            return false;
+
+        --_size;
+        return true;
+    }
+
+    /// Removes the entry for the key only if it is the given value,
+    /// so a stale reference can't remove a newer entry for the same key.
+    /// Returns true if removed.
+    bool erase(const std::string& key, const Ptr& value)
+    {
+        Shard& shard = getShard(key);
+        std::unique_lock<std::mutex> lock(shard._mutex);
+        const auto it = shard._map.find(key);
+        if (it == shard._map.end() || it->second != value)
+            return false;
+
+        shard._map.erase(it);
+        --_size;
+        return true;
+    }
+
+    /// Returns a copy of all the entries, to iterate without holding any locks.
+    std::vector<std::pair<std::string, Ptr>> snapshot() const
+    {
+        std::vector<std::pair<std::string, Ptr>> entries;
+        entries.reserve(_size);
+        for (const Shard& shard : _shards)
+        {
+            std::unique_lock<std::mutex> lock(shard._mutex);
+            entries.insert(entries.end(), shard._map.begin(), shard._map.end());
+        }
+
+        return entries;
+    }
+
+    void clear()
+    {
+        for (Shard& shard : _shards)
+        {
+            std::unique_lock<std::mutex> lock(shard._mutex);
+            _size -= shard._map.size();
+            shard._map.clear();
+        }
+    }
+
+private:
+    struct Shard
+    {
+        mutable std::mutex _mutex;
+        std::map<std::string, Ptr> _map;
+    };
+
+    Shard& getShard(const std::string& key)
+    {
+        return _shards[std::hash<std::string>()(key) % _shards.size()];
+    }
+
+    const Shard& getShard(const std::string& key) const
+    {
+        return _shards[std::hash<std::string>()(key) % _shards.size()];
+    }
+
+    /// Accounts for one more entry, unless that would exceed maxSize.
+    bool reserve(const size_t maxSize)
+    {
+        if (++_size > maxSize)
+        {
+            --_size;
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    std::vector<Shard> _shards;
+    std::atomic<size_t> _size;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -11,10 +11,17 @@
 
 #include "Storage.hpp"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <cassert>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <Poco/DateTime.h>
 #include <Poco/DateTimeParser.h>
@@ -33,6 +40,7 @@
 
 #include "Auth.hpp"
 #include "Common.hpp"
+#include "DocumentCache.hpp"
 #include "Exceptions.hpp"
 #include "common/FileUtil.hpp"
 #include "LOOLWSD.hpp"
@@ -97,6 +105,9 @@ void StorageBase::initialize()
                 break;
             }
         }
+
+        const size_t cacheSizeMB = app.config().getUInt("storage.wopi.document_cache_size", 0);
+        DocumentCache::instance().initialize(LOOLWSD::Cache + "/documents", cacheSizeMB * 1024 * 1024);
     }
 }
 
@@ -237,7 +248,12 @@ std::string LocalStorage::loadStorageFileToLocal()
         if (!Poco::File(_jailedFilePath).exists())
         {
             LOG_INF("Copying " << publicFilePath << " to " << _jailedFilePath);
-            Poco::File(publicFilePath).copyTo(_jailedFilePath);
+            if (!FileUtil::copyFileTo(publicFilePath, _jailedFilePath))
+            {
+                // Not all file systems support sendfile; take the slow path.
+                Poco::File(publicFilePath).copyTo(_jailedFilePath);
+            }
+
             _isCopy = true;
         }
     }
@@ -416,6 +432,7 @@ std::unique_ptr<WopiStorage::WOPIFileInfo> WopiStorage::getWOPIFileInfo(const Po
     bool disableExport = false;
     bool disableCopy = false;
     std::string lastModifiedTime;
+    std::string version;
 
     LOG_DBG("WOPI::CheckFileInfo returned: " << resMsg << ". Call duration: " << callDuration.count() << "s");
     const auto index = resMsg.find_first_of('{');
@@ -440,6 +457,7 @@ std::unique_ptr<WopiStorage::WOPIFileInfo> WopiStorage::getWOPIFileInfo(const Po
         getWOPIValue(object, "DisableExport", disableExport);
         getWOPIValue(object, "DisableCopy", disableCopy);
         getWOPIValue(object, "LastModifiedTime", lastModifiedTime);
+        getWOPIValue(object, "Version", version);
     }
     else
     {
@@ -469,20 +487,36 @@ std::unique_ptr<WopiStorage::WOPIFileInfo> WopiStorage::getWOPIFileInfo(const Po
     }
 
     _fileInfo = FileInfo({filename, ownerId, modifiedTime, size});
+    _fileVersion = version;
 
     return std::unique_ptr<WopiStorage::WOPIFileInfo>(new WOPIFileInfo({userId, userName, canWrite, postMessageOrigin, hidePrintOption, hideSaveOption, hideExportOption, enableOwnerTermination, disablePrint, disableExport, disableCopy, callDuration}));
 }
 
-/// uri format: http://server/<...>/wopi*/files/<id>/content
-std::string WopiStorage::loadStorageFileToLocal()
+std::string WopiStorage::WOPILoadTimings::toString() const
+{
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+
+    std::ostringstream oss;
+    oss << "connect:" << duration_cast<milliseconds>(_connect).count()
+        << ",ttfb:" << duration_cast<milliseconds>(_firstByte).count()
+        << ",transfer:" << duration_cast<milliseconds>(_transfer).count()
+        << ",write:" << duration_cast<milliseconds>(_write).count();
+    return oss.str();
+}
+
+size_t WopiStorage::downloadStorageFile(const Poco::URI& uri, const std::string& path,
+                                        WOPILoadTimings& timings, std::string& itemVersion,
+                                        const std::atomic<bool>* abort)
 {
     // WOPI URI to download files ends in '/contents'.
     // Add it here to get the payload instead of file info.
-    Poco::URI uriObject(_uri);
+    Poco::URI uriObject(uri);
     uriObject.setPath(uriObject.getPath() + "/contents");
     LOG_DBG("Wopi requesting: " << uriObject.toString());
 
     const auto startTime = std::chrono::steady_clock::now();
+    int fd = -1;
     try
     {
         std::unique_ptr<Poco::Net::HTTPClientSession> psession(getHTTPClientSession(uriObject));
@@ -490,11 +524,12 @@ std::string WopiStorage::loadStorageFileToLocal()
         Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_GET, uriObject.getPathAndQuery(), Poco::Net::HTTPMessage::HTTP_1_1);
         request.set("User-Agent", "LOOLWSD WOPI Agent");
         psession->sendRequest(request);
+        const auto sentTime = std::chrono::steady_clock::now();
+        timings._connect = sentTime - startTime;
 
         Poco::Net::HTTPResponse response;
         std::istream& rs = psession->receiveResponse(response);
-        const std::chrono::duration<double> diff = (std::chrono::steady_clock::now() - startTime);
-        _wopiLoadDuration += diff;
+        timings._firstByte = std::chrono::steady_clock::now() - sentTime;
 
         auto logger = Log::trace();
         if (logger.enabled())
@@ -508,28 +543,279 @@ std::string WopiStorage::loadStorageFileToLocal()
             LOG_END(logger);
         }
 
-        _jailedFilePath = Poco::Path(getLocalRootPath(), _fileInfo._filename).toString();
-        std::ofstream ofs(_jailedFilePath);
-        std::copy(std::istreambuf_iterator<char>(rs),
-                  std::istreambuf_iterator<char>(),
-                  std::ostreambuf_iterator<char>(ofs));
+        // Whatever else we got is not the document.
+        if (response.getStatus() != Poco::Net::HTTPResponse::HTTP_OK)
+        {
+            LOG_ERR("WOPI::GetFile failed for [" << uriObject.toString() << "]: " <<
+                    response.getStatus() << " " << response.getReason());
+            throw StorageConnectionException("WOPI::GetFile failed with status " +
+                                             std::to_string(response.getStatus()));
+        }
+
+        itemVersion = response.get("X-WOPI-ItemVersion", "");
 
-        LOG_INF("WOPI::GetFile downloaded " << getFileSize(_jailedFilePath) << " bytes from [" << uriObject.toString() <<
-                "] -> " << _jailedFilePath << " in " << diff.count() << "s : " <<
-                response.getStatus() << " " << response.getReason());
+        // Stream the body into the jail in chunks as it arrives.
+        // The socket stream may be SSL, so we can't splice it directly,
+        // but we avoid holding the document in memory and going through
+        // the per-character streambuf iterators.
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd < 0)
+        {
+            LOG_SYS("Failed to create [" << path << "] for WOPI::GetFile.");
+            throw StorageSpaceLowException("Failed to create " + path);
+        }
+
+        std::vector<char> buffer(READ_BUFFER_SIZE);
+        size_t total = 0;
+        for (;;)
+        {
+            if (abort != nullptr && *abort)
+            {
+                LOG_DBG("WOPI::GetFile of [" << uriObject.toString() << "] aborted after " << total << " bytes.");
+                throw StorageConnectionException("WOPI::GetFile aborted");
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            rs.read(buffer.data(), buffer.size());
+            const std::streamsize len = rs.gcount();
+            timings._transfer += std::chrono::steady_clock::now() - now;
+            if (len <= 0)
+                break;
+
+            now = std::chrono::steady_clock::now();
+            const char* data = buffer.data();
+            std::streamsize left = len;
+            while (left > 0)
+            {
+                const ssize_t wrote = write(fd, data, left);
+                if (wrote < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    LOG_SYS("Failed to write to [" << path << "] during WOPI::GetFile.");
+                    throw StorageSpaceLowException("Failed to write " + path);
+                }
+
+                data += wrote;
+                left -= wrote;
+            }
+
+            timings._write += std::chrono::steady_clock::now() - now;
+            total += len;
+            if (!rs)
+                break;
+        }
+
+        close(fd);
+        fd = -1;
+
+        // A connection dropped midway looks like the end of the body.
+        if (rs.bad() || (response.hasContentLength() &&
+                         total != static_cast<size_t>(response.getContentLength64())))
+        {
+            LOG_ERR("WOPI::GetFile got " << total << " bytes of " << response.getContentLength64() <<
+                    " from [" << uriObject.toString() << "].");
+            throw StorageConnectionException("WOPI::GetFile got a truncated document");
+        }
+
+        const std::chrono::duration<double> diff = (std::chrono::steady_clock::now() - startTime);
+        LOG_INF("WOPI::GetFile downloaded " << total << " bytes from [" << uriObject.toString() <<
+                "] -> " << path << " in " << diff.count() << "s (" << timings.toString() <<
+                ") : " << response.getStatus() << " " << response.getReason());
+        return total;
     }
-    catch(const Poco::Exception& pexc)
+    catch (const Poco::Exception& pexc)
     {
         LOG_ERR("Cannot load document from WOPI storage uri [" + uriObject.toString() + "]. Error: " << pexc.displayText() <<
                 (pexc.nested() ? " (" + pexc.nested()->displayText() + ")" : ""));
+        if (fd >= 0)
+            close(fd);
+        FileUtil::removeFile(path);
+        throw;
+    }
+    catch (const std::exception&)
+    {
+        if (fd >= 0)
+            close(fd);
+        FileUtil::removeFile(path);
         throw;
     }
+}
+
+void WopiStorage::downloadStorageFile(const std::string& path)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+    _downloadSize = downloadStorageFile(_uri, path, _loadTimings, _downloadVersion);
+    _wopiLoadDuration += std::chrono::steady_clock::now() - startTime;
+}
+
+std::string WopiStorage::getCacheFileId() const
+{
+    // Without the query, which holds the per-user access token.
+    return _uri.getHost() + ':' + std::to_string(_uri.getPort()) + _uri.getPath();
+}
+
+WopiStorage::~WopiStorage()
+{
+    if (_prefetchState)
+    {
+        abortPrefetch();
+
+        // Whoever finishes last removes what was never moved into place.
+        std::unique_lock<std::mutex> lock(_prefetchState->_mutex);
+        _prefetchState->_abandoned = true;
+        if (_prefetchState->_done)
+            FileUtil::removeFile(_prefetchState->_path);
+    }
+}
+
+void WopiStorage::prefetchStorageFile()
+{
+    if (_prefetch.valid() || _isLoaded)
+        return;
+
+    // We might not need to download at all.
+    if (DocumentCache::instance().hasFile(getCacheFileId()))
+    {
+        LOG_DBG("Not prefetching WOPI file, have a cached version to validate.");
+        return;
+    }
+
+    // Under a name of its own, lest a failed download look like the document.
+    _prefetchState = std::make_shared<Prefetch>();
+    _prefetchState->_path = Poco::Path(getLocalRootPath(), ".download").toString();
+    LOG_DBG("Prefetching WOPI file into [" << _prefetchState->_path << "].");
+
+    // Not std::async, whose future would block our destruction until the download ends.
+    const Poco::URI uri = _uri;
+    const std::shared_ptr<Prefetch> state = _prefetchState;
+    std::packaged_task<size_t()> task([uri, state]()
+        {
+            struct Done
+            {
+                const std::shared_ptr<Prefetch>& _state;
+                ~Done()
+                {
+                    std::unique_lock<std::mutex> lock(_state->_mutex);
+                    _state->_done = true;
+                    if (_state->_abandoned)
+                        FileUtil::removeFile(_state->_path);
+                }
+            } done = { state };
+
+            return downloadStorageFile(uri, state->_path, state->_timings, state->_itemVersion, &state->_abort);
+        });
+
+    _prefetch = task.get_future();
+    std::thread(std::move(task)).detach();
+}
+
+void WopiStorage::abortPrefetch()
+{
+    if (_prefetchState)
+    {
+        LOG_DBG("Aborting the prefetch of the WOPI file into [" << _prefetchState->_path << "].");
+        _prefetchState->_abort = true;
+    }
+}
+
+/// uri format: http://server/<...>/wopi*/files/<id>/content
+std::string WopiStorage::loadStorageFileToLocal()
+{
+    _jailedFilePath = Poco::Path(getLocalRootPath(), _fileInfo._filename).toString();
+    if (_prefetch.valid())
+    {
+        const std::string prefetchPath = _prefetchState->_path;
+        try
+        {
+            // Rethrows whatever the download failed with, having removed what it wrote.
+            const auto startTime = std::chrono::steady_clock::now();
+            _downloadSize = _prefetch.get();
+            _wopiLoadDuration += std::chrono::steady_clock::now() - startTime;
+            _loadTimings = _prefetchState->_timings;
+            _downloadVersion = _prefetchState->_itemVersion;
+        }
+        catch (const std::exception& exc)
+        {
+            LOG_WRN("Prefetching WOPI file failed: " << exc.what() << ". Downloading again.");
+            _downloadSize = 0;
+            _prefetchState.reset();
+        }
+
+        // The file may have changed since CheckFileInfo.
+        if (_prefetchState &&
+            ((_fileInfo._size > 0 && _downloadSize != _fileInfo._size) ||
+             (!_downloadVersion.empty() && !_fileVersion.empty() && _downloadVersion != _fileVersion)))
+        {
+            LOG_WRN("Prefetched version [" << _downloadVersion << "] of " << _downloadSize <<
+                    " bytes, but CheckFileInfo reported version [" << _fileVersion << "] of " <<
+                    _fileInfo._size << " bytes. Downloading again.");
+            FileUtil::removeFile(prefetchPath);
+            _prefetchState.reset();
+        }
+
+        if (!_prefetchState)
+        {
+            downloadStorageFile(_jailedFilePath);
+            updateDocumentCache(getDownloadCacheVersion());
+        }
+        else if (rename(prefetchPath.c_str(), _jailedFilePath.c_str()) != 0)
+        {
+            LOG_SYS("Failed to rename [" << prefetchPath << "] to [" << _jailedFilePath << "].");
+            FileUtil::removeFile(prefetchPath);
+            throw std::runtime_error("Failed to move downloaded file into place.");
+        }
+        else if (!_downloadVersion.empty() && _downloadVersion == _fileVersion)
+        {
+            // Only the item version tells what the download actually got.
+            updateDocumentCache(getCacheVersion());
+        }
+
+        _prefetchState.reset();
+    }
+    else if (!DocumentCache::instance().fetch(getCacheFileId(), getCacheVersion(), _jailedFilePath))
+    {
+        downloadStorageFile(_jailedFilePath);
+        updateDocumentCache(getDownloadCacheVersion());
+    }
 
     _isLoaded = true;
     // Now return the jailed path.
     return Poco::Path(_jailPath, _fileInfo._filename).toString();
 }
 
+std::string WopiStorage::getCacheVersion() const
+{
+    if (!_fileVersion.empty())
+        return "v:" + _fileVersion;
+
+    if (_fileInfo._modifiedTime != Poco::Timestamp::fromEpochTime(0))
+        return "t:" + std::to_string(_fileInfo._modifiedTime.epochMicroseconds());
+
+    return std::string();
+}
+
+std::string WopiStorage::getDownloadCacheVersion() const
+{
+    // Without an item version, a download made after CheckFileInfo
+    // is taken to be the version it reported.
+    if (!_downloadVersion.empty())
+        return "v:" + _downloadVersion;
+
+    return getCacheVersion();
+}
+
+void WopiStorage::updateDocumentCache()
+{
+    updateDocumentCache(getCacheVersion());
+}
+
+void WopiStorage::updateDocumentCache(const std::string& version)
+{
+    DocumentCache::instance().insert(getCacheFileId(), version, _jailedFilePath);
+}
+
 StorageBase::SaveResult WopiStorage::saveLocalFileToStorage(const Poco::URI& uriPublic)
 {
     LOG_INF("Uploading URI [" << uriPublic.toString() << "] from [" << _jailedFilePath + "].");
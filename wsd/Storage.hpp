@@ -11,6 +11,11 @@
 #ifndef INCLUDED_STORAGE_HPP
 #define INCLUDED_STORAGE_HPP
 
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 
@@ -74,6 +79,8 @@ public:
         LOG_DBG("Storage ctor: " << uri.toString());
     }
 
+    virtual ~StorageBase() {}
+
     std::string getLocalRootPath() const;
 
     const std::string getUri() const { return _uri.toString(); }
@@ -82,6 +89,13 @@ public:
 
     bool isLoaded() const { return _isLoaded; }
 
+    /// Sets where to load the file, when created before the jail was known.
+    void setJailPaths(const std::string& localStorePath, const std::string& jailPath)
+    {
+        _localStorePath = localStorePath;
+        _jailPath = jailPath;
+    }
+
     /// Returns the basic information about the file.
     FileInfo getFileInfo() { return _fileInfo; }
 
@@ -167,12 +181,15 @@ public:
                 const std::string& localStorePath,
                 const std::string& jailPath) :
         StorageBase(uri, localStorePath, jailPath),
-        _wopiLoadDuration(0)
+        _wopiLoadDuration(0),
+        _downloadSize(0)
     {
         LOG_INF("WopiStorage ctor with localStorePath: [" << localStorePath <<
                 "], jailPath: [" << jailPath << "], uri: [" << uri.toString() << "].");
     }
 
+    ~WopiStorage() override;
+
     class WOPIFileInfo
     {
     public:
@@ -229,22 +246,120 @@ public:
         std::chrono::duration<double> _callDuration;
     };
 
+    /// Breakdown of the time spent in WOPI::GetFile.
+    class WOPILoadTimings
+    {
+    public:
+        WOPILoadTimings()
+            : _connect(0),
+              _firstByte(0),
+              _transfer(0),
+              _write(0)
+        {
+        }
+
+        /// Formats as "connect:<ms>,ttfb:<ms>,transfer:<ms>,write:<ms>".
+        std::string toString() const;
+
+        /// Connecting and sending the request.
+        std::chrono::duration<double> _connect;
+        /// Waiting for the response headers (time to first byte).
+        std::chrono::duration<double> _firstByte;
+        /// Reading the body from the socket.
+        std::chrono::duration<double> _transfer;
+        /// Writing the body into the jail.
+        std::chrono::duration<double> _write;
+    };
+
     /// Returns the response of CheckFileInfo WOPI call for given URI
     /// Also extracts the basic file information from the response
     /// which can then be obtained using getFileInfo()
     std::unique_ptr<WOPIFileInfo> getWOPIFileInfo(const Poco::URI& uriPublic);
 
+    /// Starts downloading the file contents in the background, once
+    /// CheckFileInfo authorized the user, so the transfer overlaps with
+    /// the rest of the load. The download lands in a temporary file that
+    /// loadStorageFileToLocal() moves into place.
+    void prefetchStorageFile();
+
+    /// Stops the background download, if any, at its next read, and
+    /// removes what it wrote. For when the load fails or is abandoned.
+    void abortPrefetch();
+
     /// uri format: http://server/<...>/wopi*/files/<id>/content
     std::string loadStorageFileToLocal() override;
 
     SaveResult saveLocalFileToStorage(const Poco::URI& uriPublic) override;
 
+    /// Stores the jailed file in the DocumentCache as the version
+    /// last reported by CheckFileInfo, e.g. after saving.
+    void updateDocumentCache();
+
     /// Total time taken for making WOPI calls during load
     std::chrono::duration<double> getWopiLoadDuration() const { return _wopiLoadDuration; }
 
+    /// The phases of the last GetFile call.
+    const WOPILoadTimings& getLoadTimings() const { return _loadTimings; }
+
+private:
+    /// Identifies the file in the DocumentCache independently of the user.
+    std::string getCacheFileId() const;
+
+    /// The DocumentCache version of what CheckFileInfo reported: its Version
+    /// if any, else its LastModifiedTime. Empty if it reported neither.
+    std::string getCacheVersion() const;
+
+    /// The DocumentCache version of what the last synchronous download got.
+    std::string getDownloadCacheVersion() const;
+
+    void updateDocumentCache(const std::string& version);
+
+    /// Streams the GetFile response of uri into the file at path in
+    /// fixed-size chunks, without buffering the whole document.
+    /// Returns the size downloaded, and the X-WOPI-ItemVersion in itemVersion.
+    /// Throws, having removed the file, unless all of a 200 response made it to the
+    /// disk, or as soon as abort, if given, is set.
+    static size_t downloadStorageFile(const Poco::URI& uri, const std::string& path,
+                                      WOPILoadTimings& timings, std::string& itemVersion,
+                                      const std::atomic<bool>* abort = nullptr);
+
+    /// Downloads our file into path, accounting for it in the load timings.
+    void downloadStorageFile(const std::string& path);
+
+    /// What the prefetching thread shares with us. The download may
+    /// outlive us, so whichever finishes last removes its file.
+    struct Prefetch
+    {
+        Prefetch()
+            : _abort(false),
+              _done(false),
+              _abandoned(false)
+        {
+        }
+
+        std::atomic<bool> _abort;
+
+        std::mutex _mutex;
+        std::string _path;
+        WOPILoadTimings _timings;
+        std::string _itemVersion;
+        bool _done;
+        bool _abandoned;
+    };
+
 private:
     // Time spend in loading the file from storage
     std::chrono::duration<double> _wopiLoadDuration;
+    WOPILoadTimings _loadTimings;
+    size_t _downloadSize;
+    /// The X-WOPI-ItemVersion of what we downloaded, if the storage sent one.
+    std::string _downloadVersion;
+    /// The Version reported by CheckFileInfo, if any.
+    std::string _fileVersion;
+
+    /// The size of the background download started by prefetchStorageFile(), if any.
+    std::future<size_t> _prefetch;
+    std::shared_ptr<Prefetch> _prefetchState;
 };
 
 /// WebDAV protocol backed storage.
@@ -27,21 +27,22 @@
 #include <Poco/Exception.h>
 #include <Poco/File.h>
 #include <Poco/Path.h>
-#include <Poco/StringTokenizer.h>
 #include <Poco/Timestamp.h>
 #include <Poco/URI.h>
 
 #include "ClientSession.hpp"
 #include "Common.hpp"
 #include "common/FileUtil.hpp"
+#include "Metrics.hpp"
 #include "Protocol.hpp"
 #include "SenderQueue.hpp"
+#include "TileCachePolicy.hpp"
+#include "TileInvalidations.hpp"
 #include "Unit.hpp"
 #include "Util.hpp"
 
 using Poco::DirectoryIterator;
 using Poco::File;
-using Poco::StringTokenizer;
 using Poco::Timestamp;
 
 using namespace LOOLProtocol;
@@ -55,6 +56,10 @@ TileCache::TileCache(const std::string& docURL,
     LOG_INF("TileCache ctor for uri [" << _docURL <<
             "] modifiedTime=" << (modifiedTime.raw()/1000000) <<
             " getLastModified()=" << (getLastModified().raw()/1000000));
+
+    // Before creating the directory, so that the sweeper doesn't remove it.
+    TileCachePolicy::instance().open(_cacheDir);
+
     File directory(_cacheDir);
     std::string unsaved;
     if (directory.exists() &&
@@ -63,6 +68,7 @@ TileCache::TileCache(const std::string& docURL,
     {
         // Document changed externally or modifications were not saved after all. Cache not useful.
         FileUtil::removeFile(_cacheDir, true);
+        TileCachePolicy::instance().removeAll(_cacheDir);
         LOG_INF("Completely cleared tile cache: " << _cacheDir);
     }
 
@@ -74,6 +80,8 @@ TileCache::TileCache(const std::string& docURL,
 TileCache::~TileCache()
 {
     LOG_INF("~TileCache dtor for uri [" << _docURL << "].");
+
+    TileCachePolicy::instance().close(_cacheDir);
 }
 
 /// Tracks the rendering of a given tile
@@ -96,7 +104,7 @@ struct TileCache::TileBeingRendered
     void setVersion(int version) { _tile.setVersion(version); }
 
     std::chrono::steady_clock::time_point getStartTime() const { return _startTime; }
-    double getElapsedTimeMs() const { return std::chrono::duration_cast<std::chrono::milliseconds>
+    double getElapsedTimeMs() const { return std::chrono::duration<double, std::milli>
                                               (std::chrono::steady_clock::now() - _startTime).count(); }
 private:
     std::chrono::steady_clock::time_point _startTime;
@@ -125,7 +133,8 @@ void TileCache::forgetTileBeingRendered(const TileDesc& tile)
 
 std::unique_ptr<std::fstream> TileCache::lookupTile(const TileDesc& tile)
 {
-    const std::string fileName = _cacheDir + "/" + cacheFileName(tile);
+    const std::string cachedName = cacheFileName(tile);
+    const std::string fileName = _cacheDir + "/" + cachedName;
 
     std::unique_ptr<std::fstream> result(new std::fstream(fileName, std::ios::in));
     UnitWSD::get().lookupTile(tile.getPart(), tile.getWidth(), tile.getHeight(),
@@ -135,9 +144,12 @@ std::unique_ptr<std::fstream> TileCache::lookupTile(const TileDesc& tile)
     if (result && result->is_open())
     {
         LOG_TRC("Found cache tile: " << fileName);
+        TileCachePolicy::instance().touch(_cacheDir, cachedName, std::chrono::steady_clock::now());
+        Metrics::instance()._tileCacheHits.inc();
         return result;
     }
 
+    Metrics::instance()._tileCacheMisses.inc();
     return nullptr;
 }
 
@@ -157,6 +169,10 @@ void TileCache::saveTileAndNotify(const TileDesc& tile, const char *data, const
     if (FileUtil::saveDataToFileSafely(fileName, data, size))
     {
         LOG_TRC("Saved cache tile: " << fileName);
+        TileCachePolicy::instance().add(_cacheDir, cachedName,
+                                        getZoom(tile.getWidth(), tile.getHeight(),
+                                                tile.getTileWidth(), tile.getTileHeight()),
+                                        size, std::chrono::steady_clock::now());
     }
 
     // Notify subscribers, if any.
@@ -165,7 +181,10 @@ void TileCache::saveTileAndNotify(const TileDesc& tile, const char *data, const
         const auto subscriberCount = tileBeingRendered->_subscribers.size();
         if (subscriberCount > 0)
         {
-            std::string response = tile.serialize("tile:");
+            // The trace is only of interest to us, not to the clients.
+            TileDesc sent = tile;
+            sent.clearTrace();
+            std::string response = sent.serialize("tile:");
             LOG_DBG("Sending tile message to " << subscriberCount << " subscribers: " << response);
 
             // Send to first subscriber as-is (without cache marker).
@@ -211,8 +230,10 @@ void TileCache::saveTileAndNotify(const TileDesc& tile, const char *data, const
         // Remove subscriptions.
         if (tileBeingRendered->getVersion() <= tile.getVersion())
         {
+            const double elapsedMs = tileBeingRendered->getElapsedTimeMs();
+            Metrics::instance()._tileLatency.addMs(elapsedMs);
             LOG_DBG("STATISTICS: tile " << tile.getVersion() << " internal roundtrip " <<
-                    tileBeingRendered->getElapsedTimeMs() << " ms.");
+                    elapsedMs << " ms.");
             _tilesBeingRendered.erase(cachedName);
         }
     }
@@ -327,6 +348,7 @@ void TileCache::invalidateTiles(int part, int x, int y, int width, int height)
             {
                 LOG_DBG("Removing tile: " << tileIterator.path().toString());
                 FileUtil::removeFile(tileIterator.path());
+                TileCachePolicy::instance().remove(_cacheDir, fileName);
             }
         }
     }
@@ -334,38 +356,12 @@ void TileCache::invalidateTiles(int part, int x, int y, int width, int height)
 
 void TileCache::invalidateTiles(const std::string& tiles)
 {
-    StringTokenizer tokens(tiles, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
-
-    assert(tokens[0] == "invalidatetiles:");
-
-    if (tokens.count() == 2 && tokens[1] == "EMPTY")
+    TileInvalidations::Area area;
+    if (TileInvalidations::parse(tiles, area))
     {
-        invalidateTiles(-1, 0, 0, INT_MAX, INT_MAX);
+        invalidateTiles(area.Part, area.X, area.Y, area.Width, area.Height);
         return;
     }
-    else if (tokens.count() == 3 && tokens[1] == "EMPTY,")
-    {
-        int part = 0;
-        if (stringToInteger(tokens[2], part))
-        {
-            invalidateTiles(part, 0, 0, INT_MAX, INT_MAX);
-            return;
-        }
-    }
-    else
-    {
-        int part, x, y, width, height;
-        if (tokens.count() == 6 &&
-            getTokenInteger(tokens[1], "part", part) &&
-            getTokenInteger(tokens[2], "x", x) &&
-            getTokenInteger(tokens[3], "y", y) &&
-            getTokenInteger(tokens[4], "width", width) &&
-            getTokenInteger(tokens[5], "height", height))
-        {
-            invalidateTiles(part, x, y, width, height);
-            return;
-        }
-    }
 
     LOG_ERR("Unexpected invalidatetiles request [" << tiles << "].");
 }
@@ -387,6 +383,23 @@ std::string TileCache::cacheFileName(const TileDesc& tile)
     return oss.str();
 }
 
+std::string TileCache::getZoom(const int width, const int height, const int tileWidth, const int tileHeight)
+{
+    std::ostringstream oss;
+    oss << width << 'x' << height << '.' << tileWidth << 'x' << tileHeight;
+    return oss.str();
+}
+
+bool TileCache::getZoom(const std::string& fileName, std::string& zoom)
+{
+    int part, width, height, tilePosX, tilePosY, tileWidth, tileHeight;
+    if (!parseCacheFileName(fileName, part, width, height, tilePosX, tilePosY, tileWidth, tileHeight))
+        return false;
+
+    zoom = getZoom(width, height, tileWidth, tileHeight);
+    return true;
+}
+
 bool TileCache::parseCacheFileName(const std::string& fileName, int& part, int& width, int& height, int& tilePosX, int& tilePosY, int& tileWidth, int& tileHeight)
 {
     return (std::sscanf(fileName.c_str(), "%d_%dx%d.%d,%d.%dx%d.png", &part, &width, &height, &tilePosX, &tilePosY, &tileWidth, &tileHeight) == 7);
@@ -69,6 +69,9 @@ public:
     // The tiles parameter is an invalidatetiles: message as sent by the child process
     void invalidateTiles(const std::string& tiles);
 
+    /// Removes the tiles of the part, of all parts if -1, in the area in twips.
+    void invalidateTiles(int part, int x, int y, int width, int height);
+
     /// Store the timestamp to modtime.txt.
     void saveLastModified(const Poco::Timestamp& timestamp);
 
@@ -76,13 +79,17 @@ public:
 
     void forgetTileBeingRendered(const TileDesc& tile);
 
-private:
-    void invalidateTiles(int part, int x, int y, int width, int height);
+    /// Gets the zoom, as "<width>x<height>.<tileWidth>x<tileHeight>", from the
+    /// name of a cached tile.
+    /// @return false if it's not the name of a cached tile.
+    static bool getZoom(const std::string& fileName, std::string& zoom);
 
+private:
     // Removes the given file from the cache
     void removeFile(const std::string& fileName);
 
     static std::string cacheFileName(const TileDesc& tile);
+    static std::string getZoom(int width, int height, int tileWidth, int tileHeight);
     static bool parseCacheFileName(const std::string& fileName, int& part, int& width, int& height, int& tilePosX, int& tilePosY, int& tileWidth, int& tileHeight);
 
     /// Extract location from fileName, and check if it intersects with [x, y, width, height].
@@ -0,0 +1,276 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "TileCachePolicy.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+TileCachePolicy::TileCachePolicy() :
+    _maxBytes(0),
+    _bytes(0),
+    _tileCount(0),
+    _evicted(0)
+{
+}
+
+void TileCachePolicy::setMaxBytes(const size_t maxBytes)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _maxBytes = maxBytes;
+}
+
+size_t TileCachePolicy::getMaxBytes() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _maxBytes;
+}
+
+void TileCachePolicy::addZoomUse(Dir& dir, const std::string& zoom)
+{
+    ++dir._zoomUses[zoom];
+    if (++dir._uses < MaxZoomUses)
+        return;
+
+    dir._uses = 0;
+    for (auto it = dir._zoomUses.begin(); it != dir._zoomUses.end(); )
+    {
+        it->second /= 2;
+        dir._uses += it->second;
+        if (it->second == 0)
+            it = dir._zoomUses.erase(it);
+        else
+            ++it;
+    }
+}
+
+void TileCachePolicy::add(const std::string& dir, const std::string& name, const std::string& zoom,
+                          const size_t bytes, const TimePoint lastUsed)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    Dir& entry = _dirs[dir];
+    const auto it = entry._tiles.find(name);
+    if (it != entry._tiles.end())
+        removeTile(entry, it);
+
+    entry._tiles[name] = Tile({ bytes, zoom, lastUsed });
+    entry._bytes += bytes;
+    _bytes += bytes;
+    ++_tileCount;
+    addZoomUse(entry, zoom);
+}
+
+void TileCachePolicy::touch(const std::string& dir, const std::string& name, const TimePoint now)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    const auto dirIt = _dirs.find(dir);
+    if (dirIt == _dirs.end())
+        return;
+
+    const auto it = dirIt->second._tiles.find(name);
+    if (it != dirIt->second._tiles.end())
+    {
+        it->second._lastUsed = now;
+        addZoomUse(dirIt->second, it->second._zoom);
+    }
+}
+
+void TileCachePolicy::removeTile(Dir& dir, const std::map<std::string, Tile>::iterator it)
+{
+    dir._bytes -= it->second._bytes;
+    _bytes -= it->second._bytes;
+    --_tileCount;
+    dir._tiles.erase(it);
+}
+
+void TileCachePolicy::remove(const std::string& dir, const std::string& name)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    const auto dirIt = _dirs.find(dir);
+    if (dirIt == _dirs.end())
+        return;
+
+    const auto it = dirIt->second._tiles.find(name);
+    if (it != dirIt->second._tiles.end())
+        removeTile(dirIt->second, it);
+}
+
+void TileCachePolicy::removeAll(const std::string& dir)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    const auto dirIt = _dirs.find(dir);
+    if (dirIt != _dirs.end())
+    {
+        _bytes -= dirIt->second._bytes;
+        _tileCount -= dirIt->second._tiles.size();
+        _dirs.erase(dirIt);
+    }
+}
+
+void TileCachePolicy::addDir(const std::string& dir)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _dirs[dir];
+}
+
+void TileCachePolicy::open(const std::string& dir)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    ++_openDirs[dir];
+}
+
+void TileCachePolicy::close(const std::string& dir)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const auto it = _openDirs.find(dir);
+    if (it != _openDirs.end() && --it->second == 0)
+        _openDirs.erase(it);
+}
+
+void TileCachePolicy::removeEmptyDirs(const std::function<void(const std::string&)>& removeDir)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (auto it = _dirs.begin(); it != _dirs.end(); )
+    {
+        if (it->second._tiles.empty() && _openDirs.find(it->first) == _openDirs.end())
+        {
+            removeDir(it->first);
+            it = _dirs.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+bool TileCachePolicy::has(const std::string& dir, const std::string& name) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const auto dirIt = _dirs.find(dir);
+    return (dirIt != _dirs.end() && dirIt->second._tiles.find(name) != dirIt->second._tiles.end());
+}
+
+size_t TileCachePolicy::getBytes() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _bytes;
+}
+
+size_t TileCachePolicy::getBytes(const std::string& dir) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const auto dirIt = _dirs.find(dir);
+    return (dirIt != _dirs.end() ? dirIt->second._bytes : 0);
+}
+
+size_t TileCachePolicy::getTileCount() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _tileCount;
+}
+
+std::vector<TileCachePolicy::Victim> TileCachePolicy::pickVictims(const TimePoint now)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    std::vector<Victim> victims;
+    if (_maxBytes == 0 || _bytes <= _maxBytes)
+        return victims;
+
+    // Rank by age, scaled by how rarely the tile's zoom is used in its document.
+    struct Candidate
+    {
+        double _score;
+        size_t _bytes;
+        TimePoint _lastUsed;
+        Victim _victim;
+    };
+
+    // Only snapshot the candidates under the lock, and rank them without it.
+    std::vector<Candidate> candidates;
+    candidates.reserve(_tileCount);
+    for (const auto& dirIt : _dirs)
+    {
+        const Dir& dir = dirIt.second;
+        for (const auto& it : dir._tiles)
+        {
+            const auto zoomIt = dir._zoomUses.find(it.second._zoom);
+            const double share = (dir._uses > 0 && zoomIt != dir._zoomUses.end()
+                                  ? static_cast<double>(zoomIt->second) / dir._uses : 0);
+            const double age = std::chrono::duration<double>(now - it.second._lastUsed).count();
+            candidates.push_back(Candidate({ std::max(0.0, age) * 2 / (1 + share), it.second._bytes,
+                                             it.second._lastUsed, Victim({ dirIt.first, it.first }) }));
+        }
+    }
+
+    const size_t target = static_cast<size_t>(_maxBytes * LowWater);
+    const size_t averageBytes = std::max<size_t>(1, _bytes / std::max<size_t>(1, candidates.size()));
+    size_t toFree = _bytes - target;
+    lock.unlock();
+
+    // Sort only as many as we expect to evict, by their average size, and more if that's not enough.
+    const auto higherScore = [](const Candidate& a, const Candidate& b) { return a._score > b._score; };
+    size_t sorted = 0;
+    size_t picked = 0;
+    while (picked < candidates.size() && toFree > 0)
+    {
+        if (picked == sorted)
+        {
+            const size_t count = std::max<size_t>(sorted, toFree / averageBytes + 1);
+            const auto end = candidates.begin() + std::min(candidates.size(), sorted + count);
+            std::partial_sort(candidates.begin() + sorted, end, candidates.end(), higherScore);
+            sorted = end - candidates.begin();
+        }
+
+        toFree -= std::min(toFree, candidates[picked]._bytes);
+        ++picked;
+    }
+
+    // Forget the picked tiles, unless removed or used again meanwhile.
+    lock.lock();
+    victims.reserve(picked);
+    for (size_t i = 0; i < picked && _bytes > target; ++i)
+    {
+        const Candidate& candidate = candidates[i];
+        const auto dirIt = _dirs.find(candidate._victim._dir);
+        if (dirIt == _dirs.end())
+            continue;
+
+        const auto it = dirIt->second._tiles.find(candidate._victim._name);
+        if (it == dirIt->second._tiles.end() || it->second._lastUsed != candidate._lastUsed)
+            continue;
+
+        removeTile(dirIt->second, it);
+        victims.push_back(candidate._victim);
+        ++_evicted;
+    }
+
+    return victims;
+}
+
+std::string TileCachePolicy::toString() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    std::ostringstream oss;
+    oss << "tiles=" << _tileCount
+        << " bytes=" << _bytes
+        << " max_bytes=" << _maxBytes
+        << " evicted=" << _evicted;
+    return oss.str();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,136 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILECACHEPOLICY_HPP
+#define INCLUDED_TILECACHEPOLICY_HPP
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Keeps the tile caches of all the documents, open or not, within a
+/// budget of bytes on disk.
+/// Indexes the cached tiles of each cache directory, with their size,
+/// zoom and when they were last used, and picks which to evict: the least
+/// recently used first, with the tiles of the zooms a document is rarely
+/// viewed at aging up to twice as fast as those of its usual zoom.
+/// Only indexes and picks; removing the files is up to the caller.
+/// Thread-safe.
+class TileCachePolicy
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    /// A tile to evict: its cache directory and file name.
+    struct Victim
+    {
+        std::string _dir;
+        std::string _name;
+    };
+
+    TileCachePolicy();
+
+    /// The one shared by the tile caches of all documents.
+    static TileCachePolicy& instance()
+    {
+        static TileCachePolicy policy;
+        return policy;
+    }
+
+    /// A maxBytes of 0 means no limit.
+    void setMaxBytes(size_t maxBytes);
+    size_t getMaxBytes() const;
+
+    /// A tile was saved, or found on disk, last used at the given time.
+    void add(const std::string& dir, const std::string& name, const std::string& zoom,
+             size_t bytes, TimePoint lastUsed);
+
+    /// A tile was served from the cache.
+    void touch(const std::string& dir, const std::string& name, TimePoint now);
+
+    void remove(const std::string& dir, const std::string& name);
+
+    /// The whole cache directory was wiped.
+    void removeAll(const std::string& dir);
+
+    /// A cache directory was found on disk, with or without tiles.
+    void addDir(const std::string& dir);
+
+    /// A tile cache was opened in, or closed, the given directory.
+    /// Only the directories no tile cache is open in are removed.
+    void open(const std::string& dir);
+    void close(const std::string& dir);
+
+    /// Calls removeDir with each directory left without tiles, and no tile
+    /// cache open in it, and forgets it. Under the lock, so that none is
+    /// opened while removed.
+    void removeEmptyDirs(const std::function<void(const std::string&)>& removeDir);
+
+    /// Whether we have indexed the given tile.
+    bool has(const std::string& dir, const std::string& name) const;
+
+    size_t getBytes() const;
+    size_t getBytes(const std::string& dir) const;
+    size_t getTileCount() const;
+
+    /// Picks the tiles to evict to bring the total below the budget, with
+    /// some headroom so we don't have to evict again right away, and
+    /// forgets them.
+    std::vector<Victim> pickVictims(TimePoint now);
+
+    /// Formats as "tiles=<n> bytes=<n> max_bytes=<n> evicted=<n>".
+    std::string toString() const;
+
+private:
+    struct Tile
+    {
+        size_t _bytes;
+        std::string _zoom;
+        TimePoint _lastUsed;
+    };
+
+    struct Dir
+    {
+        Dir() : _bytes(0), _uses(0) {}
+
+        std::map<std::string, Tile> _tiles;
+        size_t _bytes;
+        /// How often tiles of each zoom were used, and in total.
+        std::map<std::string, unsigned> _zoomUses;
+        unsigned _uses;
+    };
+
+    /// Counts a use of the zoom, halving the counts once in a while,
+    /// so that the popularity follows what the users do now.
+    static void addZoomUse(Dir& dir, const std::string& zoom);
+
+    void removeTile(Dir& dir, std::map<std::string, Tile>::iterator it);
+
+private:
+    /// Evict down to this share of the budget.
+    static constexpr double LowWater = 0.9;
+    /// Halve the zoom counts of a directory once it had as many uses.
+    static constexpr unsigned MaxZoomUses = 1000;
+
+    mutable std::mutex _mutex;
+    size_t _maxBytes;
+    size_t _bytes;
+    size_t _tileCount;
+    size_t _evicted;
+    std::map<std::string, Dir> _dirs;
+    /// How many tile caches are open in each directory.
+    std::map<std::string, unsigned> _openDirs;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,194 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "TileCacheSweeper.hpp"
+
+#include <ostream>
+
+#include <Poco/DirectoryIterator.h>
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/Timestamp.h>
+
+#include "FileUtil.hpp"
+#include "Log.hpp"
+#include "TileCache.hpp"
+#include "TileCachePolicy.hpp"
+#include "Util.hpp"
+
+namespace
+{
+
+/// The cache directory of a document is at <root>/<h>/<h>/<h>/<rest of the hash>.
+constexpr int CacheDirDepth = 4;
+
+}
+
+TileCacheSweeper::TileCacheSweeper() :
+    _interval(0),
+    _scanned(false),
+    _stop(false),
+    _sweeps(0)
+{
+}
+
+TileCacheSweeper::~TileCacheSweeper()
+{
+    stop();
+}
+
+void TileCacheSweeper::start(const std::string& cacheRoot, const std::chrono::seconds interval,
+                             const std::function<void()>& onSwept)
+{
+    stop();
+
+    _cacheRoot = cacheRoot;
+    _interval = interval;
+    _onSwept = onSwept;
+    _stop = false;
+    _thread = std::thread([this]() { run(); });
+}
+
+void TileCacheSweeper::stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    _cv.notify_all();
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void TileCacheSweeper::run()
+{
+    Util::setThreadName("tilecache_sweep");
+    LOG_INF("Tile cache sweeper started for [" << _cacheRoot << "] every " << _interval.count() << " secs.");
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop)
+    {
+        lock.unlock();
+        try
+        {
+            sweep();
+            if (_onSwept)
+                _onSwept();
+        }
+        catch (const std::exception& exc)
+        {
+            LOG_ERR("Failed to sweep the tile cache: " << exc.what());
+        }
+
+        lock.lock();
+        _cv.wait_for(lock, _interval, [this]() { return _stop; });
+    }
+
+    LOG_INF("Tile cache sweeper finished.");
+}
+
+void TileCacheSweeper::sweep()
+{
+    if (!_scanned)
+    {
+        scan(_cacheRoot, CacheDirDepth);
+        _scanned = true;
+        LOG_INF("Indexed the tile cache: " << TileCachePolicy::instance().toString());
+    }
+
+    TileCachePolicy& policy = TileCachePolicy::instance();
+    const auto victims = policy.pickVictims(std::chrono::steady_clock::now());
+    for (const auto& victim : victims)
+    {
+        // Picking forgets them, so the policy has those saved again since.
+        if (policy.has(victim._dir, victim._name))
+            continue;
+
+        FileUtil::removeFile(victim._dir + '/' + victim._name);
+    }
+
+    // The documents closed, and evicted from the cache altogether.
+    policy.removeEmptyDirs([](const std::string& dir)
+        {
+            LOG_DBG("Removing the tile cache of closed document [" << dir << "].");
+            FileUtil::removeFile(dir, true);
+        });
+
+    ++_sweeps;
+    if (!victims.empty())
+    {
+        LOG_INF("Evicted " << victims.size() << " tiles from the tile cache: " <<
+                TileCachePolicy::instance().toString());
+    }
+}
+
+void TileCacheSweeper::scan(const std::string& dir, const int depth)
+{
+    if (depth == 0)
+    {
+        scanDocument(dir);
+        return;
+    }
+
+    Poco::File directory(dir);
+    if (!directory.exists() || !directory.isDirectory())
+        return;
+
+    for (auto it = Poco::DirectoryIterator(directory); it != Poco::DirectoryIterator(); ++it)
+    {
+        // Only the levels of the hash, not the previews, or anything else there.
+        const std::string name = it.name();
+        if ((depth > 1 && name.size() != 1) || !it->isDirectory())
+            continue;
+
+        scan(dir + '/' + name, depth - 1);
+    }
+}
+
+void TileCacheSweeper::scanDocument(const std::string& dir)
+{
+    TileCachePolicy& policy = TileCachePolicy::instance();
+    const Poco::Timestamp now;
+    const auto steadyNow = std::chrono::steady_clock::now();
+
+    try
+    {
+        // Indexed even without tiles, so that it's removed if never opened.
+        policy.addDir(dir);
+        for (auto it = Poco::DirectoryIterator(dir); it != Poco::DirectoryIterator(); ++it)
+        {
+            const std::string name = it.name();
+            std::string zoom;
+            if (!TileCache::getZoom(name, zoom) || policy.has(dir, name))
+                continue;
+
+            // Last used when last saved, as far as we know.
+            const auto age = std::chrono::microseconds(now - it->getLastModified());
+            policy.add(dir, name, zoom, it->getSize(), steadyNow - age);
+        }
+    }
+    catch (const Poco::Exception& exc)
+    {
+        // Removed meanwhile, most likely.
+        LOG_WRN("Failed to index the tile cache in [" << dir << "]: " << exc.displayText());
+    }
+}
+
+void TileCacheSweeper::dumpState(std::ostream& os)
+{
+    os << "TileCacheSweeper:\n"
+       << "  path: " << _cacheRoot << "\n"
+       << "  sweeps: " << _sweeps << "\n"
+       << "  policy: " << TileCachePolicy::instance().toString() << "\n";
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
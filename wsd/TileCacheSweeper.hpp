@@ -0,0 +1,79 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILECACHESWEEPER_HPP
+#define INCLUDED_TILECACHESWEEPER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Evicts tiles from the caches of all documents, open or closed, to keep
+/// them within the budget of TileCachePolicy, and removes the cache
+/// directories of the closed documents once they have no tiles left.
+/// Runs in its own thread, so the document brokers never wait on the
+/// disk for it. The first sweep indexes the tiles left on disk by the
+/// previous runs; after that the tile caches keep the index up to date.
+class TileCacheSweeper
+{
+    TileCacheSweeper();
+
+public:
+    ~TileCacheSweeper();
+
+    static TileCacheSweeper& instance()
+    {
+        static TileCacheSweeper sweeper;
+        return sweeper;
+    }
+
+    /// Starts sweeping the caches under cacheRoot every interval.
+    /// onSwept is called, from the sweeper thread, after each sweep.
+    void start(const std::string& cacheRoot, std::chrono::seconds interval,
+               const std::function<void()>& onSwept);
+
+    void stop();
+
+    /// Indexes the caches on disk the first time, then evicts to fit the budget.
+    void sweep();
+
+    void dumpState(std::ostream& os);
+
+private:
+    void run();
+
+    /// Indexes the tiles of the cache directories under the given one,
+    /// the given number of levels down.
+    void scan(const std::string& dir, int depth);
+
+    /// Indexes the tiles in the cache directory of a document.
+    void scanDocument(const std::string& dir);
+
+private:
+    std::string _cacheRoot;
+    std::chrono::seconds _interval;
+    std::function<void()> _onSwept;
+    bool _scanned;
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop;
+
+    std::atomic<unsigned> _sweeps;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -10,16 +10,56 @@
 #ifndef INCLUDED_TILEDESC_HPP
 #define INCLUDED_TILEDESC_HPP
 
+#include <algorithm>
+#include <array>
 #include <cassert>
-#include <map>
+#include <chrono>
+#include <cstdint>
 #include <sstream>
 #include <string>
 
-#include <Poco/StringTokenizer.h>
-
 #include "Exceptions.hpp"
 #include "Protocol.hpp"
 
+/// The stages a tile goes through from its request to its delivery.
+/// Each is stamped in microseconds of the monotonic clock, which WSD
+/// and the Kits share on a host, so that WSD can tell where the time
+/// went for every tile.
+namespace TileTrace
+{
+    enum Stage
+    {
+        Requested,  ///< WSD got the request from the client.
+        Forwarded,  ///< WSD sent it to the Kit.
+        Queued,     ///< The Kit queued it.
+        Dequeued,   ///< The Kit took it from the queue to render.
+        Painted,    ///< The Kit painted it.
+        Encoded,    ///< The Kit encoded it into PNG, and sent it.
+        Received,   ///< WSD got it back from the Kit.
+        Enqueued,   ///< WSD cached it and queued it for the client.
+        Sent,       ///< WSD wrote it to the socket of the client.
+        StageCount
+    };
+
+    /// The stages stamped by the Kit, carried back to WSD in the tile
+    /// responses as tracets=<queued>:<dequeued>:<painted>:<encoded>.
+    constexpr int FirstKitStage = Queued;
+    constexpr int LastKitStage = Encoded;
+
+    typedef std::array<uint64_t, StageCount> Stamps;
+
+    inline uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline uint64_t toStamp(const std::chrono::steady_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+    }
+}
+
 /// Tile Descriptor
 /// Represents a tile's coordinates and dimensions.
 class TileDesc
@@ -38,8 +78,11 @@ public:
         _id(id),
         _broadcast(broadcast),
         _oldHash(0),
-        _hash(0)
+        _hash(0),
+        _traceId(0)
     {
+        _stamps.fill(0);
+
         if (_part < 0 ||
             _width <= 0 ||
             _height <= 0 ||
@@ -71,6 +114,83 @@ public:
     void setHash(uint64_t hash) { _hash = hash; }
     uint64_t getHash() const { return _hash; }
 
+    /// Identifies the request of the tile in its document, to trace its latency.
+    /// 0 when not traced.
+    int getTraceId() const { return _traceId; }
+    void setTraceId(const int traceId) { _traceId = traceId; }
+    const TileTrace::Stamps& getStamps() const { return _stamps; }
+    uint64_t getStamp(const TileTrace::Stage stage) const { return _stamps[stage]; }
+    void setStamp(const TileTrace::Stage stage, const uint64_t us) { _stamps[stage] = us; }
+    /// Stamps the stage now, if traced.
+    void stamp(const TileTrace::Stage stage)
+    {
+        if (_traceId > 0)
+            _stamps[stage] = TileTrace::now();
+    }
+
+    /// Whether any of the stages stamped by the Kit is.
+    bool hasKitStamps() const
+    {
+        for (int stage = TileTrace::FirstKitStage; stage <= TileTrace::LastKitStage; ++stage)
+        {
+            if (_stamps[stage] != 0)
+                return true;
+        }
+
+        return false;
+    }
+
+    void clearKitStamps()
+    {
+        for (int stage = TileTrace::FirstKitStage; stage <= TileTrace::LastKitStage; ++stage)
+        {
+            _stamps[stage] = 0;
+        }
+    }
+
+    /// Drops the trace id and the stamps, as those of clients are never trusted.
+    void clearTrace()
+    {
+        _traceId = 0;
+        _stamps.fill(0);
+    }
+
+    /// Formats the stages stamped by the Kit as "<queued>:<dequeued>:<painted>:<encoded>".
+    std::string serializeKitStamps() const
+    {
+        std::ostringstream oss;
+        for (int stage = TileTrace::FirstKitStage; stage <= TileTrace::LastKitStage; ++stage)
+        {
+            oss << (stage > TileTrace::FirstKitStage ? ":" : "") << _stamps[stage];
+        }
+
+        return oss.str();
+    }
+
+    /// Returns false, leaving the stamps as they were, if malformed.
+    bool parseKitStamps(const LOOLProtocol::StringSpan& value)
+    {
+        LOOLProtocol::ListTokenizer tokens(value, ':');
+        if (tokens.count() != static_cast<size_t>(TileTrace::LastKitStage - TileTrace::FirstKitStage + 1))
+            return false;
+
+        TileTrace::Stamps stamps = _stamps;
+        LOOLProtocol::StringSpan token;
+        for (int stage = TileTrace::FirstKitStage; tokens.next(token); ++stage)
+        {
+            if (!LOOLProtocol::stringToUInt64(token, stamps[stage]))
+                return false;
+        }
+
+        _stamps = stamps;
+        return true;
+    }
+
+    bool parseKitStamps(const std::string& value)
+    {
+        return parseKitStamps(LOOLProtocol::StringSpan(value));
+    }
+
     bool operator==(const TileDesc& other) const
     {
         return _part == other._part &&
@@ -86,10 +206,56 @@ public:
 
     static bool rectanglesIntersect(int x1, int y1, int w1, int h1, int x2, int y2, int w2, int h2)
     {
-        return x1 + w1 >= x2 &&
-               x1 <= x2 + w2 &&
-               y1 + h1 >= y2 &&
-               y1 <= y2 + h2;
+        // The widths may be INT_MAX, for all the rest of the part.
+        return static_cast<int64_t>(x1) + w1 >= x2 &&
+               x1 <= static_cast<int64_t>(x2) + w2 &&
+               static_cast<int64_t>(y1) + h1 >= y2 &&
+               y1 <= static_cast<int64_t>(y2) + h2;
+    }
+
+    /// Joins the second rectangle into the first, if either covers the
+    /// other, or if they intersect or touch and their union is at most
+    /// 4x2 tiles at 100% zoom, so that one invalidation of the union
+    /// doesn't invalidate much more than both did.
+    /// Returns false, leaving the first as is, if they are not joined.
+    static bool joinRectangles(int& x1, int& y1, int& w1, int& h1, int x2, int y2, int w2, int h2)
+    {
+        // The widths may be INT_MAX, for all the rest of the part.
+        const int64_t right1 = static_cast<int64_t>(x1) + w1;
+        const int64_t bottom1 = static_cast<int64_t>(y1) + h1;
+        const int64_t right2 = static_cast<int64_t>(x2) + w2;
+        const int64_t bottom2 = static_cast<int64_t>(y2) + h2;
+
+        if (x1 <= x2 && right2 <= right1 && y1 <= y2 && bottom2 <= bottom1)
+            return true;
+
+        if (x2 <= x1 && right1 <= right2 && y2 <= y1 && bottom1 <= bottom2)
+        {
+            x1 = x2;
+            y1 = y2;
+            w1 = w2;
+            h1 = h2;
+            return true;
+        }
+
+        if (right1 < x2 || right2 < x1 || bottom1 < y2 || bottom2 < y1)
+            return false;
+
+        const int joinX = std::min(x1, x2);
+        const int joinY = std::min(y1, y2);
+        const int64_t joinW = std::max(right1, right2) - joinX;
+        const int64_t joinH = std::max(bottom1, bottom2) - joinY;
+
+        const int reasonableSizeX = 4*3840; // 4x tile at 100% zoom
+        const int reasonableSizeY = 2*3840; // 2x tile at 100% zoom
+        if (joinW > reasonableSizeX || joinH > reasonableSizeY)
+            return false;
+
+        x1 = joinX;
+        y1 = joinY;
+        w1 = static_cast<int>(joinW);
+        h1 = static_cast<int>(joinH);
+        return true;
     }
 
     bool intersectsWithRect(int x, int y, int w, int h) const
@@ -166,59 +332,103 @@ public:
             oss << " broadcast=yes";
         }
 
+        if (_traceId > 0)
+        {
+            oss << " traceid=" << _traceId;
+            if (hasKitStamps())
+            {
+                oss << " tracets=" << serializeKitStamps();
+            }
+        }
+
         return oss.str();
     }
 
-    /// Deserialize a TileDesc from a tokenized string.
-    static TileDesc parse(const std::vector<std::string>& tokens)
+    /// Deserialize a TileDesc from a tokenized string, without copying.
+    static TileDesc parse(const LOOLProtocol::TokenSpans& tokens)
     {
         // We don't expect undocumented fields and
         // assume all values to be int.
-        std::map<std::string, int> pairs;
+        int part = 0;
+        int width = 0;
+        int height = 0;
+        int tilePosX = 0;
+        int tilePosY = 0;
+        int tileWidth = 0;
+        int tileHeight = 0;
 
         // Optional.
-        pairs["ver"] = -1;
-        pairs["imgsize"] = 0;
-        pairs["id"] = -1;
+        int ver = -1;
+        int imgSize = 0;
+        int id = -1;
+        int traceId = 0;
+        bool broadcast = false;
 
         uint64_t oldHash = 0;
         uint64_t hash = 0;
-        for (size_t i = 0; i < tokens.size(); ++i)
+        LOOLProtocol::StringSpan kitStamps;
+        for (const auto& token : tokens)
         {
-            if (LOOLProtocol::getTokenUInt64(tokens[i], "oldhash", oldHash))
-                ;
-            else if (LOOLProtocol::getTokenUInt64(tokens[i], "hash", hash))
-                ;
-            else
-            {
-                std::string name;
-                int value = -1;
-                if (LOOLProtocol::parseNameIntegerPair(tokens[i], name, value))
-                {
-                    pairs[name] = value;
-                }
-            }
+            LOOLProtocol::StringSpan name;
+            LOOLProtocol::StringSpan value;
+            if (!LOOLProtocol::parseNameValuePair(token, name, value) || value.empty())
+                continue;
+
+            if (name == "oldhash")
+                LOOLProtocol::stringToUInt64(value, oldHash);
+            else if (name == "hash")
+                LOOLProtocol::stringToUInt64(value, hash);
+            else if (name == "tracets")
+                kitStamps = value;
+            else if (name == "broadcast")
+                broadcast = (value == "yes");
+            else if (name == "part")
+                LOOLProtocol::stringToInteger(value, part);
+            else if (name == "width")
+                LOOLProtocol::stringToInteger(value, width);
+            else if (name == "height")
+                LOOLProtocol::stringToInteger(value, height);
+            else if (name == "tileposx")
+                LOOLProtocol::stringToInteger(value, tilePosX);
+            else if (name == "tileposy")
+                LOOLProtocol::stringToInteger(value, tilePosY);
+            else if (name == "tilewidth")
+                LOOLProtocol::stringToInteger(value, tileWidth);
+            else if (name == "tileheight")
+                LOOLProtocol::stringToInteger(value, tileHeight);
+            else if (name == "ver")
+                LOOLProtocol::stringToInteger(value, ver);
+            else if (name == "imgsize")
+                LOOLProtocol::stringToInteger(value, imgSize);
+            else if (name == "id")
+                LOOLProtocol::stringToInteger(value, id);
+            else if (name == "traceid")
+                LOOLProtocol::stringToInteger(value, traceId);
         }
 
-        std::string s;
-        const bool broadcast = (LOOLProtocol::getTokenString(tokens, "broadcast", s) &&
-                                s == "yes");
-
-        auto result = TileDesc(pairs["part"], pairs["width"], pairs["height"],
-                               pairs["tileposx"], pairs["tileposy"],
-                               pairs["tilewidth"], pairs["tileheight"],
-                               pairs["ver"],
-                               pairs["imgsize"], pairs["id"], broadcast);
+        auto result = TileDesc(part, width, height,
+                               tilePosX, tilePosY,
+                               tileWidth, tileHeight,
+                               ver, imgSize, id, broadcast);
         result.setOldHash(oldHash);
         result.setHash(hash);
+        result.setTraceId(traceId);
+        if (!kitStamps.empty())
+            result.parseKitStamps(kitStamps);
 
         return result;
     }
 
+    /// Deserialize a TileDesc from a tokenized string.
+    static TileDesc parse(const std::vector<std::string>& tokens)
+    {
+        return parse(LOOLProtocol::TokenSpans(tokens));
+    }
+
     /// Deserialize a TileDesc from a string format.
     static TileDesc parse(const std::string& message)
     {
-        return parse(LOOLProtocol::tokenize(message.data(), message.size()));
+        return parse(LOOLProtocol::TokenSpans(message));
     }
 
 private:
@@ -235,6 +445,8 @@ private:
     bool _broadcast;
     uint64_t _oldHash;
     uint64_t _hash;
+    int _traceId;
+    TileTrace::Stamps _stamps;
 };
 
 /// One or more tile header.
@@ -244,11 +456,13 @@ class TileCombined
 {
 private:
     TileCombined(int part, int width, int height,
-                 const std::string& tilePositionsX, const std::string& tilePositionsY,
-                 int tileWidth, int tileHeight, const std::string& vers,
-                 const std::string& imgSizes, int id,
-                 const std::string& oldHashes,
-                 const std::string& hashes) :
+                 const LOOLProtocol::StringSpan& tilePositionsX, const LOOLProtocol::StringSpan& tilePositionsY,
+                 int tileWidth, int tileHeight, const LOOLProtocol::StringSpan& vers,
+                 const LOOLProtocol::StringSpan& imgSizes, int id,
+                 const LOOLProtocol::StringSpan& oldHashes,
+                 const LOOLProtocol::StringSpan& hashes,
+                 const LOOLProtocol::StringSpan& traceIds = LOOLProtocol::StringSpan(),
+                 const LOOLProtocol::StringSpan& kitStamps = LOOLProtocol::StringSpan()) :
         _part(part),
         _width(width),
         _height(height),
@@ -265,12 +479,14 @@ private:
             throw BadArgumentException("Invalid tilecombine descriptor.");
         }
 
-        Poco::StringTokenizer positionXtokens(tilePositionsX, ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
-        Poco::StringTokenizer positionYtokens(tilePositionsY, ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
-        Poco::StringTokenizer imgSizeTokens(imgSizes, ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
-        Poco::StringTokenizer verTokens(vers, ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
-        Poco::StringTokenizer oldHashTokens(oldHashes, ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
-        Poco::StringTokenizer hashTokens(hashes, ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
+        LOOLProtocol::ListTokenizer positionXtokens(tilePositionsX, ',');
+        LOOLProtocol::ListTokenizer positionYtokens(tilePositionsY, ',');
+        LOOLProtocol::ListTokenizer imgSizeTokens(imgSizes, ',');
+        LOOLProtocol::ListTokenizer verTokens(vers, ',');
+        LOOLProtocol::ListTokenizer oldHashTokens(oldHashes, ',');
+        LOOLProtocol::ListTokenizer hashTokens(hashes, ',');
+        LOOLProtocol::ListTokenizer traceIdTokens(traceIds, ',');
+        LOOLProtocol::ListTokenizer kitStampTokens(kitStamps, ',');
 
         const auto numberOfPositions = positionXtokens.count();
 
@@ -279,52 +495,69 @@ private:
             (!imgSizes.empty() && numberOfPositions != imgSizeTokens.count()) ||
             (!vers.empty() && numberOfPositions != verTokens.count()) ||
             (!oldHashes.empty() && numberOfPositions != oldHashTokens.count()) ||
-            (!hashes.empty() && numberOfPositions != hashTokens.count()))
+            (!hashes.empty() && numberOfPositions != hashTokens.count()) ||
+            (!traceIds.empty() && numberOfPositions != traceIdTokens.count()) ||
+            (!kitStamps.empty() && numberOfPositions != kitStampTokens.count()))
         {
             throw BadArgumentException("Invalid tilecombine descriptor. Unequal number of tiles in parameters.");
         }
 
+        _tiles.reserve(numberOfPositions);
+
+        // The lists are either empty or of numberOfPositions items.
+        LOOLProtocol::StringSpan token;
         for (size_t i = 0; i < numberOfPositions; ++i)
         {
             int x = 0;
-            if (!LOOLProtocol::stringToInteger(positionXtokens[i], x))
+            if (!positionXtokens.next(token) || !LOOLProtocol::stringToInteger(token, x))
             {
                 throw BadArgumentException("Invalid 'tileposx' in tilecombine descriptor.");
             }
 
             int y = 0;
-            if (!LOOLProtocol::stringToInteger(positionYtokens[i], y))
+            if (!positionYtokens.next(token) || !LOOLProtocol::stringToInteger(token, y))
             {
                 throw BadArgumentException("Invalid 'tileposy' in tilecombine descriptor.");
             }
 
             int imgSize = 0;
-            if (imgSizeTokens.count() && !LOOLProtocol::stringToInteger(imgSizeTokens[i], imgSize))
+            if (imgSizeTokens.next(token) && !LOOLProtocol::stringToInteger(token, imgSize))
             {
                 throw BadArgumentException("Invalid 'imgsize' in tilecombine descriptor.");
             }
 
             int ver = -1;
-            if (verTokens.count() && !verTokens[i].empty() && !LOOLProtocol::stringToInteger(verTokens[i], ver))
+            if (verTokens.next(token) && !LOOLProtocol::stringToInteger(token, ver))
             {
                 throw BadArgumentException("Invalid 'ver' in tilecombine descriptor.");
             }
 
             uint64_t oldHash = 0;
-            if (oldHashTokens.count() && !LOOLProtocol::stringToUInt64(oldHashTokens[i], oldHash))
+            if (oldHashTokens.next(token) && !LOOLProtocol::stringToUInt64(token, oldHash))
             {
                 throw BadArgumentException("Invalid tilecombine descriptor.");
             }
 
             uint64_t hash = 0;
-            if (hashTokens.count() && !LOOLProtocol::stringToUInt64(hashTokens[i], hash))
+            if (hashTokens.next(token) && !LOOLProtocol::stringToUInt64(token, hash))
             {
                 throw BadArgumentException("Invalid tilecombine descriptor.");
             }
 
+            int traceId = 0;
+            if (traceIdTokens.next(token) && !LOOLProtocol::stringToInteger(token, traceId))
+            {
+                throw BadArgumentException("Invalid 'traceid' in tilecombine descriptor.");
+            }
+
             _tiles.emplace_back(_part, _width, _height, x, y, _tileWidth, _tileHeight, ver, imgSize, id, false);
             _tiles.back().setOldHash(oldHash);
             _tiles.back().setHash(hash);
+            _tiles.back().setTraceId(traceId);
+            if (kitStampTokens.next(token) && !_tiles.back().parseKitStamps(token))
+            {
+                throw BadArgumentException("Invalid 'tracets' in tilecombine descriptor.");
+            }
         }
     }
 
@@ -336,8 +569,41 @@ public:
     int getTileHeight() const { return _tileHeight; }
 
     const std::vector<TileDesc>& getTiles() const { return _tiles; }
+
+    /// Drops the trace ids and the stamps of all the tiles.
+    void clearTraces()
+    {
+        for (auto& tile : _tiles)
+        {
+            tile.clearTrace();
+        }
+    }
+
     std::vector<TileDesc>& getTiles() { return _tiles; }
 
+    /// Whether any of the tiles is.
+    bool isTraced() const
+    {
+        for (const auto& tile : _tiles)
+        {
+            if (tile.getTraceId() > 0)
+                return true;
+        }
+
+        return false;
+    }
+
+    bool hasKitStamps() const
+    {
+        for (const auto& tile : _tiles)
+        {
+            if (tile.hasKitStamps())
+                return true;
+        }
+
+        return false;
+    }
+
     /// Serialize this instance into a string.
     /// Optionally prepend a prefix.
     std::string serialize(const std::string& prefix = "") const
@@ -397,80 +663,109 @@ public:
             oss << " id=" << _id;
         }
 
+        if (isTraced())
+        {
+            oss << " traceid=";
+            for (const auto& tile : _tiles)
+            {
+                oss << tile.getTraceId() << ',';
+            }
+            oss.seekp(-1, std::ios_base::cur); // Ditto.
+
+            if (hasKitStamps())
+            {
+                oss << " tracets=";
+                for (const auto& tile : _tiles)
+                {
+                    oss << tile.serializeKitStamps() << ',';
+                }
+                oss.seekp(-1, std::ios_base::cur); // Ditto.
+            }
+        }
+
         // Make sure we don't return a potential trailing comma that
         // we have seeked back over but not overwritten after all.
         return oss.str().substr(0, oss.tellp());
     }
 
-    /// Deserialize a TileDesc from a tokenized string.
-    static TileCombined parse(const std::vector<std::string>& tokens)
+    /// Deserialize a TileCombined from a tokenized string, without copying.
+    static TileCombined parse(const LOOLProtocol::TokenSpans& tokens)
     {
         // We don't expect undocumented fields and
         // assume all values to be int.
-        std::map<std::string, int> pairs;
+        int part = 0;
+        int width = 0;
+        int height = 0;
+        int tileWidth = 0;
+        int tileHeight = 0;
 
         // Optional.
-        pairs["id"] = -1;
+        int id = -1;
 
-        std::string tilePositionsX;
-        std::string tilePositionsY;
-        std::string imgSizes;
-        std::string versions;
-        std::string oldhashes;
-        std::string hashes;
+        LOOLProtocol::StringSpan tilePositionsX;
+        LOOLProtocol::StringSpan tilePositionsY;
+        LOOLProtocol::StringSpan imgSizes;
+        LOOLProtocol::StringSpan versions;
+        LOOLProtocol::StringSpan oldhashes;
+        LOOLProtocol::StringSpan hashes;
+        LOOLProtocol::StringSpan traceIds;
+        LOOLProtocol::StringSpan kitStamps;
 
         for (const auto& token : tokens)
         {
-            std::string name;
-            std::string value;
-            if (LOOLProtocol::parseNameValuePair(token, name, value))
-            {
-                if (name == "tileposx")
-                {
-                    tilePositionsX = value;
-                }
-                else if (name == "tileposy")
-                {
-                    tilePositionsY = value;
-                }
-                else if (name == "imgsize")
-                {
-                    imgSizes = value;
-                }
-                else if (name == "ver")
-                {
-                    versions = value;
-                }
-                else if (name == "oldhash")
-                {
-                    oldhashes = value;
-                }
-                else if (name == "hash")
-                {
-                    hashes = value;
-                }
-                else
-                {
-                    int v = 0;
-                    if (LOOLProtocol::stringToInteger(value, v))
-                    {
-                        pairs[name] = v;
-                    }
-                }
-            }
+            LOOLProtocol::StringSpan name;
+            LOOLProtocol::StringSpan value;
+            if (!LOOLProtocol::parseNameValuePair(token, name, value))
+                continue;
+
+            if (name == "tileposx")
+                tilePositionsX = value;
+            else if (name == "tileposy")
+                tilePositionsY = value;
+            else if (name == "imgsize")
+                imgSizes = value;
+            else if (name == "ver")
+                versions = value;
+            else if (name == "oldhash")
+                oldhashes = value;
+            else if (name == "hash")
+                hashes = value;
+            else if (name == "traceid")
+                traceIds = value;
+            else if (name == "tracets")
+                kitStamps = value;
+            else if (name == "part")
+                LOOLProtocol::stringToInteger(value, part);
+            else if (name == "width")
+                LOOLProtocol::stringToInteger(value, width);
+            else if (name == "height")
+                LOOLProtocol::stringToInteger(value, height);
+            else if (name == "tilewidth")
+                LOOLProtocol::stringToInteger(value, tileWidth);
+            else if (name == "tileheight")
+                LOOLProtocol::stringToInteger(value, tileHeight);
+            else if (name == "id")
+                LOOLProtocol::stringToInteger(value, id);
         }
 
-        return TileCombined(pairs["part"], pairs["width"], pairs["height"],
+        return TileCombined(part, width, height,
                             tilePositionsX, tilePositionsY,
-                            pairs["tilewidth"], pairs["tileheight"],
+                            tileWidth, tileHeight,
                             versions,
-                            imgSizes, pairs["id"], oldhashes, hashes);
+                            imgSizes, id, oldhashes, hashes,
+                            traceIds, kitStamps);
     }
 
-    /// Deserialize a TileDesc from a string format.
+    /// Deserialize a TileCombined from a tokenized string.
+    static TileCombined parse(const std::vector<std::string>& tokens)
+    {
+        return parse(LOOLProtocol::TokenSpans(tokens));
+    }
+
+    /// Deserialize a TileCombined from a string format.
     static TileCombined parse(const std::string& message)
     {
-        return parse(LOOLProtocol::tokenize(message.data(), message.size()));
+        return parse(LOOLProtocol::TokenSpans(message));
     }
 
     static TileCombined create(const std::vector<TileDesc>& tiles)
@@ -482,6 +777,10 @@ public:
         std::ostringstream vers;
         std::ostringstream oldhs;
         std::ostringstream hs;
+        std::ostringstream traceIds;
+        std::ostringstream kitStamps;
+        bool traced = false;
+        bool kitStamped = false;
 
         for (const auto& tile : tiles)
         {
@@ -490,12 +789,26 @@ public:
             vers << tile.getVersion() << ',';
             oldhs << tile.getOldHash() << ',';
             hs << tile.getHash() << ',';
+            traceIds << tile.getTraceId() << ',';
+            kitStamps << tile.serializeKitStamps() << ',';
+            traced = traced || tile.getTraceId() > 0;
+            kitStamped = kitStamped || tile.hasKitStamps();
         }
 
         vers.seekp(-1, std::ios_base::cur); // Remove last comma.
+        const std::string x = xs.str();
+        const std::string y = ys.str();
+        const std::string ver = vers.str();
+        const std::string oldHash = oldhs.str();
+        const std::string hash = hs.str();
+        const std::string traceId = (traced ? traceIds.str() : std::string());
+        const std::string kitStamp = (kitStamped ? kitStamps.str() : std::string());
         return TileCombined(tiles[0].getPart(), tiles[0].getWidth(), tiles[0].getHeight(),
-                            xs.str(), ys.str(), tiles[0].getTileWidth(), tiles[0].getTileHeight(),
-                            vers.str(), "", -1, oldhs.str(), hs.str());
+                            LOOLProtocol::StringSpan(x), LOOLProtocol::StringSpan(y),
+                            tiles[0].getTileWidth(), tiles[0].getTileHeight(),
+                            LOOLProtocol::StringSpan(ver), LOOLProtocol::StringSpan(), -1,
+                            LOOLProtocol::StringSpan(oldHash), LOOLProtocol::StringSpan(hash),
+                            LOOLProtocol::StringSpan(traceId), LOOLProtocol::StringSpan(kitStamp));
     }
 
 private:
@@ -0,0 +1,96 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "TileInvalidations.hpp"
+
+#include <climits>
+
+#include "Protocol.hpp"
+#include "TileDesc.hpp"
+
+bool TileInvalidations::add(const std::string& message)
+{
+    Area area;
+    if (!parse(message, area))
+        return false;
+
+    add(area.Part, area.X, area.Y, area.Width, area.Height);
+    return true;
+}
+
+void TileInvalidations::add(const int part, int x, int y, int width, int height)
+{
+    // Grown by a merge, the area may now reach those checked before it.
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (size_t i = 0; i < _areas.size(); ++i)
+        {
+            const Area& area = _areas[i];
+            if (area.Part == part &&
+                TileDesc::joinRectangles(x, y, width, height, area.X, area.Y, area.Width, area.Height))
+            {
+                _areas.erase(_areas.begin() + i);
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    _areas.push_back(Area({ part, x, y, width, height }));
+}
+
+bool TileInvalidations::parse(const std::string& message, Area& area)
+{
+    const LOOLProtocol::TokenSpans tokens(message);
+    if (tokens.size() < 2 || tokens[0] != "invalidatetiles:")
+        return false;
+
+    area.X = 0;
+    area.Y = 0;
+    area.Width = INT_MAX;
+    area.Height = INT_MAX;
+
+    if (tokens.size() == 2 && tokens[1] == "EMPTY")
+    {
+        area.Part = -1;
+        return true;
+    }
+
+    if (tokens.size() == 3 && tokens[1] == "EMPTY,")
+    {
+        return LOOLProtocol::stringToInteger(tokens[2], area.Part);
+    }
+
+    return tokens.size() == 6 &&
+           LOOLProtocol::getTokenInteger(tokens[1], "part", area.Part) &&
+           LOOLProtocol::getTokenInteger(tokens[2], "x", area.X) &&
+           LOOLProtocol::getTokenInteger(tokens[3], "y", area.Y) &&
+           LOOLProtocol::getTokenInteger(tokens[4], "width", area.Width) &&
+           LOOLProtocol::getTokenInteger(tokens[5], "height", area.Height);
+}
+
+std::string TileInvalidations::toMessage(const Area& area)
+{
+    // The clients take EMPTY for the part they show.
+    if (area.Part < 0)
+        return "invalidatetiles: EMPTY";
+
+    return "invalidatetiles:"
+           " part=" + std::to_string(area.Part) +
+           " x=" + std::to_string(area.X) +
+           " y=" + std::to_string(area.Y) +
+           " width=" + std::to_string(area.Width) +
+           " height=" + std::to_string(area.Height);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,60 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILEINVALIDATIONS_HPP
+#define INCLUDED_TILEINVALIDATIONS_HPP
+
+#include <string>
+#include <vector>
+
+/// The areas of a document invalidated and not acted upon yet, merged per
+/// part where they overlap or touch (see TileDesc::joinRectangles), so that
+/// a burst of invalidatetiles messages from the Kit searches the tile cache,
+/// and notifies each client, once per merged area.
+/// Not thread-safe; the caller is expected to serialize access.
+class TileInvalidations
+{
+public:
+    /// An area invalidated, in twips. The part is -1 for all of them.
+    struct Area
+    {
+        int Part;
+        int X;
+        int Y;
+        int Width;
+        int Height;
+    };
+
+    /// Adds the area of the invalidatetiles message.
+    /// Returns false, adding nothing, if it is malformed.
+    bool add(const std::string& message);
+
+    void add(int part, int x, int y, int width, int height);
+
+    bool empty() const { return _areas.empty(); }
+
+    const std::vector<Area>& getAreas() const { return _areas; }
+
+    void clear() { _areas.clear(); }
+
+    /// Parses the area of an invalidatetiles message from the Kit:
+    /// "invalidatetiles: EMPTY", "invalidatetiles: EMPTY, <part>", or
+    /// "invalidatetiles: part=<part> x=<x> y=<y> width=<width> height=<height>".
+    static bool parse(const std::string& message, Area& area);
+
+    /// The invalidatetiles message for the clients to invalidate the area.
+    static std::string toMessage(const Area& area);
+
+private:
+    std::vector<Area> _areas;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
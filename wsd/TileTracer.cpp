@@ -0,0 +1,186 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include "TileTracer.hpp"
+
+#include <limits>
+#include <sstream>
+
+#include "Log.hpp"
+
+namespace
+{
+    /// The stages each interval is from and to.
+    const TileTrace::Stage IntervalStages[TileTracer::IntervalCount][2] =
+    {
+        { TileTrace::Requested, TileTrace::Forwarded },
+        { TileTrace::Forwarded, TileTrace::Queued },
+        { TileTrace::Queued, TileTrace::Dequeued },
+        { TileTrace::Dequeued, TileTrace::Painted },
+        { TileTrace::Painted, TileTrace::Encoded },
+        { TileTrace::Encoded, TileTrace::Received },
+        { TileTrace::Received, TileTrace::Enqueued },
+        { TileTrace::Enqueued, TileTrace::Sent },
+        { TileTrace::Requested, TileTrace::Sent }
+    };
+}
+
+TileTracer::TileTracer() :
+    _enabled(true),
+    _sampleEvery(0),
+    _nextId(1),
+    _completed(0)
+{
+}
+
+void TileTracer::requested(TileDesc& tile, const uint64_t requestedUs)
+{
+    if (!_enabled)
+    {
+        tile.setTraceId(0);
+        return;
+    }
+
+    tile.setTraceId(_nextId);
+    tile.setStamp(TileTrace::Requested, requestedUs);
+
+    // Wrap around before overflowing; 0 means not traced.
+    _nextId = (_nextId < std::numeric_limits<int>::max() ? _nextId + 1 : 1);
+}
+
+void TileTracer::forwarded(const TileDesc& tile)
+{
+    if (tile.getTraceId() <= 0)
+        return;
+
+    const auto result = _pending.emplace(tile.getTraceId(), Pending({ tile, _order.end() }));
+    if (result.second)
+    {
+        result.first->second.Order = _order.insert(_order.end(), tile.getTraceId());
+    }
+
+    result.first->second.Tile.stamp(TileTrace::Forwarded);
+
+    while (_pending.size() > MaxPending)
+    {
+        erase(_pending.find(_order.front()));
+    }
+}
+
+void TileTracer::received(const TileDesc& tile)
+{
+    const auto it = _pending.find(tile.getTraceId());
+    if (it == _pending.end())
+        return;
+
+    for (int stage = TileTrace::FirstKitStage; stage <= TileTrace::LastKitStage; ++stage)
+    {
+        const TileTrace::Stage kitStage = static_cast<TileTrace::Stage>(stage);
+        it->second.Tile.setStamp(kitStage, tile.getStamp(kitStage));
+    }
+
+    it->second.Tile.stamp(TileTrace::Received);
+}
+
+void TileTracer::enqueued(const int traceId)
+{
+    const auto it = _pending.find(traceId);
+    if (it != _pending.end())
+        it->second.Tile.stamp(TileTrace::Enqueued);
+}
+
+void TileTracer::sent(const int traceId)
+{
+    const auto it = _pending.find(traceId);
+    if (it == _pending.end())
+        return;
+
+    it->second.Tile.stamp(TileTrace::Sent);
+    complete(it->second.Tile);
+    erase(it);
+}
+
+void TileTracer::erase(const std::map<int, Pending>::iterator it)
+{
+    _order.erase(it->second.Order);
+    _pending.erase(it);
+}
+
+void TileTracer::complete(const TileDesc& tile)
+{
+    ++_completed;
+
+    for (int interval = 0; interval < IntervalCount; ++interval)
+    {
+        const double us = getIntervalUs(tile.getStamps(), IntervalStages[interval][0], IntervalStages[interval][1]);
+        if (us >= 0)
+            _histograms[interval].add(us / 1000);
+    }
+
+    if (_sampleEvery > 0 && _completed % _sampleEvery == 0)
+    {
+        std::ostringstream oss;
+        oss << "tiletrace: id=" << tile.getTraceId()
+            << " part=" << tile.getPart()
+            << " x=" << tile.getTilePosX()
+            << " y=" << tile.getTilePosY()
+            << " ver=" << tile.getVersion();
+        for (int interval = 0; interval < IntervalCount; ++interval)
+        {
+            const double us = getIntervalUs(tile.getStamps(), IntervalStages[interval][0], IntervalStages[interval][1]);
+            oss << ' ' << getName(static_cast<Interval>(interval)) << "_us=" << us;
+        }
+
+        LOG_INF(oss.str());
+    }
+}
+
+const char* TileTracer::getName(const Interval interval)
+{
+    switch (interval)
+    {
+        case Broker: return "broker";
+        case ToKit: return "tokit";
+        case Queue: return "queue";
+        case Paint: return "paint";
+        case Encode: return "encode";
+        case ToWsd: return "towsd";
+        case Cache: return "cache";
+        case Send: return "send";
+        case Total: return "total";
+        case IntervalCount: break;
+    }
+
+    return "";
+}
+
+double TileTracer::getIntervalUs(const TileTrace::Stamps& stamps, const TileTrace::Stage from, const TileTrace::Stage to)
+{
+    if (stamps[from] == 0 || stamps[to] == 0)
+        return -1;
+
+    // The Kit and WSD share the clock, but don't go negative on rounding.
+    return (stamps[to] > stamps[from] ? static_cast<double>(stamps[to] - stamps[from]) : 0);
+}
+
+std::string TileTracer::toString() const
+{
+    std::ostringstream oss;
+    for (int interval = 0; interval < IntervalCount; ++interval)
+    {
+        oss << _histograms[interval].toString(getName(static_cast<Interval>(interval))) << ' ';
+    }
+
+    oss << "traced=" << _completed;
+    return oss.str();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
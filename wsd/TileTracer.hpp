@@ -0,0 +1,115 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILETRACER_HPP
+#define INCLUDED_TILETRACER_HPP
+
+#include <array>
+#include <list>
+#include <map>
+#include <string>
+
+#include "Histogram.hpp"
+#include "TileDesc.hpp"
+
+/// Breaks down the latency of the tiles of a document by stage.
+/// Gives each tile request sent to the Kit a trace id, which the Kit
+/// sends back with the stamps of its own stages, and collects the
+/// stamps of each tile until it is written to the client, then adds
+/// the time between each stage to a histogram.
+/// Not thread-safe; the caller is expected to serialize access.
+class TileTracer
+{
+public:
+    /// The intervals between the stages, as accounted.
+    enum Interval
+    {
+        Broker,     ///< From the client request to sending it to the Kit.
+        ToKit,      ///< The socket to the Kit.
+        Queue,      ///< Waiting in the queue of the Kit.
+        Paint,      ///< Waiting for the document and painting.
+        Encode,     ///< Encoding into PNG.
+        ToWsd,      ///< The socket back to WSD.
+        Cache,      ///< Saving to the cache and notifying the subscribers.
+        Send,       ///< Waiting in the queue of the client session.
+        Total,      ///< From the client request to writing the tile to the client.
+        IntervalCount
+    };
+
+    TileTracer();
+
+    /// Disables or enables tracing. Tiles aren't given trace ids while disabled.
+    void setEnabled(bool enabled) { _enabled = enabled; }
+    bool isEnabled() const { return _enabled; }
+
+    /// Logs the stamps of every nth completed tile in full. 0 to disable.
+    void setSampleEvery(unsigned sampleEvery) { _sampleEvery = sampleEvery; }
+
+    /// Gives the tile a new trace id, requested at requestedUs, if enabled.
+    void requested(TileDesc& tile, uint64_t requestedUs);
+
+    /// The tile was sent to the Kit to render.
+    void forwarded(const TileDesc& tile);
+
+    /// The Kit sent back the tile, with the stamps of its stages.
+    void received(const TileDesc& tile);
+
+    /// The tile was queued for the client.
+    void enqueued(int traceId);
+
+    /// The tile was written to the client. Completes the trace.
+    void sent(int traceId);
+
+    size_t getPendingCount() const { return _pending.size(); }
+    unsigned getCompleted() const { return _completed; }
+    const Histogram& getHistogram(Interval interval) const { return _histograms[interval]; }
+
+    /// The name of the interval in toString().
+    static const char* getName(Interval interval);
+
+    /// The microseconds from one stage to another, -1 if either isn't stamped.
+    static double getIntervalUs(const TileTrace::Stamps& stamps, TileTrace::Stage from, TileTrace::Stage to);
+
+    /// Formats as "<interval>=<counts> <interval>_p50=<ms> <interval>_p99=<ms> <interval>_max=<ms> ...
+    /// traced=<count>", for each interval, as Histogram::toString().
+    std::string toString() const;
+
+private:
+    void complete(const TileDesc& tile);
+
+private:
+    /// Traces not completed beyond this many are forgotten, oldest first,
+    /// like those of tiles rendered again before they were sent.
+    static constexpr size_t MaxPending = 1024;
+
+    /// A tile sent to the Kit and not yet written to the client.
+    struct Pending
+    {
+        TileDesc Tile;
+        /// Its trace id in _order.
+        std::list<int>::iterator Order;
+    };
+
+    void erase(std::map<int, Pending>::iterator it);
+
+    bool _enabled;
+    unsigned _sampleEvery;
+    int _nextId;
+    unsigned _completed;
+    /// The pending tiles, by trace id.
+    std::map<int, Pending> _pending;
+    /// The trace ids of the pending tiles, oldest first. The ids wrap around,
+    /// so their order isn't that of the tiles.
+    std::list<int> _order;
+    std::array<Histogram, IntervalCount> _histograms;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
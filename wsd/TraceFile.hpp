@@ -10,10 +10,18 @@
 #ifndef INCLUDED_TRACEFILE_HPP
 #define INCLUDED_TRACEFILE_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <fstream>
+#include <iterator>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <Poco/DateTime.h>
@@ -53,8 +61,107 @@ public:
         return oss.str();
     }
 
+    /// The binary format starts with this, then the time the trace started,
+    /// in microseconds since the epoch, as 8 bytes.
+    /// Then come the records, each: the length of the rest of the record (4 bytes),
+    /// the direction (1 byte), the time since the trace started, in microseconds
+    /// by the monotonic clock (8 bytes), the length of the id (2 bytes) and the id,
+    /// the length of the session id (2 bytes) and the session id, and the payload
+    /// to the end of the record. Integers are little-endian.
+    static std::string getBinaryMagic() { return std::string("LOOLTRC\x01", 8); }
+
+    static constexpr size_t BinaryHeaderSize = 16;
+
+    static bool isBinary(const std::string& data)
+    {
+        return data.size() >= BinaryHeaderSize && data.compare(0, 8, getBinaryMagic()) == 0;
+    }
+
+    static void appendBinaryHeader(std::string& out, const int64_t startTime)
+    {
+        out += getBinaryMagic();
+        appendInt<uint64_t>(out, startTime);
+    }
+
+    static void appendBinary(std::string& out, const Direction dir, const int64_t time,
+                             const std::string& id, const std::string& sessionId,
+                             const std::string& payload)
+    {
+        const uint16_t idSize = std::min<size_t>(id.size(), UINT16_MAX);
+        const uint16_t sessionIdSize = std::min<size_t>(sessionId.size(), UINT16_MAX);
+        appendInt<uint32_t>(out, 1 + 8 + 2 + idSize + 2 + sessionIdSize + payload.size());
+        out.push_back(static_cast<char>(dir));
+        appendInt<uint64_t>(out, time);
+        appendInt<uint16_t>(out, idSize);
+        out.append(id, 0, idSize);
+        appendInt<uint16_t>(out, sessionIdSize);
+        out.append(sessionId, 0, sessionIdSize);
+        out += payload;
+    }
+
+    /// Reads the record at pos, and moves past it.
+    /// Returns false if truncated or invalid.
+    bool readBinary(const std::string& data, size_t& pos)
+    {
+        size_t start = pos;
+        uint32_t size;
+        if (!readInt(data, start, size) || size == 0 || data.size() - start < size)
+            return false;
+
+        const std::string record = data.substr(start, size);
+        size_t next = 1;
+        uint64_t time;
+        uint16_t idSize;
+        uint16_t sessionIdSize;
+        if (!readInt(record, next, time) ||
+            !readInt(record, next, idSize) || record.size() - next < idSize)
+        {
+            return false;
+        }
+
+        const std::string id = record.substr(next, idSize);
+        next += idSize;
+        if (!readInt(record, next, sessionIdSize) || record.size() - next < sessionIdSize)
+            return false;
+
+        Dir = static_cast<Direction>(record[0]);
+        TimestampNs = time;
+        Pid = std::atoi(id.c_str());
+        SessionId = record.substr(next, sessionIdSize);
+        Payload = record.substr(next + sessionIdSize);
+        pos = start + size;
+        return true;
+    }
+
+    template <typename T>
+    static void appendInt(std::string& out, const T value)
+    {
+        for (size_t i = 0; i < sizeof(T); ++i)
+        {
+            out.push_back(static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xff));
+        }
+    }
+
+    template <typename T>
+    static bool readInt(const std::string& data, size_t& pos, T& value)
+    {
+        if (data.size() < pos || data.size() - pos < sizeof(T))
+            return false;
+
+        uint64_t result = 0;
+        for (size_t i = 0; i < sizeof(T); ++i)
+        {
+            result |= static_cast<uint64_t>(static_cast<unsigned char>(data[pos + i])) << (8 * i);
+        }
+
+        value = static_cast<T>(result);
+        pos += sizeof(T);
+        return true;
+    }
+
     Direction Dir;
-    unsigned TimestampNs;
+    /// In microseconds, despite the name.
+    Poco::Int64 TimestampNs;
     unsigned Pid;
     std::string SessionId;
     std::string Payload;
@@ -62,31 +169,60 @@ public:
 
 /// Trace-file generator class.
 /// Writes records into a trace file.
+/// In the text format, every record is written under a lock.
+/// In the binary format, threads append the records to a buffer of
+/// their own, and a flusher thread writes them out periodically, so
+/// the threads tracing don't contend with each other, nor wait for the disk.
 class TraceFileWriter
 {
 public:
     TraceFileWriter(const std::string& path,
                     const bool recordOugoing,
                     const bool compress,
+                    const bool binary,
                     const bool takeSnapshot,
                     const std::vector<std::string>& filters) :
         _epochStart(Poco::Timestamp().epochMicroseconds()),
+        _startTime(std::chrono::steady_clock::now()),
         _recordOutgoing(recordOugoing),
         _compress(compress),
+        _binary(binary),
         _takeSnapshot(takeSnapshot),
         _path(Poco::Path(path).parent().toString()),
         _filter(true),
-        _stream(processPath(path), compress ? std::ios::binary : std::ios::out),
-        _deflater(_stream, Poco::DeflatingStreamBuf::STREAM_GZIP)
+        _stream(processPath(path), (compress || binary) ? std::ios::binary : std::ios::out),
+        _deflater(_stream, Poco::DeflatingStreamBuf::STREAM_GZIP),
+        _id(++getInstanceCount()),
+        _stop(false),
+        _dropped(0)
     {
         for (const auto& f : filters)
         {
             _filter.deny(f);
         }
+
+        if (_binary)
+        {
+            std::string header;
+            TraceFileRecord::appendBinaryHeader(header, _epochStart);
+            writeData(header);
+            _flusher = std::thread([this]() { flushBuffers(); });
+        }
     }
 
     ~TraceFileWriter()
     {
+        if (_flusher.joinable())
+        {
+            {
+                std::unique_lock<std::mutex> lock(_buffersMutex);
+                _stop = true;
+            }
+
+            _buffersCV.notify_one();
+            _flusher.join();
+        }
+
         std::unique_lock<std::mutex> lock(_mutex);
 
         _deflater.close();
@@ -129,8 +265,7 @@ public:
         }
 
         const auto data = "NewSession: " + snapshot;
-        writeLocked(id, sessionId, data, static_cast<char>(TraceFileRecord::Direction::Event));
-        flushLocked();
+        writeEventLocked(id, sessionId, data);
     }
 
     void endSession(const std::string& id, const std::string& sessionId, const std::string& uri)
@@ -156,75 +291,150 @@ public:
         }
 
         const auto data = "EndSession: " + snapshot;
-        writeLocked(id, sessionId, data, static_cast<char>(TraceFileRecord::Direction::Event));
-        flushLocked();
+        writeEventLocked(id, sessionId, data);
     }
 
     void writeEvent(const std::string& id, const std::string& sessionId, const std::string& data)
     {
+        if (_binary)
+        {
+            writeBinary(id, sessionId, data, TraceFileRecord::Direction::Event);
+            return;
+        }
+
         std::unique_lock<std::mutex> lock(_mutex);
 
-        writeLocked(id, sessionId, data, static_cast<char>(TraceFileRecord::Direction::Event));
-        flushLocked();
+        writeEventLocked(id, sessionId, data);
     }
 
     void writeIncoming(const std::string& id, const std::string& sessionId, const std::string& data)
     {
-        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_filter.match(data))
+            return;
 
-        if (_filter.match(data))
+        // Remap the URL to the snapshot.
+        if (LOOLProtocol::matchPrefix("load", data))
         {
-            // Remap the URL to the snapshot.
-            if (LOOLProtocol::matchPrefix("load", data))
+            auto tokens = LOOLProtocol::tokenize(data);
+            if (tokens.size() >= 2)
             {
-                auto tokens = LOOLProtocol::tokenize(data);
-                if (tokens.size() >= 2)
+                std::string url;
+                if (LOOLProtocol::getTokenString(tokens[1], "url", url))
                 {
-                    std::string url;
-                    if (LOOLProtocol::getTokenString(tokens[1], "url", url))
+                    std::string decodedUrl;
+                    Poco::URI::decode(url, decodedUrl);
+                    auto uriPublic = Poco::URI(decodedUrl);
+                    if (uriPublic.isRelative() || uriPublic.getScheme() == "file")
                     {
-                        std::string decodedUrl;
-                        Poco::URI::decode(url, decodedUrl);
-                        auto uriPublic = Poco::URI(decodedUrl);
-                        if (uriPublic.isRelative() || uriPublic.getScheme() == "file")
-                        {
-                            uriPublic.normalize();
-                        }
+                        uriPublic.normalize();
+                    }
+
+                    url = uriPublic.getPath();
+
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    const auto it = _urlToSnapshot.find(url);
+                    if (it != _urlToSnapshot.end())
+                    {
+                        LOG_TRC("TraceFile: Mapped URL: " << url << " to " << it->second.Snapshot);
+                        tokens[1] = "url=" + it->second.Snapshot;
+                        lock.unlock();
 
-                        url = uriPublic.getPath();
-                        const auto it = _urlToSnapshot.find(url);
-                        if (it != _urlToSnapshot.end())
+                        std::string newData;
+                        for (const auto& token : tokens)
                         {
-                            LOG_TRC("TraceFile: Mapped URL: " << url << " to " << it->second.Snapshot);
-                            tokens[1] = "url=" + it->second.Snapshot;
-                            std::string newData;
-                            for (const auto& token : tokens)
-                            {
-                                newData += token + ' ';
-                            }
-
-                            writeLocked(id, sessionId, newData, static_cast<char>(TraceFileRecord::Direction::Incoming));
-                            return;
+                            newData += token + ' ';
                         }
+
+                        write(id, sessionId, newData, TraceFileRecord::Direction::Incoming);
+                        return;
                     }
                 }
             }
-
-            writeLocked(id, sessionId, data, static_cast<char>(TraceFileRecord::Direction::Incoming));
         }
+
+        write(id, sessionId, data, TraceFileRecord::Direction::Incoming);
     }
 
     void writeOutgoing(const std::string& id, const std::string& sessionId, const std::string& data)
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-
         if (_recordOutgoing && _filter.match(data))
         {
-            writeLocked(id, sessionId, data, static_cast<char>(TraceFileRecord::Direction::Outgoing));
+            write(id, sessionId, data, TraceFileRecord::Direction::Outgoing);
         }
     }
 
+    /// The number of records not written because the buffer of their thread was full.
+    size_t getDropped() const { return _dropped; }
+
 private:
+    /// The records of one thread, waiting for the flusher.
+    struct ThreadBuffer
+    {
+        ThreadBuffer() :
+            _closed(false)
+        {
+        }
+
+        std::mutex _mutex;
+        std::string _data;
+        /// The thread exited.
+        std::atomic<bool> _closed;
+    };
+
+    /// Marks the buffer of the thread closed when it exits,
+    /// for the flusher to forget it once written out.
+    struct ThreadBufferHolder
+    {
+        ThreadBufferHolder() :
+            _writerId(0)
+        {
+        }
+
+        ~ThreadBufferHolder()
+        {
+            if (_buffer)
+                _buffer->_closed = true;
+        }
+
+        std::shared_ptr<ThreadBuffer> _buffer;
+        unsigned _writerId;
+    };
+
+    static std::atomic<unsigned>& getInstanceCount()
+    {
+        static std::atomic<unsigned> count(0);
+        return count;
+    }
+
+    void write(const std::string& id, const std::string& sessionId, const std::string& data,
+               const TraceFileRecord::Direction dir)
+    {
+        if (_binary)
+        {
+            writeBinary(id, sessionId, data, dir);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        writeLocked(id, sessionId, data, static_cast<char>(dir));
+    }
+
+    void writeEventLocked(const std::string& id, const std::string& sessionId, const std::string& data)
+    {
+        Util::assertIsLocked(_mutex);
+
+        if (_binary)
+        {
+            writeBinary(id, sessionId, data, TraceFileRecord::Direction::Event);
+        }
+        else
+        {
+            writeLocked(id, sessionId, data, static_cast<char>(TraceFileRecord::Direction::Event));
+            flushLocked();
+        }
+    }
+
     void flushLocked()
     {
         Util::assertIsLocked(_mutex);
@@ -264,6 +474,112 @@ private:
         }
     }
 
+    /// Appends the record to the buffer of the calling thread.
+    void writeBinary(const std::string& id, const std::string& sessionId, const std::string& data,
+                     const TraceFileRecord::Direction dir)
+    {
+        const auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - _startTime).count();
+
+        ThreadBuffer& buffer = getThreadBuffer();
+        std::unique_lock<std::mutex> lock(buffer._mutex);
+        if (buffer._data.size() >= MaxBufferBytes)
+        {
+            // Rather than grow without bound if the disk can't keep up.
+            ++_dropped;
+            return;
+        }
+
+        TraceFileRecord::appendBinary(buffer._data, dir, time, id, sessionId, data);
+    }
+
+    ThreadBuffer& getThreadBuffer()
+    {
+        static thread_local ThreadBufferHolder holder;
+        if (!holder._buffer || holder._writerId != _id)
+        {
+            if (holder._buffer)
+                holder._buffer->_closed = true;
+
+            holder._buffer = std::make_shared<ThreadBuffer>();
+            holder._writerId = _id;
+
+            std::unique_lock<std::mutex> lock(_buffersMutex);
+            _buffers.push_back(holder._buffer);
+        }
+
+        return *holder._buffer;
+    }
+
+    /// The flusher thread.
+    void flushBuffers()
+    {
+        Util::setThreadName("trace_flush");
+
+        // Often enough to lose little in a crash.
+        const std::chrono::milliseconds flushInterval(500);
+
+        std::string data;
+        size_t reportedDropped = 0;
+        std::unique_lock<std::mutex> lock(_buffersMutex);
+        for (;;)
+        {
+            const bool stop = _stop;
+            const std::vector<std::shared_ptr<ThreadBuffer>> buffers = _buffers;
+            lock.unlock();
+
+            for (const auto& buffer : buffers)
+            {
+                {
+                    // Swap, so the thread reuses the memory we wrote out before.
+                    std::unique_lock<std::mutex> bufferLock(buffer->_mutex);
+                    data.swap(buffer->_data);
+                }
+
+                writeData(data);
+                data.clear();
+            }
+
+            _deflater.flush();
+            _stream.flush();
+
+            if (_dropped != reportedDropped)
+            {
+                LOG_WRN("TraceFile: Dropped " << (_dropped - reportedDropped) <<
+                        " records, the disk isn't keeping up.");
+                reportedDropped = _dropped;
+            }
+
+            lock.lock();
+
+            // Forget the buffers of the threads that exited, once written out.
+            _buffers.erase(std::remove_if(_buffers.begin(), _buffers.end(),
+                                          [](const std::shared_ptr<ThreadBuffer>& buffer)
+                                          {
+                                              if (!buffer->_closed)
+                                                  return false;
+
+                                              std::unique_lock<std::mutex> bufferLock(buffer->_mutex);
+                                              return buffer->_data.empty();
+                                          }),
+                           _buffers.end());
+
+            if (stop)
+                break;
+
+            _buffersCV.wait_for(lock, flushInterval, [this]() { return _stop; });
+        }
+    }
+
+    /// Writes to the file, compressed or not.
+    void writeData(const std::string& data)
+    {
+        if (_compress)
+            _deflater.write(data.data(), data.size());
+        else
+            _stream.write(data.data(), data.size());
+    }
+
     static std::string processPath(const std::string& path)
     {
         const auto pos = path.find('%');
@@ -298,9 +614,14 @@ private:
     };
 
 private:
+    /// The most a thread may have waiting to be written.
+    static constexpr size_t MaxBufferBytes = 16 * 1024 * 1024;
+
     const Poco::Int64 _epochStart;
+    const std::chrono::steady_clock::time_point _startTime;
     const bool _recordOutgoing;
     const bool _compress;
+    const bool _binary;
     const bool _takeSnapshot;
     const std::string _path;
     Util::RegexListMatcher _filter;
@@ -308,6 +629,15 @@ private:
     Poco::DeflatingOutputStream _deflater;
     std::mutex _mutex;
     std::map<std::string, SnapshotData> _urlToSnapshot;
+
+    /// Tells apart the buffers of this writer from those of an earlier one.
+    const unsigned _id;
+    std::mutex _buffersMutex;
+    std::condition_variable _buffersCV;
+    std::vector<std::shared_ptr<ThreadBuffer>> _buffers;
+    bool _stop;
+    std::atomic<size_t> _dropped;
+    std::thread _flusher;
 };
 
 /// Trace-file parser class.
@@ -317,6 +647,7 @@ class TraceFileReader
 public:
     TraceFileReader(const std::string& path) :
         _compressed(path.size() > 2 && path.substr(path.size() - 2) == "gz"),
+        _startTime(0),
         _epochStart(0),
         _epochEnd(0),
         _stream(path, _compressed ? std::ios::binary : std::ios::in),
@@ -333,6 +664,9 @@ public:
         _stream.close();
     }
 
+    /// When the trace started, in microseconds since the epoch.
+    /// Only known for binary traces, 0 otherwise.
+    Poco::Int64 getStartTime() const { return _startTime; }
     Poco::Int64 getEpochStart() const { return _epochStart; }
     Poco::Int64 getEpochEnd() const { return _epochEnd; }
 
@@ -377,18 +711,44 @@ private:
     {
         _records.clear();
 
+        std::istream& in = (_compressed ? static_cast<std::istream&>(_inflater) : _stream);
+
+        // Text records start with their direction, never like the binary
+        // magic. Binary records are sorted, so are read all at once, while
+        // the text ones, which can be huge, are read line by line.
+        if (in.peek() == TraceFileRecord::getBinaryMagic()[0])
+        {
+            const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (TraceFileRecord::isBinary(data))
+                readBinary(data);
+        }
+        else
+        {
+            readText(in);
+        }
+
+        if (_records.empty() ||
+            _records[0].Dir != TraceFileRecord::Direction::Event ||
+            _records[0].Payload.find("NewSession") != 0)
+        {
+            fprintf(stderr, "Invalid trace file with %zu records. First record: %s\n", _records.size(),
+                    _records.empty() ? "<empty>" : _records[0].Payload.c_str());
+            throw std::runtime_error("Invalid trace file.");
+        }
+
+        _indexIn = advance(-1, TraceFileRecord::Direction::Incoming);
+        _indexOut = advance(-1, TraceFileRecord::Direction::Outgoing);
+
+        _epochStart = _records[0].TimestampNs;
+        _epochEnd = _records[_records.size() - 1].TimestampNs;
+    }
+
+    void readText(std::istream& in)
+    {
         std::string line;
         for (;;)
         {
-            if (_compressed)
-            {
-                std::getline(_inflater, line);
-            }
-            else
-            {
-                std::getline(_stream, line);
-            }
-
+            std::getline(in, line);
             if (line.empty())
             {
                 break;
@@ -400,21 +760,34 @@ private:
             else
                 fprintf(stderr, "Invalid trace file record, expected 4 tokens. [%s]\n", line.c_str());
         }
+    }
 
-        if (_records.empty() ||
-            _records[0].Dir != TraceFileRecord::Direction::Event ||
-            _records[0].Payload.find("NewSession") != 0)
+    void readBinary(const std::string& data)
+    {
+        size_t pos = 8;
+        uint64_t startTime = 0;
+        TraceFileRecord::readInt(data, pos, startTime);
+        _startTime = startTime;
+
+        while (pos < data.size())
         {
-            fprintf(stderr, "Invalid trace file with %ld records. First record: %s\n", _records.size(),
-                    _records.empty() ? "<empty>" : _records[0].Payload.c_str());
-            throw std::runtime_error("Invalid trace file.");
-        }
+            TraceFileRecord rec;
+            if (!rec.readBinary(data, pos))
+            {
+                // Most likely cut short by a crash; keep what we have.
+                fprintf(stderr, "Invalid or truncated trace file record at offset %zu.\n", pos);
+                break;
+            }
 
-        _indexIn = advance(-1, TraceFileRecord::Direction::Incoming);
-        _indexOut = advance(-1, TraceFileRecord::Direction::Outgoing);
+            _records.push_back(rec);
+        }
 
-        _epochStart = _records[0].TimestampNs;
-        _epochEnd = _records[_records.size() - 1].TimestampNs;
+        // Written out by thread, so only in order within each thread.
+        std::stable_sort(_records.begin(), _records.end(),
+                         [](const TraceFileRecord& a, const TraceFileRecord& b)
+                         {
+                             return a.TimestampNs < b.TimestampNs;
+                         });
     }
 
     static bool extractRecord(const std::string& s, TraceFileRecord& rec)
@@ -434,7 +807,7 @@ private:
             switch (record)
             {
                 case 0:
-                    rec.TimestampNs = std::atoi(s.substr(pos, next - pos).c_str());
+                    rec.TimestampNs = std::atoll(s.substr(pos, next - pos).c_str());
                     break;
                 case 1:
                     rec.Pid = std::atoi(s.substr(pos, next - pos).c_str());
@@ -471,6 +844,7 @@ private:
 
 private:
     const bool _compressed;
+    Poco::Int64 _startTime;
     Poco::Int64 _epochStart;
     Poco::Int64 _epochEnd;
     std::ifstream _stream;